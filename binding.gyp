@@ -5,7 +5,13 @@
       "sources": [
         "native/binding.cc",
         "native/koda_binary.cc",
-        "native/koda_parse.cc"
+        "native/koda_frame.cc",
+        "native/koda_hash.cc",
+        "native/koda_incremental.cc",
+        "native/koda_index.cc",
+        "native/koda_mmap.cc",
+        "native/koda_parse.cc",
+        "native/koda_pool.cc"
       ],
       "include_dirs": [
         "<!@(node -p \"require('node-addon-api').include\")",
@@ -2,12 +2,208 @@
 #include <node_api.h>
 
 #include "koda_binary.h"
+#include "koda_cancel.h"
+#include "koda_frame.h"
+#include "koda_hash.h"
+#include "koda_incremental.h"
+#include "koda_mmap.h"
 #include "koda_parse.h"
+#include "koda_pool.h"
 #include "koda_value.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
 namespace koda {
 
-static Napi::Value ValueToNapi(const Value& v, const Napi::Env& env) {
+// Constructors looked up by native code, one set per JS environment.
+struct AddonData {
+  Napi::FunctionReference dictionary;
+  Napi::FunctionReference lazy_node;
+  Napi::FunctionReference cancel_token;
+};
+
+// Per-call state for converting a decoded Value tree to JS.
+struct ToNapiContext {
+  // Return packed numeric arrays as TypedArrays instead of plain Arrays.
+  bool typed_arrays = false;
+  // Return the root as a lazy node (see LazyNodeHandle) instead of converting it.
+  bool lazy = false;
+  // One JS string per string-table entry, created on first use.
+  std::vector<Napi::Value> strings;
+  // Shared subtrees from a placeholder-mode decode; each is converted once and
+  // every reference returns the same JS object.
+  const std::vector<Value>* shared = nullptr;
+  std::vector<Napi::Value> subtrees;
+  // Interned JS strings for the keys of an external dictionary, if any.
+  const std::unordered_map<std::string, uint32_t>* key_index = nullptr;
+  std::vector<Napi::Value> keys;
+};
+
+// JS strings for a key list, kept alive across calls so decoded objects reuse
+// them instead of creating a new string per key.
+class InternedKeys {
+ public:
+  void Reset(const Napi::Env& env, const std::vector<std::string>& keys) {
+    Napi::Array js = Napi::Array::New(env, keys.size());
+    index_.clear();
+    for (uint32_t i = 0; i < keys.size(); ++i) {
+      js[i] = Napi::String::New(env, keys[i]);
+      index_.emplace(keys[i], i);
+    }
+    js_ = Napi::Persistent(js);
+    size_ = keys.size();
+  }
+
+  void Intern(ToNapiContext& ctx) const {
+    if (js_.IsEmpty()) return;
+    Napi::Array js = js_.Value();
+    ctx.keys.resize(size_);
+    for (uint32_t i = 0; i < size_; ++i) ctx.keys[i] = js.Get(i);
+    ctx.key_index = &index_;
+  }
+
+  size_t size() const { return size_; }
+
+ private:
+  std::unordered_map<std::string, uint32_t> index_;
+  Napi::Reference<Napi::Array> js_;
+  size_t size_ = 0;
+};
+
+// Native side of a KodaDictionary: the sorted keys and their JS strings.
+class DictionaryHandle : public Napi::ObjectWrap<DictionaryHandle> {
+ public:
+  static Napi::Function Define(Napi::Env env) { return DefineClass(env, "Dictionary", {}); }
+
+  explicit DictionaryHandle(const Napi::CallbackInfo& info) : Napi::ObjectWrap<DictionaryHandle>(info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsArray()) {
+      Napi::TypeError::New(env, "Expected array of keys").ThrowAsJavaScriptException();
+      return;
+    }
+    Napi::Array in = info[0].As<Napi::Array>();
+    std::vector<std::string> keys;
+    keys.reserve(in.Length());
+    for (uint32_t i = 0; i < in.Length(); ++i) {
+      Napi::Value k = in.Get(i);
+      if (!k.IsString()) {
+        Napi::TypeError::New(env, "Dictionary keys must be strings").ThrowAsJavaScriptException();
+        return;
+      }
+      keys.push_back(k.As<Napi::String>().Utf8Value());
+    }
+    dict_ = make_dictionary(std::move(keys));
+    keys_.Reset(env, dict_.keys);
+  }
+
+  const Dictionary& dict() const { return dict_; }
+  void Intern(ToNapiContext& ctx) const { keys_.Intern(ctx); }
+
+  // The handle in options.dictionary, or nullptr if absent or not a handle.
+  static DictionaryHandle* FromOptions(const Napi::Env& env, const Napi::Object& opts) {
+    if (!opts.Has("dictionary")) return nullptr;
+    Napi::Value d = opts.Get("dictionary");
+    AddonData* data = env.GetInstanceData<AddonData>();
+    if (!d.IsObject() || !data || !d.As<Napi::Object>().InstanceOf(data->dictionary.Value())) return nullptr;
+    return Unwrap(d.As<Napi::Object>());
+  }
+
+ private:
+  Dictionary dict_;
+  InternedKeys keys_;
+};
+
+// JS handle for a CancelToken: new CancelToken({ deadlineMs, flag }). `flag`
+// is an Int32Array, usually over a SharedArrayBuffer so that another thread
+// can cancel by storing a nonzero word. Pool jobs share the token, so it
+// outlives a handle collected before the job ends.
+class CancelTokenHandle : public Napi::ObjectWrap<CancelTokenHandle> {
+ public:
+  static Napi::Function Define(Napi::Env env) {
+    return DefineClass(env, "CancelToken", {InstanceMethod("cancel", &CancelTokenHandle::Cancel)});
+  }
+
+  explicit CancelTokenHandle(const Napi::CallbackInfo& info)
+      : Napi::ObjectWrap<CancelTokenHandle>(info), token_(std::make_shared<CancelToken>()) {
+    if (info.Length() < 1 || !info[0].IsObject()) return;
+    Napi::Object opts = info[0].As<Napi::Object>();
+    if (opts.Has("deadlineMs") && opts.Get("deadlineMs").IsNumber()) {
+      double ms = std::max(0.0, opts.Get("deadlineMs").As<Napi::Number>().DoubleValue());
+      token_->set_deadline(CancelToken::Clock::now() +
+                           std::chrono::microseconds(static_cast<int64_t>(ms * 1000)));
+    }
+    if (opts.Has("flag") && opts.Get("flag").IsTypedArray()) {
+      Napi::TypedArray flag = opts.Get("flag").As<Napi::TypedArray>();
+      if (flag.TypedArrayType() != napi_int32_array || flag.ElementLength() < 1) {
+        Napi::TypeError::New(info.Env(), "flag must be a non-empty Int32Array").ThrowAsJavaScriptException();
+        return;
+      }
+      // Data() comes from the typed array itself, which also works over a
+      // SharedArrayBuffer.
+      Napi::Int32Array words = flag.As<Napi::Int32Array>();
+      flag_ = Napi::Persistent(static_cast<Napi::Object>(words));
+      token_->set_flag(words.Data());
+    }
+  }
+
+  const std::shared_ptr<CancelToken>& token() const { return token_; }
+
+  // The handle in options.cancel, or nullptr if absent or not a handle.
+  static CancelTokenHandle* FromOptions(const Napi::Env& env, const Napi::Object& opts) {
+    if (!opts.Has("cancel")) return nullptr;
+    Napi::Value c = opts.Get("cancel");
+    AddonData* data = env.GetInstanceData<AddonData>();
+    if (!c.IsObject() || !data || !c.As<Napi::Object>().InstanceOf(data->cancel_token.Value())) return nullptr;
+    return Unwrap(c.As<Napi::Object>());
+  }
+
+ private:
+  Napi::Value Cancel(const Napi::CallbackInfo& info) {
+    token_->cancel();
+    return info.Env().Undefined();
+  }
+
+  std::shared_ptr<CancelToken> token_;
+  Napi::ObjectReference flag_;
+};
+
+static Napi::Value PackedToTypedArray(const Value& v, const Napi::Env& env) {
+  size_t n = v.packed_count();
+  Napi::ArrayBuffer ab = Napi::ArrayBuffer::New(env, v.packed.size());
+  if (!v.packed.empty()) memcpy(ab.Data(), v.packed.data(), v.packed.size());
+  switch (v.packed_type) {
+    case Value::Packed::Int8:
+      return Napi::TypedArrayOf<int8_t>::New(env, n, ab, 0, napi_int8_array);
+    case Value::Packed::Int16:
+      return Napi::TypedArrayOf<int16_t>::New(env, n, ab, 0, napi_int16_array);
+    case Value::Packed::Int32:
+      return Napi::TypedArrayOf<int32_t>::New(env, n, ab, 0, napi_int32_array);
+    case Value::Packed::Int64:
+      return Napi::TypedArrayOf<int64_t>::New(env, n, ab, 0, napi_bigint64_array);
+    case Value::Packed::Float32:
+      return Napi::TypedArrayOf<float>::New(env, n, ab, 0, napi_float32_array);
+    case Value::Packed::Float64:
+      return Napi::TypedArrayOf<double>::New(env, n, ab, 0, napi_float64_array);
+  }
+  return env.Null();
+}
+
+static Napi::Value ValueToNapi(const Value& v, const Napi::Env& env, ToNapiContext& ctx) {
+  if (v.ref >= 0 && v.type != Value::Type::String && ctx.shared) {
+    size_t id = static_cast<size_t>(v.ref);
+    if (ctx.subtrees.size() <= id) ctx.subtrees.resize(ctx.shared->size());
+    if (ctx.subtrees[id].IsEmpty()) ctx.subtrees[id] = ValueToNapi((*ctx.shared)[id], env, ctx);
+    return ctx.subtrees[id];
+  }
   switch (v.type) {
     case Value::Type::Null:
       return env.Null();
@@ -17,37 +213,144 @@ static Napi::Value ValueToNapi(const Value& v, const Napi::Env& env) {
       return Napi::Number::New(env, static_cast<double>(v.i));
     case Value::Type::Float:
       return Napi::Number::New(env, v.d);
-    case Value::Type::String:
-      return Napi::String::New(env, v.s);
+    case Value::Type::String: {
+      if (v.ref < 0) return Napi::String::New(env, v.s);
+      size_t idx = static_cast<size_t>(v.ref);
+      if (idx >= ctx.strings.size()) ctx.strings.resize(idx + 1);
+      if (ctx.strings[idx].IsEmpty()) ctx.strings[idx] = Napi::String::New(env, v.s);
+      return ctx.strings[idx];
+    }
     case Value::Type::Array: {
       Napi::Array arr = Napi::Array::New(env, v.arr.size());
       for (size_t i = 0; i < v.arr.size(); ++i)
-        arr[static_cast<uint32_t>(i)] = ValueToNapi(v.arr[i], env);
+        arr[static_cast<uint32_t>(i)] = ValueToNapi(v.arr[i], env, ctx);
+      return arr;
+    }
+    case Value::Type::Packed: {
+      if (ctx.typed_arrays) return PackedToTypedArray(v, env);
+      size_t n = v.packed_count();
+      Napi::Array arr = Napi::Array::New(env, n);
+      bool is_float = Value::packed_is_float(v.packed_type);
+      for (size_t i = 0; i < n; ++i)
+        arr[static_cast<uint32_t>(i)] = Napi::Number::New(
+            env, is_float ? v.packed_float(i) : static_cast<double>(v.packed_int(i)));
       return arr;
     }
     case Value::Type::Object: {
       Napi::Object obj = Napi::Object::New(env);
-      for (const auto& p : v.obj)
-        obj.Set(p.first, ValueToNapi(p.second, env));
+      for (const auto& p : v.obj) {
+        if (ctx.key_index) {
+          auto it = ctx.key_index->find(p.first);
+          if (it != ctx.key_index->end()) {
+            obj.Set(ctx.keys[it->second], ValueToNapi(p.second, env, ctx));
+            continue;
+          }
+        }
+        obj.Set(p.first, ValueToNapi(p.second, env, ctx));
+      }
       return obj;
     }
   }
   return env.Null();
 }
 
+static Value NumberToValue(double d) {
+  if (d >= -9007199254740992.0 && d <= 9007199254740992.0) {
+    int64_t i = static_cast<int64_t>(d);
+    if (static_cast<double>(i) == d) return Value::int_val(i);
+  }
+  return Value::float_val(d);
+}
+
+template <typename T>
+static std::vector<uint8_t> TypedArrayBytes(const Napi::TypedArray& ta) {
+  const uint8_t* p = static_cast<const uint8_t*>(ta.ArrayBuffer().Data()) + ta.ByteOffset();
+  return std::vector<uint8_t>(p, p + ta.ElementLength() * sizeof(T));
+}
+
+template <typename T>
+static std::vector<uint8_t> WidenToInt64(const Napi::TypedArray& ta) {
+  const uint8_t* p = static_cast<const uint8_t*>(ta.ArrayBuffer().Data()) + ta.ByteOffset();
+  size_t n = ta.ElementLength();
+  std::vector<uint8_t> out(n * 8);
+  for (size_t i = 0; i < n; ++i) {
+    T x;
+    memcpy(&x, p + i * sizeof(T), sizeof(T));
+    int64_t wide = static_cast<int64_t>(x);
+    memcpy(out.data() + i * 8, &wide, 8);
+  }
+  return out;
+}
+
+// Float typed arrays follow the Number rule element-wise: all integral values
+// pack as Int, all fractional as Float, and a mix falls back to a plain Array.
+template <typename T>
+static Value FloatTypedArrayToValue(const Napi::TypedArray& ta, Value::Packed t) {
+  const uint8_t* p = static_cast<const uint8_t*>(ta.ArrayBuffer().Data()) + ta.ByteOffset();
+  size_t n = ta.ElementLength();
+  Value items;
+  items.type = Value::Type::Array;
+  items.arr.reserve(n);
+  bool all_int = true, all_float = true;
+  for (size_t i = 0; i < n; ++i) {
+    T x;
+    memcpy(&x, p + i * sizeof(T), sizeof(T));
+    items.arr.push_back(NumberToValue(static_cast<double>(x)));
+    if (items.arr.back().type == Value::Type::Int) all_float = false;
+    else all_int = false;
+  }
+  if (n > 0 && all_float) return Value::packed_val(t, TypedArrayBytes<T>(ta));
+  if (n > 0 && all_int) {
+    std::vector<uint8_t> out(n * 8);
+    for (size_t i = 0; i < n; ++i) memcpy(out.data() + i * 8, &items.arr[i].i, 8);
+    return Value::packed_val(Value::Packed::Int64, std::move(out));
+  }
+  return items;
+}
+
+static Value TypedArrayToValue(const Napi::TypedArray& ta) {
+  switch (ta.TypedArrayType()) {
+    case napi_int8_array:
+      return Value::packed_val(Value::Packed::Int8, TypedArrayBytes<int8_t>(ta));
+    case napi_int16_array:
+      return Value::packed_val(Value::Packed::Int16, TypedArrayBytes<int16_t>(ta));
+    case napi_int32_array:
+      return Value::packed_val(Value::Packed::Int32, TypedArrayBytes<int32_t>(ta));
+    case napi_bigint64_array:
+      return Value::packed_val(Value::Packed::Int64, TypedArrayBytes<int64_t>(ta));
+    case napi_uint8_array:
+    case napi_uint8_clamped_array:
+      return Value::packed_val(Value::Packed::Int64, WidenToInt64<uint8_t>(ta));
+    case napi_uint16_array:
+      return Value::packed_val(Value::Packed::Int64, WidenToInt64<uint16_t>(ta));
+    case napi_uint32_array:
+      return Value::packed_val(Value::Packed::Int64, WidenToInt64<uint32_t>(ta));
+    case napi_float32_array:
+      return FloatTypedArrayToValue<float>(ta, Value::Packed::Float32);
+    case napi_float64_array:
+      return FloatTypedArrayToValue<double>(ta, Value::Packed::Float64);
+    default: {
+      // BigUint64Array: values above INT64_MAX have no Int representation.
+      const uint8_t* p = static_cast<const uint8_t*>(ta.ArrayBuffer().Data()) + ta.ByteOffset();
+      Value items;
+      items.type = Value::Type::Array;
+      for (size_t i = 0; i < ta.ElementLength(); ++i) {
+        uint64_t x;
+        memcpy(&x, p + i * 8, 8);
+        items.arr.push_back(x <= INT64_MAX ? Value::int_val(static_cast<int64_t>(x))
+                                           : Value::float_val(static_cast<double>(x)));
+      }
+      return items;
+    }
+  }
+}
+
 static Value NapiToValue(const Napi::Value& val) {
   if (val.IsNull() || val.IsUndefined()) return Value::null_val();
   if (val.IsBoolean()) return Value::bool_val(val.As<Napi::Boolean>().Value());
-  if (val.IsNumber()) {
-    Napi::Number n = val.As<Napi::Number>();
-    double d = n.DoubleValue();
-    if (d >= -9007199254740992.0 && d <= 9007199254740992.0) {
-      int64_t i = static_cast<int64_t>(d);
-      if (static_cast<double>(i) == d) return Value::int_val(i);
-    }
-    return Value::float_val(d);
-  }
+  if (val.IsNumber()) return NumberToValue(val.As<Napi::Number>().DoubleValue());
   if (val.IsString()) return Value::string_val(val.As<Napi::String>().Utf8Value());
+  if (val.IsTypedArray()) return TypedArrayToValue(val.As<Napi::TypedArray>());
   if (val.IsArray()) {
     Value v;
     v.type = Value::Type::Array;
@@ -71,6 +374,25 @@ static Value NapiToValue(const Napi::Value& val) {
   return Value::null_val();
 }
 
+static void ReadParseOptions(const Napi::Object& opts, ParseOptions& parse_opts) {
+  if (opts.Has("maxDepth")) {
+    Napi::Value v = opts.Get("maxDepth");
+    if (v.IsNumber()) parse_opts.max_depth = static_cast<size_t>(v.As<Napi::Number>().Uint32Value());
+  }
+  if (opts.Has("maxInputLength")) {
+    Napi::Value v = opts.Get("maxInputLength");
+    if (v.IsNumber()) parse_opts.max_input_len = static_cast<size_t>(v.As<Napi::Number>().DoubleValue());
+  }
+  if (opts.Has("mode")) {
+    Napi::Value v = opts.Get("mode");
+    if (v.IsString() && v.As<Napi::String>().Utf8Value() == "indexed") parse_opts.mode = ParseMode::Indexed;
+  }
+  if (opts.Has("threads")) {
+    Napi::Value v = opts.Get("threads");
+    if (v.IsNumber()) parse_opts.threads = v.As<Napi::Number>().Uint32Value();
+  }
+}
+
 static Napi::Value NativeParse(const Napi::CallbackInfo& info) {
   Napi::Env env = info.Env();
   if (info.Length() < 1 || !info[0].IsString()) {
@@ -78,17 +400,16 @@ static Napi::Value NativeParse(const Napi::CallbackInfo& info) {
     return env.Null();
   }
   std::string text = info[0].As<Napi::String>().Utf8Value();
-  size_t max_depth = 256;
+  ParseOptions parse_opts;
   if (info.Length() >= 2 && info[1].IsObject()) {
-    Napi::Object opts = info[1].As<Napi::Object>();
-    if (opts.Has("maxDepth")) {
-      Napi::Value v = opts.Get("maxDepth");
-      if (v.IsNumber()) max_depth = static_cast<size_t>(v.As<Napi::Number>().Uint32Value());
-    }
+    ReadParseOptions(info[1].As<Napi::Object>(), parse_opts);
+    if (CancelTokenHandle* cancel = CancelTokenHandle::FromOptions(env, info[1].As<Napi::Object>()))
+      parse_opts.cancel = cancel->token().get();
   }
   try {
-    Value v = parse(text, max_depth);
-    return ValueToNapi(v, env);
+    Value v = parse(text, parse_opts);
+    ToNapiContext ctx;
+    return ValueToNapi(v, env, ctx);
   } catch (const std::exception& e) {
     Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
     return env.Null();
@@ -110,21 +431,238 @@ static Napi::Value NativeStringify(const Napi::CallbackInfo& info) {
   }
 }
 
+static void ReadEncodeOptions(const Napi::Env& env, const Napi::Object& opts, EncodeOptions& enc_opts) {
+  if (opts.Has("maxDepth") && opts.Get("maxDepth").IsNumber())
+    enc_opts.max_depth = static_cast<size_t>(opts.Get("maxDepth").As<Napi::Number>().Uint32Value());
+  if (opts.Has("version") && opts.Get("version").IsNumber())
+    enc_opts.version = static_cast<uint8_t>(opts.Get("version").As<Napi::Number>().Uint32Value());
+  if (opts.Has("stringTable"))
+    enc_opts.string_table = opts.Get("stringTable").ToBoolean().Value();
+  if (opts.Has("dedupe"))
+    enc_opts.dedupe = opts.Get("dedupe").ToBoolean().Value();
+  if (opts.Has("threads") && opts.Get("threads").IsNumber())
+    enc_opts.threads = opts.Get("threads").As<Napi::Number>().Uint32Value();
+  if (DictionaryHandle* dict = DictionaryHandle::FromOptions(env, opts))
+    enc_opts.dictionary = &dict->dict();
+}
+
+// Returns the dictionary handle from the options, if any.
+static DictionaryHandle* ReadDecodeOptions(const Napi::Env& env, const Napi::Object& opts,
+                                           DecodeOptions& dec_opts, ToNapiContext& to_napi) {
+  if (opts.Has("maxDepth") && opts.Get("maxDepth").IsNumber())
+    dec_opts.max_depth = static_cast<size_t>(opts.Get("maxDepth").As<Napi::Number>().Uint32Value());
+  if (opts.Has("maxDictionarySize") && opts.Get("maxDictionarySize").IsNumber())
+    dec_opts.max_dict = static_cast<size_t>(opts.Get("maxDictionarySize").As<Napi::Number>().Uint32Value());
+  if (opts.Has("maxStringLength") && opts.Get("maxStringLength").IsNumber())
+    dec_opts.max_str_len = static_cast<size_t>(opts.Get("maxStringLength").As<Napi::Number>().Uint32Value());
+  if (opts.Has("typedArrays"))
+    to_napi.typed_arrays = opts.Get("typedArrays").ToBoolean().Value();
+  if (opts.Has("lazy"))
+    to_napi.lazy = opts.Get("lazy").ToBoolean().Value();
+  if (opts.Has("threads") && opts.Get("threads").IsNumber())
+    dec_opts.threads = opts.Get("threads").As<Napi::Number>().Uint32Value();
+  DictionaryHandle* dict = DictionaryHandle::FromOptions(env, opts);
+  if (dict) dec_opts.dictionary = &dict->dict();
+  return dict;
+}
+
+// A decoded document kept off the JS heap and converted to JS a node at a
+// time. Values point into root and shared, which live as long as any node.
+struct LazyDocument {
+  Value root;
+  std::vector<Value> shared;
+  bool typed_arrays = false;
+
+  // The subtree a shared-subtree placeholder stands for, or v itself.
+  const Value& resolve(const Value& v) const {
+    if (v.ref >= 0 && v.type != Value::Type::String && static_cast<size_t>(v.ref) < shared.size())
+      return shared[static_cast<size_t>(v.ref)];
+    return v;
+  }
+};
+
+// Documents decoded on one JS thread (a decoder worker) and waiting to be
+// picked up on another. The addon is loaded once per process, so all threads
+// share this table. An entry is removed when it is adopted or released, or
+// when the environment that decoded it shuts down: a terminated worker's
+// replies are never read, so nobody else would free its documents.
+class DocumentRegistry {
+ public:
+  static DocumentRegistry& shared() {
+    static DocumentRegistry registry;
+    return registry;
+  }
+
+  // `owner` identifies the decoding environment (its AddonData).
+  uint64_t add(std::shared_ptr<const LazyDocument> doc, const void* owner) {
+    std::lock_guard<std::mutex> lock(mu_);
+    uint64_t id = ++last_;
+    docs_.emplace(id, Entry{owner, std::move(doc)});
+    return id;
+  }
+
+  std::shared_ptr<const LazyDocument> take(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = docs_.find(id);
+    if (it == docs_.end()) return nullptr;
+    std::shared_ptr<const LazyDocument> doc = std::move(it->second.doc);
+    docs_.erase(it);
+    return doc;
+  }
+
+  // Drops every document `owner` decoded that is still waiting. They are
+  // freed after the lock is released.
+  void drop_owner(const void* owner) {
+    std::vector<std::shared_ptr<const LazyDocument>> dropped;
+    std::lock_guard<std::mutex> lock(mu_);
+    for (auto it = docs_.begin(); it != docs_.end();) {
+      if (it->second.owner == owner) {
+        dropped.push_back(std::move(it->second.doc));
+        it = docs_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+ private:
+  struct Entry {
+    const void* owner;
+    std::shared_ptr<const LazyDocument> doc;
+  };
+
+  std::mutex mu_;
+  uint64_t last_ = 0;
+  std::unordered_map<uint64_t, Entry> docs_;
+};
+
+// One array or object of a LazyDocument. get() converts a single child:
+// scalars and packed arrays directly, containers as further nodes. The JS
+// side wraps nodes in read-only proxies (src/lazy.ts).
+class LazyNodeHandle : public Napi::ObjectWrap<LazyNodeHandle> {
+ public:
+  static Napi::Function Define(Napi::Env env) {
+    return DefineClass(env, "LazyNode",
+                       {InstanceMethod("kind", &LazyNodeHandle::Kind),
+                        InstanceMethod("length", &LazyNodeHandle::Length),
+                        InstanceMethod("keys", &LazyNodeHandle::Keys),
+                        InstanceMethod("get", &LazyNodeHandle::Get),
+                        InstanceMethod("materialize", &LazyNodeHandle::Materialize)});
+  }
+
+  explicit LazyNodeHandle(const Napi::CallbackInfo& info) : Napi::ObjectWrap<LazyNodeHandle>(info) {}
+
+  // v as JS: a node for an array or object, otherwise the converted value.
+  static Napi::Value Wrap(Napi::Env env, const std::shared_ptr<const LazyDocument>& doc, const Value& v) {
+    const Value& r = doc->resolve(v);
+    if (r.type != Value::Type::Array && r.type != Value::Type::Object) {
+      ToNapiContext ctx;
+      ctx.typed_arrays = doc->typed_arrays;
+      return ValueToNapi(r, env, ctx);
+    }
+    Napi::Object obj = env.GetInstanceData<AddonData>()->lazy_node.New({});
+    LazyNodeHandle* node = Unwrap(obj);
+    node->doc_ = doc;
+    node->node_ = &r;
+    return obj;
+  }
+
+ private:
+  // Objects with more keys than this get a hash index on first lookup.
+  static constexpr size_t kLinearLookup = 16;
+
+  bool Check(const Napi::Env& env) {
+    if (node_) return true;
+    Napi::Error::New(env, "LazyNode is not attached to a document").ThrowAsJavaScriptException();
+    return false;
+  }
+
+  Napi::Value Kind(const Napi::CallbackInfo& info) {
+    if (!Check(info.Env())) return info.Env().Null();
+    return Napi::String::New(info.Env(), node_->type == Value::Type::Array ? "array" : "object");
+  }
+
+  Napi::Value Length(const Napi::CallbackInfo& info) {
+    if (!Check(info.Env())) return info.Env().Null();
+    size_t n = node_->type == Value::Type::Array ? node_->arr.size() : node_->obj.size();
+    return Napi::Number::New(info.Env(), static_cast<double>(n));
+  }
+
+  Napi::Value Keys(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (!Check(env)) return env.Null();
+    Napi::Array out = Napi::Array::New(env, node_->obj.size());
+    for (size_t i = 0; i < node_->obj.size(); ++i)
+      out[static_cast<uint32_t>(i)] = Napi::String::New(env, node_->obj[i].first);
+    return out;
+  }
+
+  // get(index) on an array, get(key) on an object; undefined when absent.
+  Napi::Value Get(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (!Check(env)) return env.Null();
+    if (info.Length() < 1) return env.Undefined();
+    if (node_->type == Value::Type::Array) {
+      if (!info[0].IsNumber()) return env.Undefined();
+      double i = info[0].As<Napi::Number>().DoubleValue();
+      if (!(i >= 0) || i >= static_cast<double>(node_->arr.size())) return env.Undefined();
+      return Wrap(env, doc_, node_->arr[static_cast<size_t>(i)]);
+    }
+    if (!info[0].IsString()) return env.Undefined();
+    std::string key = info[0].As<Napi::String>().Utf8Value();
+    const auto& pairs = node_->obj;
+    if (pairs.size() <= kLinearLookup) {
+      for (const auto& p : pairs)
+        if (p.first == key) return Wrap(env, doc_, p.second);
+      return env.Undefined();
+    }
+    if (!index_) {
+      index_ = std::make_unique<std::unordered_map<std::string_view, size_t>>();
+      index_->reserve(pairs.size());
+      for (size_t i = 0; i < pairs.size(); ++i) index_->emplace(pairs[i].first, i);
+    }
+    auto it = index_->find(key);
+    return it == index_->end() ? env.Undefined() : Wrap(env, doc_, pairs[it->second].second);
+  }
+
+  // The whole subtree as plain JS values, as an eager decode returns it.
+  Napi::Value Materialize(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (!Check(env)) return env.Null();
+    ToNapiContext ctx;
+    ctx.typed_arrays = doc_->typed_arrays;
+    ctx.shared = &doc_->shared;
+    return ValueToNapi(*node_, env, ctx);
+  }
+
+  std::shared_ptr<const LazyDocument> doc_;
+  const Value* node_ = nullptr;
+  std::unique_ptr<std::unordered_map<std::string_view, size_t>> index_;
+};
+
+static Napi::Value LazyRoot(Napi::Env env, Value root, std::vector<Value> shared, bool typed_arrays) {
+  auto doc = std::make_shared<LazyDocument>();
+  doc->root = std::move(root);
+  doc->shared = std::move(shared);
+  doc->typed_arrays = typed_arrays;
+  return LazyNodeHandle::Wrap(env, doc, doc->root);
+}
+
 static Napi::Value NativeEncode(const Napi::CallbackInfo& info) {
   Napi::Env env = info.Env();
   if (info.Length() < 1) {
     Napi::TypeError::New(env, "Expected value").ThrowAsJavaScriptException();
     return env.Null();
   }
-  size_t max_depth = 256;
+  EncodeOptions enc_opts;
   if (info.Length() >= 2 && info[1].IsObject()) {
-    Napi::Object opts = info[1].As<Napi::Object>();
-    if (opts.Has("maxDepth") && opts.Get("maxDepth").IsNumber())
-      max_depth = static_cast<size_t>(opts.Get("maxDepth").As<Napi::Number>().Uint32Value());
+    ReadEncodeOptions(env, info[1].As<Napi::Object>(), enc_opts);
+    if (CancelTokenHandle* cancel = CancelTokenHandle::FromOptions(env, info[1].As<Napi::Object>()))
+      enc_opts.cancel = cancel->token().get();
   }
   try {
     Value v = NapiToValue(info[0]);
-    std::vector<uint8_t> buf = encode(v, max_depth);
+    std::vector<uint8_t> buf = encode(v, enc_opts);
     Napi::Buffer<uint8_t> out = Napi::Buffer<uint8_t>::Copy(env, buf.data(), buf.size());
     return out;
   } catch (const std::exception& e) {
@@ -133,6 +671,77 @@ static Napi::Value NativeEncode(const Napi::CallbackInfo& info) {
   }
 }
 
+// Hex digest of bytes fed through `feed`, by options.algorithm: "xxh3"
+// (the default, 16 hex digits) or "sha256" (64).
+template <typename Feed>
+static Napi::Value HashWith(const Napi::Env& env, const Napi::Value& options, Feed feed) {
+  std::string algorithm = "xxh3";
+  if (options.IsObject()) {
+    Napi::Value a = options.As<Napi::Object>().Get("algorithm");
+    if (a.IsString()) algorithm = a.As<Napi::String>().Utf8Value();
+  }
+  static const char kHex[] = "0123456789abcdef";
+  std::string out;
+  if (algorithm == "xxh3") {
+    Xxh3 h;
+    feed([&h](const uint8_t* data, size_t size) { h.update(data, size); });
+    uint64_t d = h.digest();
+    for (int i = 15; i >= 0; --i) out.push_back(kHex[(d >> (4 * i)) & 0xF]);
+  } else if (algorithm == "sha256") {
+    Sha256 h;
+    feed([&h](const uint8_t* data, size_t size) { h.update(data, size); });
+    uint8_t d[32];
+    h.digest(d);
+    for (uint8_t b : d) {
+      out.push_back(kHex[b >> 4]);
+      out.push_back(kHex[b & 0xF]);
+    }
+  } else {
+    throw std::runtime_error("Unknown hash algorithm: " + algorithm);
+  }
+  return Napi::String::New(env, out);
+}
+
+// hash(value, options): digest of the canonical encoding of value. The
+// encoder writes into the hash in pieces, so the encoding is never held
+// whole. Encode options that change the bytes (version, stringTable, dedupe,
+// dictionary) change the digest.
+static Napi::Value NativeHash(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Expected value").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  EncodeOptions enc_opts;
+  Napi::Value options = info.Length() >= 2 ? info[1] : env.Undefined();
+  if (options.IsObject()) ReadEncodeOptions(env, options.As<Napi::Object>(), enc_opts);
+  try {
+    Value v = NapiToValue(info[0]);
+    return HashWith(env, options, [&](const ByteSink& sink) { encode(v, enc_opts, sink); });
+  } catch (const std::exception& e) {
+    Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+}
+
+// hashBinary(buffer, options): digest of already-encoded bytes; equal to
+// hash() of the decoded value when the bytes are canonical.
+static Napi::Value NativeHashBinary(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (info.Length() < 1 || !info[0].IsBuffer()) {
+    Napi::TypeError::New(env, "Expected Buffer").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  Napi::Buffer<uint8_t> buf = info[0].As<Napi::Buffer<uint8_t>>();
+  try {
+    return HashWith(env, info.Length() >= 2 ? info[1] : env.Undefined(),
+                    [&](const ByteSink& sink) { sink(buf.Data(), buf.Length()); });
+  } catch (const std::exception& e) {
+    Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+}
+
 static Napi::Value NativeDecode(const Napi::CallbackInfo& info) {
   Napi::Env env = info.Env();
   if (info.Length() < 1 || !info[0].IsBuffer()) {
@@ -140,27 +749,1282 @@ static Napi::Value NativeDecode(const Napi::CallbackInfo& info) {
     return env.Null();
   }
   Napi::Buffer<uint8_t> buf = info[0].As<Napi::Buffer<uint8_t>>();
-  size_t max_depth = 256;
-  size_t max_dict = 65536;
-  size_t max_str = 1000000;
+  DecodeOptions dec_opts;
+  ToNapiContext to_napi;
+  if (info.Length() >= 2 && info[1].IsObject()) {
+    if (DictionaryHandle* dict = ReadDecodeOptions(env, info[1].As<Napi::Object>(), dec_opts, to_napi))
+      dict->Intern(to_napi);
+    if (CancelTokenHandle* cancel = CancelTokenHandle::FromOptions(env, info[1].As<Napi::Object>()))
+      dec_opts.cancel = cancel->token().get();
+  }
+  try {
+    // Decode shared subtrees once as placeholders so references become the
+    // same JS object rather than independent copies.
+    std::vector<Value> shared;
+    Value v = decode(buf.Data(), buf.ByteLength(), dec_opts, &shared);
+    if (to_napi.lazy) return LazyRoot(env, std::move(v), std::move(shared), to_napi.typed_arrays);
+    to_napi.shared = &shared;
+    return ValueToNapi(v, env, to_napi);
+  } catch (const std::exception& e) {
+    Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+}
+
+// Decode for another thread: the document is kept in the registry and its id
+// returned, for adoptDocument() on the thread that wants it.
+static Napi::Value NativeDecodeDetached(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (info.Length() < 1 || !info[0].IsBuffer()) {
+    Napi::TypeError::New(env, "Expected Buffer").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  Napi::Buffer<uint8_t> buf = info[0].As<Napi::Buffer<uint8_t>>();
+  DecodeOptions dec_opts;
+  ToNapiContext settings;
   if (info.Length() >= 2 && info[1].IsObject()) {
-    Napi::Object opts = info[1].As<Napi::Object>();
-    if (opts.Has("maxDepth") && opts.Get("maxDepth").IsNumber())
-      max_depth = static_cast<size_t>(opts.Get("maxDepth").As<Napi::Number>().Uint32Value());
-    if (opts.Has("maxDictionarySize") && opts.Get("maxDictionarySize").IsNumber())
-      max_dict = static_cast<size_t>(opts.Get("maxDictionarySize").As<Napi::Number>().Uint32Value());
-    if (opts.Has("maxStringLength") && opts.Get("maxStringLength").IsNumber())
-      max_str = static_cast<size_t>(opts.Get("maxStringLength").As<Napi::Number>().Uint32Value());
+    ReadDecodeOptions(env, info[1].As<Napi::Object>(), dec_opts, settings);
+    if (CancelTokenHandle* cancel = CancelTokenHandle::FromOptions(env, info[1].As<Napi::Object>()))
+      dec_opts.cancel = cancel->token().get();
   }
   try {
-    Value v = decode(buf.Data(), buf.ByteLength(), max_depth, max_dict, max_str);
-    return ValueToNapi(v, env);
+    auto doc = std::make_shared<LazyDocument>();
+    doc->root = decode(buf.Data(), buf.ByteLength(), dec_opts, &doc->shared);
+    doc->typed_arrays = settings.typed_arrays;
+    uint64_t id = DocumentRegistry::shared().add(std::move(doc), env.GetInstanceData<AddonData>());
+    return Napi::Number::New(env, static_cast<double>(id));
   } catch (const std::exception& e) {
     Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
     return env.Null();
   }
 }
 
+// The root of a document from decodeDetached(), as a lazy node.
+static Napi::Value NativeAdoptDocument(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (info.Length() < 1 || !info[0].IsNumber()) {
+    Napi::TypeError::New(env, "Expected document id").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  auto id = static_cast<uint64_t>(info[0].As<Napi::Number>().DoubleValue());
+  std::shared_ptr<const LazyDocument> doc = DocumentRegistry::shared().take(id);
+  if (!doc) {
+    Napi::Error::New(env, "Unknown or already adopted document").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  return LazyNodeHandle::Wrap(env, doc, doc->root);
+}
+
+// Frees a document from decodeDetached() that will not be adopted. Unknown
+// ids are ignored, so a reply may be released after its worker has exited.
+static Napi::Value NativeReleaseDocument(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (info.Length() < 1 || !info[0].IsNumber()) {
+    Napi::TypeError::New(env, "Expected document id").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  DocumentRegistry::shared().take(static_cast<uint64_t>(info[0].As<Napi::Number>().DoubleValue()));
+  return env.Undefined();
+}
+
+// Freezes a converted value and everything under it. Typed arrays cannot be
+// frozen, which is why the parse cache refuses typedArrays.
+static void DeepFreeze(Napi::Env env, Napi::Value v) {
+  if (!v.IsObject() || v.IsTypedArray()) return;
+  Napi::Object obj = v.As<Napi::Object>();
+  if (v.IsArray()) {
+    Napi::Array arr = v.As<Napi::Array>();
+    for (uint32_t i = 0; i < arr.Length(); ++i) DeepFreeze(env, arr.Get(i));
+  } else {
+    Napi::Array names = obj.GetPropertyNames();
+    for (uint32_t i = 0; i < names.Length(); ++i) DeepFreeze(env, obj.Get(names.Get(i)));
+  }
+  obj.Freeze();
+}
+
+// Parse and decode results keyed by an XXH64 hash of the input bytes, plus
+// its length and the options that shape the result. Each entry keeps a copy
+// of its input, and a hit is only taken when the bytes match, so a hash
+// collision is a miss. A hit returns the same deeply frozen JS value without
+// parsing anything. Entries are evicted least recently used first once their
+// inputs add up to more than maxBytes.
+class ParseCacheHandle : public Napi::ObjectWrap<ParseCacheHandle> {
+ public:
+  static Napi::Function Define(Napi::Env env) {
+    return DefineClass(env, "ParseCache",
+                       {InstanceMethod("parse", &ParseCacheHandle::Parse),
+                        InstanceMethod("decode", &ParseCacheHandle::Decode),
+                        InstanceMethod("stats", &ParseCacheHandle::Stats),
+                        InstanceMethod("clear", &ParseCacheHandle::Clear)});
+  }
+
+  explicit ParseCacheHandle(const Napi::CallbackInfo& info) : Napi::ObjectWrap<ParseCacheHandle>(info) {
+    if (info.Length() >= 1 && info[0].IsObject()) {
+      Napi::Object o = info[0].As<Napi::Object>();
+      if (o.Has("maxBytes") && o.Get("maxBytes").IsNumber())
+        max_bytes_ = static_cast<size_t>(o.Get("maxBytes").As<Napi::Number>().DoubleValue());
+    }
+  }
+
+ private:
+  struct Key {
+    uint64_t hash;
+    uint64_t size;
+    uint64_t options;  // kind and result-shaping options, mixed
+    bool operator==(const Key& o) const { return hash == o.hash && size == o.size && options == o.options; }
+  };
+  struct KeyHash {
+    size_t operator()(const Key& k) const { return static_cast<size_t>(k.hash ^ (k.options * 0x9E3779B97F4A7C15ULL)); }
+  };
+  struct Entry {
+    Key key;
+    std::vector<uint8_t> input;
+    Napi::Reference<Napi::Array> holder;  // [value], so scalar roots can be held too
+  };
+
+  static uint64_t Mix(uint64_t h, uint64_t v) { return (h ^ v) * 0x100000001B3ULL + 0x9E3779B97F4A7C15ULL; }
+
+  // parse(text | Buffer, options): a Buffer is hashed and parsed in place.
+  Napi::Value Parse(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !(info[0].IsString() || info[0].IsBuffer())) {
+      Napi::TypeError::New(env, "Expected string or Buffer").ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    ParseOptions opts;
+    if (info.Length() >= 2 && info[1].IsObject()) ReadParseOptions(info[1].As<Napi::Object>(), opts);
+    std::string owned;
+    std::string_view text;
+    if (info[0].IsString()) {
+      owned = info[0].As<Napi::String>().Utf8Value();
+      text = owned;
+    } else {
+      Napi::Buffer<char> buf = info[0].As<Napi::Buffer<char>>();
+      text = std::string_view(buf.Data(), buf.Length());
+    }
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(text.data());
+    Key key{xxh64(bytes, text.size()), text.size(), Mix(Mix(1, opts.max_depth), opts.max_input_len)};
+    if (Napi::Value hit = Find(key, bytes); !hit.IsEmpty()) return hit;
+    try {
+      Value v = parse(text, opts);
+      ToNapiContext ctx;
+      return Insert(env, key, bytes, ValueToNapi(v, env, ctx));
+    } catch (const std::exception& e) {
+      Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+  }
+
+  // decode(buffer, options): decodeSync through the cache. `lazy` is ignored.
+  Napi::Value Decode(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsBuffer()) {
+      Napi::TypeError::New(env, "Expected Buffer").ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    Napi::Buffer<uint8_t> buf = info[0].As<Napi::Buffer<uint8_t>>();
+    DecodeOptions opts;
+    ToNapiContext ctx;
+    if (info.Length() >= 2 && info[1].IsObject()) {
+      if (DictionaryHandle* dict = ReadDecodeOptions(env, info[1].As<Napi::Object>(), opts, ctx))
+        dict->Intern(ctx);
+    }
+    // A typed array cannot be frozen, so a cached one could be changed by
+    // whoever got it and seen by every later hit.
+    if (ctx.typed_arrays) {
+      Napi::Error::New(env, "The parse cache does not support typedArrays").ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    uint64_t shape = Mix(Mix(Mix(2, opts.max_depth), opts.max_dict), opts.max_str_len);
+    if (opts.dictionary) shape = Mix(shape, opts.dictionary->id);
+    Key key{xxh64(buf.Data(), buf.Length()), buf.Length(), shape};
+    if (Napi::Value hit = Find(key, buf.Data()); !hit.IsEmpty()) return hit;
+    try {
+      std::vector<Value> shared;
+      Value v = decode(buf.Data(), buf.Length(), opts, &shared);
+      ctx.shared = &shared;
+      return Insert(env, key, buf.Data(), ValueToNapi(v, env, ctx));
+    } catch (const std::exception& e) {
+      Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+  }
+
+  Napi::Value Stats(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::Object out = Napi::Object::New(env);
+    out.Set("entries", Napi::Number::New(env, static_cast<double>(lru_.size())));
+    out.Set("bytes", Napi::Number::New(env, static_cast<double>(bytes_)));
+    out.Set("maxBytes", Napi::Number::New(env, static_cast<double>(max_bytes_)));
+    out.Set("hits", Napi::Number::New(env, static_cast<double>(hits_)));
+    out.Set("misses", Napi::Number::New(env, static_cast<double>(misses_)));
+    out.Set("evictions", Napi::Number::New(env, static_cast<double>(evictions_)));
+    return out;
+  }
+
+  // Drops every entry and resets the counters.
+  Napi::Value Clear(const Napi::CallbackInfo& info) {
+    index_.clear();
+    lru_.clear();
+    bytes_ = 0;
+    hits_ = misses_ = evictions_ = 0;
+    return info.Env().Undefined();
+  }
+
+  // The cached value for `input` (key.size bytes), moved to the front; an
+  // empty handle on a miss.
+  Napi::Value Find(const Key& key, const uint8_t* input) {
+    auto it = index_.find(key);
+    if (it == index_.end() || !std::equal(it->second->input.begin(), it->second->input.end(), input)) {
+      ++misses_;
+      return Napi::Value();
+    }
+    ++hits_;
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->holder.Value().Get(uint32_t(0));
+  }
+
+  Napi::Value Insert(Napi::Env env, const Key& key, const uint8_t* input, Napi::Value value) {
+    DeepFreeze(env, value);
+    if (key.size > max_bytes_) return value;
+    // An entry whose hash collided with this input is replaced.
+    if (auto it = index_.find(key); it != index_.end()) {
+      bytes_ -= key.size;
+      lru_.erase(it->second);
+      index_.erase(it);
+    }
+    Napi::Array holder = Napi::Array::New(env, 1);
+    holder.Set(uint32_t(0), value);
+    lru_.push_front({key, std::vector<uint8_t>(input, input + key.size), Napi::Persistent(holder)});
+    index_[key] = lru_.begin();
+    bytes_ += key.size;
+    while (bytes_ > max_bytes_) {
+      Entry& last = lru_.back();
+      bytes_ -= last.key.size;
+      index_.erase(last.key);
+      lru_.pop_back();
+      ++evictions_;
+    }
+    return value;
+  }
+
+  size_t max_bytes_ = size_t(64) << 20;
+  size_t bytes_ = 0;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+  uint64_t evictions_ = 0;
+  std::list<Entry> lru_;
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index_;
+};
+
+// --- Promise-returning calls, run on the shared thread pool.
+
+// One async call. Run() executes on a pool thread; Result() then builds the
+// resolved value on the JS thread. JS inputs that Run() reads are held until
+// the promise settles.
+class AsyncJob {
+ public:
+  virtual ~AsyncJob() = default;
+  virtual void Run() = 0;
+  virtual Napi::Value Result(Napi::Env env) = 0;
+
+  void Keep(const Napi::Value& v) { keep_.push_back(Napi::Persistent(v)); }
+
+  // Checked before Run(), so work cancelled while queued never starts. The
+  // job's options point at the same token.
+  std::shared_ptr<CancelToken> cancel;
+  bool failed = false;
+  std::string error;
+
+ private:
+  std::vector<Napi::Reference<Napi::Value>> keep_;
+};
+
+static Priority ReadPriority(const Napi::Object& opts) {
+  if (!opts.Has("priority") || !opts.Get("priority").IsString()) return Priority::Normal;
+  std::string p = opts.Get("priority").As<Napi::String>().Utf8Value();
+  if (p == "high") return Priority::High;
+  if (p == "low") return Priority::Low;
+  return Priority::Normal;
+}
+
+// Queues the job and returns its promise. The job is handed back to the JS
+// thread through a thread-safe function and freed there, since it holds
+// references.
+static Napi::Value Schedule(Napi::Env env, std::unique_ptr<AsyncJob> job, Priority priority) {
+  Napi::Promise::Deferred deferred = Napi::Promise::Deferred::New(env);
+  Napi::ThreadSafeFunction tsfn = Napi::ThreadSafeFunction::New(
+      env, Napi::Function::New(env, [](const Napi::CallbackInfo&) {}), "koda.async", 0, 1);
+  AsyncJob* raw = job.release();
+  ThreadPool::shared().submit(
+      [raw, deferred, tsfn]() mutable {
+        try {
+          if (raw->cancel) raw->cancel->check();
+          raw->Run();
+        } catch (const std::exception& e) {
+          raw->failed = true;
+          raw->error = e.what();
+        } catch (...) {
+          raw->failed = true;
+          raw->error = "Unknown error";
+        }
+        tsfn.BlockingCall([raw, deferred](Napi::Env env, Napi::Function) {
+          std::unique_ptr<AsyncJob> job(raw);
+          if (job->failed) {
+            deferred.Reject(Napi::Error::New(env, job->error).Value());
+            return;
+          }
+          try {
+            deferred.Resolve(job->Result(env));
+          } catch (const Napi::Error& e) {
+            deferred.Reject(e.Value());
+          } catch (const std::exception& e) {
+            deferred.Reject(Napi::Error::New(env, e.what()).Value());
+          }
+        });
+        tsfn.Release();
+      },
+      priority);
+  return deferred.Promise();
+}
+
+class ParseJob : public AsyncJob {
+ public:
+  ParseJob(std::string text, const ParseOptions& opts) : text_(std::move(text)), opts_(opts) {}
+  void Run() override { value_ = parse(text_, opts_); }
+  Napi::Value Result(Napi::Env env) override {
+    ToNapiContext ctx;
+    return ValueToNapi(value_, env, ctx);
+  }
+
+ protected:
+  std::string text_;
+  ParseOptions opts_;
+  Value value_;
+};
+
+// Parses a file in place from a read-only mapping, with no copy of the text
+// on either heap. The file is mapped on the pool thread too.
+class ParseFileJob : public ParseJob {
+ public:
+  ParseFileJob(std::string path, const ParseOptions& opts) : ParseJob(std::string(), opts), path_(std::move(path)) {}
+  void Run() override {
+    MappedFile file(path_);
+    value_ = parse(file.text(), opts_);
+  }
+
+ private:
+  std::string path_;
+};
+
+class EncodeJob : public AsyncJob {
+ public:
+  EncodeJob(Value value, const EncodeOptions& opts) : value_(std::move(value)), opts_(opts) {}
+  void Run() override { out_ = encode(value_, opts_); }
+  Napi::Value Result(Napi::Env env) override {
+    return Napi::Buffer<uint8_t>::Copy(env, out_.data(), out_.size());
+  }
+
+ private:
+  Value value_;
+  EncodeOptions opts_;
+  std::vector<uint8_t> out_;
+};
+
+class DecodeJob : public AsyncJob {
+ public:
+  DecodeJob(const Napi::Buffer<uint8_t>& buf, const DecodeOptions& opts, const ToNapiContext& settings,
+            const DictionaryHandle* dict)
+      : data_(buf.Data()),
+        size_(buf.ByteLength()),
+        opts_(opts),
+        typed_arrays_(settings.typed_arrays),
+        lazy_(settings.lazy),
+        dict_(dict) {}
+  void Run() override { value_ = decode(data_, size_, opts_, &shared_); }
+  Napi::Value Result(Napi::Env env) override {
+    if (lazy_) return LazyRoot(env, std::move(value_), std::move(shared_), typed_arrays_);
+    ToNapiContext ctx;
+    ctx.typed_arrays = typed_arrays_;
+    if (dict_) dict_->Intern(ctx);
+    ctx.shared = &shared_;
+    return ValueToNapi(value_, env, ctx);
+  }
+
+ protected:
+  DecodeJob(const DecodeOptions& opts, const ToNapiContext& settings, const DictionaryHandle* dict)
+      : data_(nullptr), size_(0), opts_(opts), typed_arrays_(settings.typed_arrays), lazy_(settings.lazy), dict_(dict) {}
+
+  const uint8_t* data_;
+  size_t size_;
+  DecodeOptions opts_;
+  bool typed_arrays_;
+  bool lazy_;
+  const DictionaryHandle* dict_;
+  Value value_;
+  std::vector<Value> shared_;
+};
+
+// Decodes a file from a read-only mapping. The decoded tree owns its strings
+// and arrays, so the mapping is released as soon as the decode ends, lazy or
+// not.
+class DecodeFileJob : public DecodeJob {
+ public:
+  DecodeFileJob(std::string path, const DecodeOptions& opts, const ToNapiContext& settings,
+                const DictionaryHandle* dict)
+      : DecodeJob(opts, settings, dict), path_(std::move(path)) {}
+  void Run() override {
+    MappedFile file(path_);
+    data_ = file.data();
+    size_ = file.size();
+    DecodeJob::Run();
+    data_ = nullptr;
+  }
+
+ private:
+  std::string path_;
+};
+
+static Napi::Value NativeParseAsync(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (info.Length() < 1 || !info[0].IsString()) {
+    Napi::TypeError::New(env, "Expected string").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  ParseOptions parse_opts;
+  Priority priority = Priority::Normal;
+  std::shared_ptr<CancelToken> cancel;
+  if (info.Length() >= 2 && info[1].IsObject()) {
+    ReadParseOptions(info[1].As<Napi::Object>(), parse_opts);
+    priority = ReadPriority(info[1].As<Napi::Object>());
+    if (CancelTokenHandle* handle = CancelTokenHandle::FromOptions(env, info[1].As<Napi::Object>()))
+      cancel = handle->token();
+  }
+  parse_opts.cancel = cancel.get();
+  auto job = std::make_unique<ParseJob>(info[0].As<Napi::String>().Utf8Value(), parse_opts);
+  if (cancel) job->Keep(info[1].As<Napi::Object>().Get("cancel"));
+  job->cancel = std::move(cancel);
+  return Schedule(env, std::move(job), priority);
+}
+
+static Napi::Value NativeEncodeAsync(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Expected value").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  EncodeOptions enc_opts;
+  Priority priority = Priority::Normal;
+  std::shared_ptr<CancelToken> cancel;
+  std::unique_ptr<EncodeJob> job;
+  try {
+    // The value is copied out of JS here; only the encode itself runs off
+    // the JS thread.
+    if (info.Length() >= 2 && info[1].IsObject()) {
+      ReadEncodeOptions(env, info[1].As<Napi::Object>(), enc_opts);
+      priority = ReadPriority(info[1].As<Napi::Object>());
+      if (CancelTokenHandle* handle = CancelTokenHandle::FromOptions(env, info[1].As<Napi::Object>()))
+        cancel = handle->token();
+    }
+    enc_opts.cancel = cancel.get();
+    job = std::make_unique<EncodeJob>(NapiToValue(info[0]), enc_opts);
+    if (cancel) job->Keep(info[1].As<Napi::Object>().Get("cancel"));
+    job->cancel = std::move(cancel);
+  } catch (const std::exception& e) {
+    Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  if (enc_opts.dictionary) job->Keep(info[1].As<Napi::Object>().Get("dictionary"));
+  return Schedule(env, std::move(job), priority);
+}
+
+static Napi::Value NativeDecodeAsync(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (info.Length() < 1 || !info[0].IsBuffer()) {
+    Napi::TypeError::New(env, "Expected Buffer").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  DecodeOptions dec_opts;
+  ToNapiContext settings;
+  DictionaryHandle* dict = nullptr;
+  Priority priority = Priority::Normal;
+  std::shared_ptr<CancelToken> cancel;
+  if (info.Length() >= 2 && info[1].IsObject()) {
+    dict = ReadDecodeOptions(env, info[1].As<Napi::Object>(), dec_opts, settings);
+    priority = ReadPriority(info[1].As<Napi::Object>());
+    if (CancelTokenHandle* handle = CancelTokenHandle::FromOptions(env, info[1].As<Napi::Object>()))
+      cancel = handle->token();
+  }
+  dec_opts.cancel = cancel.get();
+  auto job = std::make_unique<DecodeJob>(info[0].As<Napi::Buffer<uint8_t>>(), dec_opts, settings, dict);
+  if (cancel) job->Keep(info[1].As<Napi::Object>().Get("cancel"));
+  job->cancel = std::move(cancel);
+  // The bytes are read in place, so the buffer must outlive the job.
+  job->Keep(info[0]);
+  if (dict) job->Keep(info[1].As<Napi::Object>().Get("dictionary"));
+  return Schedule(env, std::move(job), priority);
+}
+
+// parseFile(path, options) and decodeFile(path, options): parseAsync and
+// decodeAsync over a file mapped on the pool thread.
+static Napi::Value NativeParseFile(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (info.Length() < 1 || !info[0].IsString()) {
+    Napi::TypeError::New(env, "Expected path").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  ParseOptions parse_opts;
+  Priority priority = Priority::Normal;
+  std::shared_ptr<CancelToken> cancel;
+  if (info.Length() >= 2 && info[1].IsObject()) {
+    ReadParseOptions(info[1].As<Napi::Object>(), parse_opts);
+    priority = ReadPriority(info[1].As<Napi::Object>());
+    if (CancelTokenHandle* handle = CancelTokenHandle::FromOptions(env, info[1].As<Napi::Object>()))
+      cancel = handle->token();
+  }
+  parse_opts.cancel = cancel.get();
+  auto job = std::make_unique<ParseFileJob>(info[0].As<Napi::String>().Utf8Value(), parse_opts);
+  if (cancel) job->Keep(info[1].As<Napi::Object>().Get("cancel"));
+  job->cancel = std::move(cancel);
+  return Schedule(env, std::move(job), priority);
+}
+
+static Napi::Value NativeDecodeFile(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (info.Length() < 1 || !info[0].IsString()) {
+    Napi::TypeError::New(env, "Expected path").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  DecodeOptions dec_opts;
+  ToNapiContext settings;
+  DictionaryHandle* dict = nullptr;
+  Priority priority = Priority::Normal;
+  std::shared_ptr<CancelToken> cancel;
+  if (info.Length() >= 2 && info[1].IsObject()) {
+    dict = ReadDecodeOptions(env, info[1].As<Napi::Object>(), dec_opts, settings);
+    priority = ReadPriority(info[1].As<Napi::Object>());
+    if (CancelTokenHandle* handle = CancelTokenHandle::FromOptions(env, info[1].As<Napi::Object>()))
+      cancel = handle->token();
+  }
+  dec_opts.cancel = cancel.get();
+  auto job = std::make_unique<DecodeFileJob>(info[0].As<Napi::String>().Utf8Value(), dec_opts, settings, dict);
+  if (cancel) job->Keep(info[1].As<Napi::Object>().Get("cancel"));
+  job->cancel = std::move(cancel);
+  if (dict) job->Keep(info[1].As<Napi::Object>().Get("dictionary"));
+  return Schedule(env, std::move(job), priority);
+}
+
+// loadFiles(paths, options): parses many files on the pool, at most
+// `concurrency` at a time (default: the pool's thread count). Each runner
+// task takes the next unclaimed path until none are left; the last runner to
+// finish resolves the promise with one entry per path, { path, value } or
+// { path, error }, so a bad file does not fail the batch. Cancellation does.
+struct LoadFilesBatch {
+  struct Entry {
+    Value value;
+    bool failed = false;
+    std::string error;
+  };
+
+  std::vector<std::string> paths;
+  std::vector<Entry> entries;
+  ParseOptions opts;
+  std::shared_ptr<CancelToken> cancel;
+  Napi::Reference<Napi::Value> keep_cancel;
+  std::atomic<size_t> next{0};
+  std::atomic<unsigned> running{0};
+  std::atomic<bool> cancelled{false};
+  std::string cancel_error;
+  std::mutex mu;
+};
+
+static Napi::Value NativeLoadFiles(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (info.Length() < 1 || !info[0].IsArray()) {
+    Napi::TypeError::New(env, "Expected array of paths").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  auto batch = std::make_unique<LoadFilesBatch>();
+  Napi::Array in = info[0].As<Napi::Array>();
+  batch->paths.reserve(in.Length());
+  for (uint32_t i = 0; i < in.Length(); ++i) {
+    Napi::Value p = in.Get(i);
+    if (!p.IsString()) {
+      Napi::TypeError::New(env, "Paths must be strings").ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    batch->paths.push_back(p.As<Napi::String>().Utf8Value());
+  }
+  batch->entries.resize(batch->paths.size());
+  Priority priority = Priority::Normal;
+  unsigned concurrency = ThreadPool::shared().threads();
+  if (info.Length() >= 2 && info[1].IsObject()) {
+    Napi::Object o = info[1].As<Napi::Object>();
+    ReadParseOptions(o, batch->opts);
+    priority = ReadPriority(o);
+    if (o.Has("concurrency") && o.Get("concurrency").IsNumber())
+      concurrency = o.Get("concurrency").As<Napi::Number>().Uint32Value();
+    if (CancelTokenHandle* handle = CancelTokenHandle::FromOptions(env, o)) {
+      batch->cancel = handle->token();
+      batch->keep_cancel = Napi::Persistent(o.Get("cancel"));
+    }
+  }
+  batch->opts.cancel = batch->cancel.get();
+
+  Napi::Promise::Deferred deferred = Napi::Promise::Deferred::New(env);
+  unsigned runners = static_cast<unsigned>(std::min<size_t>(std::max(1u, concurrency), batch->paths.size()));
+  if (runners == 0) {
+    deferred.Resolve(Napi::Array::New(env, 0));
+    return deferred.Promise();
+  }
+  batch->running = runners;
+  Napi::ThreadSafeFunction tsfn = Napi::ThreadSafeFunction::New(
+      env, Napi::Function::New(env, [](const Napi::CallbackInfo&) {}), "koda.loadFiles", 0, runners);
+  LoadFilesBatch* raw = batch.release();
+  for (unsigned r = 0; r < runners; ++r) {
+    ThreadPool::shared().submit(
+        [raw, deferred, tsfn]() mutable {
+          while (!raw->cancelled) {
+            size_t i = raw->next.fetch_add(1);
+            if (i >= raw->paths.size()) break;
+            LoadFilesBatch::Entry& entry = raw->entries[i];
+            try {
+              if (raw->cancel) raw->cancel->check();
+              MappedFile file(raw->paths[i]);
+              entry.value = parse(file.text(), raw->opts);
+            } catch (const Cancelled& e) {
+              std::lock_guard<std::mutex> lock(raw->mu);
+              if (!raw->cancelled) raw->cancel_error = e.what();
+              raw->cancelled = true;
+            } catch (const std::exception& e) {
+              entry.failed = true;
+              entry.error = e.what();
+            }
+          }
+          if (raw->running.fetch_sub(1) != 1) {
+            tsfn.Release();
+            return;
+          }
+          tsfn.BlockingCall([raw, deferred](Napi::Env env, Napi::Function) {
+            std::unique_ptr<LoadFilesBatch> batch(raw);
+            if (batch->cancelled) {
+              deferred.Reject(Napi::Error::New(env, batch->cancel_error).Value());
+              return;
+            }
+            try {
+              Napi::Array out = Napi::Array::New(env, batch->paths.size());
+              for (size_t i = 0; i < batch->paths.size(); ++i) {
+                LoadFilesBatch::Entry& entry = batch->entries[i];
+                Napi::Object result = Napi::Object::New(env);
+                result.Set("path", batch->paths[i]);
+                if (entry.failed) {
+                  result.Set("error", entry.error);
+                } else {
+                  ToNapiContext ctx;
+                  result.Set("value", ValueToNapi(entry.value, env, ctx));
+                  entry.value = Value();
+                }
+                out[static_cast<uint32_t>(i)] = result;
+              }
+              deferred.Resolve(out);
+            } catch (const Napi::Error& e) {
+              deferred.Reject(e.Value());
+            }
+          });
+          tsfn.Release();
+        },
+        priority);
+  }
+  return deferred.Promise();
+}
+
+static Napi::Value NativeConfigurePool(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (info.Length() >= 1 && info[0].IsObject()) {
+    Napi::Object opts = info[0].As<Napi::Object>();
+    if (opts.Has("threads") && opts.Get("threads").IsNumber())
+      ThreadPool::shared().set_threads(opts.Get("threads").As<Napi::Number>().Uint32Value());
+  }
+  return env.Undefined();
+}
+
+static Napi::Value NativePoolStats(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  PoolStats stats = ThreadPool::shared().stats();
+  Napi::Object queued = Napi::Object::New(env);
+  queued.Set("high", static_cast<double>(stats.queued[static_cast<size_t>(Priority::High)]));
+  queued.Set("normal", static_cast<double>(stats.queued[static_cast<size_t>(Priority::Normal)]));
+  queued.Set("low", static_cast<double>(stats.queued[static_cast<size_t>(Priority::Low)]));
+  Napi::Object out = Napi::Object::New(env);
+  out.Set("threads", static_cast<double>(stats.threads));
+  out.Set("active", static_cast<double>(stats.active));
+  out.Set("queued", queued);
+  out.Set("executed", static_cast<double>(stats.executed));
+  out.Set("stolen", static_cast<double>(stats.stolen));
+  return out;
+}
+
+// Stateful encoder for session frames (SPEC §6.12).
+class EncoderSessionHandle : public Napi::ObjectWrap<EncoderSessionHandle> {
+ public:
+  static Napi::Function Define(Napi::Env env) {
+    return DefineClass(env, "EncoderSession", {InstanceMethod("encode", &EncoderSessionHandle::Encode)});
+  }
+
+  explicit EncoderSessionHandle(const Napi::CallbackInfo& info)
+      : Napi::ObjectWrap<EncoderSessionHandle>(info) {
+    EncodeOptions opts;
+    if (info.Length() >= 1 && info[0].IsObject()) ReadEncodeOptions(info.Env(), info[0].As<Napi::Object>(), opts);
+    session_ = std::make_unique<EncoderSession>(opts);  // copies dictionary keys
+  }
+
+ private:
+  Napi::Value Encode(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1) {
+      Napi::TypeError::New(env, "Expected value").ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    try {
+      std::vector<uint8_t> buf = session_->encode(NapiToValue(info[0]));
+      return Napi::Buffer<uint8_t>::Copy(env, buf.data(), buf.size());
+    } catch (const std::exception& e) {
+      Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+  }
+
+  std::unique_ptr<EncoderSession> session_;
+};
+
+// Stateful decoder for session frames. Interns the session's key strings and
+// refreshes them only when a frame grows the dictionary.
+class DecoderSessionHandle : public Napi::ObjectWrap<DecoderSessionHandle> {
+ public:
+  static Napi::Function Define(Napi::Env env) {
+    return DefineClass(env, "DecoderSession", {InstanceMethod("decode", &DecoderSessionHandle::Decode)});
+  }
+
+  explicit DecoderSessionHandle(const Napi::CallbackInfo& info)
+      : Napi::ObjectWrap<DecoderSessionHandle>(info) {
+    DecodeOptions opts;
+    if (info.Length() >= 1 && info[0].IsObject()) {
+      Napi::Object o = info[0].As<Napi::Object>();
+      ToNapiContext settings;
+      // Keep the dictionary handle alive: the session points at its keys.
+      if (ReadDecodeOptions(info.Env(), o, opts, settings))
+        dictionary_ = Napi::Persistent(o.Get("dictionary").As<Napi::Object>());
+      typed_arrays_ = settings.typed_arrays;
+    }
+    session_ = std::make_unique<DecoderSession>(opts);
+    keys_.Reset(info.Env(), session_->keys());
+  }
+
+ private:
+  Napi::Value Decode(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsBuffer()) {
+      Napi::TypeError::New(env, "Expected Buffer").ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    Napi::Buffer<uint8_t> buf = info[0].As<Napi::Buffer<uint8_t>>();
+    try {
+      std::vector<Value> shared;
+      Value v = session_->decode(buf.Data(), buf.ByteLength(), &shared);
+      if (session_->keys().size() != keys_.size()) keys_.Reset(env, session_->keys());
+      ToNapiContext ctx;
+      ctx.typed_arrays = typed_arrays_;
+      ctx.shared = &shared;
+      keys_.Intern(ctx);
+      return ValueToNapi(v, env, ctx);
+    } catch (const std::exception& e) {
+      Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+  }
+
+  std::unique_ptr<DecoderSession> session_;
+  bool typed_arrays_ = false;
+  InternedKeys keys_;
+  Napi::ObjectReference dictionary_;
+};
+
+// Encoder side of a framed stream: one [length][payload] record per value,
+// through an EncoderSession when `session` is set.
+class FrameEncoderHandle : public Napi::ObjectWrap<FrameEncoderHandle> {
+ public:
+  static Napi::Function Define(Napi::Env env) {
+    return DefineClass(env, "FrameEncoder", {InstanceMethod("encode", &FrameEncoderHandle::Encode)});
+  }
+
+  explicit FrameEncoderHandle(const Napi::CallbackInfo& info) : Napi::ObjectWrap<FrameEncoderHandle>(info) {
+    if (info.Length() >= 1 && info[0].IsObject()) {
+      Napi::Object o = info[0].As<Napi::Object>();
+      ReadEncodeOptions(info.Env(), o, opts_);
+      if (o.Has("session") && o.Get("session").ToBoolean().Value()) {
+        session_ = std::make_unique<EncoderSession>(opts_);
+      } else if (opts_.dictionary) {
+        dictionary_ = Napi::Persistent(o.Get("dictionary").As<Napi::Object>());
+      }
+    }
+  }
+
+ private:
+  Napi::Value Encode(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1) {
+      Napi::TypeError::New(env, "Expected value").ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    try {
+      Value v = NapiToValue(info[0]);
+      std::vector<uint8_t> payload = session_ ? session_->encode(v) : encode(v, opts_);
+      std::vector<uint8_t> header;
+      write_frame_header(header, payload.size());
+      Napi::Buffer<uint8_t> out = Napi::Buffer<uint8_t>::New(env, header.size() + payload.size());
+      memcpy(out.Data(), header.data(), header.size());
+      memcpy(out.Data() + header.size(), payload.data(), payload.size());
+      return out;
+    } catch (const std::exception& e) {
+      Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+  }
+
+  EncodeOptions opts_;
+  std::unique_ptr<EncoderSession> session_;
+  Napi::ObjectReference dictionary_;  // keeps opts_.dictionary alive
+};
+
+// Decoder side of a framed stream. push() scans the chunk list in place and
+// decodes every complete frame in one call; chunks are held by reference
+// until the reader has consumed them, so nothing is concatenated.
+class FrameDecoderHandle : public Napi::ObjectWrap<FrameDecoderHandle> {
+ public:
+  static constexpr size_t kDefaultMaxFrame = 64 * 1024 * 1024;
+
+  static Napi::Function Define(Napi::Env env) {
+    return DefineClass(env, "FrameDecoder",
+                       {InstanceMethod("push", &FrameDecoderHandle::Push),
+                        InstanceMethod("end", &FrameDecoderHandle::End)});
+  }
+
+  explicit FrameDecoderHandle(const Napi::CallbackInfo& info)
+      : Napi::ObjectWrap<FrameDecoderHandle>(info), reader_(kDefaultMaxFrame) {
+    Napi::Env env = info.Env();
+    DictionaryHandle* dict = nullptr;
+    if (info.Length() >= 1 && info[0].IsObject()) {
+      Napi::Object o = info[0].As<Napi::Object>();
+      ToNapiContext settings;
+      dict = ReadDecodeOptions(env, o, opts_, settings);
+      typed_arrays_ = settings.typed_arrays;
+      if (dict) dictionary_ = Napi::Persistent(o.Get("dictionary").As<Napi::Object>());
+      if (o.Has("maxFrameSize") && o.Get("maxFrameSize").IsNumber())
+        reader_ = FrameReader(static_cast<size_t>(o.Get("maxFrameSize").As<Napi::Number>().DoubleValue()));
+      if (o.Has("session") && o.Get("session").ToBoolean().Value())
+        session_ = std::make_unique<DecoderSession>(opts_);
+    }
+    if (session_) keys_.Reset(env, session_->keys());
+    else if (dict) keys_.Reset(env, dict->dict().keys);
+  }
+
+ private:
+  Napi::Value Push(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsBuffer()) {
+      Napi::TypeError::New(env, "Expected Buffer").ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    Napi::Buffer<uint8_t> chunk = info[0].As<Napi::Buffer<uint8_t>>();
+    Napi::Array out = Napi::Array::New(env);
+    if (chunk.Length() == 0) return out;  // the reader ignores it; don't hold a reference either
+    chunks_.push_back(Napi::Persistent(chunk.As<Napi::Object>()));
+    reader_.push(chunk.Data(), chunk.Length());
+    try {
+      const uint8_t* payload;
+      size_t size;
+      uint32_t n = 0;
+      while (reader_.next(payload, size)) {
+        std::vector<Value> shared;
+        Value v = session_ ? session_->decode(payload, size, &shared)
+                           : decode(payload, size, opts_, &shared);
+        if (session_ && session_->keys().size() != keys_.size()) keys_.Reset(env, session_->keys());
+        ToNapiContext ctx;
+        ctx.typed_arrays = typed_arrays_;
+        ctx.shared = &shared;
+        keys_.Intern(ctx);
+        out[n++] = ValueToNapi(v, env, ctx);
+      }
+    } catch (const std::exception& e) {
+      Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    for (size_t released = reader_.take_released(); released > 0; --released) chunks_.pop_front();
+    return out;
+  }
+
+  Napi::Value End(const Napi::CallbackInfo& info) {
+    if (reader_.buffered() > 0) {
+      Napi::Error::New(info.Env(), "Truncated frame").ThrowAsJavaScriptException();
+    }
+    return info.Env().Undefined();
+  }
+
+  DecodeOptions opts_;
+  bool typed_arrays_ = false;
+  FrameReader reader_;
+  std::deque<Napi::ObjectReference> chunks_;  // chunks the reader still points into
+  std::unique_ptr<DecoderSession> session_;
+  InternedKeys keys_;
+  Napi::ObjectReference dictionary_;
+};
+
+// Root array written row by row (see StreamEncoder). finish(path) writes the
+// document to a file; finish() returns it as a Buffer.
+class StreamEncoderHandle : public Napi::ObjectWrap<StreamEncoderHandle> {
+ public:
+  static Napi::Function Define(Napi::Env env) {
+    return DefineClass(env, "StreamEncoder",
+                       {InstanceMethod("beginArray", &StreamEncoderHandle::BeginArray),
+                        InstanceMethod("writeValue", &StreamEncoderHandle::WriteValue),
+                        InstanceMethod("finish", &StreamEncoderHandle::Finish)});
+  }
+
+  explicit StreamEncoderHandle(const Napi::CallbackInfo& info)
+      : Napi::ObjectWrap<StreamEncoderHandle>(info) {
+    EncodeOptions opts;
+    if (info.Length() >= 1 && info[0].IsObject()) ReadEncodeOptions(info.Env(), info[0].As<Napi::Object>(), opts);
+    try {
+      encoder_ = std::make_unique<StreamEncoder>(opts);  // copies dictionary keys
+    } catch (const std::exception& e) {
+      Napi::Error::New(info.Env(), e.what()).ThrowAsJavaScriptException();
+    }
+  }
+
+ private:
+  Napi::Value BeginArray(const Napi::CallbackInfo& info) {
+    try {
+      encoder_->begin_array();
+    } catch (const std::exception& e) {
+      Napi::Error::New(info.Env(), e.what()).ThrowAsJavaScriptException();
+    }
+    return info.Env().Undefined();
+  }
+
+  Napi::Value WriteValue(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1) {
+      Napi::TypeError::New(env, "Expected value").ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    try {
+      encoder_->write_value(NapiToValue(info[0]));
+    } catch (const std::exception& e) {
+      Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+    }
+    return env.Undefined();
+  }
+
+  Napi::Value Finish(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    try {
+      if (info.Length() >= 1 && info[0].IsString()) {
+        std::string path = info[0].As<Napi::String>().Utf8Value();
+        std::FILE* out = std::fopen(path.c_str(), "wb");
+        if (!out) throw std::runtime_error("Cannot open " + path);
+        bool ok = true;
+        try {
+          encoder_->finish([out, &ok](const uint8_t* data, size_t size) {
+            if (ok && std::fwrite(data, 1, size, out) != size) ok = false;
+          });
+        } catch (...) {
+          std::fclose(out);
+          throw;
+        }
+        if (std::fclose(out) != 0 || !ok) throw std::runtime_error("Cannot write " + path);
+        return env.Undefined();
+      }
+      std::vector<uint8_t> buf;
+      encoder_->finish([&buf](const uint8_t* data, size_t size) { buf.insert(buf.end(), data, data + size); });
+      return Napi::Buffer<uint8_t>::Copy(env, buf.data(), buf.size());
+    } catch (const std::exception& e) {
+      Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+  }
+
+  std::unique_ptr<StreamEncoder> encoder_;
+};
+
+// One document pushed in chunks; push() returns the root array elements that
+// the chunk completed.
+class IncrementalDecoderHandle : public Napi::ObjectWrap<IncrementalDecoderHandle> {
+ public:
+  static Napi::Function Define(Napi::Env env) {
+    return DefineClass(env, "IncrementalDecoder",
+                       {InstanceMethod("push", &IncrementalDecoderHandle::Push),
+                        InstanceMethod("end", &IncrementalDecoderHandle::End)});
+  }
+
+  explicit IncrementalDecoderHandle(const Napi::CallbackInfo& info)
+      : Napi::ObjectWrap<IncrementalDecoderHandle>(info) {
+    Napi::Env env = info.Env();
+    DecodeOptions opts;
+    if (info.Length() >= 1 && info[0].IsObject()) {
+      Napi::Object o = info[0].As<Napi::Object>();
+      ToNapiContext settings;
+      if (ReadDecodeOptions(env, o, opts, settings))
+        dictionary_ = Napi::Persistent(o.Get("dictionary").As<Napi::Object>());
+      typed_arrays_ = settings.typed_arrays;
+    }
+    decoder_ = std::make_unique<IncrementalDecoder>(opts);
+  }
+
+ private:
+  Napi::Value Push(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsBuffer()) {
+      Napi::TypeError::New(env, "Expected Buffer").ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    Napi::Buffer<uint8_t> chunk = info[0].As<Napi::Buffer<uint8_t>>();
+    Napi::Array out = Napi::Array::New(env);
+    try {
+      decoder_->push(chunk.Data(), chunk.Length());
+      ToNapiContext ctx;
+      ctx.typed_arrays = typed_arrays_;
+      Value v;
+      uint32_t n = 0;
+      while (decoder_->next(v)) {
+        if (n == 0) {
+          if (decoder_->keys().size() != keys_.size()) keys_.Reset(env, decoder_->keys());
+          keys_.Intern(ctx);
+        }
+        out[n++] = ValueToNapi(v, env, ctx);
+      }
+    } catch (const std::exception& e) {
+      Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    return out;
+  }
+
+  Napi::Value End(const Napi::CallbackInfo& info) {
+    try {
+      decoder_->finish();
+    } catch (const std::exception& e) {
+      Napi::Error::New(info.Env(), e.what()).ThrowAsJavaScriptException();
+    }
+    return info.Env().Undefined();
+  }
+
+  std::unique_ptr<IncrementalDecoder> decoder_;
+  bool typed_arrays_ = false;
+  InternedKeys keys_;
+  Napi::ObjectReference dictionary_;
+};
+
+// Decodes a whole buffer on the JS thread in steps of bounded duration, for
+// mid-sized documents where a thread handoff costs more than the decode.
+// Input is fed to an IncrementalDecoder a slice at a time, and each decoded
+// root element (or the root itself) is converted to JS with an explicit
+// stack, so a step can stop between any two nodes. A step does not split the
+// native decode of a single root element, nor of a root that is not a plain
+// array; a columnar root is one such value.
+class SlicedDecoderHandle : public Napi::ObjectWrap<SlicedDecoderHandle> {
+ public:
+  static Napi::Function Define(Napi::Env env) {
+    return DefineClass(env, "SlicedDecoder",
+                       {InstanceMethod("step", &SlicedDecoderHandle::Step),
+                        InstanceMethod("result", &SlicedDecoderHandle::Result)});
+  }
+
+  explicit SlicedDecoderHandle(const Napi::CallbackInfo& info)
+      : Napi::ObjectWrap<SlicedDecoderHandle>(info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsBuffer()) {
+      Napi::TypeError::New(env, "Expected Buffer").ThrowAsJavaScriptException();
+      return;
+    }
+    Napi::Buffer<uint8_t> buf = info[0].As<Napi::Buffer<uint8_t>>();
+    input_ = Napi::Persistent(buf.As<Napi::Object>());
+    data_ = buf.Data();
+    size_ = buf.Length();
+    DecodeOptions opts;
+    if (info.Length() >= 2 && info[1].IsObject()) {
+      Napi::Object o = info[1].As<Napi::Object>();
+      ToNapiContext settings;
+      if (ReadDecodeOptions(env, o, opts, settings))
+        dictionary_ = Napi::Persistent(o.Get("dictionary").As<Napi::Object>());
+      typed_arrays_ = settings.typed_arrays;
+    }
+    decoder_ = std::make_unique<IncrementalDecoder>(opts, false);
+    holder_ = Napi::Persistent(Napi::Array::New(env, 1));
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  // Input bytes handed to the decoder at a time.
+  static constexpr size_t kSlice = size_t(1) << 16;
+  // Nodes converted between clock reads.
+  static constexpr unsigned kClockEvery = 64;
+
+  // A container being filled: its JS object and the next child to convert.
+  struct Frame {
+    const Value* v;
+    Napi::ObjectReference js;
+    size_t next = 0;
+  };
+
+  // step(budgetMs): work for about that long; true once the value is complete.
+  Napi::Value Step(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (failed_) return Fail(env);
+    if (done_) return Napi::Boolean::New(env, true);
+    double budget_ms = info.Length() >= 1 && info[0].IsNumber() ? info[0].As<Napi::Number>().DoubleValue() : 4;
+    Clock::time_point deadline =
+        Clock::now() + std::chrono::microseconds(static_cast<int64_t>(std::max(0.0, budget_ms) * 1000));
+    ToNapiContext ctx;
+    ctx.typed_arrays = typed_arrays_;
+    try {
+      for (unsigned n = 1;; ++n) {
+        if (n % kClockEvery == 0 && Clock::now() >= deadline) return Napi::Boolean::New(env, false);
+        if (!frames_.empty()) {
+          Advance(env, ctx);
+          continue;
+        }
+        Value v;
+        if (decoder_->next(v)) {
+          if (decoder_->keys().size() != keys_.size()) {
+            keys_.Reset(env, decoder_->keys());
+            keys_.Intern(ctx);
+          } else if (ctx.keys.empty()) {
+            keys_.Intern(ctx);
+          }
+          Begin(env, std::move(v), ctx);
+          continue;
+        }
+        if (fed_ < size_) {
+          size_t n_bytes = std::min(kSlice, size_ - fed_);
+          decoder_->push(data_ + fed_, n_bytes);
+          fed_ += n_bytes;
+          continue;
+        }
+        decoder_->finish();
+        if (decoder_->root_is_array() && elements_ == 0) holder_.Value().Set(uint32_t(0), Napi::Array::New(env, 0));
+        done_ = true;
+        input_.Reset();
+        return Napi::Boolean::New(env, true);
+      }
+    } catch (const std::exception& e) {
+      // The partly built value is dropped; every later step() and result()
+      // rethrows this error.
+      failed_ = true;
+      error_ = e.what();
+      frames_.clear();
+      current_ = Value();
+      decoder_.reset();
+      holder_.Reset();
+      input_.Reset();
+      return Fail(env);
+    }
+  }
+
+  // result(): the decoded value, once step() has returned true.
+  Napi::Value Result(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (failed_) return Fail(env);
+    if (!done_) {
+      Napi::Error::New(env, "Decode is not complete").ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    return holder_.Value().Get(uint32_t(0));
+  }
+
+  // Throws the error that ended the decode.
+  Napi::Value Fail(Napi::Env env) {
+    Napi::Error::New(env, error_).ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  // A decoded root element, or the root: placed into the result, and its
+  // conversion started.
+  void Begin(Napi::Env env, Value v, ToNapiContext& ctx) {
+    current_ = std::move(v);
+    Napi::Value js = Node(env, current_, ctx);
+    Napi::Array holder = holder_.Value();
+    if (!decoder_->root_is_array()) {
+      holder.Set(uint32_t(0), js);
+      return;
+    }
+    if (elements_ == 0) holder.Set(uint32_t(0), Napi::Array::New(env));
+    holder.Get(uint32_t(0)).As<Napi::Array>().Set(elements_++, js);
+  }
+
+  // Converts one child of the innermost open container.
+  void Advance(Napi::Env env, ToNapiContext& ctx) {
+    Frame& f = frames_.back();
+    const Value& v = *f.v;
+    size_t size = v.type == Value::Type::Array ? v.arr.size() : v.obj.size();
+    if (f.next == size) {
+      frames_.pop_back();
+      return;
+    }
+    size_t i = f.next++;
+    Napi::Object container = f.js.Value();
+    if (v.type == Value::Type::Array) {
+      Napi::Value child = Node(env, v.arr[i], ctx);
+      container.Set(static_cast<uint32_t>(i), child);
+      return;
+    }
+    const auto& p = v.obj[i];
+    Napi::Value child = Node(env, p.second, ctx);
+    if (ctx.key_index) {
+      auto it = ctx.key_index->find(p.first);
+      if (it != ctx.key_index->end()) {
+        container.Set(ctx.keys[it->second], child);
+        return;
+      }
+    }
+    container.Set(p.first, child);
+  }
+
+  // An empty container (with a frame to fill it) or a converted leaf. Note
+  // that pushing a frame can move the frames_ vector, so callers must not
+  // hold a Frame reference across it.
+  Napi::Value Node(Napi::Env env, const Value& v, ToNapiContext& ctx) {
+    if (v.type == Value::Type::Array) {
+      Napi::Array arr = Napi::Array::New(env, v.arr.size());
+      if (!v.arr.empty()) frames_.push_back({&v, Napi::Persistent(arr.As<Napi::Object>())});
+      return arr;
+    }
+    if (v.type == Value::Type::Object) {
+      Napi::Object obj = Napi::Object::New(env);
+      if (!v.obj.empty()) frames_.push_back({&v, Napi::Persistent(obj)});
+      return obj;
+    }
+    return ValueToNapi(v, env, ctx);
+  }
+
+  Napi::ObjectReference input_;
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  size_t fed_ = 0;
+  std::unique_ptr<IncrementalDecoder> decoder_;
+  bool typed_arrays_ = false;
+  InternedKeys keys_;
+  Napi::ObjectReference dictionary_;
+  Value current_;  // the element being converted; frames point into it
+  std::vector<Frame> frames_;
+  // [result]; a one-element array so that a scalar root can be held too.
+  Napi::Reference<Napi::Array> holder_;
+  uint32_t elements_ = 0;
+  bool done_ = false;
+  bool failed_ = false;
+  std::string error_;  // set with failed_
+};
+
 }  // namespace koda
 
 static Napi::Object Init(Napi::Env env, Napi::Object exports) {
@@ -168,6 +2032,40 @@ static Napi::Object Init(Napi::Env env, Napi::Object exports) {
   exports.Set("stringify", Napi::Function::New(env, koda::NativeStringify));
   exports.Set("encode", Napi::Function::New(env, koda::NativeEncode));
   exports.Set("decode", Napi::Function::New(env, koda::NativeDecode));
+  exports.Set("decodeDetached", Napi::Function::New(env, koda::NativeDecodeDetached));
+  exports.Set("adoptDocument", Napi::Function::New(env, koda::NativeAdoptDocument));
+  exports.Set("releaseDocument", Napi::Function::New(env, koda::NativeReleaseDocument));
+  exports.Set("parseAsync", Napi::Function::New(env, koda::NativeParseAsync));
+  exports.Set("encodeAsync", Napi::Function::New(env, koda::NativeEncodeAsync));
+  exports.Set("decodeAsync", Napi::Function::New(env, koda::NativeDecodeAsync));
+  exports.Set("parseFile", Napi::Function::New(env, koda::NativeParseFile));
+  exports.Set("decodeFile", Napi::Function::New(env, koda::NativeDecodeFile));
+  exports.Set("hash", Napi::Function::New(env, koda::NativeHash));
+  exports.Set("hashBinary", Napi::Function::New(env, koda::NativeHashBinary));
+  exports.Set("loadFiles", Napi::Function::New(env, koda::NativeLoadFiles));
+  exports.Set("configurePool", Napi::Function::New(env, koda::NativeConfigurePool));
+  exports.Set("poolStats", Napi::Function::New(env, koda::NativePoolStats));
+  Napi::Function dictionary = koda::DictionaryHandle::Define(env);
+  Napi::Function lazy_node = koda::LazyNodeHandle::Define(env);
+  auto* data = new koda::AddonData();
+  data->dictionary = Napi::Persistent(dictionary);
+  data->lazy_node = Napi::Persistent(lazy_node);
+  Napi::Function cancel_token = koda::CancelTokenHandle::Define(env);
+  data->cancel_token = Napi::Persistent(cancel_token);
+  env.SetInstanceData(data);
+  // Documents this environment decoded for another thread and nobody adopted.
+  env.AddCleanupHook([data]() { koda::DocumentRegistry::shared().drop_owner(data); });
+  exports.Set("Dictionary", dictionary);
+  exports.Set("LazyNode", lazy_node);
+  exports.Set("CancelToken", cancel_token);
+  exports.Set("EncoderSession", koda::EncoderSessionHandle::Define(env));
+  exports.Set("DecoderSession", koda::DecoderSessionHandle::Define(env));
+  exports.Set("FrameEncoder", koda::FrameEncoderHandle::Define(env));
+  exports.Set("FrameDecoder", koda::FrameDecoderHandle::Define(env));
+  exports.Set("StreamEncoder", koda::StreamEncoderHandle::Define(env));
+  exports.Set("IncrementalDecoder", koda::IncrementalDecoderHandle::Define(env));
+  exports.Set("ParseCache", koda::ParseCacheHandle::Define(env));
+  exports.Set("SlicedDecoder", koda::SlicedDecoderHandle::Define(env));
   return exports;
 }
 
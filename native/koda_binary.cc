@@ -1,8 +1,17 @@
 #include "koda_binary.h"
 
 #include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <limits>
 #include <stdexcept>
 #include <set>
+#include <string_view>
+#include <unordered_map>
+
+#include "koda_pool.h"
 
 namespace koda {
 
@@ -15,6 +24,7 @@ void collect_keys(const Value& v, std::set<std::string>& out) {
     case Value::Type::Int:
     case Value::Type::Float:
     case Value::Type::String:
+    case Value::Type::Packed:
       break;
     case Value::Type::Array:
       for (const auto& el : v.arr) collect_keys(el, out);
@@ -28,11 +38,302 @@ void collect_keys(const Value& v, std::set<std::string>& out) {
   }
 }
 
+void count_strings(const Value& v, std::unordered_map<std::string_view, size_t>& out) {
+  switch (v.type) {
+    case Value::Type::String:
+      ++out[v.s];
+      break;
+    case Value::Type::Array:
+      for (const auto& el : v.arr) count_strings(el, out);
+      break;
+    case Value::Type::Object:
+      for (const auto& p : v.obj) count_strings(p.second, out);
+      break;
+    default:
+      break;
+  }
+}
+
+bool fits_float32(double d) {
+  if (std::isnan(d)) return false;
+  if (!std::isinf(d) && std::fabs(d) > std::numeric_limits<float>::max()) return false;
+  return static_cast<double>(static_cast<float>(d)) == d;
+}
+
+Value::Packed int_packed_type(int64_t lo, int64_t hi) {
+  if (lo >= INT8_MIN && hi <= INT8_MAX) return Value::Packed::Int8;
+  if (lo >= INT16_MIN && hi <= INT16_MAX) return Value::Packed::Int16;
+  if (lo >= INT32_MIN && hi <= INT32_MAX) return Value::Packed::Int32;
+  return Value::Packed::Int64;
+}
+
+// Elements of an array being encoded: a Value's arr, or one column of an
+// array of objects (SPEC §6.8).
+struct Items {
+  const Value* arr = nullptr;
+  const Value* const* column = nullptr;
+  size_t n = 0;
+
+  const Value& operator[](size_t i) const { return arr ? arr[i] : *column[i]; }
+};
+
+using Pair = std::pair<std::string, Value>;
+
+std::vector<const Pair*> sorted_pairs(const Value& obj) {
+  std::vector<const Pair*> out;
+  out.reserve(obj.obj.size());
+  for (const auto& p : obj.obj) out.push_back(&p);
+  std::sort(out.begin(), out.end(), [](const Pair* a, const Pair* b) { return a->first < b->first; });
+  return out;
+}
+
+// Canonical packed element type (SPEC §6.6): version 2, non-empty and all
+// Int, or all Float. Returns false when the array must use TAG_ARRAY.
+bool canonical_packed_type(const Items& items, uint8_t version, Value::Packed& out) {
+  if (version != VERSION_VARINT || items.n == 0) return false;
+  Value::Type first = items[0].type;
+  if (first == Value::Type::Int) {
+    int64_t lo = items[0].i, hi = lo;
+    for (size_t i = 0; i < items.n; ++i) {
+      const Value& el = items[i];
+      if (el.type != Value::Type::Int) return false;
+      lo = std::min(lo, el.i);
+      hi = std::max(hi, el.i);
+    }
+    out = int_packed_type(lo, hi);
+    return true;
+  }
+  if (first == Value::Type::Float) {
+    bool f32 = true;
+    for (size_t i = 0; i < items.n; ++i) {
+      const Value& el = items[i];
+      if (el.type != Value::Type::Float) return false;
+      if (f32 && !fits_float32(el.d)) f32 = false;
+    }
+    out = f32 ? Value::Packed::Float32 : Value::Packed::Float64;
+    return true;
+  }
+  return false;
+}
+
+Value::Packed canonical_packed_type(const Value& v) {
+  size_t n = v.packed_count();
+  if (Value::packed_is_float(v.packed_type)) {
+    for (size_t i = 0; i < n; ++i)
+      if (!fits_float32(v.packed_float(i))) return Value::Packed::Float64;
+    return Value::Packed::Float32;
+  }
+  int64_t lo = v.packed_int(0), hi = lo;
+  for (size_t i = 1; i < n; ++i) {
+    int64_t x = v.packed_int(i);
+    lo = std::min(lo, x);
+    hi = std::max(hi, x);
+  }
+  return int_packed_type(lo, hi);
+}
+
+// Columnar form (SPEC §6.8): version 2, at least two rows, all objects with
+// the same non-empty key set. On success `rows` holds each row's pairs in key
+// order.
+bool columnar_rows(const Items& items, uint8_t version, std::vector<std::vector<const Pair*>>& rows) {
+  if (version != VERSION_VARINT || items.n < 2) return false;
+  for (size_t i = 0; i < items.n; ++i)
+    if (items[i].type != Value::Type::Object || items[i].obj.size() != items[0].obj.size())
+      return false;
+  if (items[0].obj.empty()) return false;
+  rows.clear();
+  rows.reserve(items.n);
+  for (size_t i = 0; i < items.n; ++i) {
+    rows.push_back(sorted_pairs(items[i]));
+    if (i == 0) continue;
+    for (size_t k = 0; k < rows[i].size(); ++k)
+      if (rows[i][k]->first != rows[0][k]->first) return false;
+  }
+  return true;
+}
+
+uint8_t packed_tag(Value::Packed t) {
+  switch (t) {
+    case Value::Packed::Int8: return TAG_PACKED_INT8;
+    case Value::Packed::Int16: return TAG_PACKED_INT16;
+    case Value::Packed::Int32: return TAG_PACKED_INT32;
+    case Value::Packed::Int64: return TAG_PACKED_INT64;
+    case Value::Packed::Float32: return TAG_PACKED_FLOAT32;
+    case Value::Packed::Float64: return TAG_PACKED_FLOAT64;
+  }
+  return TAG_PACKED_INT64;
+}
+
+bool is_shareable(const Value& v) {
+  return (v.type == Value::Type::Array && !v.arr.empty()) ||
+         (v.type == Value::Type::Object && !v.obj.empty()) ||
+         (v.type == Value::Type::Packed && !v.packed.empty());
+}
+
+uint64_t mix(uint64_t h, uint64_t x) {
+  h ^= x + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+  return h;
+}
+
+// Hash-consing of subtrees for dedupe (SPEC §6.10). Subtrees that would
+// encode to the same bytes share one class id: objects compare in key order,
+// and a Packed value equals the Array of the same Int/Float elements.
+class SubtreeClasses {
+ public:
+  size_t class_of(const Value& v) {
+    uint64_t h = hash(v);
+    auto range = classes_.equal_range(h);
+    for (auto it = range.first; it != range.second; ++it)
+      if (same(*it->second.first, v)) return it->second.second;
+    size_t id = count_.size();
+    classes_.emplace(h, std::make_pair(&v, id));
+    count_.push_back(0);
+    return id;
+  }
+  size_t& count(size_t id) { return count_[id]; }
+  size_t size() const { return count_.size(); }
+
+ private:
+  static size_t seq_size(const Value& v) {
+    return v.type == Value::Type::Packed ? v.packed_count() : v.arr.size();
+  }
+  static uint64_t scalar_hash(const Value& v) {
+    switch (v.type) {
+      case Value::Type::Null: return 1;
+      case Value::Type::Bool: return v.b ? 3 : 2;
+      case Value::Type::Int: return mix(4, static_cast<uint64_t>(v.i));
+      case Value::Type::Float: {
+        uint64_t u;
+        memcpy(&u, &v.d, 8);
+        return mix(5, u);
+      }
+      case Value::Type::String: return mix(6, std::hash<std::string_view>()(v.s));
+      default: return 0;
+    }
+  }
+  static bool same_scalar(const Value& a, const Value& b) {
+    if (a.type != b.type) return false;
+    switch (a.type) {
+      case Value::Type::Bool: return a.b == b.b;
+      case Value::Type::Int: return a.i == b.i;
+      case Value::Type::Float: return memcmp(&a.d, &b.d, 8) == 0;
+      case Value::Type::String: return a.s == b.s;
+      default: return true;
+    }
+  }
+
+  uint64_t hash(const Value& v) {
+    if (v.type != Value::Type::Array && v.type != Value::Type::Object &&
+        v.type != Value::Type::Packed)
+      return scalar_hash(v);
+    auto it = hashes_.find(&v);
+    if (it != hashes_.end()) return it->second;
+    uint64_t h;
+    if (v.type == Value::Type::Object) {
+      h = mix(0x11, v.obj.size());
+      for (const Pair* p : sorted_pairs(v))
+        h = mix(mix(h, std::hash<std::string>()(p->first)), hash(p->second));
+    } else {
+      size_t n = seq_size(v);
+      h = mix(0x10, n);
+      for (size_t i = 0; i < n; ++i)
+        h = mix(h, v.type == Value::Type::Packed ? scalar_hash(v.packed_at(i)) : hash(v.arr[i]));
+    }
+    hashes_.emplace(&v, h);
+    return h;
+  }
+
+  static bool same(const Value& a, const Value& b) {
+    if (&a == &b) return true;
+    bool a_seq = a.type == Value::Type::Array || a.type == Value::Type::Packed;
+    bool b_seq = b.type == Value::Type::Array || b.type == Value::Type::Packed;
+    if (a_seq || b_seq) {
+      if (!a_seq || !b_seq || seq_size(a) != seq_size(b)) return false;
+      for (size_t i = 0, n = seq_size(a); i < n; ++i) {
+        bool ok = a.type == Value::Type::Array && b.type == Value::Type::Array
+                      ? same(a.arr[i], b.arr[i])
+                  : a.type == Value::Type::Array ? same(a.arr[i], b.packed_at(i))
+                  : b.type == Value::Type::Array ? same(a.packed_at(i), b.arr[i])
+                                                 : same_scalar(a.packed_at(i), b.packed_at(i));
+        if (!ok) return false;
+      }
+      return true;
+    }
+    if (a.type == Value::Type::Object || b.type == Value::Type::Object) {
+      if (a.type != b.type || a.obj.size() != b.obj.size()) return false;
+      std::vector<const Pair*> pa = sorted_pairs(a), pb = sorted_pairs(b);
+      for (size_t i = 0; i < pa.size(); ++i)
+        if (pa[i]->first != pb[i]->first || !same(pa[i]->second, pb[i]->second)) return false;
+      return true;
+    }
+    return same_scalar(a, b);
+  }
+
+  std::unordered_map<const Value*, uint64_t> hashes_;
+  std::unordered_multimap<uint64_t, std::pair<const Value*, size_t>> classes_;
+  std::vector<size_t> count_;
+};
+
+// Count how often each subtree is written, following the encoder's layout:
+// packed arrays have no child values and columnar rows are not values
+// themselves. Repeats are not descended into, since they become references.
+void count_subtrees(const Value& v, uint8_t version, SubtreeClasses& classes);
+
+void count_items(const Items& items, uint8_t version, SubtreeClasses& classes) {
+  Value::Packed t;
+  std::vector<std::vector<const Pair*>> rows;
+  if (canonical_packed_type(items, version, t)) return;
+  if (columnar_rows(items, version, rows)) {
+    std::vector<const Value*> column(items.n);
+    for (size_t k = 0; k < rows[0].size(); ++k) {
+      for (size_t r = 0; r < items.n; ++r) column[r] = &rows[r][k]->second;
+      Items col;
+      col.column = column.data();
+      col.n = items.n;
+      count_items(col, version, classes);
+    }
+    return;
+  }
+  for (size_t i = 0; i < items.n; ++i) count_subtrees(items[i], version, classes);
+}
+
+void count_subtrees(const Value& v, uint8_t version, SubtreeClasses& classes) {
+  if (!is_shareable(v)) return;
+  if (++classes.count(classes.class_of(v)) > 1) return;
+  if (v.type == Value::Type::Object) {
+    for (const auto& p : v.obj) count_subtrees(p.second, version, classes);
+    return;
+  }
+  if (v.type == Value::Type::Packed) return;
+  Items items;
+  items.arr = v.arr.data();
+  items.n = v.arr.size();
+  count_items(items, version, classes);
+}
+
 struct Encoder {
   std::vector<uint8_t> buf;
   size_t max_depth;
+  uint8_t version = VERSION;
   std::vector<std::string> dictionary;
   std::map<std::string, size_t> key_to_index;
+  std::unordered_map<std::string_view, size_t> string_to_index;
+  SubtreeClasses* subtrees = nullptr;  // set when deduplicating
+  std::vector<int64_t> shared_id;      // per subtree class; -1 until defined
+  size_t next_shared = 0;
+  CancelPoll poll;                     // checked against bytes written
+  const ByteSink* sink = nullptr;      // if set, buf is handed to it as it fills
+  size_t flushed = 0;                  // bytes already handed to sink
+
+  // Bytes buffered before they go to the sink.
+  static constexpr size_t kSinkChunk = size_t(1) << 16;
+
+  void flush() {
+    if (buf.empty()) return;
+    (*sink)(buf.data(), buf.size());
+    flushed += buf.size();
+    buf.clear();
+  }
 
   void u8(uint8_t x) { buf.push_back(x); }
   void u32_be(uint32_t x) {
@@ -44,6 +345,29 @@ struct Encoder {
   void i64_be(int64_t x) {
     for (int i = 7; i >= 0; --i) buf.push_back((x >> (i * 8)) & 0xFF);
   }
+  void uvarint(uint64_t x) {
+    while (x >= 0x80) {
+      buf.push_back(static_cast<uint8_t>(x | 0x80));
+      x >>= 7;
+    }
+    buf.push_back(static_cast<uint8_t>(x));
+  }
+  // Length, count or key index: 4 bytes in v1, LEB128 in v2.
+  void len(size_t x) {
+    if (version == VERSION) u32_be(static_cast<uint32_t>(x));
+    else uvarint(x);
+  }
+  void integer(int64_t x) {
+    if (version == VERSION) {
+      u8(TAG_INTEGER);
+      i64_be(x);
+    } else if (x >= 0 && x <= SMALL_INT_MAX) {
+      u8(static_cast<uint8_t>(TAG_SMALL_INT + x));
+    } else {
+      u8(TAG_INTEGER);
+      uvarint((static_cast<uint64_t>(x) << 1) ^ static_cast<uint64_t>(x >> 63));
+    }
+  }
   void f64_be(double x) {
     uint64_t u;
     memcpy(&u, &x, 8);
@@ -52,9 +376,85 @@ struct Encoder {
   void bytes(const uint8_t* p, size_t n) {
     for (size_t i = 0; i < n; ++i) buf.push_back(p[i]);
   }
+  void uint_be(uint64_t x, size_t width) {
+    for (size_t i = width; i-- > 0;) buf.push_back((x >> (i * 8)) & 0xFF);
+  }
+
+  void packed_element(int64_t i, double d, Value::Packed t) {
+    if (t == Value::Packed::Float32) {
+      float f = static_cast<float>(d);
+      uint32_t u;
+      memcpy(&u, &f, 4);
+      uint_be(u, 4);
+    } else if (t == Value::Packed::Float64) {
+      uint64_t u;
+      memcpy(&u, &d, 8);
+      uint_be(u, 8);
+    } else {
+      uint_be(static_cast<uint64_t>(i), Value::packed_width(t));
+    }
+  }
+
+  // Array of n elements; the count is omitted for columns, whose length is
+  // the enclosing row count.
+  void encode_items(const Items& items, size_t depth, bool with_count) {
+    Value::Packed t;
+    std::vector<std::vector<const Pair*>> rows;
+    if (canonical_packed_type(items, version, t)) {
+      u8(packed_tag(t));
+      if (with_count) len(items.n);
+      buf.reserve(buf.size() + items.n * Value::packed_width(t));
+      for (size_t i = 0; i < items.n; ++i) packed_element(items[i].i, items[i].d, t);
+    } else if (columnar_rows(items, version, rows)) {
+      u8(TAG_COLUMNS);
+      if (with_count) len(items.n);
+      len(rows[0].size());
+      for (const Pair* p : rows[0]) len(key_index(p->first));
+      std::vector<const Value*> column(items.n);
+      for (size_t k = 0; k < rows[0].size(); ++k) {
+        for (size_t r = 0; r < items.n; ++r) column[r] = &rows[r][k]->second;
+        Items col;
+        col.column = column.data();
+        col.n = items.n;
+        encode_items(col, depth + 1, false);
+      }
+    } else {
+      u8(TAG_ARRAY);
+      if (with_count) len(items.n);
+      for (size_t i = 0; i < items.n; ++i) encode_value(items[i], depth + 1);
+    }
+  }
+
+  size_t key_index(const std::string& key) const {
+    auto it = key_to_index.find(key);
+    if (it == key_to_index.end()) throw std::runtime_error("Key not in dictionary");
+    return it->second;
+  }
 
   void encode_value(const Value& v, size_t depth) {
     if (depth > max_depth) throw std::runtime_error("Maximum nesting depth exceeded");
+    poll.at(flushed + buf.size());
+    if (sink && buf.size() >= kSinkChunk) flush();
+    if (subtrees && is_shareable(v)) {
+      size_t id = subtrees->class_of(v);
+      if (subtrees->count(id) > 1) {
+        if (shared_id[id] >= 0) {
+          u8(TAG_SHARED_REF);
+          len(static_cast<size_t>(shared_id[id]));
+          return;
+        }
+        // Ids are assigned when the definition ends, so a reference can only
+        // point at a completed subtree.
+        u8(TAG_SHARED_DEF);
+        encode_body(v, depth);
+        shared_id[id] = static_cast<int64_t>(next_shared++);
+        return;
+      }
+    }
+    encode_body(v, depth);
+  }
+
+  void encode_body(const Value& v, size_t depth) {
     switch (v.type) {
       case Value::Type::Null:
         u8(TAG_NULL);
@@ -63,34 +463,58 @@ struct Encoder {
         u8(v.b ? TAG_TRUE : TAG_FALSE);
         break;
       case Value::Type::Int:
-        u8(TAG_INTEGER);
-        i64_be(v.i);
+        integer(v.i);
         break;
       case Value::Type::Float:
         u8(TAG_FLOAT);
         f64_be(v.d);
         break;
-      case Value::Type::String:
+      case Value::Type::String: {
+        if (!string_to_index.empty()) {
+          auto it = string_to_index.find(v.s);
+          if (it != string_to_index.end()) {
+            u8(TAG_STRING_REF);
+            len(it->second);
+            break;
+          }
+        }
         u8(TAG_STRING);
-        u32_be(static_cast<uint32_t>(v.s.size()));
+        len(v.s.size());
         bytes(reinterpret_cast<const uint8_t*>(v.s.data()), v.s.size());
         break;
-      case Value::Type::Array:
-        u8(TAG_ARRAY);
-        u32_be(static_cast<uint32_t>(v.arr.size()));
-        for (const auto& el : v.arr) encode_value(el, depth + 1);
+      }
+      case Value::Type::Array: {
+        Items items;
+        items.arr = v.arr.data();
+        items.n = v.arr.size();
+        encode_items(items, depth, true);
+        break;
+      }
+      case Value::Type::Packed: {
+        size_t n = v.packed_count();
+        // Version 1 has no packed tags: the elements are written one by one.
+        if (n == 0 || version != VERSION_VARINT) {
+          u8(TAG_ARRAY);
+          len(n);
+          for (size_t i = 0; i < n; ++i) encode_value(v.packed_at(i), depth + 1);
+          break;
+        }
+        Value::Packed t = canonical_packed_type(v);
+        u8(packed_tag(t));
+        len(n);
+        buf.reserve(buf.size() + n * Value::packed_width(t));
+        bool is_float = Value::packed_is_float(v.packed_type);
+        for (size_t i = 0; i < n; ++i)
+          packed_element(is_float ? 0 : v.packed_int(i), is_float ? v.packed_float(i) : 0, t);
         break;
+      }
       case Value::Type::Object: {
         u8(TAG_OBJECT);
-        std::vector<std::pair<std::string, Value>> sorted = v.obj;
-        std::sort(sorted.begin(), sorted.end(),
-                  [](const auto& a, const auto& b) { return a.first < b.first; });
-        u32_be(static_cast<uint32_t>(sorted.size()));
-        for (const auto& p : sorted) {
-          auto it = key_to_index.find(p.first);
-          if (it == key_to_index.end()) throw std::runtime_error("Key not in dictionary");
-          u32_be(static_cast<uint32_t>(it->second));
-          encode_value(p.second, depth + 1);
+        std::vector<const Pair*> sorted = sorted_pairs(v);
+        len(sorted.size());
+        for (const Pair* p : sorted) {
+          len(key_index(p->first));
+          encode_value(p->second, depth + 1);
         }
         break;
       }
@@ -100,31 +524,272 @@ struct Encoder {
 
 }  // namespace
 
+Dictionary make_dictionary(std::vector<std::string> keys) {
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  // FNV-1a 64 over each key's 4-byte big-endian length and UTF-8 bytes.
+  uint64_t h = 0xcbf29ce484222325ULL;
+  auto feed = [&h](uint8_t b) {
+    h ^= b;
+    h *= 0x100000001b3ULL;
+  };
+  for (const auto& k : keys) {
+    uint32_t n = static_cast<uint32_t>(k.size());
+    for (int i = 3; i >= 0; --i) feed(static_cast<uint8_t>(n >> (i * 8)));
+    for (char c : k) feed(static_cast<uint8_t>(c));
+  }
+  Dictionary dict;
+  dict.keys = std::move(keys);
+  dict.id = h;
+  return dict;
+}
+
 std::vector<uint8_t> encode(const Value& value, size_t max_depth) {
-  std::set<std::string> keys_set;
-  collect_keys(value, keys_set);
+  EncodeOptions options;
+  options.max_depth = max_depth;
+  return encode(value, options);
+}
+
+namespace {
+
+// Keys in `base` (sorted) are already known to the decoder, from an external
+// dictionary or an earlier session frame: only the others are written, and key
+// indices refer to the sorted union, which is stored in `keys_out` if given.
+// Sets up `enc` for the document's keys and writes the header up to the key
+// dictionary.
+void begin_document(Encoder& enc, std::set<std::string> keys_set, const EncodeOptions& options,
+                    uint8_t flags, const std::vector<std::string>* base) {
+  std::vector<std::string> inline_keys;
+  if (base) {
+    for (const auto& k : keys_set)
+      if (!std::binary_search(base->begin(), base->end(), k)) inline_keys.push_back(k);
+    keys_set.insert(base->begin(), base->end());
+  }
   std::vector<std::string> dictionary(keys_set.begin(), keys_set.end());
   std::map<std::string, size_t> key_to_index;
   for (size_t i = 0; i < dictionary.size(); ++i) key_to_index[dictionary[i]] = i;
 
-  Encoder enc;
-  enc.max_depth = max_depth;
+  enc.max_depth = options.max_depth;
+  enc.version = options.version;
+  enc.poll = CancelPoll(options.cancel);
   enc.dictionary = std::move(dictionary);
   enc.key_to_index = std::move(key_to_index);
 
   enc.bytes(MAGIC, 4);
-  enc.u8(VERSION);
-  enc.u32_be(static_cast<uint32_t>(enc.dictionary.size()));
-  for (const auto& k : enc.dictionary) {
-    enc.u32_be(static_cast<uint32_t>(k.size()));
+  enc.u8(enc.version | flags);
+  if (flags & FLAG_EXTERNAL_DICT) enc.uint_be(options.dictionary->id, 8);
+  if (flags & FLAG_SESSION) enc.len(base->size());
+  const std::vector<std::string>& header_keys = base ? inline_keys : enc.dictionary;
+  enc.len(header_keys.size());
+  for (const auto& k : header_keys) {
+    enc.len(k.size());
     enc.bytes(reinterpret_cast<const uint8_t*>(k.data()), k.size());
   }
-  enc.encode_value(value, 0);
-  return enc.buf;
+}
+
+// Fewest root array elements per thread worth splitting an encode for.
+constexpr size_t kMinSlice = 4096;
+
+// Threads to encode `value` with: its root array is cut into this many
+// slices of elements. 1 when it is encoded serially, which is always the
+// case with dedupe, since subtree ids follow document order.
+size_t encode_parts(const Value& value, const EncodeOptions& options) {
+  if (options.threads <= 1 || options.dedupe || value.type != Value::Type::Array) return 1;
+  return std::max<size_t>(1, std::min<size_t>(options.threads, value.arr.size() / kMinSlice));
+}
+
+// Elements [first, end) of slice `s` of `parts`.
+std::pair<size_t, size_t> slice(size_t n, size_t s, size_t parts) {
+  return {n * s / parts, n * (s + 1) / parts};
+}
+
+// collect_keys and count_strings over slices of the root array in parallel,
+// merged into `keys` and `counts`.
+void collect_split(const Value& value, size_t parts, bool strings, std::set<std::string>& keys,
+                   std::unordered_map<std::string_view, size_t>& counts) {
+  std::vector<std::set<std::string>> slice_keys(parts);
+  std::vector<std::unordered_map<std::string_view, size_t>> slice_counts(parts);
+  ThreadPool::shared().parallel_for(parts, [&](size_t s) {
+    auto range = slice(value.arr.size(), s, parts);
+    for (size_t i = range.first; i < range.second; ++i) {
+      collect_keys(value.arr[i], slice_keys[s]);
+      if (strings) count_strings(value.arr[i], slice_counts[s]);
+    }
+  });
+  for (auto& k : slice_keys) keys.merge(k);
+  for (const auto& c : slice_counts)
+    for (const auto& e : c) counts[e.first] += e.second;
+}
+
+// Root array body, encoded in slices on their own threads with the
+// document's key and string indices, then appended in order. A columnar
+// root is split between its columns instead; a packed one is written
+// serially.
+void encode_split(Encoder& enc, const Value& value, size_t parts) {
+  Items items;
+  items.arr = value.arr.data();
+  items.n = value.arr.size();
+  Value::Packed t;
+  std::vector<std::vector<const Pair*>> rows;
+  if (canonical_packed_type(items, enc.version, t)) {
+    enc.encode_value(value, 0);
+    return;
+  }
+  bool columns = columnar_rows(items, enc.version, rows);
+  enc.u8(columns ? TAG_COLUMNS : TAG_ARRAY);
+  enc.len(items.n);
+  if (columns) {
+    enc.len(rows[0].size());
+    for (const Pair* p : rows[0]) enc.len(enc.key_index(p->first));
+    parts = std::min(parts, rows[0].size());
+  }
+  std::vector<Encoder> slices(parts);
+  for (auto& w : slices) {
+    w.max_depth = enc.max_depth;
+    w.version = enc.version;
+    w.key_to_index = enc.key_to_index;
+    w.string_to_index = enc.string_to_index;
+    w.poll = enc.poll;
+  }
+  ThreadPool::shared().parallel_for(parts, [&](size_t s) {
+    Encoder& w = slices[s];
+    if (!columns) {
+      auto range = slice(items.n, s, parts);
+      for (size_t i = range.first; i < range.second; ++i) w.encode_value(items[i], 1);
+      return;
+    }
+    auto range = slice(rows[0].size(), s, parts);
+    std::vector<const Value*> column(items.n);
+    for (size_t k = range.first; k < range.second; ++k) {
+      for (size_t r = 0; r < items.n; ++r) column[r] = &rows[r][k]->second;
+      Items col;
+      col.column = column.data();
+      col.n = items.n;
+      w.encode_items(col, 1, false);
+    }
+  });
+  // With a sink, each slice is handed over as it is rather than appended.
+  if (enc.sink) {
+    enc.flush();
+    for (auto& w : slices) {
+      enc.buf.swap(w.buf);
+      enc.flush();
+    }
+    return;
+  }
+  size_t total = enc.buf.size();
+  for (const auto& w : slices) total += w.buf.size();
+  enc.buf.reserve(total);
+  for (const auto& w : slices) enc.buf.insert(enc.buf.end(), w.buf.begin(), w.buf.end());
+}
+
+std::vector<uint8_t> encode_document(const Value& value, const EncodeOptions& options,
+                                     uint8_t flags, const std::vector<std::string>* base,
+                                     std::vector<std::string>* keys_out, const ByteSink* sink = nullptr) {
+  if (options.version != VERSION && options.version != VERSION_VARINT)
+    throw std::runtime_error("Unsupported version");
+  size_t parts = encode_parts(value, options);
+  std::set<std::string> keys_set;
+  std::unordered_map<std::string_view, size_t> counts;
+  if (parts > 1) {
+    collect_split(value, parts, options.string_table, keys_set, counts);
+  } else {
+    collect_keys(value, keys_set);
+    if (options.string_table) count_strings(value, counts);
+  }
+  Encoder enc;
+  enc.sink = sink;
+  begin_document(enc, std::move(keys_set), options, flags, base);
+  if (options.string_table) {
+    // Canonical table: every string value that occurs more than once, sorted.
+    std::vector<std::string_view> table;
+    for (const auto& c : counts)
+      if (c.second > 1) table.push_back(c.first);
+    if (!table.empty()) {
+      std::sort(table.begin(), table.end());
+      enc.u8(TAG_STRING_TABLE);
+      enc.len(table.size());
+      for (size_t i = 0; i < table.size(); ++i) {
+        enc.len(table[i].size());
+        enc.bytes(reinterpret_cast<const uint8_t*>(table[i].data()), table[i].size());
+        enc.string_to_index[table[i]] = i;
+      }
+    }
+  }
+  SubtreeClasses subtrees;
+  if (options.dedupe) {
+    count_subtrees(value, options.version, subtrees);
+    enc.subtrees = &subtrees;
+    enc.shared_id.assign(subtrees.size(), -1);
+  }
+  if (parts > 1)
+    encode_split(enc, value, parts);
+  else
+    enc.encode_value(value, 0);
+  if (keys_out) *keys_out = std::move(enc.dictionary);
+  if (sink) {
+    enc.flush();
+    return {};
+  }
+  return std::move(enc.buf);
+}
+
+}  // namespace
+
+std::vector<uint8_t> encode(const Value& value, const EncodeOptions& options) {
+  if (options.dictionary)
+    return encode_document(value, options, FLAG_EXTERNAL_DICT, &options.dictionary->keys, nullptr);
+  return encode_document(value, options, 0, nullptr, nullptr);
+}
+
+void encode(const Value& value, const EncodeOptions& options, const ByteSink& sink) {
+  if (options.dictionary)
+    encode_document(value, options, FLAG_EXTERNAL_DICT, &options.dictionary->keys, nullptr, &sink);
+  else
+    encode_document(value, options, 0, nullptr, nullptr, &sink);
+}
+
+EncoderSession::EncoderSession(const EncodeOptions& options) : options_(options) {
+  if (options_.dictionary) keys_ = options_.dictionary->keys;
+  options_.dictionary = nullptr;
+}
+
+std::vector<uint8_t> EncoderSession::encode(const Value& value) {
+  std::vector<std::string> keys;
+  std::vector<uint8_t> out = encode_document(value, options_, FLAG_SESSION, &keys_, &keys);
+  keys_ = std::move(keys);
+  return out;
+}
+
+size_t packed_tag_width(uint8_t tag, uint8_t version) {
+  if (version != VERSION_VARINT) return 0;
+  switch (tag) {
+    case TAG_PACKED_INT8: return 1;
+    case TAG_PACKED_INT16: return 2;
+    case TAG_PACKED_INT32: return 4;
+    case TAG_PACKED_INT64: return 8;
+    case TAG_PACKED_FLOAT32: return 4;
+    case TAG_PACKED_FLOAT64: return 8;
+    default: return 0;
+  }
 }
 
 namespace {
 
+constexpr size_t kNone = std::numeric_limits<size_t>::max();
+
+Value::Packed packed_tag_type(uint8_t tag) {
+  switch (tag) {
+    case TAG_PACKED_INT8: return Value::Packed::Int8;
+    case TAG_PACKED_INT16: return Value::Packed::Int16;
+    case TAG_PACKED_INT32: return Value::Packed::Int32;
+    case TAG_PACKED_FLOAT32: return Value::Packed::Float32;
+    case TAG_PACKED_FLOAT64: return Value::Packed::Float64;
+    default: return Value::Packed::Int64;
+  }
+}
+
+
 struct Decoder {
   const uint8_t* data;
   size_t size;
@@ -132,10 +797,22 @@ struct Decoder {
   size_t max_depth;
   size_t max_dict;
   size_t max_str;
-  std::vector<std::string> dictionary;
+  // Version, inline keys, string table and shared-subtree accounting.
+  DocumentState* doc = nullptr;
+  // Key index space: doc->keys, or a caller's base dictionary when the
+  // document adds no keys to it.
+  const std::vector<std::string>* keys = nullptr;
+  // Shared subtrees in definition order. With `placeholders`, definitions and
+  // references decode to empty Values carrying `ref` instead of copies.
+  std::vector<Value>* shared = nullptr;
+  bool placeholders = false;
+  // Column keys must ascend. Off only for StreamEncoder's spill file, whose
+  // provisional ids follow first use rather than key order.
+  bool sorted_columns = true;
+  CancelPoll poll;  // checked against offset
 
   void ensure(size_t n) {
-    if (offset + n > size) throw std::runtime_error("Truncated input");
+    if (offset + n > size) throw TruncatedInput();
   }
   uint8_t u8() {
     ensure(1);
@@ -159,6 +836,27 @@ struct Decoder {
     memcpy(&x, &u, 8);
     return x;
   }
+  // LEB128; rejects overlong encodings and values wider than `bits`.
+  uint64_t uvarint(unsigned bits) {
+    uint64_t x = 0;
+    for (unsigned shift = 0;; shift += 7) {
+      uint8_t b = u8();
+      if (shift >= bits || (shift > 0 && b == 0) ||
+          (bits - shift < 7 && (b & 0x7F) >> (bits - shift)))
+        throw std::runtime_error("Malformed varint");
+      x |= static_cast<uint64_t>(b & 0x7F) << shift;
+      if (!(b & 0x80)) return x;
+    }
+  }
+  uint32_t len() {
+    if (doc->version == VERSION) return u32_be();
+    return static_cast<uint32_t>(uvarint(32));
+  }
+  int64_t integer() {
+    if (doc->version == VERSION) return i64_be();
+    uint64_t z = uvarint(64);
+    return static_cast<int64_t>((z >> 1) ^ (~(z & 1) + 1));
+  }
   double f64_be() {
     ensure(8);
     uint64_t u = 0;
@@ -169,10 +867,117 @@ struct Decoder {
     return x;
   }
 
+  // Values materialized through references when copying, to bound the
+  // expansion of nested references.
+  static constexpr size_t kMaxSharedExpansion = size_t(1) << 26;
+
+  static size_t node_count(const Value& v) {
+    size_t n = 1;
+    for (const auto& el : v.arr) n += node_count(el);
+    for (const auto& p : v.obj) n += node_count(p.second);
+    return n;
+  }
+
+  static Value placeholder(Value::Type type, size_t idx) {
+    Value v;
+    v.type = type;
+    v.ref = static_cast<int32_t>(idx);
+    return v;
+  }
+
+  Value define_shared(Value v) {
+    size_t idx = shared->size();
+    if (idx >= INT32_MAX) throw std::runtime_error("Too many shared subtrees");
+    if (placeholders) {
+      Value::Type type = v.type;
+      shared->push_back(std::move(v));
+      return placeholder(type, idx);
+    }
+    doc->shared_nodes.push_back(node_count(v));
+    shared->push_back(v);
+    return v;
+  }
+
+  // Packed payload: big-endian elements byte-swapped into host order.
+  Value decode_packed(Value::Packed t, uint32_t n) {
+    size_t w = Value::packed_width(t);
+    if (n > (size - offset) / w) throw TruncatedInput();
+    std::vector<uint8_t> out(static_cast<size_t>(n) * w);
+    for (size_t i = 0; i < n; ++i) {
+      uint64_t u = 0;
+      for (size_t b = 0; b < w; ++b) u = (u << 8) | data[offset + b];
+      offset += w;
+      uint8_t* dst = out.data() + i * w;
+      switch (w) {
+        case 1: { uint8_t x = static_cast<uint8_t>(u); memcpy(dst, &x, 1); break; }
+        case 2: { uint16_t x = static_cast<uint16_t>(u); memcpy(dst, &x, 2); break; }
+        case 4: { uint32_t x = static_cast<uint32_t>(u); memcpy(dst, &x, 4); break; }
+        default: memcpy(dst, &u, 8); break;
+      }
+    }
+    return Value::packed_val(t, std::move(out));
+  }
+
+  // Array body of n elements after its tag (and count, when it has one).
+  Value decode_items(uint8_t tag, uint32_t n, size_t depth) {
+    if (packed_tag_width(tag, doc->version)) return decode_packed(packed_tag_type(tag), n);
+    switch (tag) {
+      case TAG_ARRAY: {
+        Value v;
+        v.type = Value::Type::Array;
+        if (n > size - offset) throw TruncatedInput();
+        v.arr.reserve(n);
+        for (uint32_t i = 0; i < n; ++i) v.arr.push_back(decode_value(depth + 1));
+        return v;
+      }
+      case TAG_COLUMNS:
+        // Columnar arrays are version 2 only (SPEC §6.8).
+        if (doc->version == VERSION_VARINT) return decode_columns(n, depth);
+        throw std::runtime_error("Invalid column tag");
+      default:
+        throw std::runtime_error("Invalid column tag");
+    }
+  }
+
+  // Columnar array (SPEC §6.8): key indices, then one count-less array per
+  // column; rows are rebuilt as objects.
+  Value decode_columns(uint32_t rows, size_t depth) {
+    if (depth + 1 > max_depth) throw std::runtime_error("Maximum nesting depth exceeded");
+    uint32_t k = len();
+    if (k == 0) throw std::runtime_error("Invalid column keys");
+    // Every column element takes at least one byte.
+    if (k > size - offset || rows > size - offset) throw TruncatedInput();
+    std::vector<uint32_t> keys(k);
+    for (uint32_t c = 0; c < k; ++c) {
+      keys[c] = len();
+      if (keys[c] >= this->keys->size()) throw std::runtime_error("Invalid key index");
+      if (sorted_columns && c > 0 && keys[c] <= keys[c - 1])
+        throw std::runtime_error("Invalid column keys");
+    }
+    Value v;
+    v.type = Value::Type::Array;
+    v.arr.resize(rows);
+    for (auto& row : v.arr) {
+      row.type = Value::Type::Object;
+      row.obj.reserve(k);
+    }
+    for (uint32_t c = 0; c < k; ++c) {
+      Value col = decode_items(u8(), rows, depth + 1);
+      const std::string& key = (*this->keys)[keys[c]];
+      for (uint32_t r = 0; r < rows; ++r)
+        v.arr[r].obj.emplace_back(key, col.type == Value::Type::Packed ? col.packed_at(r)
+                                                                       : std::move(col.arr[r]));
+    }
+    return v;
+  }
+
   Value decode_value(size_t depth) {
     if (depth > max_depth) throw std::runtime_error("Maximum nesting depth exceeded");
+    poll.at(offset);
     ensure(1);
     uint8_t tag = u8();
+    if (doc->version == VERSION_VARINT && tag >= TAG_SMALL_INT && tag <= TAG_SMALL_INT + SMALL_INT_MAX)
+      return Value::int_val(tag - TAG_SMALL_INT);
     switch (tag) {
       case TAG_NULL:
         return Value::null_val();
@@ -181,40 +986,170 @@ struct Decoder {
       case TAG_TRUE:
         return Value::bool_val(true);
       case TAG_INTEGER:
-        return Value::int_val(i64_be());
+        return Value::int_val(integer());
       case TAG_FLOAT:
         return Value::float_val(f64_be());
       case TAG_STRING: {
-        uint32_t len = u32_be();
-        if (len > max_str) throw std::runtime_error("String too long");
-        ensure(len);
-        std::string s(reinterpret_cast<const char*>(data + offset), len);
-        offset += len;
+        uint32_t n = len();
+        if (n > max_str) throw std::runtime_error("String too long");
+        ensure(n);
+        std::string s(reinterpret_cast<const char*>(data + offset), n);
+        offset += n;
         return Value::string_val(std::move(s));
       }
-      case TAG_BINARY:
-        throw std::runtime_error("Binary type not supported");
-      case TAG_ARRAY: {
-        Value v;
-        v.type = Value::Type::Array;
-        uint32_t n = u32_be();
-        v.arr.reserve(n);
-        for (uint32_t i = 0; i < n; ++i) v.arr.push_back(decode_value(depth + 1));
+      case TAG_STRING_REF: {
+        uint32_t idx = len();
+        if (idx >= doc->strings.size()) throw std::runtime_error("Invalid string reference");
+        Value v = Value::string_val(doc->strings[idx]);
+        v.ref = static_cast<int32_t>(idx);
         return v;
       }
+      case TAG_SHARED_DEF: {
+        ensure(1);
+        if (data[offset] == TAG_SHARED_DEF || data[offset] == TAG_SHARED_REF)
+          throw std::runtime_error("Invalid shared subtree");
+        Value v = decode_value(depth);
+        if (!is_shareable(v)) throw std::runtime_error("Invalid shared subtree");
+        return define_shared(std::move(v));
+      }
+      case TAG_SHARED_REF: {
+        uint32_t idx = len();
+        if (idx >= shared->size()) throw std::runtime_error("Invalid shared reference");
+        if (placeholders) return placeholder((*shared)[idx].type, idx);
+        doc->expanded_nodes += doc->shared_nodes[idx];
+        if (doc->expanded_nodes > kMaxSharedExpansion)
+          throw std::runtime_error("Shared subtree expansion limit exceeded");
+        return (*shared)[idx];
+      }
+      case TAG_BINARY:
+        throw std::runtime_error("Binary type not supported");
+      case TAG_ARRAY:
+        return decode_items(tag, len(), depth);
+      case TAG_COLUMNS:
+        if (doc->version != VERSION_VARINT) throw std::runtime_error("Unknown type tag");
+        return decode_items(tag, len(), depth);
       case TAG_OBJECT: {
         Value v;
         v.type = Value::Type::Object;
-        uint32_t n = u32_be();
+        uint32_t n = len();
         for (uint32_t i = 0; i < n; ++i) {
-          uint32_t idx = u32_be();
-          if (idx >= dictionary.size()) throw std::runtime_error("Invalid key index");
-          v.obj.emplace_back(dictionary[idx], decode_value(depth + 1));
+          uint32_t idx = len();
+          if (idx >= keys->size()) throw std::runtime_error("Invalid key index");
+          v.obj.emplace_back((*keys)[idx], decode_value(depth + 1));
         }
         return v;
       }
       default:
-        throw std::runtime_error("Unknown type tag");
+        if (!packed_tag_width(tag, doc->version)) throw std::runtime_error("Unknown type tag");
+        return decode_items(tag, len(), depth);
+    }
+  }
+
+  // --- Skipping: moves past a value without building it, checking only what
+  // the walk itself depends on (tags, lengths, key indices, depth).
+
+  struct Span {
+    size_t start;  // offset of the value
+    size_t end;
+  };
+
+  // Shared definitions are appended to `defs`, when given, in id order.
+  void skip_value(size_t depth, std::vector<Span>* defs) {
+    if (depth > max_depth) throw std::runtime_error("Maximum nesting depth exceeded");
+    poll.at(offset);
+    uint8_t tag = u8();
+    if (doc->version == VERSION_VARINT && tag >= TAG_SMALL_INT && tag <= TAG_SMALL_INT + SMALL_INT_MAX)
+      return;
+    switch (tag) {
+      case TAG_NULL:
+      case TAG_FALSE:
+      case TAG_TRUE:
+        return;
+      case TAG_INTEGER:
+        integer();
+        return;
+      case TAG_FLOAT:
+        ensure(8);
+        offset += 8;
+        return;
+      case TAG_STRING: {
+        uint32_t n = len();
+        ensure(n);
+        offset += n;
+        return;
+      }
+      case TAG_STRING_REF:
+      case TAG_SHARED_REF:
+        len();
+        return;
+      case TAG_SHARED_DEF: {
+        size_t start = offset;
+        ensure(1);
+        if (data[start] == TAG_SHARED_DEF || data[start] == TAG_SHARED_REF)
+          throw std::runtime_error("Invalid shared subtree");
+        skip_value(depth, defs);
+        if (defs) defs->push_back({start, offset});
+        return;
+      }
+      case TAG_ARRAY: {
+        uint32_t n = len();
+        for (uint32_t i = 0; i < n; ++i) skip_value(depth + 1, defs);
+        return;
+      }
+      case TAG_OBJECT: {
+        uint32_t n = len();
+        for (uint32_t i = 0; i < n; ++i) {
+          if (len() >= keys->size()) throw std::runtime_error("Invalid key index");
+          skip_value(depth + 1, defs);
+        }
+        return;
+      }
+      case TAG_COLUMNS: {
+        if (doc->version != VERSION_VARINT) throw std::runtime_error("Unknown type tag");
+        uint32_t rows = len();
+        skip_columns(rows, depth, defs);
+        return;
+      }
+      case TAG_BINARY:
+        throw std::runtime_error("Binary type not supported");
+      default: {
+        size_t w = packed_tag_width(tag, doc->version);
+        if (w == 0) throw std::runtime_error("Unknown type tag");
+        uint32_t n = len();
+        if (n > (size - offset) / w) throw TruncatedInput();
+        offset += static_cast<size_t>(n) * w;
+        return;
+      }
+    }
+  }
+
+  // Column keys and bodies of a columnar array, after its row count.
+  void skip_columns(uint32_t rows, size_t depth, std::vector<Span>* defs) {
+    if (depth + 1 > max_depth) throw std::runtime_error("Maximum nesting depth exceeded");
+    uint32_t k = len();
+    if (k == 0) throw std::runtime_error("Invalid column keys");
+    if (k > size - offset || rows > size - offset) throw TruncatedInput();
+    uint32_t prev = 0;
+    for (uint32_t c = 0; c < k; ++c) {
+      uint32_t idx = len();
+      if (idx >= keys->size()) throw std::runtime_error("Invalid key index");
+      if (c > 0 && idx <= prev) throw std::runtime_error("Invalid column keys");
+      prev = idx;
+    }
+    for (uint32_t c = 0; c < k; ++c) skip_column(u8(), rows, depth, defs);
+  }
+
+  // One count-less column of `rows` elements after its tag.
+  void skip_column(uint8_t tag, uint32_t rows, size_t depth, std::vector<Span>* defs) {
+    if (tag == TAG_ARRAY) {
+      for (uint32_t r = 0; r < rows; ++r) skip_value(depth + 2, defs);
+    } else if (tag == TAG_COLUMNS && doc->version == VERSION_VARINT) {
+      skip_columns(rows, depth + 1, defs);
+    } else if (size_t w = packed_tag_width(tag, doc->version)) {
+      if (rows > (size - offset) / w) throw TruncatedInput();
+      offset += static_cast<size_t>(rows) * w;
+    } else {
+      throw std::runtime_error("Invalid column tag");
     }
   }
 };
@@ -223,34 +1158,955 @@ struct Decoder {
 
 Value decode(const uint8_t* data, size_t size, size_t max_depth, size_t max_dict,
              size_t max_str_len) {
+  DecodeOptions options;
+  options.max_depth = max_depth;
+  options.max_dict = max_dict;
+  options.max_str_len = max_str_len;
+  return decode(data, size, options, nullptr);
+}
+
+namespace {
+
+Decoder make_decoder(const uint8_t* data, size_t size, const DecodeOptions& options,
+                     DocumentState& doc) {
   Decoder dec;
   dec.data = data;
   dec.size = size;
-  dec.max_depth = max_depth;
-  dec.max_dict = max_dict;
-  dec.max_str = max_str_len;
+  dec.max_depth = options.max_depth;
+  dec.max_dict = options.max_dict;
+  dec.max_str = options.max_str_len;
+  dec.poll = CancelPoll(options.cancel);
+  dec.doc = &doc;
+  dec.keys = &doc.keys;
+  dec.shared = &doc.shared;
+  return dec;
+}
 
+// Magic through string table. `session` is the dictionary of a decoder
+// session, or nullptr outside one. Afterwards `*dec.keys` is the document's
+// key index space: the base dictionary itself when the document adds no keys.
+// Returns the version byte's flag bits.
+uint8_t read_header(Decoder& dec, const DecodeOptions& options,
+                    const std::vector<std::string>* session) {
+  DocumentState& doc = *dec.doc;
   dec.ensure(5);
   for (int i = 0; i < 4; ++i)
     if (dec.data[i] != MAGIC[i]) throw std::runtime_error("Invalid magic number");
   dec.offset = 4;
-  uint8_t version = dec.u8();
-  if (version != VERSION) throw std::runtime_error("Unsupported version");
+  uint8_t version_byte = dec.u8();
+  uint8_t flags = version_byte & (FLAG_EXTERNAL_DICT | FLAG_SESSION);
+  doc.version = version_byte & ~flags;
+  if ((doc.version != VERSION && doc.version != VERSION_VARINT) ||
+      flags == (FLAG_EXTERNAL_DICT | FLAG_SESSION))
+    throw std::runtime_error("Unsupported version");
+  // Keys the document does not repeat: an external dictionary or the session's.
+  const std::vector<std::string>* base = nullptr;
+  if (flags & FLAG_EXTERNAL_DICT) {
+    dec.ensure(8);
+    uint64_t id = 0;
+    for (int i = 0; i < 8; ++i) id = (id << 8) | dec.data[dec.offset++];
+    if (!options.dictionary || options.dictionary->id != id)
+      throw std::runtime_error("Unknown dictionary");
+    base = &options.dictionary->keys;
+  } else if (flags & FLAG_SESSION) {
+    if (!session) throw std::runtime_error("Session frame outside a decoder session");
+    if (dec.len() != session->size()) throw std::runtime_error("Session dictionary out of sync");
+    base = session;
+  }
 
-  uint32_t dict_len = dec.u32_be();
-  if (dict_len > max_dict) throw std::runtime_error("Dictionary too large");
-  dec.dictionary.reserve(dict_len);
+  uint32_t dict_len = dec.len();
+  size_t base_len = base ? base->size() : 0;
+  if (dict_len > dec.max_dict || base_len > dec.max_dict - dict_len)
+    throw std::runtime_error("Dictionary too large");
+  doc.keys.reserve(dict_len);
   for (uint32_t i = 0; i < dict_len; ++i) {
-    uint32_t key_len = dec.u32_be();
-    if (key_len > max_str_len) throw std::runtime_error("Key string too long");
+    uint32_t key_len = dec.len();
+    if (key_len > dec.max_str) throw std::runtime_error("Key string too long");
     dec.ensure(key_len);
-    dec.dictionary.emplace_back(reinterpret_cast<const char*>(dec.data + dec.offset), key_len);
+    doc.keys.emplace_back(reinterpret_cast<const char*>(dec.data + dec.offset), key_len);
     dec.offset += key_len;
   }
+  if (base && dict_len == 0) {
+    dec.keys = base;
+  } else if (base) {
+    // Inline keys must be sorted and absent from the base dictionary, so the
+    // merged index space is well defined.
+    for (size_t i = 0; i < doc.keys.size(); ++i) {
+      if ((i > 0 && !(doc.keys[i - 1] < doc.keys[i])) ||
+          std::binary_search(base->begin(), base->end(), doc.keys[i]))
+        throw std::runtime_error("Invalid dictionary");
+    }
+    std::vector<std::string> merged;
+    merged.reserve(base->size() + doc.keys.size());
+    std::merge(base->begin(), base->end(), std::make_move_iterator(doc.keys.begin()),
+               std::make_move_iterator(doc.keys.end()), std::back_inserter(merged));
+    doc.keys = std::move(merged);
+  }
+
+  if (dec.offset < dec.size && dec.data[dec.offset] == TAG_STRING_TABLE) {
+    dec.offset++;
+    uint32_t n = dec.len();
+    if (n > dec.size - dec.offset || n > INT32_MAX) throw TruncatedInput();
+    doc.strings.reserve(n);
+    for (uint32_t i = 0; i < n; ++i) {
+      uint32_t str_len = dec.len();
+      if (str_len > dec.max_str) throw std::runtime_error("String too long");
+      dec.ensure(str_len);
+      doc.strings.emplace_back(reinterpret_cast<const char*>(dec.data + dec.offset), str_len);
+      dec.offset += str_len;
+    }
+  }
+  return flags;
+}
 
+// When a session frame adds keys, the grown dictionary is stored in `grown`.
+Value decode_document(const uint8_t* data, size_t size, const DecodeOptions& options,
+                      std::vector<Value>* shared, const std::vector<std::string>* session,
+                      std::vector<std::string>* grown) {
+  DocumentState doc;
+  Decoder dec = make_decoder(data, size, options, doc);
+  if (shared) dec.shared = shared;
+  dec.placeholders = shared != nullptr;
+  uint8_t flags = read_header(dec, options, session);
   Value v = dec.decode_value(0);
   if (dec.offset != size) throw std::runtime_error("Trailing bytes after root value");
+  if ((flags & FLAG_SESSION) && dec.keys == &doc.keys) *grown = std::move(doc.keys);
   return v;
 }
 
+// Smallest run of a root array worth a thread of its own.
+constexpr size_t kMinChunk = size_t(1) << 18;
+
+// Columnar root body after its tag, for decode_split(): one skipping pass
+// finds where each column starts, the columns are decoded side by side, and
+// the rows are then assembled from them in slices, as decode_columns() does.
+bool decode_split_columns(Decoder& dec, const DecodeOptions& options, Value& out) {
+  const uint8_t* data = dec.data;
+  size_t size = dec.size;
+  uint32_t rows = 0;
+  std::vector<uint32_t> keys;
+  std::vector<size_t> starts;  // offset of each column's tag
+  try {
+    size_t parts = std::min<size_t>(options.threads, (size - dec.offset) / kMinChunk);
+    if (parts < 2 || dec.max_depth < 1) return false;
+    rows = dec.len();
+    uint32_t k = dec.len();
+    if (k < 2 || k > size - dec.offset || rows > size - dec.offset) return false;
+    keys.resize(k);
+    for (uint32_t c = 0; c < k; ++c) {
+      keys[c] = dec.len();
+      if (keys[c] >= dec.keys->size() || (c > 0 && keys[c] <= keys[c - 1])) return false;
+    }
+    std::vector<Decoder::Span> defs;
+    for (uint32_t c = 0; c < k; ++c) {
+      starts.push_back(dec.offset);
+      dec.skip_column(dec.u8(), rows, 0, &defs);
+      if (!defs.empty()) return false;
+    }
+    if (dec.offset != size) return false;
+  } catch (const Cancelled&) {
+    throw;
+  } catch (const std::runtime_error&) {
+    return false;
+  }
+
+  size_t k = keys.size();
+  std::vector<Value> columns(k);
+  out = Value();
+  out.type = Value::Type::Array;
+  out.arr.resize(rows);
+  try {
+    ThreadPool::shared().parallel_for(k, [&](size_t c) {
+      Decoder d = dec;
+      d.offset = starts[c] + 1;
+      d.poll = CancelPoll(options.cancel);
+      columns[c] = d.decode_items(data[starts[c]], rows, 1);
+    });
+    size_t parts = std::min<size_t>(options.threads, std::max<size_t>(1, rows / kMinSlice));
+    ThreadPool::shared().parallel_for(parts, [&](size_t s) {
+      auto range = slice(rows, s, parts);
+      for (size_t r = range.first; r < range.second; ++r) {
+        Value& row = out.arr[r];
+        row.type = Value::Type::Object;
+        row.obj.reserve(k);
+        for (size_t c = 0; c < k; ++c) {
+          Value& col = columns[c];
+          row.obj.emplace_back((*dec.keys)[keys[c]], col.type == Value::Type::Packed
+                                                         ? col.packed_at(r)
+                                                         : std::move(col.arr[r]));
+        }
+      }
+    });
+  } catch (const Cancelled&) {
+    throw;
+  } catch (const std::runtime_error&) {
+    return false;
+  }
+  return true;
+}
+
+// Decodes a root array on several threads. One skipping pass finds element
+// boundaries; each thread then decodes a contiguous run of elements straight
+// into its slots of `out`. A columnar root is split between its columns
+// instead (decode_split_columns). Returns false for other roots, when the
+// document defines shared subtrees (their ids run across the whole
+// document), or when anything fails: a serial decode then reports the error
+// exactly as it always does. Cancelled propagates.
+bool decode_split(const uint8_t* data, size_t size, const DecodeOptions& options, Value& out) {
+  DocumentState doc;
+  Decoder dec = make_decoder(data, size, options, doc);
+  struct Run {
+    uint32_t first;  // element index
+    size_t offset;
+  };
+  std::vector<Run> runs;
+  uint32_t n = 0;
+  try {
+    read_header(dec, options, nullptr);
+    if (dec.offset < size && data[dec.offset] == TAG_COLUMNS && doc.version == VERSION_VARINT) {
+      dec.offset++;
+      return decode_split_columns(dec, options, out);
+    }
+    if (dec.offset >= size || data[dec.offset] != TAG_ARRAY) return false;
+    dec.offset++;
+    n = dec.len();
+    size_t parts = std::min<size_t>(options.threads, (size - dec.offset) / kMinChunk);
+    if (parts < 2) return false;
+    size_t step = (size - dec.offset) / parts;
+    size_t next = dec.offset;
+    std::vector<Decoder::Span> defs;
+    for (uint32_t i = 0; i < n; ++i) {
+      if (dec.offset >= next && runs.size() < parts) {
+        runs.push_back({i, dec.offset});
+        next = dec.offset + step;
+      }
+      dec.skip_value(1, &defs);
+      if (!defs.empty()) return false;
+    }
+    if (dec.offset != size || runs.size() < 2) return false;
+  } catch (const Cancelled&) {
+    throw;
+  } catch (const std::runtime_error&) {
+    return false;
+  }
+  runs.push_back({n, size});
+
+  out = Value();
+  out.type = Value::Type::Array;
+  out.arr.resize(n);
+  try {
+    ThreadPool::shared().parallel_for(runs.size() - 1, [&](size_t r) {
+      Decoder d = dec;
+      d.offset = runs[r].offset;
+      d.poll = CancelPoll(options.cancel);
+      for (uint32_t i = runs[r].first; i < runs[r + 1].first; ++i) out.arr[i] = d.decode_value(1);
+    });
+  } catch (const Cancelled&) {
+    throw;
+  } catch (const std::runtime_error&) {
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+Value decode(const uint8_t* data, size_t size, const DecodeOptions& options,
+             std::vector<Value>* shared) {
+  Value v;
+  if (options.threads > 1 && size >= 2 * kMinChunk && decode_split(data, size, options, v))
+    return v;
+  return decode_document(data, size, options, shared, nullptr, nullptr);
+}
+
+size_t decode_header(const uint8_t* data, size_t size, const DecodeOptions& options,
+                     DocumentState& doc) {
+  doc = DocumentState();
+  Decoder dec = make_decoder(data, size, options, doc);
+  try {
+    read_header(dec, options, nullptr);
+  } catch (const TruncatedInput&) {
+    return 0;
+  }
+  // The next byte decides whether a string table follows the dictionary.
+  if (dec.offset == size) return 0;
+  if (dec.keys != &doc.keys) doc.keys = *dec.keys;
+  return dec.offset;
+}
+
+Value decode_value(const uint8_t* data, size_t size, const DecodeOptions& options,
+                   DocumentState& doc, size_t depth) {
+  Decoder dec = make_decoder(data, size, options, doc);
+  Value v = dec.decode_value(depth);
+  if (dec.offset != size) throw std::runtime_error("Trailing bytes after value");
+  return v;
+}
+
+DecoderSession::DecoderSession(const DecodeOptions& options) : options_(options) {
+  if (options_.dictionary) keys_ = options_.dictionary->keys;
+}
+
+Value DecoderSession::decode(const uint8_t* data, size_t size, std::vector<Value>* shared) {
+  // The session only grows once the whole frame has decoded, so a rejected
+  // frame never leaves a half-applied delta behind.
+  std::vector<std::string> grown;
+  Value v = decode_document(data, size, options_, shared, &keys_, &grown);
+  if (!grown.empty()) keys_ = std::move(grown);
+  return v;
+}
+
+namespace {
+
+// Canonical layout statistics for the elements of one array, or one column
+// of a columnar array, gathered element by element (SPEC §6.6, §6.8).
+struct ColumnStats {
+  size_t n = 0;
+  bool all_int = true;
+  bool all_float = true;
+  bool f32 = true;
+  int64_t lo = 0;
+  int64_t hi = 0;
+  bool all_objects = true;
+  std::vector<std::string> keys;      // key set of the first element, sorted
+  std::vector<ColumnStats> children;  // per key, while all_objects holds
+
+  void add(const Value& v) {
+    bool first = n++ == 0;
+    if (v.type == Value::Type::Int) {
+      all_float = false;
+      if (all_int) {
+        lo = first ? v.i : std::min(lo, v.i);
+        hi = first ? v.i : std::max(hi, v.i);
+      }
+    } else if (v.type == Value::Type::Float) {
+      all_int = false;
+      if (f32 && !fits_float32(v.d)) f32 = false;
+    } else {
+      all_int = all_float = false;
+    }
+    if (!all_objects) return;
+    if (v.type != Value::Type::Object || v.obj.empty()) return drop_objects();
+    std::vector<const Pair*> sorted = sorted_pairs(v);
+    if (first) {
+      for (const Pair* p : sorted) keys.push_back(p->first);
+      children.resize(keys.size());
+    } else {
+      if (sorted.size() != keys.size()) return drop_objects();
+      for (size_t k = 0; k < keys.size(); ++k)
+        if (sorted[k]->first != keys[k]) return drop_objects();
+    }
+    for (size_t k = 0; k < keys.size(); ++k) children[k].add(sorted[k]->second);
+  }
+
+  void drop_objects() {
+    all_objects = false;
+    keys = std::vector<std::string>();
+    children = std::vector<ColumnStats>();
+  }
+};
+
+}  // namespace
+
+struct StreamEncoder::State {
+  EncodeOptions options;
+  Dictionary dictionary;  // copy of *options.dictionary
+  // Encodes spilled rows in the version 2 layout; its key_to_index holds the
+  // provisional ids, assigned in order of first use.
+  Encoder spill;
+  std::vector<std::string> provisional;
+  std::FILE* file = nullptr;
+  bool begun = false;
+  bool finished = false;
+  ColumnStats rows;
+
+  ~State() {
+    if (file) std::fclose(file);
+  }
+
+  // One leaf column of the layout: the elements at `path` in every row,
+  // written as packed elements or as tagged values.
+  struct Column {
+    std::vector<size_t> path;  // field indices from the row down to the element
+    bool packed;
+    Value::Packed type;
+    size_t depth;
+    size_t at;  // offset in the layout bytes where its elements go
+    std::vector<uint8_t> buf;
+    std::FILE* file = nullptr;  // every column but the first, which goes straight out
+  };
+
+  // Calls fn(row) for every spilled row, decoded once.
+  template <typename Fn>
+  void for_each_row(Fn fn) {
+    DocumentState doc;
+    doc.version = VERSION_VARINT;
+    doc.keys = provisional;
+    DecodeOptions opts;
+    opts.max_depth = std::numeric_limits<size_t>::max() / 2;
+    opts.max_str_len = std::numeric_limits<size_t>::max();
+    std::vector<uint8_t> record;
+    std::rewind(file);
+    for (size_t r = 0; r < rows.n; ++r) {
+      uint64_t len = 0;
+      for (unsigned shift = 0;; shift += 7) {
+        int c = std::getc(file);
+        if (c == EOF) throw std::runtime_error("Cannot read temporary file");
+        len |= static_cast<uint64_t>(c & 0x7F) << shift;
+        if (!(c & 0x80)) break;
+      }
+      record.resize(len);
+      if (std::fread(record.data(), 1, len, file) != len)
+        throw std::runtime_error("Cannot read temporary file");
+      Decoder dec = make_decoder(record.data(), record.size(), opts, doc);
+      dec.sorted_columns = false;
+      fn(dec.decode_value(1));
+    }
+  }
+
+  // Mirrors Encoder::encode_items() with the layout decided by `stats`:
+  // writes the tags, counts and column keys to `enc`, and records each leaf
+  // column with the offset its elements go at.
+  void write_layout(Encoder& enc, const ColumnStats& stats, std::vector<size_t>& path,
+                    size_t depth, bool with_count, std::vector<Column>& columns) {
+    if (enc.version == VERSION_VARINT && stats.n > 0 && (stats.all_int || stats.all_float)) {
+      Value::Packed t = stats.all_int ? int_packed_type(stats.lo, stats.hi)
+                        : stats.f32   ? Value::Packed::Float32
+                                      : Value::Packed::Float64;
+      enc.u8(packed_tag(t));
+      if (with_count) enc.len(stats.n);
+      columns.push_back({path, true, t, depth, enc.buf.size(), {}, nullptr});
+    } else if (enc.version == VERSION_VARINT && stats.n >= 2 && stats.all_objects) {
+      enc.u8(TAG_COLUMNS);
+      if (with_count) enc.len(stats.n);
+      enc.len(stats.keys.size());
+      for (const auto& k : stats.keys) enc.len(enc.key_index(k));
+      for (size_t k = 0; k < stats.keys.size(); ++k) {
+        path.push_back(k);
+        write_layout(enc, stats.children[k], path, depth + 1, false, columns);
+        path.pop_back();
+      }
+    } else {
+      enc.u8(TAG_ARRAY);
+      if (with_count) enc.len(stats.n);
+      columns.push_back({path, false, Value::Packed::Int64, depth, enc.buf.size(), {}, nullptr});
+    }
+  }
+
+  void flush_column(size_t c, Column& col, const Sink& sink) {
+    if (c == 0) {
+      sink(col.buf.data(), col.buf.size());
+    } else if (std::fwrite(col.buf.data(), 1, col.buf.size(), col.file) != col.buf.size()) {
+      throw std::runtime_error("Cannot write temporary file");
+    }
+    col.buf.clear();
+  }
+
+  // One pass over the spilled rows: the first column's elements go to the
+  // sink as they are encoded, every other column's to a temporary file of
+  // its own. The files are then appended in column order.
+  void write_columns(Encoder& enc, std::vector<Column>& columns, const Sink& sink) {
+    constexpr size_t kFlushSize = size_t(1) << 16;
+    std::vector<uint8_t> layout = std::move(enc.buf);
+    enc.buf.clear();
+    sink(layout.data(), columns[0].at);
+    struct Files {
+      std::vector<Column>& columns;
+      ~Files() {
+        for (Column& col : columns)
+          if (col.file) std::fclose(col.file);
+      }
+    } files{columns};
+    for (size_t c = 1; c < columns.size(); ++c) {
+      columns[c].file = std::tmpfile();
+      if (!columns[c].file) throw std::runtime_error("Cannot create temporary file");
+    }
+    for_each_row([&](const Value& row) {
+      for (size_t c = 0; c < columns.size(); ++c) {
+        Column& col = columns[c];
+        const Value* v = &row;
+        for (size_t k : col.path) v = &v->obj[k].second;  // same sorted key set in every row
+        std::swap(enc.buf, col.buf);
+        if (col.packed) enc.packed_element(v->i, v->d, col.type);
+        else enc.encode_value(*v, col.depth + 1);
+        std::swap(enc.buf, col.buf);
+        if (col.buf.size() >= kFlushSize) flush_column(c, col, sink);
+      }
+    });
+    for (size_t c = 0; c < columns.size(); ++c) flush_column(c, columns[c], sink);
+    std::vector<uint8_t> chunk(kFlushSize);
+    for (size_t c = 1; c < columns.size(); ++c) {
+      sink(layout.data() + columns[c - 1].at, columns[c].at - columns[c - 1].at);
+      std::rewind(columns[c].file);
+      for (size_t n; (n = std::fread(chunk.data(), 1, chunk.size(), columns[c].file)) > 0;) sink(chunk.data(), n);
+      if (std::ferror(columns[c].file)) throw std::runtime_error("Cannot read temporary file");
+    }
+    sink(layout.data() + columns.back().at, layout.size() - columns.back().at);
+  }
+};
+
+StreamEncoder::StreamEncoder(const EncodeOptions& options) : state_(new State) {
+  if (options.version != VERSION && options.version != VERSION_VARINT)
+    throw std::runtime_error("Unsupported version");
+  if (options.string_table || options.dedupe)
+    throw std::runtime_error("Streaming encode does not support stringTable or dedupe");
+  state_->options = options;
+  if (options.dictionary) state_->dictionary = *options.dictionary;
+  state_->options.dictionary = options.dictionary ? &state_->dictionary : nullptr;
+  state_->spill.max_depth = options.max_depth;
+  state_->spill.version = VERSION_VARINT;
+}
+
+StreamEncoder::~StreamEncoder() = default;
+
+size_t StreamEncoder::size() const { return state_->rows.n; }
+
+void StreamEncoder::begin_array() {
+  State& st = *state_;
+  if (st.begun) throw std::runtime_error("Array already begun");
+  st.file = std::tmpfile();
+  if (!st.file) throw std::runtime_error("Cannot create temporary file");
+  st.begun = true;
+}
+
+void StreamEncoder::write_value(const Value& value) {
+  State& st = *state_;
+  if (!st.begun || st.finished) throw std::runtime_error("No array in progress");
+  std::set<std::string> keys;
+  collect_keys(value, keys);
+  size_t known = st.provisional.size();
+  for (const auto& k : keys)
+    if (st.spill.key_to_index.emplace(k, st.provisional.size()).second) st.provisional.push_back(k);
+  st.spill.buf.clear();
+  try {
+    st.spill.encode_value(value, 1);
+  } catch (...) {
+    // Keys first seen in a rejected row must not reach the dictionary.
+    for (size_t i = known; i < st.provisional.size(); ++i) st.spill.key_to_index.erase(st.provisional[i]);
+    st.provisional.resize(known);
+    throw;
+  }
+  uint8_t header[10];
+  size_t n = 0;
+  for (uint64_t len = st.spill.buf.size(); ; len >>= 7) {
+    header[n++] = static_cast<uint8_t>(len >= 0x80 ? (len & 0x7F) | 0x80 : len);
+    if (len < 0x80) break;
+  }
+  if (std::fwrite(header, 1, n, st.file) != n ||
+      std::fwrite(st.spill.buf.data(), 1, st.spill.buf.size(), st.file) != st.spill.buf.size())
+    throw std::runtime_error("Cannot write temporary file");
+  st.rows.add(value);
+}
+
+void StreamEncoder::finish(const Sink& sink) {
+  State& st = *state_;
+  if (!st.begun || st.finished) throw std::runtime_error("No array in progress");
+  st.finished = true;
+  if (std::fflush(st.file) != 0) throw std::runtime_error("Cannot write temporary file");
+  const EncodeOptions& options = st.options;
+  Encoder enc;
+  std::set<std::string> keys(st.provisional.begin(), st.provisional.end());
+  if (options.dictionary)
+    begin_document(enc, std::move(keys), options, FLAG_EXTERNAL_DICT, &options.dictionary->keys);
+  else
+    begin_document(enc, std::move(keys), options, 0, nullptr);
+  std::vector<size_t> path;
+  std::vector<State::Column> columns;
+  st.write_layout(enc, st.rows, path, 0, true, columns);
+  st.write_columns(enc, columns, sink);
+  std::fclose(st.file);
+  st.file = nullptr;
+}
+
+// The cursor reads through "sources": a raw run of tagged values, the
+// elements of a packed array, or the rows of a columnar array (one source
+// per column). Each open container is a frame that draws its children from a
+// source; sources live on a stack and are dropped with the frame that made
+// them, so memory grows with nesting and column count, not document size.
+struct Cursor::State {
+  struct Source {
+    enum class Kind : uint8_t { Raw, Packed, Columns } kind;
+    size_t offset;                 // Raw, Packed: next element
+    Value::Packed type;            // Packed
+    std::vector<uint32_t> keys;    // Columns: key index per column
+    std::vector<size_t> columns;   // Columns: source per column
+  };
+  struct Frame {
+    enum class Kind : uint8_t { Array, Object, Row } kind;
+    size_t src;          // Array: elements; Object: raw pairs; Row: columns source
+    uint32_t remaining;  // elements, pairs or columns left
+    uint32_t column;     // Row: next column
+    bool key_next;       // Object, Row: a key comes next
+    size_t parent;       // raw source the container was read from, or kNone
+    size_t end;          // Array over packed or columns: offset after it
+    size_t mark;         // source stack size to restore on End
+    bool replay;         // opened by a shared reference
+  };
+  using Shared = Decoder::Span;
+
+  DocumentState doc;
+  Decoder dec;
+  std::vector<Source> sources;
+  std::vector<Frame> frames;
+  std::vector<Shared> shared;  // by id, filled on the first reference
+  bool shared_indexed = false;
+  bool indexing = false;
+  size_t root_offset = 0;
+  size_t replaying = 0;
+  size_t expanded = 0;
+  bool started = false;
+  Event event;
+
+  [[noreturn]] static void fail(const char* msg) { throw std::runtime_error(msg); }
+
+  size_t add_source(Source::Kind kind, size_t offset) {
+    Source src;
+    src.kind = kind;
+    src.offset = offset;
+    src.type = Value::Packed::Int64;
+    sources.push_back(std::move(src));
+    return sources.size() - 1;
+  }
+
+  uint32_t key_index() {
+    uint32_t idx = dec.len();
+    if (idx >= dec.keys->size()) fail("Invalid key index");
+    return idx;
+  }
+
+  // --- Skipping (no events), to find column starts and shared definitions.
+
+  size_t skip_value(size_t offset, size_t depth) {
+    dec.offset = offset;
+    dec.skip_value(depth, indexing ? &shared : nullptr);
+    return dec.offset;
+  }
+
+  // Column keys and bodies of a columnar array, setting up the Columns
+  // source `into`: its keys and one source per column.
+  size_t skip_columns(size_t offset, uint32_t rows, size_t depth, size_t into) {
+    if (depth + 1 > dec.max_depth) fail("Maximum nesting depth exceeded");
+    dec.offset = offset;
+    uint32_t k = dec.len();
+    if (k == 0) fail("Invalid column keys");
+    if (k > dec.size - dec.offset || rows > dec.size - dec.offset) throw TruncatedInput();
+    std::vector<uint32_t> keys(k);
+    for (uint32_t c = 0; c < k; ++c) {
+      keys[c] = key_index();
+      if (c > 0 && keys[c] <= keys[c - 1]) fail("Invalid column keys");
+    }
+    for (uint32_t c = 0; c < k; ++c) {
+      uint8_t tag = dec.u8();
+      size_t col;
+      if (tag == TAG_COLUMNS && doc.version == VERSION_VARINT) {
+        col = add_source(Source::Kind::Columns, dec.offset);
+        dec.offset = skip_columns(dec.offset, rows, depth + 1, col);
+      } else {
+        size_t start = dec.offset;
+        dec.skip_column(tag, rows, depth, nullptr);
+        col = add_source(tag == TAG_ARRAY ? Source::Kind::Raw : Source::Kind::Packed, start);
+        if (tag != TAG_ARRAY) sources[col].type = packed_tag_type(tag);
+      }
+      sources[into].columns.push_back(col);
+    }
+    sources[into].keys = std::move(keys);
+    return dec.offset;
+  }
+
+  // Shared definitions in id order (completion order in the byte stream),
+  // found by one skipping pass over the root on the first reference.
+  void index_shared() {
+    size_t saved = dec.offset;
+    indexing = true;
+    skip_value(root_offset, 0);
+    indexing = false;
+    shared_indexed = true;
+    dec.offset = saved;
+  }
+
+  // --- Events.
+
+  void push_frame(Frame::Kind kind, size_t src, uint32_t remaining, size_t parent, size_t end,
+                  size_t mark, bool replay) {
+    if (replay) ++replaying;
+    frames.push_back({kind, src, remaining, 0, true, parent, end, mark, replay});
+  }
+
+  void end_frame() {
+    const Frame& f = frames.back();
+    if (f.parent != kNone) {
+      size_t end = f.kind == Frame::Kind::Object ||
+                           (f.kind == Frame::Kind::Array && sources[f.src].kind == Source::Kind::Raw)
+                       ? sources[f.src].offset
+                       : f.end;
+      sources[f.parent].offset = end;
+    }
+    if (f.replay) --replaying;
+    sources.resize(f.mark);
+    frames.pop_back();
+    event = Event();
+    event.type = Event::Type::End;
+  }
+
+  void scalar(Event::Type type) {
+    event = Event();
+    event.type = type;
+  }
+
+  // Next element of source `si`.
+  void emit_element(size_t si) {
+    Source& src = sources[si];
+    if (src.kind == Source::Kind::Packed) {
+      size_t w = Value::packed_width(src.type);
+      uint64_t u = 0;
+      for (size_t b = 0; b < w; ++b) u = (u << 8) | dec.data[src.offset + b];
+      src.offset += w;
+      if (src.type == Value::Packed::Float32) {
+        uint32_t x = static_cast<uint32_t>(u);
+        float f;
+        memcpy(&f, &x, 4);
+        scalar(Event::Type::Float);
+        event.d = f;
+      } else if (src.type == Value::Packed::Float64) {
+        scalar(Event::Type::Float);
+        memcpy(&event.d, &u, 8);
+      } else {
+        // Sign-extend from the element width.
+        unsigned shift = static_cast<unsigned>(64 - 8 * w);
+        scalar(Event::Type::Int);
+        event.i = static_cast<int64_t>(u << shift) >> shift;
+      }
+      return;
+    }
+    if (src.kind == Source::Kind::Columns) {
+      uint32_t k = static_cast<uint32_t>(src.keys.size());
+      push_frame(Frame::Kind::Row, si, k, kNone, kNone, sources.size(), false);
+      scalar(Event::Type::ObjectStart);
+      event.count = k;
+      return;
+    }
+    emit_raw(si, sources.size(), false);
+  }
+
+  // Tagged value at the offset of raw source `si`. `mark` is the source stack
+  // size to restore when a container opened here ends.
+  void emit_raw(size_t si, size_t mark, bool replay) {
+    if (frames.size() > dec.max_depth) fail("Maximum nesting depth exceeded");
+    dec.offset = sources[si].offset;
+    size_t tag_offset = dec.offset;
+    uint8_t tag = dec.u8();
+    bool def = false;
+    if (tag == TAG_SHARED_DEF) {
+      def = true;
+      tag = dec.u8();
+      if (tag == TAG_SHARED_DEF || tag == TAG_SHARED_REF) fail("Invalid shared subtree");
+    }
+    bool container = tag == TAG_ARRAY || tag == TAG_OBJECT || tag == TAG_COLUMNS ||
+                     packed_tag_width(tag, doc.version) != 0;
+    if ((def || replay) && !container) fail("Invalid shared subtree");
+    if (doc.version == VERSION_VARINT && tag >= TAG_SMALL_INT && tag <= TAG_SMALL_INT + SMALL_INT_MAX) {
+      scalar(Event::Type::Int);
+      event.i = tag - TAG_SMALL_INT;
+      sources[si].offset = dec.offset;
+      return;
+    }
+    switch (tag) {
+      case TAG_NULL:
+        scalar(Event::Type::Null);
+        break;
+      case TAG_FALSE:
+      case TAG_TRUE:
+        scalar(Event::Type::Bool);
+        event.b = tag == TAG_TRUE;
+        break;
+      case TAG_INTEGER:
+        scalar(Event::Type::Int);
+        event.i = dec.integer();
+        break;
+      case TAG_FLOAT:
+        scalar(Event::Type::Float);
+        event.d = dec.f64_be();
+        break;
+      case TAG_STRING: {
+        uint32_t n = dec.len();
+        if (n > dec.max_str) fail("String too long");
+        dec.ensure(n);
+        scalar(Event::Type::String);
+        event.s = std::string_view(reinterpret_cast<const char*>(dec.data + dec.offset), n);
+        dec.offset += n;
+        break;
+      }
+      case TAG_STRING_REF: {
+        uint32_t idx = dec.len();
+        if (idx >= doc.strings.size()) fail("Invalid string reference");
+        scalar(Event::Type::String);
+        event.s = doc.strings[idx];
+        break;
+      }
+      case TAG_SHARED_REF: {
+        uint32_t idx = dec.len();
+        sources[si].offset = dec.offset;
+        if (!shared_indexed) index_shared();
+        // Like the decoder, only definitions completed before the reference count.
+        if (idx >= shared.size() || shared[idx].end > tag_offset) fail("Invalid shared reference");
+        size_t mark_here = sources.size();
+        emit_raw(add_source(Source::Kind::Raw, shared[idx].start), mark_here, true);
+        return;
+      }
+      case TAG_BINARY:
+        fail("Binary type not supported");
+      case TAG_ARRAY:
+      case TAG_OBJECT: {
+        uint32_t n = dec.len();
+        if (def && n == 0) fail("Invalid shared subtree");
+        size_t body = add_source(Source::Kind::Raw, dec.offset);
+        bool object = tag == TAG_OBJECT;
+        push_frame(object ? Frame::Kind::Object : Frame::Kind::Array, body, n, si, kNone, mark, replay);
+        scalar(object ? Event::Type::ObjectStart : Event::Type::ArrayStart);
+        event.count = n;
+        return;
+      }
+      case TAG_COLUMNS: {
+        if (doc.version != VERSION_VARINT) fail("Unknown type tag");
+        uint32_t rows = dec.len();
+        if (def && rows == 0) fail("Invalid shared subtree");
+        size_t cols = add_source(Source::Kind::Columns, kNone);
+        size_t end = skip_columns(dec.offset, rows, frames.size(), cols);
+        push_frame(Frame::Kind::Array, cols, rows, si, end, mark, replay);
+        scalar(Event::Type::ArrayStart);
+        event.count = rows;
+        return;
+      }
+      default: {
+        size_t w = packed_tag_width(tag, doc.version);
+        if (w == 0) fail("Unknown type tag");
+        uint32_t n = dec.len();
+        if (def && n == 0) fail("Invalid shared subtree");
+        if (n > (dec.size - dec.offset) / w) throw TruncatedInput();
+        size_t body = add_source(Source::Kind::Packed, dec.offset);
+        sources[body].type = packed_tag_type(tag);
+        push_frame(Frame::Kind::Array, body, n, si, dec.offset + static_cast<size_t>(n) * w, mark,
+                   replay);
+        scalar(Event::Type::ArrayStart);
+        event.count = n;
+        return;
+      }
+    }
+    sources[si].offset = dec.offset;
+  }
+
+  // Advance source `si` past one element without events.
+  void skip_element(size_t si, size_t depth) {
+    Source& src = sources[si];
+    if (src.kind == Source::Kind::Packed) {
+      src.offset += Value::packed_width(src.type);
+    } else if (src.kind == Source::Kind::Raw) {
+      src.offset = skip_value(src.offset, depth);
+    } else {
+      for (size_t col : src.columns) skip_element(col, depth + 1);
+    }
+  }
+
+  // Close the container just opened, without its events: raw bodies are
+  // skipped with the decoder, packed and columnar arrays jump to their end.
+  void skip_frame() {
+    Frame& f = frames.back();
+    size_t depth = frames.size();
+    Source& src = sources[f.src];
+    if (f.kind == Frame::Kind::Row) {
+      for (; f.column < src.columns.size(); ++f.column) skip_element(src.columns[f.column], depth);
+    } else if (src.kind == Source::Kind::Raw) {
+      for (; f.remaining > 0; --f.remaining) {
+        if (f.kind == Frame::Kind::Object) {
+          dec.offset = src.offset;
+          key_index();
+          src.offset = dec.offset;
+        }
+        src.offset = skip_value(src.offset, depth);
+      }
+    }
+    end_frame();
+  }
+
+  bool next() {
+    // Events replayed through references, to bound nested expansion.
+    if (replaying > 0 && ++expanded > Decoder::kMaxSharedExpansion)
+      fail("Shared subtree expansion limit exceeded");
+    if (frames.empty()) {
+      if (started) {
+        if (sources[0].offset != dec.size) fail("Trailing bytes after root value");
+        return false;
+      }
+      started = true;
+      emit_raw(0, 1, false);
+      return true;
+    }
+    Frame& f = frames.back();
+    if (f.remaining == 0) {
+      end_frame();
+      return true;
+    }
+    switch (f.kind) {
+      case Frame::Kind::Array:
+        --f.remaining;
+        emit_element(f.src);
+        break;
+      case Frame::Kind::Object:
+        if (f.key_next) {
+          dec.offset = sources[f.src].offset;
+          uint32_t idx = key_index();
+          sources[f.src].offset = dec.offset;
+          f.key_next = false;
+          scalar(Event::Type::Key);
+          event.key = idx;
+        } else {
+          f.key_next = true;
+          --f.remaining;
+          emit_raw(f.src, sources.size(), false);
+        }
+        break;
+      case Frame::Kind::Row:
+        if (f.key_next) {
+          f.key_next = false;
+          uint32_t idx = sources[f.src].keys[f.column];
+          scalar(Event::Type::Key);
+          event.key = idx;
+        } else {
+          f.key_next = true;
+          --f.remaining;
+          emit_element(sources[f.src].columns[f.column++]);
+        }
+        break;
+    }
+    return true;
+  }
+};
+
+Cursor::Cursor(const uint8_t* data, size_t size, const DecodeOptions& options)
+    : state_(new State) {
+  State& st = *state_;
+  st.dec = make_decoder(data, size, options, st.doc);
+  read_header(st.dec, options, nullptr);
+  st.root_offset = st.dec.offset;
+  st.add_source(State::Source::Kind::Raw, st.dec.offset);
+}
+
+Cursor::~Cursor() = default;
+
+bool Cursor::next() { return state_->next(); }
+
+const Cursor::Event& Cursor::event() const { return state_->event; }
+
+const std::vector<std::string>& Cursor::keys() const { return *state_->dec.keys; }
+
+void Cursor::skip() {
+  State& st = *state_;
+  Event::Type type = st.event.type;
+  if (type == Event::Type::Key) {
+    if (!st.next()) return;
+    type = st.event.type;
+  }
+  if (type != Event::Type::ObjectStart && type != Event::Type::ArrayStart) return;
+  st.skip_frame();
+}
+
 }  // namespace koda
@@ -3,9 +3,15 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "koda_cancel.h"
 #include "koda_value.h"
 
 namespace koda {
@@ -13,6 +19,12 @@ namespace koda {
 // Binary format constants (SPEC §6)
 constexpr uint8_t MAGIC[] = {0x4B, 0x4F, 0x44, 0x41};
 constexpr uint8_t VERSION = 1;
+// Compact layout (SPEC §6.7): LEB128 lengths/counts/key indices, zigzag varint integers.
+constexpr uint8_t VERSION_VARINT = 2;
+// Version byte flag: the header names an external dictionary (SPEC §6.11).
+constexpr uint8_t FLAG_EXTERNAL_DICT = 0x80;
+// Version byte flag: session frame carrying a dictionary delta (SPEC §6.12).
+constexpr uint8_t FLAG_SESSION = 0x40;
 
 constexpr uint8_t TAG_NULL = 0x01;
 constexpr uint8_t TAG_FALSE = 0x02;
@@ -23,14 +35,250 @@ constexpr uint8_t TAG_STRING = 0x06;
 constexpr uint8_t TAG_BINARY = 0x07;
 constexpr uint8_t TAG_ARRAY = 0x10;
 constexpr uint8_t TAG_OBJECT = 0x11;
+// Version 2 only: array of objects sharing one key set, stored column-major
+// (SPEC §6.8).
+constexpr uint8_t TAG_COLUMNS = 0x12;
+
+// Version 2 only: packed homogeneous numeric arrays (SPEC §6.6), count + raw
+// big-endian elements.
+constexpr uint8_t TAG_PACKED_INT8 = 0x20;
+constexpr uint8_t TAG_PACKED_INT16 = 0x21;
+constexpr uint8_t TAG_PACKED_INT32 = 0x22;
+constexpr uint8_t TAG_PACKED_INT64 = 0x23;
+constexpr uint8_t TAG_PACKED_FLOAT32 = 0x24;
+constexpr uint8_t TAG_PACKED_FLOAT64 = 0x25;
+
+// Element width in bytes of a packed array tag; 0 for any other tag, and for
+// every tag in a version 1 document, which has no packed arrays.
+size_t packed_tag_width(uint8_t tag, uint8_t version);
+
+// Optional value-string table before the root value, and references into it (SPEC §6.9).
+constexpr uint8_t TAG_STRING_TABLE = 0x30;
+constexpr uint8_t TAG_STRING_REF = 0x31;
+
+// Shared subtrees (SPEC §6.10): definition wrapper and back-reference.
+constexpr uint8_t TAG_SHARED_DEF = 0x32;
+constexpr uint8_t TAG_SHARED_REF = 0x33;
+
+// Version 2 only: integers 0..63 inline in the tag byte.
+constexpr uint8_t TAG_SMALL_INT = 0x80;
+constexpr uint8_t SMALL_INT_MAX = 63;
+
+// Pre-agreed key dictionary, referenced from documents by id instead of being
+// written into each one (SPEC §6.11). Keys are sorted by UTF-8 bytes, unique.
+struct Dictionary {
+  std::vector<std::string> keys;
+  uint64_t id = 0;
+};
+
+// Build a dictionary from keys in any order; duplicates are dropped.
+Dictionary make_dictionary(std::vector<std::string> keys);
+
+struct EncodeOptions {
+  size_t max_depth = 256;
+  uint8_t version = VERSION;  // VERSION or VERSION_VARINT
+  bool string_table = false;  // store repeated string values once
+  bool dedupe = false;        // write repeated subtrees once, then back-reference them
+  const Dictionary* dictionary = nullptr;  // external dictionary; missing keys go inline
+  // Threads for a large root array: keys and repeated strings are collected
+  // and the elements encoded in slices side by side. The bytes are the same
+  // as a serial encode. Ignored with dedupe.
+  unsigned threads = 1;
+  // Polled as output grows; the encode throws Cancelled when it fires.
+  const CancelToken* cancel = nullptr;
+};
+
+struct DecodeOptions {
+  size_t max_depth = 256;
+  size_t max_dict = 65536;
+  size_t max_str_len = 1000000;
+  const Dictionary* dictionary = nullptr;  // required for documents that name one
+  // Threads for a large document whose root is an array: runs of elements
+  // are decoded side by side, or the columns of a columnar root. Documents
+  // with shared subtrees, and other roots, decode on the calling thread.
+  // The result is the same either way.
+  unsigned threads = 1;
+  // Polled as input is read; the decode throws Cancelled when it fires.
+  const CancelToken* cancel = nullptr;
+};
+
+// Thrown when the input ends inside a document. A subclass so incremental
+// callers can wait for more bytes instead of failing.
+struct TruncatedInput : std::runtime_error {
+  TruncatedInput() : std::runtime_error("Truncated input") {}
+};
 
 // Encode value to canonical binary. Throws std::runtime_error on depth exceed.
 std::vector<uint8_t> encode(const Value& value, size_t max_depth = 256);
+std::vector<uint8_t> encode(const Value& value, const EncodeOptions& options);
+
+// Receives encoded bytes in order, a piece at a time.
+using ByteSink = std::function<void(const uint8_t* data, size_t size)>;
 
-// Decode binary to value. Throws std::runtime_error on invalid input.
+// Encode to `sink` instead of a buffer: the same bytes as encode(), handed
+// over in pieces of about 64 KB, so the document is never held in memory
+// whole (for hashing it, for example).
+void encode(const Value& value, const EncodeOptions& options, const ByteSink& sink);
+
+// Decode binary to value; the format version is read from the header.
+// Throws std::runtime_error on invalid input.
 Value decode(const uint8_t* data, size_t size, size_t max_depth = 256,
              size_t max_dict = 65536, size_t max_str_len = 1000000);
 
+// Decode without copying shared subtrees: each definition and reference
+// becomes a placeholder Value with `ref` set, and the subtrees are appended
+// to `shared` in definition order. With shared == nullptr every reference is
+// materialized as a copy.
+Value decode(const uint8_t* data, size_t size, const DecodeOptions& options,
+             std::vector<Value>* shared);
+
+// Header and running state of one document decoded piecewise (see
+// IncrementalDecoder). Shared subtrees are kept here and copied into the
+// values that reference them.
+struct DocumentState {
+  uint8_t version = VERSION;
+  std::vector<std::string> keys;     // full key index space, base dictionary included
+  std::vector<std::string> strings;  // value-string table
+  std::vector<Value> shared;
+  std::vector<size_t> shared_nodes;
+  size_t expanded_nodes = 0;
+};
+
+// Read the header (magic through string table) from a prefix of a document.
+// Returns the header size, or 0 when `size` bytes cannot tell where the
+// header ends yet. Session frames are rejected.
+size_t decode_header(const uint8_t* data, size_t size, const DecodeOptions& options,
+                     DocumentState& doc);
+
+// Decode the one value that fills data[0, size), at nesting `depth` of the
+// document whose header was read into `doc`.
+Value decode_value(const uint8_t* data, size_t size, const DecodeOptions& options,
+                   DocumentState& doc, size_t depth);
+
+// Encoder state for a stream of session frames (SPEC §6.12). The dictionary
+// grows across frames and each frame writes only the keys that are new to it.
+// Seeded with options.dictionary when set.
+class EncoderSession {
+ public:
+  explicit EncoderSession(const EncodeOptions& options = EncodeOptions());
+  std::vector<uint8_t> encode(const Value& value);
+  const std::vector<std::string>& keys() const { return keys_; }
+
+ private:
+  EncodeOptions options_;
+  std::vector<std::string> keys_;  // sorted session dictionary
+};
+
+// Decoder counterpart of EncoderSession; frames must be decoded in the order
+// they were encoded. Standalone documents are also accepted and leave the
+// session unchanged. `shared` works as in decode().
+class DecoderSession {
+ public:
+  explicit DecoderSession(const DecodeOptions& options = DecodeOptions());
+  Value decode(const uint8_t* data, size_t size, std::vector<Value>* shared = nullptr);
+  const std::vector<std::string>& keys() const { return keys_; }
+
+ private:
+  DecodeOptions options_;
+  std::vector<std::string> keys_;
+};
+
+// Encoder for a root array too large to hold in memory; the output is
+// byte-identical to encode() of the whole array. Rows are spilled to a
+// temporary file with provisional key ids, along with the statistics that
+// decide the canonical array layout. finish() writes the header once the
+// dictionary is known, then re-encodes the rows from the file with their
+// final key indices in one more pass; when the rows are stored column-major,
+// each column but the first is staged in a temporary file of its own and the
+// files are appended in column order. Memory is bounded by the dictionary and
+// the column statistics, not the row count. String tables and dedupe need
+// counts over the whole document and are rejected.
+class StreamEncoder {
+ public:
+  using Sink = std::function<void(const uint8_t* data, size_t size)>;
+
+  explicit StreamEncoder(const EncodeOptions& options = EncodeOptions());
+  ~StreamEncoder();
+
+  // Start the root array; call once, before the first write_value().
+  void begin_array();
+  // Append one element. A rejected value (too deep) leaves the array unchanged.
+  void write_value(const Value& value);
+  // Write the document to `sink` in pieces. The encoder cannot be reused.
+  void finish(const Sink& sink);
+
+  size_t size() const;  // elements written so far
+
+ private:
+  struct State;
+  std::unique_ptr<State> state_;
+};
+
+// Pull reader over a binary document: reports it as a flat sequence of
+// events without building Values, so a document can be filtered or
+// re-encoded in constant memory. Packed arrays are reported element by
+// element, columnar arrays row by row, and shared references replay the
+// referenced subtree. The buffer (and options.dictionary) must outlive the
+// cursor. Session frames are rejected.
+class Cursor {
+ public:
+  struct Event {
+    enum class Type : uint8_t { ObjectStart, ArrayStart, End, Key, Null, Bool, Int, Float, String };
+    Type type = Type::End;
+    uint32_t count = 0;  // ObjectStart: pairs; ArrayStart: elements
+    uint32_t key = 0;    // Key: index into keys()
+    bool b = false;
+    int64_t i = 0;
+    double d = 0;
+    std::string_view s;  // String: view into the buffer or its string table
+  };
+
+  Cursor(const uint8_t* data, size_t size, const DecodeOptions& options = DecodeOptions());
+  ~Cursor();
+
+  // Advance to the next event; false once the root value has ended.
+  // Throws std::runtime_error on invalid input.
+  bool next();
+  const Event& event() const;
+  // After ObjectStart/ArrayStart: move past the container, its End included,
+  // without visiting its contents (shared subtrees in it are not expanded).
+  // After Key: move past the key's value. Otherwise does nothing.
+  void skip();
+
+  // Key index space of the document.
+  const std::vector<std::string>& keys() const;
+
+  // Input iterator over the remaining events: for (const auto& e : cursor).
+  class iterator {
+   public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = Event;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Event*;
+    using reference = const Event&;
+
+    iterator() = default;
+    explicit iterator(Cursor* cursor) : cursor_(cursor) { ++*this; }
+    reference operator*() const { return cursor_->event(); }
+    pointer operator->() const { return &cursor_->event(); }
+    iterator& operator++() {
+      if (!cursor_->next()) cursor_ = nullptr;
+      return *this;
+    }
+    bool operator==(const iterator& other) const { return cursor_ == other.cursor_; }
+    bool operator!=(const iterator& other) const { return cursor_ != other.cursor_; }
+
+   private:
+    Cursor* cursor_ = nullptr;
+  };
+  iterator begin() { return iterator(this); }
+  iterator end() { return iterator(); }
+
+ private:
+  struct State;
+  std::unique_ptr<State> state_;
+};
+
 }  // namespace koda
 
 #endif
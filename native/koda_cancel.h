@@ -0,0 +1,89 @@
+#ifndef KODA_CANCEL_H
+#define KODA_CANCEL_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+namespace koda {
+
+// Thrown by CancelToken::check(). Parallel paths rethrow it instead of
+// retrying serially.
+struct Cancelled : std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+// Relaxed load of a word that another thread or JS agent may store to
+// meanwhile. std::atomic_ref would do this in C++20, but the addon builds as
+// C++17, and casting the pointer to std::atomic<int32_t> is undefined
+// behaviour. So this uses the compiler builtin; on MSVC, an aligned volatile
+// read, which is a single load.
+inline int32_t load_relaxed(const int32_t* word) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  return *static_cast<const volatile int32_t*>(word);
+#else
+  return __atomic_load_n(word, __ATOMIC_RELAXED);
+#endif
+}
+
+// Cooperative stop request for a long parse, encode or decode. It is set from
+// another thread (cancel(), or an external flag such as a SharedArrayBuffer
+// word), or expires at a deadline. Loops poll it through CancelPoll.
+class CancelToken {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  void cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+
+  void set_deadline(Clock::time_point at) {
+    deadline_ = at;
+    has_deadline_ = true;
+  }
+
+  // A 32-bit word that requests cancellation when nonzero. It must outlive
+  // the token.
+  void set_flag(const int32_t* flag) { flag_ = flag; }
+
+  // Throws Cancelled once cancelled or past the deadline.
+  void check() const {
+    if (cancelled_.load(std::memory_order_relaxed) || (flag_ && load_relaxed(flag_) != 0))
+      throw Cancelled("Operation aborted");
+    if (has_deadline_ && Clock::now() >= deadline_) throw Cancelled("Deadline exceeded");
+  }
+
+ private:
+  std::atomic<bool> cancelled_{false};
+  const int32_t* flag_ = nullptr;
+  bool has_deadline_ = false;
+  Clock::time_point deadline_;
+};
+
+// Bytes read or written between checks of a token.
+constexpr size_t kCancelStride = size_t(1) << 16;
+
+// Checks a token once per `stride` units of progress (bytes, or values
+// built); a single comparison otherwise, and nothing without a token.
+class CancelPoll {
+ public:
+  CancelPoll() = default;
+  explicit CancelPoll(const CancelToken* token, size_t stride = kCancelStride)
+      : token_(token), stride_(stride), next_(token ? 0 : std::numeric_limits<size_t>::max()) {}
+
+  void at(size_t progress) {
+    if (progress < next_) return;
+    token_->check();
+    next_ = progress + stride_;
+  }
+
+ private:
+  const CancelToken* token_ = nullptr;
+  size_t stride_ = kCancelStride;
+  size_t next_ = std::numeric_limits<size_t>::max();
+};
+
+}  // namespace koda
+
+#endif
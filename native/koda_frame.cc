@@ -0,0 +1,89 @@
+#include "koda_frame.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace koda {
+
+void write_frame_header(std::vector<uint8_t>& out, size_t size) {
+  while (size >= 0x80) {
+    out.push_back(static_cast<uint8_t>(size | 0x80));
+    size >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(size));
+}
+
+void FrameReader::push(const uint8_t* data, size_t size) {
+  if (size == 0) return;  // never queued, so never reported as released
+  chunks_.push_back({data, size});
+  buffered_ += size;
+}
+
+uint8_t FrameReader::at(size_t i) const {
+  i += offset_;
+  for (const Chunk& c : chunks_) {
+    if (i < c.size) return c.data[i];
+    i -= c.size;
+  }
+  return 0;  // unreachable: callers check buffered_
+}
+
+void FrameReader::consume(size_t n) {
+  buffered_ -= n;
+  while (n > 0) {
+    size_t avail = chunks_.front().size - offset_;
+    if (n < avail) {
+      offset_ += n;
+      return;
+    }
+    n -= avail;
+    chunks_.pop_front();
+    offset_ = 0;
+    ++released_;
+  }
+}
+
+bool FrameReader::next(const uint8_t*& payload, size_t& size) {
+  // Length prefix: at most 5 bytes for a 32-bit length, minimal encoding.
+  uint64_t len = 0;
+  size_t header = 0;
+  for (;; ++header) {
+    if (header >= buffered_) return false;
+    uint8_t b = at(header);
+    if (header == 4 && b > 0x0F) throw std::runtime_error("Malformed frame length");
+    if (header > 0 && b == 0) throw std::runtime_error("Malformed frame length");
+    len |= static_cast<uint64_t>(b & 0x7F) << (7 * header);
+    if (!(b & 0x80)) break;
+  }
+  ++header;
+  if (len > max_frame_) throw std::runtime_error("Frame too large");
+  if (buffered_ - header < len) return false;
+  consume(header);
+  size = static_cast<size_t>(len);
+  if (size == 0 || chunks_.front().size - offset_ >= size) {
+    payload = size ? chunks_.front().data + offset_ : scratch_.data();
+    consume(size);
+    return true;
+  }
+  scratch_.resize(size);
+  size_t copied = 0;
+  for (const Chunk& c : chunks_) {
+    size_t from = copied == 0 ? offset_ : 0;
+    size_t n = std::min(c.size - from, size - copied);
+    std::memcpy(scratch_.data() + copied, c.data + from, n);
+    copied += n;
+    if (copied == size) break;
+  }
+  consume(size);
+  payload = scratch_.data();
+  return true;
+}
+
+size_t FrameReader::take_released() {
+  size_t n = released_;
+  released_ = 0;
+  return n;
+}
+
+}  // namespace koda
@@ -0,0 +1,58 @@
+#ifndef KODA_FRAME_H
+#define KODA_FRAME_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace koda {
+
+// Stream framing: each record is [LEB128 payload length][payload].
+
+// Append the length prefix for a payload of `size` bytes.
+void write_frame_header(std::vector<uint8_t>& out, size_t size);
+
+// Reassembles frames from a sequence of chunks without concatenating them.
+// A frame that lies inside one chunk is returned in place; only frames that
+// straddle chunks are copied, into a scratch buffer of at most one frame.
+class FrameReader {
+ public:
+  explicit FrameReader(size_t max_frame_size) : max_frame_(max_frame_size) {}
+
+  // Append a chunk. Its bytes must stay valid until the chunk is released.
+  // An empty chunk is ignored and does not count toward take_released().
+  void push(const uint8_t* data, size_t size);
+
+  // Next complete payload, or false if more input is needed. The payload is
+  // valid until the next call to next() and until released chunks are freed.
+  // Throws std::runtime_error on a malformed length or a frame over the limit.
+  bool next(const uint8_t*& payload, size_t& size);
+
+  // Chunks fully consumed since the last call, oldest first. Call it once the
+  // returned payloads have been used; the caller may then free the chunks.
+  size_t take_released();
+
+  // Bytes received but not yet returned as a frame.
+  size_t buffered() const { return buffered_; }
+
+ private:
+  struct Chunk {
+    const uint8_t* data;
+    size_t size;
+  };
+  // Byte at logical position i past the read offset.
+  uint8_t at(size_t i) const;
+  void consume(size_t n);
+
+  size_t max_frame_;
+  std::deque<Chunk> chunks_;
+  size_t offset_ = 0;  // read position in chunks_.front()
+  size_t buffered_ = 0;
+  size_t released_ = 0;
+  std::vector<uint8_t> scratch_;
+};
+
+}  // namespace koda
+
+#endif
@@ -0,0 +1,360 @@
+#include "koda_hash.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace koda {
+
+namespace {
+
+constexpr uint64_t P1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t P2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t P3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t P4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t P5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+inline uint64_t read64(const uint8_t* p) {
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+  return v;
+}
+
+inline uint32_t read32(const uint8_t* p) {
+  return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+inline uint64_t round(uint64_t acc, uint64_t input) {
+  acc += input * P2;
+  acc = rotl(acc, 31);
+  return acc * P1;
+}
+
+inline uint64_t merge_round(uint64_t acc, uint64_t val) {
+  acc ^= round(0, val);
+  return acc * P1 + P4;
+}
+
+}  // namespace
+
+Xxh64::Xxh64(uint64_t seed) : seed_(seed) {
+  v_[0] = seed + P1 + P2;
+  v_[1] = seed + P2;
+  v_[2] = seed;
+  v_[3] = seed - P1;
+}
+
+void Xxh64::update(const uint8_t* data, size_t size) {
+  total_ += size;
+  if (buffered_ + size < 32) {
+    if (size) std::memcpy(buf_ + buffered_, data, size);
+    buffered_ += size;
+    return;
+  }
+  if (buffered_) {
+    size_t fill = 32 - buffered_;
+    std::memcpy(buf_ + buffered_, data, fill);
+    for (int i = 0; i < 4; ++i) v_[i] = round(v_[i], read64(buf_ + 8 * i));
+    data += fill;
+    size -= fill;
+    buffered_ = 0;
+  }
+  for (; size >= 32; data += 32, size -= 32)
+    for (int i = 0; i < 4; ++i) v_[i] = round(v_[i], read64(data + 8 * i));
+  if (size) std::memcpy(buf_, data, size);
+  buffered_ = size;
+}
+
+uint64_t Xxh64::digest() const {
+  uint64_t h;
+  if (total_ >= 32) {
+    h = rotl(v_[0], 1) + rotl(v_[1], 7) + rotl(v_[2], 12) + rotl(v_[3], 18);
+    for (int i = 0; i < 4; ++i) h = merge_round(h, v_[i]);
+  } else {
+    h = seed_ + P5;
+  }
+  h += total_;
+  const uint8_t* p = buf_;
+  size_t n = buffered_;
+  for (; n >= 8; p += 8, n -= 8) h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+  if (n >= 4) {
+    h = rotl(h ^ (uint64_t(read32(p)) * P1), 23) * P2 + P3;
+    p += 4;
+    n -= 4;
+  }
+  for (; n > 0; ++p, --n) h = rotl(h ^ (*p * P5), 11) * P1;
+  h ^= h >> 33;
+  h *= P2;
+  h ^= h >> 29;
+  h *= P3;
+  h ^= h >> 32;
+  return h;
+}
+
+// --- XXH3
+
+namespace {
+
+constexpr uint64_t P32_1 = 0x9E3779B1U;
+constexpr uint64_t P32_2 = 0x85EBCA77U;
+constexpr uint64_t P32_3 = 0xC2B2AE3DU;
+constexpr uint64_t MX1 = 0x165667919E3779F9ULL;
+constexpr uint64_t MX2 = 0x9FB21C651E98DF25ULL;
+
+constexpr size_t kSecretSize = 192;
+constexpr uint8_t kSecret[kSecretSize] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+// Input up to this size is hashed by the short-input paths.
+constexpr size_t kMidSizeMax = 240;
+constexpr size_t kStripe = 64;
+constexpr size_t kStripesPerBlock = (kSecretSize - kStripe) / 8;
+
+inline uint64_t fold64(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+  unsigned __int128 p = static_cast<unsigned __int128>(a) * b;
+  return static_cast<uint64_t>(p) ^ static_cast<uint64_t>(p >> 64);
+#else
+  uint64_t lo_lo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+  uint64_t hi_lo = (a >> 32) * (b & 0xFFFFFFFF);
+  uint64_t lo_hi = (a & 0xFFFFFFFF) * (b >> 32);
+  uint64_t hi_hi = (a >> 32) * (b >> 32);
+  uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+  uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+  uint64_t lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+  return lower ^ upper;
+#endif
+}
+
+inline uint64_t swap64(uint64_t x) {
+  uint64_t r = 0;
+  for (int i = 0; i < 8; ++i) r = (r << 8) | ((x >> (8 * i)) & 0xFF);
+  return r;
+}
+
+inline uint64_t xxh64_avalanche(uint64_t h) {
+  h ^= h >> 33;
+  h *= P2;
+  h ^= h >> 29;
+  h *= P3;
+  return h ^ (h >> 32);
+}
+
+inline uint64_t xxh3_avalanche(uint64_t h) {
+  h ^= h >> 37;
+  h *= MX1;
+  return h ^ (h >> 32);
+}
+
+inline uint64_t rrmxmx(uint64_t h, uint64_t len) {
+  h ^= rotl(h, 49) ^ rotl(h, 24);
+  h *= MX2;
+  h ^= (h >> 35) + len;
+  h *= MX2;
+  return h ^ (h >> 28);
+}
+
+inline uint64_t mix16(const uint8_t* p, const uint8_t* secret) {
+  return fold64(read64(p) ^ read64(secret), read64(p + 8) ^ read64(secret + 8));
+}
+
+uint64_t xxh3_short(const uint8_t* p, size_t len) {
+  if (len == 0) return xxh64_avalanche(read64(kSecret + 56) ^ read64(kSecret + 64));
+  if (len <= 3) {
+    uint32_t combined = uint32_t(p[0]) << 16 | uint32_t(p[len >> 1]) << 24 | uint32_t(p[len - 1]) |
+                        static_cast<uint32_t>(len) << 8;
+    uint64_t bitflip = read32(kSecret) ^ read32(kSecret + 4);
+    return xxh64_avalanche(combined ^ bitflip);
+  }
+  if (len <= 8) {
+    uint64_t bitflip = read64(kSecret + 8) ^ read64(kSecret + 16);
+    uint64_t input = read32(p + len - 4) + (uint64_t(read32(p)) << 32);
+    return rrmxmx(input ^ bitflip, len);
+  }
+  if (len <= 16) {
+    uint64_t lo = read64(p) ^ (read64(kSecret + 24) ^ read64(kSecret + 32));
+    uint64_t hi = read64(p + len - 8) ^ (read64(kSecret + 40) ^ read64(kSecret + 48));
+    return xxh3_avalanche(len + swap64(lo) + hi + fold64(lo, hi));
+  }
+  uint64_t acc = len * P1;
+  if (len <= 128) {
+    if (len > 32) {
+      if (len > 64) {
+        if (len > 96) {
+          acc += mix16(p + 48, kSecret + 96);
+          acc += mix16(p + len - 64, kSecret + 112);
+        }
+        acc += mix16(p + 32, kSecret + 64);
+        acc += mix16(p + len - 48, kSecret + 80);
+      }
+      acc += mix16(p + 16, kSecret + 32);
+      acc += mix16(p + len - 32, kSecret + 48);
+    }
+    acc += mix16(p, kSecret);
+    acc += mix16(p + len - 16, kSecret + 16);
+    return xxh3_avalanche(acc);
+  }
+  size_t rounds = len / 16;
+  for (size_t i = 0; i < 8; ++i) acc += mix16(p + 16 * i, kSecret + 16 * i);
+  acc = xxh3_avalanche(acc);
+  for (size_t i = 8; i < rounds; ++i) acc += mix16(p + 16 * i, kSecret + 16 * (i - 8) + 3);
+  acc += mix16(p + len - 16, kSecret + 136 - 17);
+  return xxh3_avalanche(acc);
+}
+
+inline void accumulate(uint64_t acc[8], const uint8_t* p, const uint8_t* secret) {
+  for (int i = 0; i < 8; ++i) {
+    uint64_t data = read64(p + 8 * i);
+    uint64_t key = data ^ read64(secret + 8 * i);
+    acc[i ^ 1] += data;
+    acc[i] += (key & 0xFFFFFFFF) * (key >> 32);
+  }
+}
+
+}  // namespace
+
+Xxh3::Xxh3() : acc_{P32_3, P1, P2, P3, P4, P32_2, P5, P32_1} {}
+
+void Xxh3::stripe(const uint8_t* p) {
+  accumulate(acc_, p, kSecret + 8 * stripes_);
+  std::memcpy(last_, p, kStripe);
+  if (++stripes_ < kStripesPerBlock) return;
+  const uint8_t* secret = kSecret + kSecretSize - kStripe;
+  for (int i = 0; i < 8; ++i) {
+    uint64_t a = acc_[i];
+    a ^= a >> 47;
+    a ^= read64(secret + 8 * i);
+    acc_[i] = a * P32_1;
+  }
+  stripes_ = 0;
+}
+
+// Input is buffered until it is known to be long. From then on, a stripe is
+// consumed only once at least one byte follows it, as the one-shot hash
+// does; the last stripe is hashed separately, at digest().
+void Xxh3::update(const uint8_t* data, size_t size) {
+  while (size > 0) {
+    size_t n = std::min(size, kBuffer - buffered_);
+    std::memcpy(buf_ + buffered_, data, n);
+    buffered_ += n;
+    total_ += n;
+    data += n;
+    size -= n;
+    if (total_ <= kMidSizeMax) continue;
+    size_t at = 0;
+    for (; buffered_ - at > kStripe; at += kStripe) stripe(buf_ + at);
+    std::memmove(buf_, buf_ + at, buffered_ - at);
+    buffered_ -= at;
+  }
+}
+
+uint64_t Xxh3::digest() const {
+  if (total_ <= kMidSizeMax) return xxh3_short(buf_, static_cast<size_t>(total_));
+  uint64_t acc[8];
+  std::memcpy(acc, acc_, sizeof acc);
+  uint8_t last[kStripe];
+  size_t from_last = kStripe - buffered_;
+  std::memcpy(last, last_ + buffered_, from_last);
+  std::memcpy(last + from_last, buf_, buffered_);
+  accumulate(acc, last, kSecret + kSecretSize - kStripe - 7);
+  uint64_t h = total_ * P1;
+  for (int i = 0; i < 4; ++i) h += fold64(acc[2 * i] ^ read64(kSecret + 11 + 16 * i), acc[2 * i + 1] ^ read64(kSecret + 19 + 16 * i));
+  return xxh3_avalanche(h);
+}
+
+// --- SHA-256
+
+namespace {
+
+constexpr uint32_t kK[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+inline uint32_t rotr(uint32_t x, int r) { return (x >> r) | (x << (32 - r)); }
+
+}  // namespace
+
+Sha256::Sha256()
+    : h_{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19} {}
+
+void Sha256::block(const uint8_t* p) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; ++i)
+    w[i] = uint32_t(p[4 * i]) << 24 | uint32_t(p[4 * i + 1]) << 16 | uint32_t(p[4 * i + 2]) << 8 | p[4 * i + 3];
+  for (int i = 16; i < 64; ++i) {
+    uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+  uint32_t a = h_[0], b = h_[1], c = h_[2], d = h_[3], e = h_[4], f = h_[5], g = h_[6], h = h_[7];
+  for (int i = 0; i < 64; ++i) {
+    uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + kK[i] + w[i];
+    uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  h_[0] += a;
+  h_[1] += b;
+  h_[2] += c;
+  h_[3] += d;
+  h_[4] += e;
+  h_[5] += f;
+  h_[6] += g;
+  h_[7] += h;
+}
+
+void Sha256::update(const uint8_t* data, size_t size) {
+  total_ += size;
+  if (buffered_) {
+    size_t n = std::min(size, sizeof buf_ - buffered_);
+    std::memcpy(buf_ + buffered_, data, n);
+    buffered_ += n;
+    data += n;
+    size -= n;
+    if (buffered_ < sizeof buf_) return;
+    block(buf_);
+    buffered_ = 0;
+  }
+  for (; size >= 64; data += 64, size -= 64) block(data);
+  if (size) std::memcpy(buf_, data, size);
+  buffered_ = size;
+}
+
+void Sha256::digest(uint8_t out[32]) const {
+  Sha256 s = *this;
+  uint64_t bits = total_ * 8;
+  uint8_t pad[72] = {0x80};
+  size_t n = (buffered_ < 56 ? 56 : 120) - buffered_;
+  for (int i = 0; i < 8; ++i) pad[n + i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+  s.update(pad, n + 8);
+  for (int i = 0; i < 8; ++i)
+    for (int j = 0; j < 4; ++j) out[4 * i + j] = static_cast<uint8_t>(s.h_[i] >> (24 - 8 * j));
+}
+
+}  // namespace koda
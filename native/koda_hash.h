@@ -0,0 +1,73 @@
+#ifndef KODA_HASH_H
+#define KODA_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace koda {
+
+// XXH64: fast non-cryptographic 64-bit hash, fed incrementally. Equal input
+// gives equal output however it is split across update() calls.
+class Xxh64 {
+ public:
+  explicit Xxh64(uint64_t seed = 0);
+
+  void update(const uint8_t* data, size_t size);
+  uint64_t digest() const;
+
+ private:
+  uint64_t v_[4];
+  uint8_t buf_[32];
+  size_t buffered_ = 0;
+  uint64_t total_ = 0;
+  uint64_t seed_;
+};
+
+inline uint64_t xxh64(const uint8_t* data, size_t size, uint64_t seed = 0) {
+  Xxh64 h(seed);
+  h.update(data, size);
+  return h.digest();
+}
+
+// XXH3 (64-bit, default secret, seed 0), fed incrementally. Faster than
+// XXH64 on long input; output matches XXH3_64bits() of the whole input.
+class Xxh3 {
+ public:
+  Xxh3();
+
+  void update(const uint8_t* data, size_t size);
+  uint64_t digest() const;
+
+ private:
+  static constexpr size_t kBuffer = 256;
+
+  void stripe(const uint8_t* p);
+
+  uint64_t acc_[8];
+  uint8_t buf_[kBuffer];
+  size_t buffered_ = 0;
+  uint8_t last_[64];  // the most recently consumed stripe
+  size_t stripes_ = 0;  // consumed in the current block
+  uint64_t total_ = 0;
+};
+
+// SHA-256, fed incrementally.
+class Sha256 {
+ public:
+  Sha256();
+
+  void update(const uint8_t* data, size_t size);
+  void digest(uint8_t out[32]) const;
+
+ private:
+  void block(const uint8_t* p);
+
+  uint32_t h_[8];
+  uint8_t buf_[64];
+  size_t buffered_ = 0;
+  uint64_t total_ = 0;
+};
+
+}  // namespace koda
+
+#endif
@@ -0,0 +1,276 @@
+#include "koda_incremental.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace koda {
+
+void IncrementalDecoder::push(const uint8_t* data, size_t size) {
+  // Drop consumed bytes once they are at least half of the buffer.
+  if (start_ > 0 && start_ >= buf_.size() - start_) {
+    buf_.erase(buf_.begin(), buf_.begin() + static_cast<std::ptrdiff_t>(start_));
+    pos_ -= start_;
+    header_tried_ = 0;
+    start_ = 0;
+  }
+  buf_.insert(buf_.end(), data, data + size);
+}
+
+bool IncrementalDecoder::read_varint(unsigned bits, uint64_t& out) {
+  // Same checks as the decoder's uvarint(), one byte at a time.
+  for (;;) {
+    if (pos_ == buf_.size()) return false;
+    uint8_t b = buf_[pos_++];
+    unsigned shift = 7 * got_;
+    if (shift >= bits || (shift > 0 && b == 0) ||
+        (bits - shift < 7 && (b & 0x7F) >> (bits - shift)))
+      throw std::runtime_error("Malformed varint");
+    acc_ |= static_cast<uint64_t>(b & 0x7F) << shift;
+    ++got_;
+    if (!(b & 0x80)) break;
+  }
+  out = acc_;
+  acc_ = 0;
+  got_ = 0;
+  return true;
+}
+
+bool IncrementalDecoder::read_len(uint64_t& out) {
+  if (doc_.version != VERSION) return read_varint(32, out);
+  for (; got_ < 4; ++got_) {
+    if (pos_ == buf_.size()) return false;
+    acc_ = (acc_ << 8) | buf_[pos_++];
+  }
+  out = acc_;
+  acc_ = 0;
+  got_ = 0;
+  return true;
+}
+
+// Mirrors Decoder::decode_value(): push what follows `tag` at `depth`.
+void IncrementalDecoder::scan_tag(uint8_t tag, size_t depth) {
+  if (doc_.version == VERSION_VARINT && tag >= TAG_SMALL_INT && tag <= TAG_SMALL_INT + SMALL_INT_MAX)
+    return;
+  switch (tag) {
+    case TAG_NULL:
+    case TAG_FALSE:
+    case TAG_TRUE:
+      return;
+    case TAG_INTEGER:
+      if (doc_.version == VERSION)
+        stack_.push_back({Op::Skip, 0, 0, 8, depth});
+      else
+        stack_.push_back({Op::Varint, 0, 0, 0, depth});
+      return;
+    case TAG_FLOAT:
+      stack_.push_back({Op::Skip, 0, 0, 8, depth});
+      return;
+    case TAG_STRING:
+      stack_.push_back({Op::StringLen, 0, 0, 0, depth});
+      return;
+    case TAG_STRING_REF:
+    case TAG_SHARED_REF:
+      stack_.push_back({Op::Lens, 0, 0, 1, depth});
+      return;
+    case TAG_SHARED_DEF:
+      stack_.push_back({Op::Value, 0, 0, 0, depth});
+      return;
+    case TAG_BINARY:
+      throw std::runtime_error("Binary type not supported");
+    case TAG_ARRAY:
+      stack_.push_back({Op::ArrayLen, 0, 0, 0, depth});
+      return;
+    case TAG_OBJECT:
+      stack_.push_back({Op::ObjectLen, 0, 0, 0, depth});
+      return;
+    case TAG_COLUMNS:
+      if (doc_.version != VERSION_VARINT) throw std::runtime_error("Unknown type tag");
+      stack_.push_back({Op::ColumnsRows, 0, 0, 0, depth});
+      return;
+    default: {
+      size_t w = packed_tag_width(tag, doc_.version);
+      if (w == 0) throw std::runtime_error("Unknown type tag");
+      stack_.push_back({Op::PackedLen, static_cast<uint8_t>(w), 0, 0, depth});
+      return;
+    }
+  }
+}
+
+// Mirrors Decoder::decode_items() for one column of a columnar array at `depth`.
+void IncrementalDecoder::scan_column(uint8_t tag, uint32_t rows, size_t depth) {
+  if (tag == TAG_ARRAY) {
+    stack_.push_back({Op::Values, 0, 0, rows, depth + 2});
+  } else if (tag == TAG_COLUMNS && doc_.version == VERSION_VARINT) {
+    stack_.push_back({Op::ColumnsKeys, 0, rows, 0, depth + 1});
+  } else if (size_t w = packed_tag_width(tag, doc_.version)) {
+    stack_.push_back({Op::Skip, 0, 0, static_cast<uint64_t>(rows) * w, depth});
+  } else {
+    throw std::runtime_error("Invalid column tag");
+  }
+}
+
+bool IncrementalDecoder::scan() {
+  uint64_t n;
+  while (!stack_.empty()) {
+    Task t = stack_.back();
+    switch (t.op) {
+      case Op::Value:
+        if (t.depth > options_.max_depth) throw std::runtime_error("Maximum nesting depth exceeded");
+        if (pos_ == buf_.size()) return false;
+        stack_.pop_back();
+        scan_tag(buf_[pos_++], t.depth);
+        break;
+      case Op::Values:
+        if (t.n == 0) {
+          stack_.pop_back();
+          break;
+        }
+        --stack_.back().n;
+        stack_.push_back({Op::Value, 0, 0, 0, t.depth});
+        break;
+      case Op::Pairs:
+        if (t.n == 0) {
+          stack_.pop_back();
+          break;
+        }
+        --stack_.back().n;
+        stack_.push_back({Op::Value, 0, 0, 0, t.depth});
+        stack_.push_back({Op::Lens, 0, 0, 1, t.depth});
+        break;
+      case Op::Lens:
+        for (; stack_.back().n > 0; --stack_.back().n)
+          if (!read_len(n)) return false;
+        stack_.pop_back();
+        break;
+      case Op::Skip: {
+        uint64_t avail = std::min<uint64_t>(t.n, buf_.size() - pos_);
+        pos_ += static_cast<size_t>(avail);
+        stack_.back().n -= avail;
+        if (stack_.back().n > 0) return false;
+        stack_.pop_back();
+        break;
+      }
+      case Op::Varint:
+        if (!read_varint(64, n)) return false;
+        stack_.pop_back();
+        break;
+      case Op::Columns:
+        if (t.n == 0) {
+          stack_.pop_back();
+          break;
+        }
+        if (pos_ == buf_.size()) return false;
+        --stack_.back().n;
+        scan_column(buf_[pos_++], t.rows, t.depth);
+        break;
+      case Op::StringLen:
+        if (!read_len(n)) return false;
+        if (n > options_.max_str_len) throw std::runtime_error("String too long");
+        stack_.back() = {Op::Skip, 0, 0, n, t.depth};
+        break;
+      case Op::ArrayLen:
+        if (!read_len(n)) return false;
+        stack_.back() = {Op::Values, 0, 0, n, t.depth + 1};
+        break;
+      case Op::ObjectLen:
+        if (!read_len(n)) return false;
+        stack_.back() = {Op::Pairs, 0, 0, n, t.depth + 1};
+        break;
+      case Op::PackedLen:
+        if (!read_len(n)) return false;
+        stack_.back() = {Op::Skip, 0, 0, n * t.width, t.depth};
+        break;
+      case Op::ColumnsRows:
+        if (!read_len(n)) return false;
+        stack_.back() = {Op::ColumnsKeys, 0, static_cast<uint32_t>(n), 0, t.depth};
+        break;
+      case Op::ColumnsKeys:
+        if (t.depth + 1 > options_.max_depth)
+          throw std::runtime_error("Maximum nesting depth exceeded");
+        if (!read_len(n)) return false;
+        if (n == 0) throw std::runtime_error("Invalid column keys");
+        stack_.back() = {Op::Columns, 0, t.rows, n, t.depth};
+        stack_.push_back({Op::Lens, 0, 0, n, t.depth});
+        break;
+    }
+  }
+  return true;
+}
+
+bool IncrementalDecoder::next(Value& out) {
+  for (;;) {
+    switch (phase_) {
+      case Phase::Header: {
+        if (buf_.size() == header_tried_) return false;
+        size_t n = decode_header(buf_.data(), buf_.size(), options_, doc_);
+        if (n == 0) {
+          header_tried_ = buf_.size();
+          return false;
+        }
+        start_ = pos_ = n;
+        phase_ = Phase::RootTag;
+        break;
+      }
+      case Phase::RootTag:
+        if (pos_ == buf_.size()) return false;
+        if (buf_[pos_] == TAG_ARRAY) {
+          ++pos_;
+          root_is_array_ = true;
+          phase_ = Phase::RootCount;
+        } else {
+          stack_.push_back({Op::Value, 0, 0, 0, 0});
+          phase_ = Phase::Root;
+        }
+        break;
+      case Phase::RootCount:
+        if (!read_len(remaining_)) return false;
+        start_ = pos_;
+        phase_ = Phase::Elements;
+        break;
+      case Phase::Elements:
+        if (stack_.empty()) {
+          if (remaining_ == 0) {
+            phase_ = Phase::Done;
+            break;
+          }
+          stack_.push_back({Op::Value, 0, 0, 0, 1});
+        }
+        if (!scan()) return false;
+        out = decode_value(buf_.data() + start_, pos_ - start_, options_, doc_, 1);
+        start_ = pos_;
+        --remaining_;
+        return true;
+      case Phase::Root: {
+        if (!scan()) return false;
+        Value root = decode_value(buf_.data() + start_, pos_ - start_, options_, doc_, 0);
+        start_ = pos_;
+        phase_ = Phase::Done;
+        if (!split_root_) {
+          ready_.push_back(std::move(root));
+        } else if (root.type == Value::Type::Array) {
+          root_is_array_ = true;
+          for (auto& el : root.arr) ready_.push_back(std::move(el));
+        } else if (root.type == Value::Type::Packed) {
+          root_is_array_ = true;
+          for (size_t i = 0; i < root.packed_count(); ++i) ready_.push_back(root.packed_at(i));
+        } else {
+          ready_.push_back(std::move(root));
+        }
+        break;
+      }
+      case Phase::Done:
+        if (pos_ != buf_.size()) throw std::runtime_error("Trailing bytes after root value");
+        if (ready_.empty()) return false;
+        out = std::move(ready_.front());
+        ready_.pop_front();
+        return true;
+    }
+  }
+}
+
+void IncrementalDecoder::finish() {
+  if (phase_ != Phase::Done) throw TruncatedInput();
+  if (pos_ != buf_.size()) throw std::runtime_error("Trailing bytes after root value");
+}
+
+}  // namespace koda
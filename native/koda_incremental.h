@@ -0,0 +1,107 @@
+#ifndef KODA_INCREMENTAL_H
+#define KODA_INCREMENTAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "koda_binary.h"
+#include "koda_value.h"
+
+namespace koda {
+
+// Push-style decoder for one document that arrives in pieces. A root array is
+// emitted element by element as each one completes, so only the unfinished
+// element stays buffered. Any other root is emitted once it is complete;
+// columnar and packed roots then yield their elements, unless `split_root`
+// is false, in which case they are emitted whole like any other root.
+//
+// Element boundaries are found by a scanner whose state (open containers,
+// bytes left in a string, a half-read length or varint) lives in this object,
+// so chunks may split the input anywhere. Each completed element is decoded
+// with decode_value() against the document header.
+class IncrementalDecoder {
+ public:
+  explicit IncrementalDecoder(const DecodeOptions& options = DecodeOptions(), bool split_root = true)
+      : options_(options), split_root_(split_root) {}
+
+  // Append input; the bytes are copied.
+  void push(const uint8_t* data, size_t size);
+
+  // Next completed element, or false if more input is needed.
+  // Throws std::runtime_error on invalid input.
+  bool next(Value& out);
+
+  // Whether the whole document has been received and scanned.
+  bool done() const { return phase_ == Phase::Done; }
+
+  // Whether next() returns the elements of a root array rather than the root
+  // itself. Known once the root's tag has arrived (for a split columnar or
+  // packed root, once the root is complete).
+  bool root_is_array() const { return root_is_array_; }
+
+  // Call once next() returns false after the last push. Throws
+  // TruncatedInput if the document is incomplete.
+  void finish();
+
+  // Bytes received but not yet returned as values.
+  size_t buffered() const { return buf_.size() - start_; }
+
+  // Key index space of the document; empty until its header has arrived.
+  const std::vector<std::string>& keys() const { return doc_.keys; }
+
+ private:
+  enum class Phase : uint8_t { Header, RootTag, RootCount, Elements, Root, Done };
+  // Scanner work items. The *Len ops read a length, then turn into the op
+  // that consumes what it counts.
+  enum class Op : uint8_t {
+    Value,        // one tagged value
+    Values,       // n values
+    Pairs,        // n (key index, value) pairs
+    Lens,         // n lengths, discarded
+    Skip,         // n raw bytes
+    Varint,       // one zigzag integer (version 2)
+    Columns,      // n column bodies of `rows` elements
+    StringLen,
+    ArrayLen,
+    ObjectLen,
+    PackedLen,    // element width in `width`
+    ColumnsRows,
+    ColumnsKeys,  // row count in `rows`
+  };
+  struct Task {
+    Op op;
+    uint8_t width;
+    uint32_t rows;
+    uint64_t n;
+    size_t depth;
+  };
+
+  // Run the scanner until its stack empties (true) or the input runs out.
+  bool scan();
+  void scan_tag(uint8_t tag, size_t depth);
+  void scan_column(uint8_t tag, uint32_t rows, size_t depth);
+  bool read_len(uint64_t& out);
+  bool read_varint(unsigned bits, uint64_t& out);
+
+  DecodeOptions options_;
+  bool split_root_;
+  bool root_is_array_ = false;
+  DocumentState doc_;
+  Phase phase_ = Phase::Header;
+  std::vector<uint8_t> buf_;
+  size_t start_ = 0;         // first byte of the value being scanned
+  size_t pos_ = 0;           // scan position
+  size_t header_tried_ = 0;  // buffer size at the last incomplete header
+  uint64_t remaining_ = 0;   // root array elements still to come
+  std::vector<Task> stack_;
+  uint64_t acc_ = 0;  // partially read length or varint
+  unsigned got_ = 0;  // bytes of it read so far
+  std::deque<Value> ready_;
+};
+
+}  // namespace koda
+
+#endif
@@ -0,0 +1,309 @@
+#include "koda_index.h"
+
+#include <cstring>
+#include <limits>
+
+#include "koda_cancel.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define KODA_SSE2 1
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace koda {
+
+namespace {
+
+constexpr size_t kNone = std::numeric_limits<size_t>::max();
+
+// Byte classes of a 64-byte block, one bit per byte.
+struct Block {
+  uint64_t ws;     // space, tab, CR, LF
+  uint64_t op;     // { } [ ] : ,
+  uint64_t dq;     // "
+  uint64_t sq;     // '
+  uint64_t bs;     // backslash
+  uint64_t ctrl;   // below 0x20
+  uint64_t slash;
+  uint64_t lf;
+};
+
+inline unsigned ctz(uint64_t x) {
+#ifdef _MSC_VER
+  unsigned long i;
+  _BitScanForward64(&i, x);
+  return static_cast<unsigned>(i);
+#else
+  return static_cast<unsigned>(__builtin_ctzll(x));
+#endif
+}
+
+#ifdef KODA_SSE2
+
+void classify(const char* p, Block& b) {
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i lbrace = _mm_set1_epi8('{');
+  const __m128i rbrace = _mm_set1_epi8('}');
+  const __m128i lbracket = _mm_set1_epi8('[');
+  const __m128i rbracket = _mm_set1_epi8(']');
+  const __m128i colon = _mm_set1_epi8(':');
+  const __m128i comma = _mm_set1_epi8(',');
+  const __m128i dq = _mm_set1_epi8('"');
+  const __m128i sq = _mm_set1_epi8('\'');
+  const __m128i bs = _mm_set1_epi8('\\');
+  const __m128i slash = _mm_set1_epi8('/');
+  const __m128i ctrl_max = _mm_set1_epi8(0x1F);
+  b = Block();
+  for (int i = 0; i < 4; ++i) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * i));
+    __m128i is_lf = _mm_cmpeq_epi8(v, lf);
+    __m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+                              _mm_or_si128(_mm_cmpeq_epi8(v, cr), is_lf));
+    __m128i op = _mm_or_si128(
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, lbrace), _mm_cmpeq_epi8(v, rbrace)),
+                     _mm_or_si128(_mm_cmpeq_epi8(v, lbracket), _mm_cmpeq_epi8(v, rbracket))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+    // Unsigned v <= 0x1F.
+    __m128i ctrl = _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl_max), ctrl_max);
+    unsigned shift = 16 * i;
+    auto bits = [shift](__m128i m) {
+      return static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(m))) << shift;
+    };
+    b.ws |= bits(ws);
+    b.op |= bits(op);
+    b.dq |= bits(_mm_cmpeq_epi8(v, dq));
+    b.sq |= bits(_mm_cmpeq_epi8(v, sq));
+    b.bs |= bits(_mm_cmpeq_epi8(v, bs));
+    b.ctrl |= bits(ctrl);
+    b.slash |= bits(_mm_cmpeq_epi8(v, slash));
+    b.lf |= bits(is_lf);
+  }
+}
+
+#else
+
+void classify(const char* p, Block& b) {
+  b = Block();
+  for (unsigned i = 0; i < 64; ++i) {
+    uint64_t bit = uint64_t(1) << i;
+    unsigned char c = static_cast<unsigned char>(p[i]);
+    switch (c) {
+      case '\n':
+        b.lf |= bit;
+        b.ws |= bit;
+        break;
+      case ' ':
+      case '\t':
+      case '\r':
+        b.ws |= bit;
+        break;
+      case '{':
+      case '}':
+      case '[':
+      case ']':
+      case ':':
+      case ',':
+        b.op |= bit;
+        break;
+      case '"':
+        b.dq |= bit;
+        break;
+      case '\'':
+        b.sq |= bit;
+        break;
+      case '\\':
+        b.bs |= bit;
+        break;
+      case '/':
+        b.slash |= bit;
+        break;
+    }
+    if (c < 0x20) b.ctrl |= bit;
+  }
+}
+
+#endif
+
+// Finds the next byte of a class, one block at a time. The block holding
+// the end of input is classified from a copy padded with spaces.
+class Scanner {
+ public:
+  explicit Scanner(std::string_view text) : text_(text) {}
+
+  // Classes of the block starting at `first`, a multiple of 64.
+  const Block& block(size_t first) {
+    if (first != current_) {
+      if (first + 64 <= text_.size()) {
+        classify(text_.data() + first, block_);
+      } else {
+        char tail[64];
+        memset(tail, ' ', sizeof tail);
+        memcpy(tail, text_.data() + first, text_.size() - first);
+        classify(tail, block_);
+      }
+      current_ = first;
+    }
+    return block_;
+  }
+
+  // First offset >= pos whose bit is set in select(block), or the input size.
+  template <typename Select>
+  size_t find(size_t pos, Select select) {
+    size_t n = text_.size();
+    while (pos < n) {
+      size_t first = pos & ~size_t(63);
+      uint64_t m = select(block(first)) >> (pos - first);
+      if (m) {
+        size_t at = pos + ctz(m);
+        return at < n ? at : n;
+      }
+      pos = first + 64;
+    }
+    return n;
+  }
+
+  // Offset after the quote closing a string whose body starts at `pos`, or
+  // kNone if the string is unclosed or holds a raw control character. An
+  // escape covers the next byte, whatever it is, as in Lexer::read_quoted.
+  size_t string_end(size_t pos, char quote) {
+    size_t n = text_.size();
+    for (;;) {
+      size_t at = quote == '"' ? find(pos, [](const Block& b) { return b.dq | b.bs | b.ctrl; })
+                               : find(pos, [](const Block& b) { return b.sq | b.bs | b.ctrl; });
+      if (at == n) return kNone;
+      char c = text_[at];
+      if (c == quote) return at + 1;
+      if (c != '\\' || at + 1 >= n) return kNone;
+      pos = at + 2;
+    }
+  }
+
+ private:
+  std::string_view text_;
+  size_t current_ = kNone;
+  Block block_;
+};
+
+// Bits at and above i (none for i >= 64).
+inline uint64_t from_bit(size_t i) { return i < 64 ? ~uint64_t(0) << i : 0; }
+
+// Offset after a block comment starting at `pos`, or kNone if unclosed. The
+// same walk as Lexer::skip_ws_and_comments, nesting included.
+size_t block_comment_end(std::string_view text, size_t pos) {
+  pos += 2;
+  size_t depth = 1;
+  while (depth > 0 && pos + 1 < text.size()) {
+    if (text[pos] == '*' && text[pos + 1] == '/') {
+      pos += 2;
+      depth--;
+    } else if (text[pos] == '/' && text[pos + 1] == '*') {
+      pos += 2;
+      depth++;
+    } else {
+      pos++;
+    }
+  }
+  return depth == 0 ? pos : kNone;
+}
+
+}  // namespace
+
+// Works a block at a time. Strings and comments are found by walking the
+// block's quotes and slashes in order; everything they cover is masked out.
+// The token starts outside them are then operators, opening quotes and the
+// first byte of each run of other bytes, and come out of the masks in order.
+StructuralIndex build_structural_index(std::string_view text, const CancelToken* cancel) {
+  StructuralIndex index;
+  CancelPoll poll(cancel);
+  std::vector<uint32_t>& out = index.tokens;
+  out.reserve(text.size() / 4 + 2);
+  Scanner scanner(text);
+  size_t n = text.size();
+  size_t resume = 0;          // end of the last string or comment
+  size_t close = kNone;       // closing quote of a string that ends in a later block
+  uint64_t prev_other = 0;    // last byte of the previous block was in a run
+  for (size_t base = 0; base < n; base += 64) {
+    poll.at(base);
+    Block b = scanner.block(base);
+    uint64_t valid = n - base >= 64 ? ~uint64_t(0) : ~from_bit(n - base);
+    uint64_t inside = resume > base ? ~from_bit(resume - base) : 0;
+    uint64_t opens = 0;
+    uint64_t closes = 0;
+    if (close != kNone && close < base + 64) {
+      closes |= uint64_t(1) << (close - base);
+      close = kNone;
+    }
+    size_t error = kNone;
+    uint64_t special = (b.dq | b.sq | b.slash) & valid & ~inside;
+    while (special) {
+      size_t i = ctz(special);
+      size_t at = base + i;
+      char c = text[at];
+      size_t end;
+      if (c == '"' || c == '\'') {
+        // Usually the next quote, escape or control byte in the block closes it.
+        uint64_t m = ((c == '"' ? b.dq : b.sq) | b.bs | b.ctrl) & from_bit(i + 1);
+        if (m && text[base + ctz(m)] == c)
+          end = base + ctz(m) + 1;
+        else
+          end = scanner.string_end(at + 1, c);
+        if (end == kNone) {
+          error = at;
+          break;
+        }
+        opens |= uint64_t(1) << i;
+        if (end - 1 < base + 64)
+          closes |= uint64_t(1) << (end - 1 - base);
+        else
+          close = end - 1;
+      } else if (at + 1 < n && text[at + 1] == '/') {
+        end = scanner.find(at + 2, [](const Block& blk) { return blk.lf; });
+      } else if (at + 1 < n && text[at + 1] == '*') {
+        end = block_comment_end(text, at);
+        if (end == kNone) {
+          error = at;
+          break;
+        }
+      } else {
+        error = at;
+        break;
+      }
+      uint64_t covered = from_bit(i);
+      if (end - base < 64) covered &= ~from_bit(end - base);
+      inside |= covered;
+      special &= end - base < 64 ? from_bit(end - base) : 0;
+      resume = end;
+    }
+    uint64_t other = ~(b.ws | b.op | b.dq | b.sq | b.slash) & ~inside & valid;
+    uint64_t runs = other & ~((other << 1) | prev_other);
+    prev_other = other >> 63;
+    uint64_t starts = (b.op & ~inside & valid) | runs | opens | closes;
+    if (error != kNone) starts &= ~from_bit(error - base);
+    // Room for a full block, trimmed back after it is written.
+    size_t count = out.size();
+    out.resize(count + 64);
+    uint32_t* dst = out.data() + count;
+    while (starts) {
+      size_t i = ctz(starts);
+      starts &= starts - 1;
+      // A closing quote records the offset after it.
+      *dst++ = static_cast<uint32_t>(base + i + ((closes >> i) & 1));
+    }
+    out.resize(static_cast<size_t>(dst - out.data()));
+    if (error != kNone) {
+      out.push_back(static_cast<uint32_t>(error));
+      return index;
+    }
+  }
+  out.push_back(static_cast<uint32_t>(n));
+  index.complete = true;
+  return index;
+}
+
+}  // namespace koda
@@ -0,0 +1,37 @@
+#ifndef KODA_INDEX_H
+#define KODA_INDEX_H
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace koda {
+
+class CancelToken;
+
+// How the text parser finds tokens. Lexer scans the input byte by byte.
+// Indexed first builds a structural index of the whole input with SIMD
+// (build_structural_index) and then lexes only at the recorded token
+// starts; values and error messages are the same, and it is faster on
+// large inputs.
+enum class ParseMode : uint8_t { Lexer, Indexed };
+
+// Token start offsets of a KODA text, found without lexing it. A quoted
+// string takes two entries: its opening quote and the offset after its
+// closing quote. Adjacent numbers and identifiers ("12ab") share one entry.
+// Whitespace and comments have none. The last entry is the end of input;
+// when `complete` is false it is instead the start of something that cannot
+// be lexed (an unclosed string or comment, a control character in a string,
+// a stray '/').
+struct StructuralIndex {
+  std::vector<uint32_t> tokens;
+  bool complete = false;
+};
+
+// Stage 1 of ParseMode::Indexed. `text` must be shorter than 4 GiB. Polls
+// `cancel` as it goes and throws Cancelled when it fires.
+StructuralIndex build_structural_index(std::string_view text, const CancelToken* cancel = nullptr);
+
+}  // namespace koda
+
+#endif
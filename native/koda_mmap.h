@@ -0,0 +1,39 @@
+#ifndef KODA_MMAP_H
+#define KODA_MMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace koda {
+
+// A whole file mapped read-only, so it can be parsed or decoded in place
+// without reading it into a buffer first. The kernel is told the mapping
+// will be read front to back, so it reads ahead aggressively. The mapping is
+// MAP_PRIVATE, which does not protect against the file shrinking: if another
+// process truncates it, reading a page past the new end raises SIGBUS.
+class MappedFile {
+ public:
+  // Throws std::runtime_error naming the path if it cannot be opened or mapped.
+  explicit MappedFile(const std::string& path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+  std::string_view text() const { return {reinterpret_cast<const char*>(data_), size_}; }
+
+ private:
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+#ifdef _WIN32
+  void* mapping_ = nullptr;
+#endif
+};
+
+}  // namespace koda
+
+#endif
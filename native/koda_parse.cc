@@ -1,320 +1,204 @@
 #include "koda_parse.h"
 
-#include <cctype>
+#include <algorithm>
 #include <stdexcept>
+#include <string_view>
+#include <unordered_set>
 #include <utility>
+#include <vector>
+
+#include "koda_pool.h"
+#include "koda_sax.h"
 
 namespace koda {
 
 namespace {
 
-class Lexer {
+// Handler that builds the Value tree for parse().
+class TreeBuilder {
  public:
-  explicit Lexer(const std::string& text) : data_(text), pos_(0), line_(1), col_(1) {}
-
-  enum class Token {
-    Eof,
-    LBrace,
-    RBrace,
-    LBracket,
-    RBracket,
-    Colon,
-    Comma,
-    String,
-    Identifier,
-    Integer,
-    Float,
-    True,
-    False,
-    Null,
-  };
-
-  Token token() const { return token_; }
-  const std::string& string_val() const { return string_val_; }
-  int64_t int_val() const { return int_val_; }
-  double float_val() const { return float_val_; }
-
-  void advance() {
-    skip_ws_and_comments();
-    start_line_ = line_;
-    start_col_ = col_;
-    if (pos_ >= data_.size()) {
-      token_ = Token::Eof;
-      return;
-    }
-    char c = data_[pos_];
-    if (c == '{') { pos_++; token_ = Token::LBrace; return; }
-    if (c == '}') { pos_++; token_ = Token::RBrace; return; }
-    if (c == '[') { pos_++; token_ = Token::LBracket; return; }
-    if (c == ']') { pos_++; token_ = Token::RBracket; return; }
-    if (c == ':') { pos_++; token_ = Token::Colon; return; }
-    if (c == ',') { pos_++; token_ = Token::Comma; return; }
-    if (c == '"' || c == '\'') { read_quoted(c); return; }
-    if (c == '-' || (c >= '0' && c <= '9')) { read_number(); return; }
-    if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') { read_identifier(); return; }
-    error("Unexpected character");
+  explicit TreeBuilder(const CancelToken* cancel = nullptr) : poll_(cancel, kPollValues) {}
+  // Starts inside an open array or object, for SaxParser::parse_items().
+  TreeBuilder(Value::Type open, const CancelToken* cancel) : TreeBuilder(cancel) {
+    root_.type = open;
+    stack_.push_back(&root_);
   }
 
-  void error(const std::string& msg) const {
-    throw std::runtime_error(msg + " at line " + std::to_string(start_line_) +
-                             " column " + std::to_string(start_col_));
+  void on_object_start() { open(Value::Type::Object); }
+  bool on_key(std::string_view key) {
+    for (const auto& p : stack_.back()->obj)
+      if (p.first == key) return false;
+    key_.assign(key.data(), key.size());
+    return true;
   }
+  void on_object_end() { stack_.pop_back(); }
+  void on_array_start() { open(Value::Type::Array); }
+  void on_array_end() { stack_.pop_back(); }
+  void on_string(std::string_view s) { add(Value::string_val(std::string(s))); }
+  void on_int(int64_t x) { add(Value::int_val(x)); }
+  void on_float(double x) { add(Value::float_val(x)); }
+  void on_bool(bool b) { add(Value::bool_val(b)); }
+  void on_null() { add(Value::null_val()); }
 
- private:
-  void skip_ws_and_comments() {
-    while (pos_ < data_.size()) {
-      char c = data_[pos_];
-      if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
-        if (c == '\n') { line_++; col_ = 1; } else { col_++; }
-        pos_++;
-        continue;
-      }
-      if (c == '/' && pos_ + 1 < data_.size() && data_[pos_ + 1] == '/') {
-        pos_ += 2;
-        while (pos_ < data_.size() && data_[pos_] != '\n') pos_++;
-        continue;
-      }
-      if (c == '/' && pos_ + 1 < data_.size() && data_[pos_ + 1] == '*') {
-        pos_ += 2;
-        size_t depth = 1;
-        while (depth > 0 && pos_ + 1 < data_.size()) {
-          if (data_[pos_] == '*' && data_[pos_ + 1] == '/') { pos_ += 2; depth--; }
-          else if (data_[pos_] == '/' && data_[pos_ + 1] == '*') { pos_ += 2; depth++; }
-          else { if (data_[pos_] == '\n') { line_++; col_ = 1; } else col_++; pos_++; }
-        }
-        if (depth != 0) error("Unclosed comment");
-        continue;
-      }
-      return;
-    }
-  }
+  Value take() { return std::move(root_); }
 
-  void read_quoted(char quote) {
-    pos_++;
-    string_val_.clear();
-    bool closed = false;
-    while (pos_ < data_.size()) {
-      char c = data_[pos_++];
-      col_++;
-      if (c == quote) { closed = true; break; }
-      if (c == '\\') {
-        if (pos_ >= data_.size()) error("Unclosed string");
-        c = data_[pos_++];
-        col_++;
-        if (c == quote) string_val_ += quote;
-        else if (c == '\\') string_val_ += '\\';
-        else if (c == 'n') string_val_ += '\n';
-        else if (c == 'r') string_val_ += '\r';
-        else if (c == 't') string_val_ += '\t';
-        else string_val_ += c;
-      } else if (static_cast<unsigned char>(c) < 0x20) {
-        error("Control character in string");
-      } else {
-        string_val_ += c;
-      }
-    }
-    if (!closed) error("Unclosed string");
-    token_ = Token::String;
-  }
+ private:
+  // Values built between cancellation checks.
+  static constexpr size_t kPollValues = 4096;
 
-  void read_number() {
-    size_t start = pos_;
-    if (data_[pos_] == '-') pos_++, col_++;
-    if (data_[pos_] == '0' && pos_ + 1 < data_.size()) {
-      char n = data_[pos_ + 1];
-      if (n >= '0' && n <= '9') error("Leading zero");
+  // Only the innermost open container grows, so pointers to the open
+  // containers stay valid.
+  Value* add(Value v) {
+    poll_.at(++values_);
+    if (stack_.empty()) {
+      root_ = std::move(v);
+      return &root_;
     }
-    bool is_float = false;
-    while (pos_ < data_.size() && std::isdigit(static_cast<unsigned char>(data_[pos_])))
-      pos_++, col_++;
-    if (pos_ < data_.size() && data_[pos_] == '.') {
-      is_float = true;
-      pos_++, col_++;
-      while (pos_ < data_.size() && std::isdigit(static_cast<unsigned char>(data_[pos_])))
-        pos_++, col_++;
-    }
-    if (pos_ < data_.size() && (data_[pos_] == 'e' || data_[pos_] == 'E')) {
-      is_float = true;
-      pos_++, col_++;
-      if (pos_ < data_.size() && (data_[pos_] == '+' || data_[pos_] == '-')) pos_++, col_++;
-      while (pos_ < data_.size() && std::isdigit(static_cast<unsigned char>(data_[pos_])))
-        pos_++, col_++;
-    }
-    std::string num_str(data_.substr(start, pos_ - start));
-    if (is_float) {
-      try {
-        float_val_ = std::stod(num_str);
-      } catch (...) {
-        error("Invalid float");
-      }
-      token_ = Token::Float;
-    } else {
-      try {
-        int_val_ = std::stoll(num_str);
-      } catch (...) {
-        error("Invalid integer");
-      }
-      token_ = Token::Integer;
+    Value& parent = *stack_.back();
+    if (parent.type == Value::Type::Object) {
+      parent.obj.emplace_back(std::move(key_), std::move(v));
+      return &parent.obj.back().second;
     }
+    parent.arr.push_back(std::move(v));
+    return &parent.arr.back();
   }
-
-  void read_identifier() {
-    size_t start = pos_;
-    while (pos_ < data_.size()) {
-      char c = data_[pos_];
-      if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_' && c != '-') break;
-      pos_++;
-      col_++;
-    }
-    string_val_ = data_.substr(start, pos_ - start);
-    if (string_val_ == "true") token_ = Token::True;
-    else if (string_val_ == "false") token_ = Token::False;
-    else if (string_val_ == "null") token_ = Token::Null;
-    else token_ = Token::Identifier;
+  void open(Value::Type type) {
+    Value v;
+    v.type = type;
+    stack_.push_back(add(std::move(v)));
   }
 
-  const std::string& data_;
-  size_t pos_;
-  int line_, col_;
-  int start_line_, start_col_;
-  Token token_ = Token::Eof;
-  std::string string_val_;
-  int64_t int_val_ = 0;
-  double float_val_ = 0;
+  Value root_;
+  std::vector<Value*> stack_;
+  std::string key_;
+  CancelPoll poll_;
+  size_t values_ = 0;
 };
 
-class Parser {
- public:
-  Parser(const std::string& text, size_t max_depth)
-      : lex_(text), max_depth_(max_depth) {
-    lex_.advance();
-  }
+using Items = SaxParser<TreeBuilder, IndexedLexer>::Items;
 
-  void expect_eof() {
-    if (lex_.token() != Lexer::Token::Eof) lex_.error("Expected end of input");
-  }
-
-  Value parse_document() {
-    if (lex_.token() == Lexer::Token::Identifier || lex_.token() == Lexer::Token::String) {
-      Lexer copy = lex_;
-      copy.advance();
-      if (copy.token() != Lexer::Token::Eof)
-        return parse_root_object(0);
-    }
-    return parse_value(0);
-  }
+// Smallest piece of a root container worth a thread of its own.
+constexpr size_t kMinChunk = size_t(1) << 18;
 
-  Value parse_root_object(size_t depth) {
-    Value v;
-    v.type = Value::Type::Object;
-    while (lex_.token() == Lexer::Token::Identifier || lex_.token() == Lexer::Token::String) {
-      std::string key = lex_.string_val();
-      lex_.advance();
-      if (lex_.token() == Lexer::Token::Colon) lex_.advance();
-      for (const auto& p : v.obj)
-        if (p.first == key) lex_.error("Duplicate key");
-      v.obj.emplace_back(key, parse_value(depth + 1));
-    }
-    return v;
+// Splits the root array or object of an indexed text at top-level element or
+// pair starts into at most `parts` pieces of similar size. `bounds` gets the
+// index entry each piece starts at, then the entry that ends the last one
+// (the root's closing bracket, or end of input for a root object without
+// braces). Returns false when the text has no such root or does not split.
+//
+// Array elements can start a piece anywhere. A key is only recognized after
+// a container value, since telling keys from scalar values would mean lexing
+// every top-level token. Malformed input may split oddly; the pieces then
+// fail to parse and the caller falls back to a serial parse.
+bool split_root(std::string_view text, const StructuralIndex& index, unsigned parts,
+                Items& items, std::vector<size_t>& bounds) {
+  const std::vector<uint32_t>& at = index.tokens;
+  if (!index.complete || at.size() < 2) return false;
+  size_t e = 0;
+  size_t base = 1;
+  char c = text[at[0]];
+  if (c == '[') {
+    items = Items::Array;
+    e = 1;
+  } else if (c == '{') {
+    items = Items::Object;
+    e = 1;
+  } else {
+    // A root object without braces, by SaxParser::parse_document()'s rule.
+    IndexedLexer lex(text, index);
+    lex.advance();
+    if (lex.token() != Lexer::Token::Identifier && lex.token() != Lexer::Token::String)
+      return false;
+    lex.advance();
+    if (lex.token() == Lexer::Token::Eof) return false;
+    items = Items::RootObject;
+    base = 0;
   }
-
-  Value parse_value(size_t depth) {
-    if (depth > max_depth_) throw std::runtime_error("Maximum nesting depth exceeded");
-    switch (lex_.token()) {
-      case Lexer::Token::LBrace:
-        return parse_object(depth);
-      case Lexer::Token::LBracket:
-        return parse_array(depth);
-      case Lexer::Token::String:
-        return parse_string_val();
-      case Lexer::Token::Identifier: {
-        Value v = Value::string_val(lex_.string_val());
-        lex_.advance();
-        return v;
+  bounds.assign(1, e);
+  size_t first = at[e];
+  size_t step = (text.size() - first) / parts;
+  size_t next = first + step;
+  size_t depth = base;
+  bool after_value = false;
+  for (; e + 1 < at.size(); ++e) {
+    c = text[at[e]];
+    if (depth == base && c != ',' && c != '}' && c != ']') {
+      bool starts = items == Items::Array || after_value;
+      after_value = false;
+      if (starts && at[e] >= next && bounds.size() < parts && e != bounds.back()) {
+        bounds.push_back(e);
+        next = at[e] + step;
       }
-      case Lexer::Token::Integer:
-        return parse_int_val();
-      case Lexer::Token::Float:
-        return parse_float_val();
-      case Lexer::Token::True:
-        return parse_true();
-      case Lexer::Token::False:
-        return parse_false();
-      case Lexer::Token::Null:
-        return parse_null();
-      default:
-        lex_.error("Unexpected token");
     }
-    return Value::null_val();
-  }
-
- private:
-  Value parse_string_val() {
-    Value v = Value::string_val(lex_.string_val());
-    lex_.advance();
-    return v;
-  }
-  Value parse_int_val() {
-    Value v = Value::int_val(lex_.int_val());
-    lex_.advance();
-    return v;
-  }
-  Value parse_float_val() {
-    Value v = Value::float_val(lex_.float_val());
-    lex_.advance();
-    return v;
-  }
-  Value parse_true() {
-    lex_.advance();
-    return Value::bool_val(true);
-  }
-  Value parse_false() {
-    lex_.advance();
-    return Value::bool_val(false);
+    if (c == '{' || c == '[') {
+      ++depth;
+    } else if (c == '}' || c == ']') {
+      if (depth == 0) return false;
+      if (--depth == 0 && base == 1) break;
+      after_value = depth == base;
+    } else if (c == '"' || c == '\'') {
+      ++e;  // its end entry
+    }
   }
-  Value parse_null() {
-    lex_.advance();
-    return Value::null_val();
+  if (base == 1) {
+    // The closing bracket must be the last token.
+    if (depth != 0 || e + 2 != at.size()) return false;
+  } else if (depth != 0) {
+    return false;
   }
+  bounds.push_back(e);
+  return bounds.size() > 2;
+}
 
-  Value parse_object(size_t depth) {
-    lex_.advance();  // consume {
-    Value v;
-    v.type = Value::Type::Object;
-    while (lex_.token() != Lexer::Token::RBrace) {
-      std::string key;
-      if (lex_.token() == Lexer::Token::Identifier)
-        key = lex_.string_val();
-      else if (lex_.token() == Lexer::Token::String)
-        key = lex_.string_val();
-      else
-        lex_.error("Expected key");
-      lex_.advance();
-      if (lex_.token() == Lexer::Token::Colon) lex_.advance();
-      for (const auto& p : v.obj)
-        if (p.first == key) lex_.error("Duplicate key");
-      v.obj.emplace_back(key, parse_value(depth + 1));
-      if (lex_.token() == Lexer::Token::Comma) lex_.advance();
-    }
-    lex_.advance();  // consume }
-    return v;
-  }
+Value parse_piece(std::string_view text, const StructuralIndex& index, size_t first, size_t end,
+                  Items items, const ParseOptions& options) {
+  TreeBuilder builder(items == Items::Array ? Value::Type::Array : Value::Type::Object, options.cancel);
+  IndexedLexer lex(text.substr(0, index.tokens[end]), index, first);
+  SaxParser<TreeBuilder, IndexedLexer> parser(std::move(lex), builder, options.max_depth);
+  parser.parse_items(items);
+  return builder.take();
+}
 
-  Value parse_array(size_t depth) {
-    lex_.advance();  // consume [
-    Value v;
-    v.type = Value::Type::Array;
-    while (lex_.token() != Lexer::Token::RBracket) {
-      v.arr.push_back(parse_value(depth + 1));
-      if (lex_.token() == Lexer::Token::Comma) lex_.advance();
-    }
-    lex_.advance();  // consume ]
-    return v;
+// Parses the pieces from split_root() on the shared pool and joins them.
+// Returns false if a piece fails or a key repeats across pieces; Cancelled
+// propagates.
+bool parse_split(std::string_view text, const StructuralIndex& index,
+                 const std::vector<size_t>& bounds, Items items, const ParseOptions& options,
+                 Value& out) {
+  size_t n = bounds.size() - 1;
+  std::vector<Value> pieces(n);
+  try {
+    ThreadPool::shared().parallel_for(n, [&](size_t i) {
+      pieces[i] = parse_piece(text, index, bounds[i], bounds[i + 1], items, options);
+    });
+  } catch (const Cancelled&) {
+    throw;
+  } catch (const std::runtime_error&) {
+    return false;
   }
-
-  Lexer lex_;
-  size_t max_depth_;
-};
+  out = Value();
+  if (items == Items::Array) {
+    out.type = Value::Type::Array;
+    size_t total = 0;
+    for (const auto& p : pieces) total += p.arr.size();
+    out.arr.reserve(total);
+    for (auto& p : pieces)
+      for (auto& el : p.arr) out.arr.push_back(std::move(el));
+    return true;
+  }
+  out.type = Value::Type::Object;
+  size_t total = 0;
+  for (const auto& p : pieces) total += p.obj.size();
+  std::unordered_set<std::string_view> seen;
+  seen.reserve(total);
+  for (const auto& p : pieces)
+    for (const auto& kv : p.obj)
+      if (!seen.insert(kv.first).second) return false;
+  out.obj.reserve(total);
+  for (auto& p : pieces)
+    for (auto& kv : p.obj) out.obj.push_back(std::move(kv));
+  return true;
+}
 
 void stringify_value(const Value& v, std::string& out, bool quote_strings) {
   switch (v.type) {
@@ -350,6 +234,14 @@ void stringify_value(const Value& v, std::string& out, bool quote_strings) {
       }
       out += ']';
       break;
+    case Value::Type::Packed:
+      out += '[';
+      for (size_t i = 0; i < v.packed_count(); ++i) {
+        if (i) out += ' ';
+        stringify_value(v.packed_at(i), out, true);
+      }
+      out += ']';
+      break;
     case Value::Type::Object:
       out += '{';
       for (size_t i = 0; i < v.obj.size(); ++i) {
@@ -366,13 +258,33 @@ void stringify_value(const Value& v, std::string& out, bool quote_strings) {
 
 }  // namespace
 
-Value parse(const std::string& text, size_t max_depth, size_t max_input_len) {
-  if (text.size() > max_input_len)
-    throw std::runtime_error("Input exceeds maximum length");
-  Parser p(text, max_depth);
-  Value v = p.parse_document();
-  p.expect_eof();
-  return v;
+Value parse(const std::string& text, size_t max_depth, size_t max_input_len, ParseMode mode) {
+  TreeBuilder builder;
+  parse_sax(text, builder, max_depth, max_input_len, mode);
+  return builder.take();
+}
+
+Value parse(std::string_view text, const ParseOptions& options) {
+  if (options.threads <= 1 || text.size() < 2 * kMinChunk || text.size() > options.max_input_len ||
+      text.size() >= UINT32_MAX) {
+    TreeBuilder builder(options.cancel);
+    parse_sax(text, builder, options.max_depth, options.max_input_len, options.mode, options.cancel);
+    return builder.take();
+  }
+  StructuralIndex index = build_structural_index(text, options.cancel);
+  unsigned parts = static_cast<unsigned>(std::min<size_t>(options.threads, text.size() / kMinChunk));
+  Items items;
+  std::vector<size_t> bounds;
+  Value v;
+  if (split_root(text, index, parts, items, bounds) &&
+      parse_split(text, index, bounds, items, options, v))
+    return v;
+  // Not splittable, or invalid: one pass over the same index reports the
+  // error exactly as a serial parse does.
+  TreeBuilder builder(options.cancel);
+  SaxParser<TreeBuilder, IndexedLexer> parser(IndexedLexer(text, index), builder, options.max_depth);
+  parser.parse_document();
+  return builder.take();
 }
 
 std::string stringify(const Value& value) {
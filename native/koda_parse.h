@@ -2,13 +2,30 @@
 #define KODA_PARSE_H
 
 #include <string>
+#include <string_view>
 
+#include "koda_cancel.h"
+#include "koda_index.h"
 #include "koda_value.h"
 
 namespace koda {
 
+struct ParseOptions {
+  size_t max_depth = 256;
+  size_t max_input_len = 1000000;
+  ParseMode mode = ParseMode::Lexer;
+  // With more than one, a large root array or root object is split between
+  // top-level elements or pairs and the pieces are parsed in parallel. Any
+  // other document parses on the calling thread.
+  unsigned threads = 1;
+  // Polled while values are built; the parse throws Cancelled when it fires.
+  const CancelToken* cancel = nullptr;
+};
+
 // Parse KODA text to Value. Throws std::runtime_error on syntax error.
-Value parse(const std::string& text, size_t max_depth = 256, size_t max_input_len = 1000000);
+Value parse(const std::string& text, size_t max_depth = 256, size_t max_input_len = 1000000,
+            ParseMode mode = ParseMode::Lexer);
+Value parse(std::string_view text, const ParseOptions& options);
 
 // Serialize Value to KODA text.
 std::string stringify(const Value& value);
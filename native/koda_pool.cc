@@ -0,0 +1,240 @@
+#include "koda_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace koda {
+
+namespace {
+
+// The pool whose worker the current thread is (as its State), that worker's
+// index, and the priority of the task it is running.
+thread_local const void* tls_pool = nullptr;
+thread_local size_t tls_index = 0;
+thread_local Priority tls_priority = Priority::Normal;
+
+}  // namespace
+
+struct ThreadPool::State {
+  struct Worker {
+    std::mutex mu;
+    std::deque<Task> tasks[kPriorities];
+    std::thread thread;
+  };
+
+  // Guards the shared queues, `pending` and `stopping`.
+  mutable std::mutex mu;
+  std::condition_variable wake;
+  std::deque<Task> injected[kPriorities];
+  long pending = 0;  // queued tasks; briefly off by one while a task moves
+  bool stopping = false;
+
+  // Held while the worker list changes, and by stats() to read it.
+  mutable std::mutex config_mu;
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::atomic<unsigned> count{0};
+
+  std::atomic<size_t> active{0};
+  std::atomic<uint64_t> executed{0};
+  std::atomic<uint64_t> stolen{0};
+
+  bool on_worker() const { return tls_pool == this; }
+
+  void push(Task task, Priority priority) {
+    size_t p = static_cast<size_t>(priority);
+    if (on_worker()) {
+      Worker& w = *workers[tls_index];
+      std::lock_guard<std::mutex> lock(w.mu);
+      w.tasks[p].push_back(std::move(task));
+    } else {
+      std::lock_guard<std::mutex> lock(mu);
+      injected[p].push_back(std::move(task));
+    }
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      ++pending;
+    }
+    wake.notify_one();
+  }
+
+  // Highest priority first; within one, the worker's own newest task, then
+  // the oldest submitted from outside, then the oldest of another worker.
+  bool take(size_t self, Task& task, Priority& priority) {
+    size_t n = workers.size();
+    for (size_t p = 0; p < kPriorities; ++p) {
+      bool found = false;
+      {
+        Worker& w = *workers[self];
+        std::lock_guard<std::mutex> lock(w.mu);
+        if (!w.tasks[p].empty()) {
+          task = std::move(w.tasks[p].back());
+          w.tasks[p].pop_back();
+          found = true;
+        }
+      }
+      if (!found) {
+        std::lock_guard<std::mutex> lock(mu);
+        if (!injected[p].empty()) {
+          task = std::move(injected[p].front());
+          injected[p].pop_front();
+          found = true;
+        }
+      }
+      for (size_t k = 1; !found && k < n; ++k) {
+        Worker& victim = *workers[(self + k) % n];
+        std::lock_guard<std::mutex> lock(victim.mu);
+        if (!victim.tasks[p].empty()) {
+          task = std::move(victim.tasks[p].front());
+          victim.tasks[p].pop_front();
+          stolen.fetch_add(1, std::memory_order_relaxed);
+          found = true;
+        }
+      }
+      if (found) {
+        priority = static_cast<Priority>(p);
+        std::lock_guard<std::mutex> lock(mu);
+        --pending;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void run(size_t self) {
+    tls_pool = this;
+    tls_index = self;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mu);
+        wake.wait(lock, [this] { return stopping || pending > 0; });
+        if (stopping) return;
+      }
+      Task task;
+      if (!take(self, task, tls_priority)) continue;
+      active.fetch_add(1, std::memory_order_relaxed);
+      task();
+      active.fetch_sub(1, std::memory_order_relaxed);
+      executed.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  void start(unsigned n) {
+    stopping = false;
+    for (unsigned i = 0; i < n; ++i) workers.push_back(std::make_unique<Worker>());
+    count = n;
+    for (unsigned i = 0; i < n; ++i) workers[i]->thread = std::thread([this, i] { run(i); });
+  }
+
+  // Joins the workers and moves the tasks left in their deques to the
+  // shared queues.
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto& w : workers) w->thread.join();
+    std::lock_guard<std::mutex> lock(mu);
+    for (auto& w : workers)
+      for (size_t p = 0; p < kPriorities; ++p)
+        for (auto& t : w->tasks[p]) injected[p].push_back(std::move(t));
+    workers.clear();
+  }
+};
+
+ThreadPool::ThreadPool(unsigned threads) : state_(std::make_unique<State>()) {
+  state_->start(std::max(1u, threads));
+}
+
+ThreadPool::~ThreadPool() {
+  std::lock_guard<std::mutex> lock(state_->config_mu);
+  state_->stop();
+}
+
+void ThreadPool::submit(Task task, Priority priority) { state_->push(std::move(task), priority); }
+
+void ThreadPool::parallel_for(size_t n, const std::function<void(size_t)>& f) {
+  if (n == 0) return;
+  if (n == 1) {
+    f(0);
+    return;
+  }
+  struct Group {
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> done{0};
+    std::vector<std::exception_ptr> errors;
+    std::mutex mu;
+    std::condition_variable finished;
+  };
+  auto group = std::make_shared<Group>();
+  group->errors.resize(n);
+  // Helpers that start after every index is claimed return without touching
+  // `f`, so it may live on this frame.
+  const std::function<void(size_t)>* fn = &f;
+  auto work = [group, n, fn] {
+    for (size_t i; (i = group->next.fetch_add(1)) < n;) {
+      try {
+        (*fn)(i);
+      } catch (...) {
+        group->errors[i] = std::current_exception();
+      }
+      if (group->done.fetch_add(1) + 1 == n) {
+        std::lock_guard<std::mutex> lock(group->mu);
+        group->finished.notify_all();
+      }
+    }
+  };
+  // A thread outside the pool is blocked until this returns, so its helpers
+  // go ahead of queued async work.
+  Priority priority = state_->on_worker() ? tls_priority : Priority::High;
+  size_t helpers = std::min<size_t>(n - 1, state_->count.load());
+  for (size_t h = 0; h < helpers; ++h) state_->push(work, priority);
+  work();
+  {
+    std::unique_lock<std::mutex> lock(group->mu);
+    group->finished.wait(lock, [&] { return group->done.load() == n; });
+  }
+  // Taken out of the group, which a late helper may be the one to free.
+  std::vector<std::exception_ptr> errors = std::move(group->errors);
+  for (auto& e : errors)
+    if (e) std::rethrow_exception(e);
+}
+
+void ThreadPool::set_threads(unsigned threads) {
+  if (state_->on_worker()) throw std::runtime_error("Cannot resize the thread pool from its own task");
+  std::lock_guard<std::mutex> lock(state_->config_mu);
+  state_->stop();
+  state_->start(std::max(1u, threads));
+}
+
+unsigned ThreadPool::threads() const { return state_->count.load(); }
+
+PoolStats ThreadPool::stats() const {
+  PoolStats out;
+  std::lock_guard<std::mutex> config(state_->config_mu);
+  out.threads = static_cast<unsigned>(state_->workers.size());
+  out.active = state_->active.load();
+  out.executed = state_->executed.load();
+  out.stolen = state_->stolen.load();
+  for (auto& w : state_->workers) {
+    std::lock_guard<std::mutex> lock(w->mu);
+    for (size_t p = 0; p < kPriorities; ++p) out.queued[p] += w->tasks[p].size();
+  }
+  std::lock_guard<std::mutex> lock(state_->mu);
+  for (size_t p = 0; p < kPriorities; ++p) out.queued[p] += state_->injected[p].size();
+  return out;
+}
+
+ThreadPool& ThreadPool::shared() {
+  static ThreadPool* pool = new ThreadPool(std::thread::hardware_concurrency());
+  return *pool;
+}
+
+}  // namespace koda
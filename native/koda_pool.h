@@ -0,0 +1,65 @@
+#ifndef KODA_POOL_H
+#define KODA_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace koda {
+
+// Scheduling class of a pool task. Queued High tasks always start before
+// Normal ones, and Normal before Low; running tasks are never preempted.
+enum class Priority : uint8_t { High, Normal, Low };
+constexpr size_t kPriorities = 3;
+
+struct PoolStats {
+  unsigned threads = 0;
+  size_t active = 0;                 // tasks running now
+  size_t queued[kPriorities] = {};   // tasks waiting, by Priority
+  uint64_t executed = 0;             // tasks finished since the pool started
+  uint64_t stolen = 0;               // of those, taken from another worker's deque
+};
+
+// Work-stealing thread pool. Each worker has a deque per priority: it pushes
+// and pops its own tasks at the back, and idle workers steal from the front,
+// so the subtasks of a large job spread over whichever workers are free.
+// Tasks submitted from outside the pool go to a shared queue per priority.
+class ThreadPool {
+ public:
+  using Task = std::function<void()>;
+
+  explicit ThreadPool(unsigned threads);
+  // Waits for running tasks; queued tasks are dropped.
+  ~ThreadPool();
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Queues a task. It must not throw.
+  void submit(Task task, Priority priority = Priority::Normal);
+
+  // Runs f(0) .. f(n - 1) and returns when all are done. Helper tasks that
+  // claim indices are queued for other workers to steal at the caller's
+  // priority, and the calling thread claims indices itself, so this never
+  // waits on a task that has not started, and may be called from inside a
+  // task. Rethrows the exception of the lowest index that failed.
+  void parallel_for(size_t n, const std::function<void(size_t)>& f);
+
+  // Restarts the workers with a new count (at least 1). Running tasks finish
+  // first; queued tasks are kept.
+  void set_threads(unsigned threads);
+  unsigned threads() const;
+  PoolStats stats() const;
+
+  // The process-wide pool used by the addon, with one worker per hardware
+  // thread. Never destroyed.
+  static ThreadPool& shared();
+
+ private:
+  struct State;
+  std::unique_ptr<State> state_;
+};
+
+}  // namespace koda
+
+#endif
@@ -0,0 +1,572 @@
+#ifndef KODA_SAX_H
+#define KODA_SAX_H
+
+#include <cctype>
+#include <cerrno>
+#include <cfloat>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "koda_index.h"
+
+namespace koda {
+
+// Tokenizer for KODA text. String and identifier tokens are views into the
+// input, or into an internal buffer when escapes had to be decoded; either
+// way they are valid until the next advance().
+class Lexer {
+ public:
+  explicit Lexer(std::string_view text)
+      : data_(text), pos_(0), line_(1), col_(1), start_line_(1), start_col_(1) {}
+
+  enum class Token {
+    Eof,
+    LBrace,
+    RBrace,
+    LBracket,
+    RBracket,
+    Colon,
+    Comma,
+    String,
+    Identifier,
+    Integer,
+    Float,
+    True,
+    False,
+    Null,
+  };
+
+  Token token() const { return token_; }
+  std::string_view string_val() const { return string_val_; }
+  int64_t int_val() const { return int_val_; }
+  double float_val() const { return float_val_; }
+
+  void advance() {
+    skip_ws_and_comments();
+    start_line_ = line_;
+    start_col_ = col_;
+    start_pos_ = pos_;
+    if (pos_ >= data_.size()) {
+      token_ = Token::Eof;
+      return;
+    }
+    char c = data_[pos_];
+    if (c == '{') { pos_++; token_ = Token::LBrace; return; }
+    if (c == '}') { pos_++; token_ = Token::RBrace; return; }
+    if (c == '[') { pos_++; token_ = Token::LBracket; return; }
+    if (c == ']') { pos_++; token_ = Token::RBracket; return; }
+    if (c == ':') { pos_++; token_ = Token::Colon; return; }
+    if (c == ',') { pos_++; token_ = Token::Comma; return; }
+    if (c == '"' || c == '\'') { read_quoted(c); return; }
+    if (c == '-' || (c >= '0' && c <= '9')) { read_number(); return; }
+    if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') { read_identifier(); return; }
+    error("Unexpected character");
+  }
+
+  [[noreturn]] void error(const std::string& msg) const {
+    if (!track_positions_) {
+      // Line and column come from lexing the input up to this token; an
+      // error inside a token is thrown by that lexer itself.
+      Lexer lex(data_);
+      lex.advance();
+      while (lex.token() != Token::Eof && lex.start_pos_ < start_pos_) lex.advance();
+      lex.error(msg);
+    }
+    throw std::runtime_error(msg + " at line " + std::to_string(start_line_) +
+                             " column " + std::to_string(start_col_));
+  }
+
+ protected:
+  void skip_ws_and_comments() {
+    while (pos_ < data_.size()) {
+      char c = data_[pos_];
+      if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+        if (c == '\n') { line_++; col_ = 1; } else { col_++; }
+        pos_++;
+        continue;
+      }
+      if (c == '/' && pos_ + 1 < data_.size() && data_[pos_ + 1] == '/') {
+        pos_ += 2;
+        while (pos_ < data_.size() && data_[pos_] != '\n') pos_++;
+        continue;
+      }
+      if (c == '/' && pos_ + 1 < data_.size() && data_[pos_ + 1] == '*') {
+        pos_ += 2;
+        size_t depth = 1;
+        while (depth > 0 && pos_ + 1 < data_.size()) {
+          if (data_[pos_] == '*' && data_[pos_ + 1] == '/') { pos_ += 2; depth--; }
+          else if (data_[pos_] == '/' && data_[pos_ + 1] == '*') { pos_ += 2; depth++; }
+          else { if (data_[pos_] == '\n') { line_++; col_ = 1; } else col_++; pos_++; }
+        }
+        if (depth != 0) error("Unclosed comment");
+        continue;
+      }
+      return;
+    }
+  }
+
+  // The token is a view into the input until the first escape; from there
+  // on it is decoded into unescaped_.
+  void read_quoted(char quote) {
+    pos_++;
+    size_t start = pos_;
+    bool escaped = false;
+    bool closed = false;
+    while (pos_ < data_.size()) {
+      char c = data_[pos_++];
+      col_++;
+      if (c == quote) { closed = true; break; }
+      if (c == '\\') {
+        if (!escaped) {
+          unescaped_.assign(data_.data() + start, pos_ - 1 - start);
+          escaped = true;
+        }
+        if (pos_ >= data_.size()) error("Unclosed string");
+        c = data_[pos_++];
+        col_++;
+        if (c == quote) unescaped_ += quote;
+        else if (c == '\\') unescaped_ += '\\';
+        else if (c == 'n') unescaped_ += '\n';
+        else if (c == 'r') unescaped_ += '\r';
+        else if (c == 't') unescaped_ += '\t';
+        else unescaped_ += c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        error("Control character in string");
+      } else if (escaped) {
+        unescaped_ += c;
+      }
+    }
+    if (!closed) error("Unclosed string");
+    string_val_ = escaped ? std::string_view(unescaped_) : data_.substr(start, pos_ - 1 - start);
+    token_ = Token::String;
+  }
+
+  void read_number() {
+    size_t start = pos_;
+    if (data_[pos_] == '-') pos_++, col_++;
+    if (data_[pos_] == '0' && pos_ + 1 < data_.size()) {
+      char n = data_[pos_ + 1];
+      if (n >= '0' && n <= '9') error("Leading zero");
+    }
+    bool is_float = false;
+    while (pos_ < data_.size() && std::isdigit(static_cast<unsigned char>(data_[pos_])))
+      pos_++, col_++;
+    if (pos_ < data_.size() && data_[pos_] == '.') {
+      is_float = true;
+      pos_++, col_++;
+      while (pos_ < data_.size() && std::isdigit(static_cast<unsigned char>(data_[pos_])))
+        pos_++, col_++;
+    }
+    if (pos_ < data_.size() && (data_[pos_] == 'e' || data_[pos_] == 'E')) {
+      is_float = true;
+      pos_++, col_++;
+      if (pos_ < data_.size() && (data_[pos_] == '+' || data_[pos_] == '-')) pos_++, col_++;
+      while (pos_ < data_.size() && std::isdigit(static_cast<unsigned char>(data_[pos_])))
+        pos_++, col_++;
+    }
+    std::string num_str(data_.substr(start, pos_ - start));
+    if (is_float) {
+      try {
+        float_val_ = std::stod(num_str);
+      } catch (...) {
+        error("Invalid float");
+      }
+      token_ = Token::Float;
+    } else {
+      try {
+        int_val_ = std::stoll(num_str);
+      } catch (...) {
+        error("Invalid integer");
+      }
+      token_ = Token::Integer;
+    }
+  }
+
+  void read_identifier() {
+    size_t start = pos_;
+    while (pos_ < data_.size()) {
+      char c = data_[pos_];
+      if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_' && c != '-') break;
+      pos_++;
+      col_++;
+    }
+    string_val_ = data_.substr(start, pos_ - start);
+    if (string_val_ == "true") token_ = Token::True;
+    else if (string_val_ == "false") token_ = Token::False;
+    else if (string_val_ == "null") token_ = Token::Null;
+    else token_ = Token::Identifier;
+  }
+
+  std::string_view data_;
+  size_t pos_;
+  size_t start_pos_ = 0;
+  int line_, col_;
+  int start_line_, start_col_;
+  bool track_positions_ = true;  // false when positions are not followed
+  Token token_ = Token::Eof;
+  std::string_view string_val_;
+  std::string unescaped_;
+  int64_t int_val_ = 0;
+  double float_val_ = 0;
+};
+
+// Lexer that jumps between the token starts of a StructuralIndex instead of
+// scanning whitespace, comments and string bodies. Tokens are Lexer's; an
+// error is reported at the position Lexer would give, found by lexing the
+// input again up to the failing token.
+class IndexedLexer : public Lexer {
+ public:
+  // Lexes from index entry `first`. `text` may stop short of the indexed
+  // input at an entry boundary, which then reads as end of input.
+  IndexedLexer(std::string_view text, const StructuralIndex& index, size_t first = 0)
+      : Lexer(text), index_(&index), next_(first) {
+    track_positions_ = false;
+  }
+
+  void advance() {
+    // A number or identifier can stop inside what the index records as one
+    // run ("12ab"); the rest of the run is the next token.
+    if (in_run_ && pos_ < data_.size() && !ends_run(data_[pos_])) {
+      lex_here();
+      return;
+    }
+    const std::vector<uint32_t>& at = index_->tokens;
+    pos_ = at[next_];
+    if (next_ + 1 == at.size()) {
+      if (!index_->complete) {
+        start_pos_ = pos_;
+        error("Unexpected character");
+      }
+    } else {
+      ++next_;
+    }
+    char c = pos_ < data_.size() ? data_[pos_] : '\0';
+    switch (c) {
+      case '{': return op(Token::LBrace);
+      case '}': return op(Token::RBrace);
+      case '[': return op(Token::LBracket);
+      case ']': return op(Token::RBracket);
+      case ':': return op(Token::Colon);
+      case ',': return op(Token::Comma);
+      case '"':
+      case '\'': {
+        size_t end = at[next_++];
+        const char* body = data_.data() + pos_ + 1;
+        size_t len = end - pos_ - 2;
+        if (memchr(body, '\\', len)) return lex_slow();
+        start_pos_ = pos_;
+        string_val_ = std::string_view(body, len);
+        token_ = Token::String;
+        pos_ = end;
+        in_run_ = false;
+        return;
+      }
+      default:
+        lex_here();
+    }
+  }
+
+ private:
+  static bool ends_run(char c) {
+    switch (c) {
+      case ' ': case '\t': case '\r': case '\n':
+      case '{': case '}': case '[': case ']': case ':': case ',':
+      case '"': case '\'': case '/':
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+  // ASCII only; bytes above 0x7F are left to Lexer's locale-aware checks.
+  static bool is_alpha(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+
+  void op(Token token) {
+    start_pos_ = pos_++;
+    token_ = token;
+    in_run_ = false;
+  }
+
+  // Numbers and identifiers as Lexer reads them, without its line and column
+  // bookkeeping. Anything else, including every error and integers too long
+  // to convert here, goes through Lexer::advance().
+  void lex_here() {
+    size_t n = data_.size();
+    size_t p = pos_;
+    char c = p < n ? data_[p] : '\0';
+    if (c == '-' || is_digit(c)) {
+      bool neg = c == '-';
+      if (neg) ++p;
+      if (p + 1 < n && data_[p] == '0' && is_digit(data_[p + 1])) return lex_slow();
+      size_t digits = p;
+      while (p < n && is_digit(data_[p])) ++p;
+      size_t int_digits = p - digits;
+      bool is_float = false;
+      if (p < n && data_[p] == '.') {
+        is_float = true;
+        ++p;
+        while (p < n && is_digit(data_[p])) ++p;
+      }
+      if (p < n && (data_[p] == 'e' || data_[p] == 'E')) {
+        is_float = true;
+        ++p;
+        if (p < n && (data_[p] == '+' || data_[p] == '-')) ++p;
+        while (p < n && is_digit(data_[p])) ++p;
+      }
+      if (is_float) {
+        if (exact_float(pos_, p)) return;
+        // strtod() on a terminated copy is what std::stod() does.
+        char buf[64];
+        size_t len = p - pos_;
+        if (len >= sizeof buf) return lex_slow();
+        memcpy(buf, data_.data() + pos_, len);
+        buf[len] = '\0';
+        char* end;
+        errno = 0;
+        double x = std::strtod(buf, &end);
+        if (end == buf || errno == ERANGE) return lex_slow();
+        float_val_ = x;
+        token_ = Token::Float;
+      } else {
+        if (int_digits == 0 || int_digits > 18) return lex_slow();
+        int64_t x = 0;
+        for (size_t i = digits; i < p; ++i) x = x * 10 + (data_[i] - '0');
+        int_val_ = neg ? -x : x;
+        token_ = Token::Integer;
+      }
+    } else if (is_alpha(c) || c == '_') {
+      while (p < n && (is_alpha(data_[p]) || is_digit(data_[p]) || data_[p] == '_' || data_[p] == '-'))
+        ++p;
+      if (p < n && static_cast<unsigned char>(data_[p]) > 0x7F) return lex_slow();
+      string_val_ = data_.substr(pos_, p - pos_);
+      if (string_val_ == "true") token_ = Token::True;
+      else if (string_val_ == "false") token_ = Token::False;
+      else if (string_val_ == "null") token_ = Token::Null;
+      else token_ = Token::Identifier;
+    } else {
+      return lex_slow();
+    }
+    start_pos_ = pos_;
+    pos_ = p;
+    in_run_ = true;
+  }
+
+  // Decimal [-]digits[.digits] with at most 15 significant digits: the
+  // digits and the power of ten are exact doubles, so one division rounds
+  // correctly and gives strtod()'s result.
+  bool exact_float(size_t from, size_t to) {
+#if FLT_EVAL_METHOD == 0
+    size_t p = from;
+    bool neg = data_[p] == '-';
+    if (neg) ++p;
+    int64_t m = 0;
+    int digits = 0;
+    int scale = 0;
+    bool dot = false;
+    for (; p < to; ++p) {
+      char c = data_[p];
+      if (c == '.') {
+        if (dot) return false;
+        dot = true;
+        continue;
+      }
+      if (!is_digit(c) || ++digits > 15) return false;
+      m = m * 10 + (c - '0');
+      if (dot) ++scale;
+    }
+    if (digits == 0) return false;
+    static const double kPow10[] = {1e0, 1e1, 1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                    1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+    double x = static_cast<double>(m) / kPow10[scale];
+    float_val_ = neg ? -x : x;
+    token_ = Token::Float;
+    start_pos_ = pos_;
+    pos_ = to;
+    in_run_ = true;
+    return true;
+#else
+    (void)from;
+    (void)to;
+    return false;
+#endif
+  }
+
+  void lex_slow() {
+    Lexer::advance();
+    in_run_ = token_ >= Token::Identifier;  // identifier, number or literal
+  }
+
+  const StructuralIndex* index_;
+  size_t next_;
+  bool in_run_ = false;
+};
+
+// Event-driven parser over the KODA text grammar. Handler is any type with
+//
+//   void on_object_start();    void on_object_end();
+//   bool on_key(std::string_view key);   // false rejects a duplicate key
+//   void on_array_start();     void on_array_end();
+//   void on_string(std::string_view s);
+//   void on_int(int64_t x);    void on_float(double x);
+//   void on_bool(bool b);      void on_null();
+//
+// Calls are resolved at compile time. Keys and strings are views that are
+// only valid during the call. A root object without braces is reported like
+// one with braces. Errors throw std::runtime_error with line and column.
+// Lex is Lexer or IndexedLexer.
+template <typename Handler, typename Lex = Lexer>
+class SaxParser {
+ public:
+  SaxParser(Lex lex, Handler& handler, size_t max_depth)
+      : lex_(std::move(lex)), handler_(handler), max_depth_(max_depth) {
+    lex_.advance();
+  }
+
+  void parse_document() {
+    bool root_object = false;
+    if (lex_.token() == Lexer::Token::Identifier || lex_.token() == Lexer::Token::String) {
+      Lex copy = lex_;
+      copy.advance();
+      root_object = copy.token() != Lexer::Token::Eof;
+    }
+    if (root_object)
+      parse_root_object(0);
+    else
+      parse_value(0);
+    if (lex_.token() != Lexer::Token::Eof) lex_.error("Expected end of input");
+  }
+
+  // The contents of a container, without its brackets, up to the end of
+  // input: elements of an array, pairs of an object, or pairs of a root
+  // object without braces (which take no commas). Events go to the handler
+  // as if the container were already open. Used to parse a root container
+  // in pieces.
+  enum class Items { Array, Object, RootObject };
+  void parse_items(Items items) {
+    if (items == Items::RootObject) {
+      while (lex_.token() == Lexer::Token::Identifier || lex_.token() == Lexer::Token::String) {
+        parse_key();
+        parse_value(1);
+      }
+      if (lex_.token() != Lexer::Token::Eof) lex_.error("Expected end of input");
+      return;
+    }
+    while (lex_.token() != Lexer::Token::Eof) {
+      if (items == Items::Object) {
+        if (lex_.token() != Lexer::Token::Identifier && lex_.token() != Lexer::Token::String)
+          lex_.error("Expected key");
+        parse_key();
+      }
+      parse_value(1);
+      if (lex_.token() == Lexer::Token::Comma) lex_.advance();
+    }
+  }
+
+ private:
+  void parse_root_object(size_t depth) {
+    handler_.on_object_start();
+    while (lex_.token() == Lexer::Token::Identifier || lex_.token() == Lexer::Token::String) {
+      parse_key();
+      parse_value(depth + 1);
+    }
+    handler_.on_object_end();
+  }
+
+  void parse_key() {
+    if (!handler_.on_key(lex_.string_val())) lex_.error("Duplicate key");
+    lex_.advance();
+    if (lex_.token() == Lexer::Token::Colon) lex_.advance();
+  }
+
+  void parse_value(size_t depth) {
+    if (depth > max_depth_) throw std::runtime_error("Maximum nesting depth exceeded");
+    switch (lex_.token()) {
+      case Lexer::Token::LBrace:
+        parse_object(depth);
+        return;
+      case Lexer::Token::LBracket:
+        parse_array(depth);
+        return;
+      case Lexer::Token::String:
+      case Lexer::Token::Identifier:
+        handler_.on_string(lex_.string_val());
+        break;
+      case Lexer::Token::Integer:
+        handler_.on_int(lex_.int_val());
+        break;
+      case Lexer::Token::Float:
+        handler_.on_float(lex_.float_val());
+        break;
+      case Lexer::Token::True:
+        handler_.on_bool(true);
+        break;
+      case Lexer::Token::False:
+        handler_.on_bool(false);
+        break;
+      case Lexer::Token::Null:
+        handler_.on_null();
+        break;
+      default:
+        lex_.error("Unexpected token");
+    }
+    lex_.advance();
+  }
+
+  void parse_object(size_t depth) {
+    lex_.advance();  // consume {
+    handler_.on_object_start();
+    while (lex_.token() != Lexer::Token::RBrace) {
+      if (lex_.token() != Lexer::Token::Identifier && lex_.token() != Lexer::Token::String)
+        lex_.error("Expected key");
+      parse_key();
+      parse_value(depth + 1);
+      if (lex_.token() == Lexer::Token::Comma) lex_.advance();
+    }
+    lex_.advance();  // consume }
+    handler_.on_object_end();
+  }
+
+  void parse_array(size_t depth) {
+    lex_.advance();  // consume [
+    handler_.on_array_start();
+    while (lex_.token() != Lexer::Token::RBracket) {
+      parse_value(depth + 1);
+      if (lex_.token() == Lexer::Token::Comma) lex_.advance();
+    }
+    lex_.advance();  // consume ]
+    handler_.on_array_end();
+  }
+
+  Lex lex_;
+  Handler& handler_;
+  size_t max_depth_;
+};
+
+// Parse KODA text, reporting it to `handler` as events (see SaxParser).
+// `cancel` is polled while the Indexed mode builds its index; the handler
+// polls its own token while events arrive.
+template <typename Handler>
+void parse_sax(std::string_view text, Handler& handler, size_t max_depth = 256,
+               size_t max_input_len = 1000000, ParseMode mode = ParseMode::Lexer,
+               const CancelToken* cancel = nullptr) {
+  if (text.size() > max_input_len) throw std::runtime_error("Input exceeds maximum length");
+  if (mode == ParseMode::Indexed && text.size() < UINT32_MAX) {
+    StructuralIndex index = build_structural_index(text, cancel);
+    SaxParser<Handler, IndexedLexer> parser(IndexedLexer(text, index), handler, max_depth);
+    parser.parse_document();
+    return;
+  }
+  SaxParser<Handler> parser(Lexer(text), handler, max_depth);
+  parser.parse_document();
+}
+
+}  // namespace koda
+
+#endif
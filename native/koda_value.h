@@ -2,6 +2,7 @@
 #define KODA_VALUE_H
 
 #include <cstdint>
+#include <cstring>
 #include <map>
 #include <memory>
 #include <string>
@@ -14,7 +15,10 @@ struct Value;
 using ValuePtr = std::shared_ptr<Value>;
 
 struct Value {
-  enum class Type { Null, Bool, Int, Float, String, Array, Object };
+  enum class Type { Null, Bool, Int, Float, String, Array, Object, Packed };
+
+  // Element type of a packed homogeneous numeric array (SPEC §6.6).
+  enum class Packed : uint8_t { Int8, Int16, Int32, Int64, Float32, Float64 };
 
   Type type = Type::Null;
   bool b = false;
@@ -23,6 +27,46 @@ struct Value {
   std::string s;
   std::vector<Value> arr;
   std::vector<std::pair<std::string, Value>> obj;  // key-order preserved; sorted at encode
+  Packed packed_type = Packed::Int64;
+  std::vector<uint8_t> packed;  // host byte order, packed_width() bytes per element
+  // Set by decode. String: string-table index (SPEC §6.9), so equal strings
+  // can share one handle. Array/Object/Packed: index of a shared subtree
+  // (SPEC §6.10); the node is an empty placeholder for that subtree. -1 otherwise.
+  int32_t ref = -1;
+
+  static size_t packed_width(Packed t) {
+    switch (t) {
+      case Packed::Int8: return 1;
+      case Packed::Int16: return 2;
+      case Packed::Int32:
+      case Packed::Float32: return 4;
+      case Packed::Int64:
+      case Packed::Float64: return 8;
+    }
+    return 8;
+  }
+  static bool packed_is_float(Packed t) { return t == Packed::Float32 || t == Packed::Float64; }
+
+  size_t packed_count() const { return packed.size() / packed_width(packed_type); }
+
+  int64_t packed_int(size_t i) const {
+    const uint8_t* p = packed.data() + i * packed_width(packed_type);
+    switch (packed_type) {
+      case Packed::Int8: { int8_t x; memcpy(&x, p, 1); return x; }
+      case Packed::Int16: { int16_t x; memcpy(&x, p, 2); return x; }
+      case Packed::Int32: { int32_t x; memcpy(&x, p, 4); return x; }
+      case Packed::Int64: { int64_t x; memcpy(&x, p, 8); return x; }
+      default: return static_cast<int64_t>(packed_float(i));
+    }
+  }
+  double packed_float(size_t i) const {
+    const uint8_t* p = packed.data() + i * packed_width(packed_type);
+    if (packed_type == Packed::Float32) { float x; memcpy(&x, p, 4); return x; }
+    if (packed_type == Packed::Float64) { double x; memcpy(&x, p, 8); return x; }
+    return static_cast<double>(packed_int(i));
+  }
+  // Element i as a scalar Value (Int or Float).
+  Value packed_at(size_t i) const;
 
   static Value null_val() {
     Value v;
@@ -53,8 +97,19 @@ struct Value {
     v.s = std::move(x);
     return v;
   }
+  static Value packed_val(Packed t, std::vector<uint8_t> bytes) {
+    Value v;
+    v.type = Type::Packed;
+    v.packed_type = t;
+    v.packed = std::move(bytes);
+    return v;
+  }
 };
 
+inline Value Value::packed_at(size_t i) const {
+  return packed_is_float(packed_type) ? float_val(packed_float(i)) : int_val(packed_int(i));
+}
+
 }  // namespace koda
 
 #endif
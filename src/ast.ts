@@ -13,6 +13,7 @@ export interface SourcePosition {
 export type KodaValue =
   | KodaObject
   | KodaArray
+  | KodaTypedArray
   | string
   | number
   | boolean
@@ -24,15 +25,31 @@ export interface KodaObject {
 
 export type KodaArray = KodaValue[];
 
+/**
+ * Homogeneous numeric array. Encodes to a packed array (SPEC §6.6); decode
+ * returns one when `typedArrays` is set.
+ */
+export type KodaTypedArray =
+  | Int8Array
+  | Int16Array
+  | Int32Array
+  | BigInt64Array
+  | Float32Array
+  | Float64Array;
+
 /** Type guard for object (and not array, which is also typeof 'object' in JSON) */
 export function isKodaObject(v: KodaValue): v is KodaObject {
-  return typeof v === 'object' && v !== null && Array.isArray(v) === false;
+  return typeof v === 'object' && v !== null && Array.isArray(v) === false && !ArrayBuffer.isView(v);
 }
 
 export function isKodaArray(v: KodaValue): v is KodaArray {
   return Array.isArray(v);
 }
 
+export function isKodaTypedArray(v: KodaValue): v is KodaTypedArray {
+  return ArrayBuffer.isView(v);
+}
+
 export function isKodaString(v: KodaValue): v is string {
   return typeof v === 'string';
 }
@@ -0,0 +1,161 @@
+/**
+ * Content-addressed cache of parse and decode results, for inputs that are
+ * loaded again and again but rarely change (config reload loops).
+ */
+
+import { createHash } from 'node:crypto';
+import { dirname, join } from 'node:path';
+import { fileURLToPath } from 'node:url';
+import type { KodaValue } from './ast.js';
+import { decode as decodeBinary } from './decoder.js';
+import type { DecodeOptions } from './decoder.js';
+import { KodaDecodeError, KodaParseError } from './errors.js';
+import { loadNative, nativeDictionary, type NativeBinding, type NativeParseCache } from './native.js';
+import { parseFast } from './parseFast.js';
+import type { ParseOptions } from './parser.js';
+
+const addonPath = join(dirname(dirname(fileURLToPath(import.meta.url))), 'build', 'Release', 'koda_js.node');
+
+function getNative(): NativeBinding | null {
+  return loadNative(import.meta.url, addonPath);
+}
+
+const DEFAULT_MAX_BYTES = 64 * 1024 * 1024;
+
+export interface ParseCacheOptions {
+  /** Total size of the cached inputs, in bytes, before the least recently used are dropped (default 64 MiB). */
+  maxBytes?: number;
+}
+
+export interface ParseCacheStats {
+  entries: number;
+  /** Size of the cached inputs. */
+  bytes: number;
+  maxBytes: number;
+  hits: number;
+  misses: number;
+  evictions: number;
+}
+
+/**
+ * Results keyed by a hash of the input bytes and the options that shape the
+ * result. Every value it returns is deeply frozen, and a hit returns the
+ * same object as the call that filled the entry. Typed arrays cannot be
+ * frozen, so `typedArrays` is refused rather than cached.
+ */
+export interface ParseCache {
+  /** parse() through the cache. A Buffer is taken as UTF-8 text and hashed in place. */
+  parse(text: string | Uint8Array, options?: ParseOptions): KodaValue;
+  /** decodeSync() through the cache. `lazy` and `threads` are ignored; `typedArrays` throws. */
+  decode(buffer: Uint8Array, options?: DecodeOptions): KodaValue;
+  stats(): ParseCacheStats;
+  /** Drop every entry and reset the hit, miss and eviction counters. */
+  clear(): void;
+}
+
+/**
+ * Create a parse cache. With the addon, inputs are hashed with XXH64 in
+ * native code, and a hit also compares the input with the cached copy, so a
+ * hash collision is a miss. Without it, inputs are keyed by SHA-256.
+ */
+export function createParseCache(options: ParseCacheOptions = {}): ParseCache {
+  const native = getNative();
+  if (native) return nativeCache(native, new native.ParseCache({ maxBytes: options.maxBytes }));
+  return jsCache(options.maxBytes ?? DEFAULT_MAX_BYTES);
+}
+
+function nativeCache(native: NativeBinding, cache: NativeParseCache): ParseCache {
+  return {
+    parse(text, options) {
+      const input = typeof text === 'string' ? text : asBuffer(text);
+      try {
+        return cache.parse(input, {
+          maxDepth: options?.maxDepth,
+          maxInputLength: options?.maxInputLength,
+          mode: options?.mode,
+        }) as KodaValue;
+      } catch (e) {
+        throw e instanceof KodaParseError ? e : new KodaParseError((e as Error).message);
+      }
+    },
+    decode(buffer, options) {
+      try {
+        return cache.decode(asBuffer(buffer), {
+          maxDepth: options?.maxDepth,
+          maxDictionarySize: options?.maxDictionarySize,
+          maxStringLength: options?.maxStringLength,
+          typedArrays: options?.typedArrays,
+          dictionary: nativeDictionary(native, options?.dictionary),
+        }) as KodaValue;
+      } catch (e) {
+        throw e instanceof KodaDecodeError ? e : new KodaDecodeError((e as Error).message);
+      }
+    },
+    stats: () => cache.stats(),
+    clear: () => cache.clear(),
+  };
+}
+
+function jsCache(maxBytes: number): ParseCache {
+  // A Map iterates in insertion order, so re-inserting on a hit keeps the
+  // least recently used entry first.
+  const entries = new Map<string, { value: KodaValue; bytes: number }>();
+  let bytes = 0;
+  let hits = 0;
+  let misses = 0;
+  let evictions = 0;
+
+  const cached = (input: Uint8Array, shape: string, build: () => KodaValue): KodaValue => {
+    const key = `${shape}:${input.byteLength}:${createHash('sha256').update(input).digest('base64')}`;
+    const hit = entries.get(key);
+    if (hit) {
+      hits++;
+      entries.delete(key);
+      entries.set(key, hit);
+      return hit.value;
+    }
+    misses++;
+    const value = deepFreeze(build());
+    if (input.byteLength > maxBytes) return value;
+    entries.set(key, { value, bytes: input.byteLength });
+    bytes += input.byteLength;
+    for (const [oldest, entry] of entries) {
+      if (bytes <= maxBytes) break;
+      entries.delete(oldest);
+      bytes -= entry.bytes;
+      evictions++;
+    }
+    return value;
+  };
+
+  return {
+    parse(text, options) {
+      const input = typeof text === 'string' ? Buffer.from(text, 'utf-8') : text;
+      const source = typeof text === 'string' ? text : asBuffer(text).toString('utf-8');
+      return cached(input, `p:${options?.maxDepth}:${options?.maxInputLength}`, () => parseFast(source, options));
+    },
+    decode(buffer, options) {
+      if (options?.typedArrays) throw new KodaDecodeError('The parse cache does not support typedArrays');
+      const dictionary = options?.dictionary?.id ?? '';
+      const shape = ['d', options?.maxDepth, options?.maxDictionarySize, options?.maxStringLength, dictionary].join(':');
+      return cached(buffer, shape, () => decodeBinary(buffer, { ...options, lazy: false }));
+    },
+    stats: () => ({ entries: entries.size, bytes, maxBytes, hits, misses, evictions }),
+    clear() {
+      entries.clear();
+      bytes = 0;
+      hits = misses = evictions = 0;
+    },
+  };
+}
+
+/** A Buffer over the same bytes, without copying. */
+function asBuffer(bytes: Uint8Array): Buffer {
+  return Buffer.isBuffer(bytes) ? bytes : Buffer.from(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+}
+
+function deepFreeze(value: KodaValue): KodaValue {
+  if (typeof value !== 'object' || value === null || ArrayBuffer.isView(value)) return value;
+  for (const child of Object.values(value)) deepFreeze(child as KodaValue);
+  return Object.freeze(value);
+}
@@ -10,9 +10,13 @@ import { Worker } from 'node:worker_threads';
 import type { KodaValue } from './ast.js';
 import type { DecodeOptions } from './decoder.js';
 import { KodaDecodeError } from './errors.js';
+import { lazyValue } from './lazy.js';
+import { loadNative } from './native.js';
+import type { CancelOptions } from './pool.js';
 
 const __filename = fileURLToPath(import.meta.url);
 const __dirname = dirname(__filename);
+const addonPath = join(dirname(__dirname), 'build', 'Release', 'koda_js.node');
 
 function getWorkerURL(): URL {
   const fromModule = join(__dirname, 'worker', 'decoder-worker.js');
@@ -24,38 +28,123 @@ function getWorkerURL(): URL {
 
 let nextId = 0;
 
+/** A worker has at most this many messages outstanding, so it never idles between jobs. */
+const MAX_WORKER_MESSAGES = 2;
+/** Most decodes sent in one batched message. */
+const MAX_BATCH_JOBS = 64;
+
 export interface DecoderPoolOptions {
   /** Number of worker threads (default 1). */
   poolSize?: number;
+  /** Most decodes admitted at once, queued or running (default 1024). */
+  maxQueue?: number;
+  /** Most buffer bytes admitted at once (default unlimited). A larger buffer is admitted when the pool is idle. */
+  maxQueueBytes?: number;
+  /** When the pool is full: 'wait' until there is room (default) or 'reject' at once. */
+  onFull?: 'wait' | 'reject';
+  /** Consecutive buffers smaller than this are sent to a worker in one message, up to this many bytes in total (default 64 KB, 0 disables). */
+  batchBytes?: number;
+}
+
+export interface DecoderWorkerStats {
+  /** Decodes sent to this worker and not yet answered. */
+  inFlight: number;
+  /** Their total size in bytes. */
+  inFlightBytes: number;
+  /** Decodes this worker has answered. */
+  completed: number;
+  /** Share of the pool's lifetime this worker had work, from 0 to 1. */
+  utilization: number;
+}
+
+export interface DecoderPoolStats {
+  /** Admitted decodes not yet sent to a worker. */
+  queued: number;
+  /** Their total size in bytes. */
+  queuedBytes: number;
+  /** Calls waiting for room in the pool (onFull 'wait'). */
+  waiting: number;
+  /** Decodes rejected because the pool was full (onFull 'reject'). */
+  rejected: number;
+  workers: DecoderWorkerStats[];
 }
 
 export interface DecoderPool {
-  /** Decode buffer in a worker; does not block the event loop. */
-  decode(buffer: Uint8Array, options?: DecodeOptions): Promise<KodaValue>;
-  /** Stop all workers. */
+  /**
+   * Decode buffer in a worker; does not block the event loop. A cancelled
+   * call leaves the queue at once; a running one stops in the worker when
+   * the addon is built.
+   */
+  decode(buffer: Uint8Array, options?: DecodeOptions & CancelOptions): Promise<KodaValue>;
+  /** Queue depth and per-worker load. */
+  stats(): DecoderPoolStats;
+  /** Stop all workers; pending decodes are rejected. */
   destroy(): void;
 }
 
+type WorkerReply = { id: number; value?: KodaValue; document?: number; error?: string };
+
+function settle(msg: WorkerReply, resolve: (v: KodaValue) => void, reject: (e: Error) => void): void {
+  if ('error' in msg && msg.error) {
+    reject(new KodaDecodeError(msg.error));
+  } else if ('document' in msg && msg.document !== undefined) {
+    // A lazy decode: the worker left the document in native memory.
+    const native = loadNative(import.meta.url, addonPath);
+    if (!native) return reject(new KodaDecodeError('Native addon is not available'));
+    try {
+      resolve(lazyValue(native, native.adoptDocument(msg.document)));
+    } catch (e) {
+      reject(new KodaDecodeError((e as Error).message));
+    }
+  } else if ('value' in msg && msg.value !== undefined) {
+    resolve(msg.value as KodaValue);
+  } else {
+    reject(new KodaDecodeError('Worker did not return value'));
+  }
+}
+
+/**
+ * Free the native document of a reply that will not be settled. Documents
+ * still in flight when a worker is terminated are freed as it exits.
+ */
+function discard(msg: WorkerReply): void {
+  if (msg.document !== undefined) loadNative(import.meta.url, addonPath)?.releaseDocument(msg.document);
+}
+
+/** Worker-side decode options: the cancel options hold an AbortSignal, which cannot be cloned. */
+function workerOptions(options: (DecodeOptions & CancelOptions) | undefined): DecodeOptions | undefined {
+  if (!options) return undefined;
+  const rest = { ...options };
+  delete rest.signal;
+  delete rest.deadlineMs;
+  return rest;
+}
+
+function deadlineError(): KodaDecodeError {
+  return new KodaDecodeError('Deadline exceeded');
+}
+
 /**
  * Decode binary in a worker thread. Main thread stays responsive.
- * Uses transferable ArrayBuffer when possible to avoid copy.
+ * Uses transferable ArrayBuffer when possible to avoid copy. With `lazy` and
+ * the addon, the result is not cloned back: the worker leaves the document in
+ * native memory and fields are converted on access. A cancelled call
+ * terminates its worker.
  */
-export function decodeAsync(buffer: Uint8Array, options?: DecodeOptions): Promise<KodaValue> {
+export function decodeAsync(buffer: Uint8Array, options?: DecodeOptions & CancelOptions): Promise<KodaValue> {
+  const signal = options?.signal;
+  if (signal?.aborted) return Promise.reject(signal.reason);
   const id = nextId++;
   const ab = buffer.buffer.slice(buffer.byteOffset, buffer.byteOffset + buffer.byteLength);
 
   return new Promise((resolve, reject) => {
     const worker = new Worker(getWorkerURL(), { workerData: null, eval: false });
-    const onMessage = (msg: { id: number; value?: KodaValue; error?: string }) => {
+    const onMessage = (msg: WorkerReply) => {
       if (msg.id !== id) return;
+      // Adopted before the worker is terminated: its exit frees whatever
+      // documents it still holds.
+      settle(msg, resolve, reject);
       cleanup();
-      if ('error' in msg && msg.error) {
-        reject(new KodaDecodeError(msg.error));
-      } else if ('value' in msg && msg.value !== undefined) {
-        resolve(msg.value as KodaValue);
-      } else {
-        reject(new KodaDecodeError('Worker did not return value'));
-      }
     };
     const onError = (err: Error) => {
       cleanup();
@@ -67,70 +156,328 @@ export function decodeAsync(buffer: Uint8Array, options?: DecodeOptions): Promis
         reject(new KodaDecodeError(`Worker exited with code ${code}`));
       }
     };
+    const onAbort = () => {
+      cleanup();
+      reject(signal!.reason);
+    };
+    const timer =
+      options?.deadlineMs !== undefined
+        ? setTimeout(() => {
+            cleanup();
+            reject(deadlineError());
+          }, options.deadlineMs)
+        : undefined;
     const cleanup = () => {
       worker.off('message', onMessage);
       worker.off('error', onError);
       worker.off('exit', onExit);
+      signal?.removeEventListener('abort', onAbort);
+      clearTimeout(timer);
       worker.terminate().catch(() => {});
     };
     worker.on('message', onMessage);
     worker.on('error', onError);
     worker.on('exit', onExit);
-    worker.postMessage({ id, buffer: ab, options }, [ab as ArrayBuffer]);
+    signal?.addEventListener('abort', onAbort, { once: true });
+    worker.postMessage({ id, buffer: ab, options: workerOptions(options) }, [ab as ArrayBuffer]);
   });
 }
 
+/** One pool.decode() call, from admission wait to settlement. */
+interface PoolCall {
+  buffer: Uint8Array;
+  options?: DecodeOptions;
+  /** Set on cancellable calls; the worker's native decode stops once its word is nonzero. */
+  flag?: Int32Array;
+  /** Set once admitted. */
+  job?: PoolJob;
+  settled: boolean;
+  resolve: (v: KodaValue) => void;
+  reject: (e: Error) => void;
+}
+
+interface PoolJob {
+  id: number;
+  bytes: number;
+  buffer: ArrayBuffer;
+  call: PoolCall;
+}
+
+interface PoolWorker {
+  worker: Worker;
+  pending: Map<number, PoolJob>;
+  messages: number;
+  bytes: number;
+  completed: number;
+  busyMs: number;
+  busySince: number;
+  dead: boolean;
+}
+
 /**
- * Create a pool of decoder workers for high throughput. Decode jobs are
- * distributed round-robin across workers.
+ * Create a pool of decoder workers for high throughput. Each batch of queued
+ * decodes goes to the worker with the fewest outstanding bytes, so one large
+ * buffer does not hold up the jobs behind it. The pool admits a bounded number
+ * of decodes; past that, decode() waits for room or rejects (`onFull`).
  */
 export function createDecoderPool(options: DecoderPoolOptions = {}): DecoderPool {
   const poolSize = Math.max(1, options.poolSize ?? 1);
-  const workers: Worker[] = [];
-  const pendingByWorker: Map<Worker, Map<number, { resolve: (v: KodaValue) => void; reject: (e: Error) => void }>> = new Map();
-  let nextIndex = 0;
+  const maxQueue = Math.max(1, options.maxQueue ?? 1024);
+  const maxQueueBytes = options.maxQueueBytes ?? Infinity;
+  const onFull = options.onFull ?? 'wait';
+  const batchBytes = Math.max(0, options.batchBytes ?? 64 * 1024);
+  const created = performance.now();
+
+  const workers: PoolWorker[] = [];
+  const queue: PoolJob[] = [];
+  const waiters: PoolCall[] = [];
+  let admitted = 0;
+  let admittedBytes = 0;
+  let queuedBytes = 0;
+  let rejected = 0;
+  let pumpScheduled = false;
   let destroyed = false;
 
   for (let i = 0; i < poolSize; i++) {
-    const w = new Worker(getWorkerURL(), { workerData: null, eval: false });
-    pendingByWorker.set(w, new Map());
-    w.on('message', (msg: { id: number; value?: KodaValue; error?: string }) => {
-      const pending = pendingByWorker.get(w)!;
-      const entry = pending.get(msg.id);
-      if (!entry) return;
-      pending.delete(msg.id);
-      if ('error' in msg && msg.error) {
-        entry.reject(new KodaDecodeError(msg.error));
-      } else if ('value' in msg && msg.value !== undefined) {
-        entry.resolve(msg.value as KodaValue);
+    const pw: PoolWorker = {
+      worker: new Worker(getWorkerURL(), { workerData: null, eval: false }),
+      pending: new Map(),
+      messages: 0,
+      bytes: 0,
+      completed: 0,
+      busyMs: 0,
+      busySince: 0,
+      dead: false,
+    };
+    pw.worker.on('message', (msg: WorkerReply | { results: WorkerReply[] }) => {
+      pw.messages--;
+      const wasBusy = pw.pending.size > 0;
+      for (const reply of 'results' in msg ? msg.results : [msg]) {
+        const job = pw.pending.get(reply.id);
+        // A job dropped by destroy() or fail(), or a cancelled call, is
+        // already settled: a lazy document is freed instead of adopted.
+        if (!job) {
+          discard(reply);
+          continue;
+        }
+        pw.pending.delete(reply.id);
+        pw.bytes -= job.bytes;
+        pw.completed++;
+        release(job);
+        if (job.call.settled) discard(reply);
+        else settle(reply, job.call.resolve, job.call.reject);
+      }
+      if (wasBusy && pw.pending.size === 0) pw.busyMs += performance.now() - pw.busySince;
+      admitWaiters();
+      schedulePump();
+    });
+    const fail = (err: Error) => {
+      if (pw.dead) return;
+      pw.dead = true;
+      if (pw.pending.size > 0) pw.busyMs += performance.now() - pw.busySince;
+      for (const job of pw.pending.values()) {
+        release(job);
+        job.call.reject(err);
+      }
+      pw.pending.clear();
+      pw.bytes = 0;
+      pw.messages = 0;
+      if (workers.every((w) => w.dead)) {
+        failQueued(new KodaDecodeError('All decoder pool workers have exited'));
       } else {
-        entry.reject(new KodaDecodeError('Worker did not return value'));
+        admitWaiters();
+        schedulePump();
       }
+    };
+    pw.worker.on('error', fail);
+    pw.worker.on('exit', (code: number) => {
+      if (!destroyed) fail(new KodaDecodeError(`Worker exited with code ${code}`));
     });
-    workers.push(w);
+    workers.push(pw);
   }
 
-  function decode(buffer: Uint8Array, options?: DecodeOptions): Promise<KodaValue> {
-    if (destroyed) return Promise.reject(new KodaDecodeError('Decoder pool has been destroyed'));
-    const id = nextId++;
-    const ab = buffer.buffer.slice(buffer.byteOffset, buffer.byteOffset + buffer.byteLength);
+  function hasRoom(bytes: number): boolean {
+    if (admitted === 0) return true;
+    return admitted < maxQueue && admittedBytes + bytes <= maxQueueBytes;
+  }
+
+  function admit(call: PoolCall): void {
+    const { buffer } = call;
+    const ab = buffer.buffer.slice(buffer.byteOffset, buffer.byteOffset + buffer.byteLength) as ArrayBuffer;
+    const job: PoolJob = { id: nextId++, bytes: ab.byteLength, buffer: ab, call };
+    call.job = job;
+    admitted++;
+    admittedBytes += job.bytes;
+    queuedBytes += job.bytes;
+    queue.push(job);
+  }
+
+  function release(job: PoolJob): void {
+    admitted--;
+    admittedBytes -= job.bytes;
+  }
+
+  function admitWaiters(): void {
+    while (waiters.length > 0 && hasRoom(waiters[0]!.buffer.byteLength)) admit(waiters.shift()!);
+  }
 
+  function failQueued(err: Error): void {
+    for (const job of queue.splice(0)) {
+      release(job);
+      job.call.reject(err);
+    }
+    queuedBytes = 0;
+    for (const call of waiters.splice(0)) call.reject(err);
+  }
+
+  /**
+   * Settle a call with `err` and free what it holds: its place in the wait
+   * list or queue, or, once sent, the worker's native decode via its flag.
+   * A sent job keeps its slot until the worker answers.
+   */
+  function cancel(call: PoolCall, err: unknown): void {
+    if (call.settled) return;
+    const job = call.job;
+    if (!job) {
+      waiters.splice(waiters.indexOf(call), 1);
+    } else {
+      const queued = queue.indexOf(job);
+      if (queued >= 0) {
+        queue.splice(queued, 1);
+        queuedBytes -= job.bytes;
+        release(job);
+        admitWaiters();
+        schedulePump();
+      } else if (call.flag) {
+        Atomics.store(call.flag, 0, 1);
+      }
+    }
+    call.reject(err as Error);
+  }
+
+  /** Live worker with a free message slot and the fewest outstanding bytes. */
+  function leastLoaded(): PoolWorker | undefined {
+    let best: PoolWorker | undefined;
+    for (const pw of workers) {
+      if (pw.dead || pw.messages >= MAX_WORKER_MESSAGES) continue;
+      if (!best || pw.bytes < best.bytes || (pw.bytes === best.bytes && pw.pending.size < best.pending.size)) best = pw;
+    }
+    return best;
+  }
+
+  /** Deferred to a microtask so decodes started in the same tick share batches. */
+  function schedulePump(): void {
+    if (pumpScheduled || destroyed) return;
+    pumpScheduled = true;
+    queueMicrotask(() => {
+      pumpScheduled = false;
+      pump();
+    });
+  }
+
+  function pump(): void {
+    while (queue.length > 0) {
+      const pw = leastLoaded();
+      if (!pw) return;
+      const batch = [queue.shift()!];
+      let bytes = batch[0]!.bytes;
+      if (bytes < batchBytes) {
+        while (batch.length < MAX_BATCH_JOBS && queue.length > 0 && bytes + queue[0]!.bytes <= batchBytes) {
+          const next = queue.shift()!;
+          batch.push(next);
+          bytes += next.bytes;
+        }
+      }
+      queuedBytes -= bytes;
+      if (pw.pending.size === 0) pw.busySince = performance.now();
+      for (const job of batch) pw.pending.set(job.id, job);
+      pw.bytes += bytes;
+      pw.messages++;
+      const transfer = batch.map((job) => job.buffer);
+      const jobs = batch.map((job) => ({ id: job.id, buffer: job.buffer, options: job.call.options, flag: job.call.flag }));
+      pw.worker.postMessage(jobs.length === 1 ? jobs[0] : { jobs }, transfer);
+    }
+  }
+
+  function decode(buffer: Uint8Array, options?: DecodeOptions & CancelOptions): Promise<KodaValue> {
+    if (destroyed) return Promise.reject(new KodaDecodeError('Decoder pool has been destroyed'));
+    if (workers.every((w) => w.dead)) return Promise.reject(new KodaDecodeError('All decoder pool workers have exited'));
+    const signal = options?.signal;
+    if (signal?.aborted) return Promise.reject(signal.reason);
     return new Promise((resolve, reject) => {
-      const worker = workers[nextIndex % workers.length]!;
-      nextIndex++;
-      pendingByWorker.get(worker)!.set(id, { resolve, reject });
-      worker.postMessage({ id, buffer: ab, options }, [ab as ArrayBuffer]);
+      const cancellable = signal !== undefined || options?.deadlineMs !== undefined;
+      const onAbort = () => cancel(call, signal!.reason);
+      const timer =
+        options?.deadlineMs !== undefined ? setTimeout(() => cancel(call, deadlineError()), options.deadlineMs) : undefined;
+      const done = () => {
+        call.settled = true;
+        signal?.removeEventListener('abort', onAbort);
+        clearTimeout(timer);
+      };
+      const call: PoolCall = {
+        buffer,
+        options: workerOptions(options),
+        flag: cancellable ? new Int32Array(new SharedArrayBuffer(4)) : undefined,
+        settled: false,
+        resolve: (v) => {
+          if (call.settled) return;
+          done();
+          resolve(v);
+        },
+        reject: (e) => {
+          if (call.settled) return;
+          done();
+          reject(e);
+        },
+      };
+      signal?.addEventListener('abort', onAbort, { once: true });
+      if (waiters.length === 0 && hasRoom(buffer.byteLength)) {
+        admit(call);
+        schedulePump();
+      } else if (onFull === 'reject') {
+        rejected++;
+        call.reject(new KodaDecodeError('Decoder pool queue is full'));
+      } else {
+        waiters.push(call);
+      }
     });
   }
 
+  function stats(): DecoderPoolStats {
+    const now = performance.now();
+    const elapsed = Math.max(now - created, 1e-6);
+    return {
+      queued: queue.length,
+      queuedBytes,
+      waiting: waiters.length,
+      rejected,
+      workers: workers.map((pw) => {
+        const busy = pw.busyMs + (!pw.dead && pw.pending.size > 0 ? now - pw.busySince : 0);
+        return {
+          inFlight: pw.pending.size,
+          inFlightBytes: pw.bytes,
+          completed: pw.completed,
+          utilization: Math.min(1, busy / elapsed),
+        };
+      }),
+    };
+  }
+
   function destroy(): void {
     if (destroyed) return;
     destroyed = true;
-    for (const w of workers) {
-      w.terminate().catch(() => {});
+    const err = new KodaDecodeError('Decoder pool has been destroyed');
+    failQueued(err);
+    for (const pw of workers) {
+      for (const job of pw.pending.values()) {
+        release(job);
+        job.call.reject(err);
+      }
+      pw.pending.clear();
+      pw.worker.terminate().catch(() => {});
     }
     workers.length = 0;
   }
 
-  return { decode, destroy };
+  return { decode, stats, destroy };
 }
@@ -3,10 +3,17 @@
  */
 
 import type { KodaValue } from './ast.js';
+import type { KodaDictionary } from './dictionary.js';
+import { compareKeys } from './encoder.js';
 import { KodaDecodeError } from './errors.js';
 
 const MAGIC = new Uint8Array([0x4b, 0x4f, 0x44, 0x41]);
 const VERSION = 1;
+const VERSION_VARINT = 2;
+const FLAG_EXTERNAL_DICT = 0x80;
+const FLAG_SESSION = 0x40;
+const SMALL_INT_TAG = 0x80;
+const SMALL_INT_MAX = 63;
 
 const enum Tag {
   Null = 0x01,
@@ -18,6 +25,17 @@ const enum Tag {
   Binary = 0x07,
   Array = 0x10,
   Object = 0x11,
+  Columns = 0x12,
+  PackedInt8 = 0x20,
+  PackedInt16 = 0x21,
+  PackedInt32 = 0x22,
+  PackedInt64 = 0x23,
+  PackedFloat32 = 0x24,
+  PackedFloat64 = 0x25,
+  StringTable = 0x30,
+  StringRef = 0x31,
+  SharedDef = 0x32,
+  SharedRef = 0x33,
 }
 
 export interface DecodeOptions {
@@ -27,6 +45,24 @@ export interface DecodeOptions {
   maxDictionarySize?: number;
   /** Max string length (default 1_000_000) */
   maxStringLength?: number;
+  /** Return packed numeric arrays as TypedArrays instead of plain arrays (default false) */
+  typedArrays?: boolean;
+  /**
+   * Keep the decoded document in native memory and return read-only proxies
+   * that convert each field on first access (default false). Main-thread
+   * cost follows the fields read, not the document size. Ignored without
+   * the addon.
+   */
+  lazy?: boolean;
+  /** External dictionary, required for documents encoded with one (SPEC §6.11) */
+  dictionary?: KodaDictionary;
+  /**
+   * Native threads for a large document whose root is an array (default 1).
+   * Runs of elements, or the columns of an array of records, are decoded in
+   * parallel; documents with shared subtrees decode serially. Same value
+   * and errors either way. Ignored without the addon.
+   */
+  threads?: number;
 }
 
 const DEFAULT_MAX_DEPTH = 256;
@@ -37,10 +73,32 @@ const DEFAULT_MAX_STRING = 1_000_000;
  * Decode KODA binary buffer to a KODA value.
  */
 export function decode(buffer: Uint8Array, options: DecodeOptions = {}): KodaValue {
+  return decodeDocument(buffer, options, undefined).value;
+}
+
+/**
+ * Decode one frame of a session (SPEC §6.12). `session` is the sorted session
+ * dictionary so far; `keys` is set when the frame grew it.
+ */
+export function decodeSessionFrame(
+  buffer: Uint8Array,
+  options: DecodeOptions,
+  session: readonly string[]
+): { value: KodaValue; keys?: string[] } {
+  return decodeDocument(buffer, options, session);
+}
+
+function decodeDocument(
+  buffer: Uint8Array,
+  options: DecodeOptions,
+  session: readonly string[] | undefined
+): { value: KodaValue; keys?: string[] } {
   const maxDepth = options.maxDepth ?? DEFAULT_MAX_DEPTH;
   const maxDict = options.maxDictionarySize ?? DEFAULT_MAX_DICT;
   const maxStr = options.maxStringLength ?? DEFAULT_MAX_STRING;
+  const typedArrays = options.typedArrays ?? false;
   let offset = 0;
+  let version = VERSION;
   const view = new DataView(buffer.buffer, buffer.byteOffset, buffer.length);
 
   function fail(message: string): never {
@@ -70,6 +128,34 @@ export function decode(buffer: Uint8Array, options: DecodeOptions = {}): KodaVal
     return v;
   }
 
+  /** LEB128; rejects overlong encodings and values wider than `bits`. */
+  function readUvarint(bits: number): bigint {
+    let x = 0n;
+    for (let shift = 0; ; shift += 7) {
+      const b = readU8();
+      if (shift >= bits || (shift > 0 && b === 0) || (bits - shift < 7 && (b & 0x7f) >> (bits - shift) !== 0)) {
+        fail('Malformed varint');
+      }
+      x |= BigInt(b & 0x7f) << BigInt(shift);
+      if ((b & 0x80) === 0) return x;
+    }
+  }
+
+  /** Length, count or key index: 4 bytes in v1, LEB128 in v2. */
+  function readLen(): number {
+    if (version === VERSION) return readU32();
+    const b = readU8();
+    if (b < 0x80) return b;
+    offset--;
+    return Number(readUvarint(32));
+  }
+
+  function readInteger(): bigint {
+    if (version === VERSION) return readI64();
+    const z = readUvarint(64);
+    return (z >> 1n) ^ -(z & 1n);
+  }
+
   function readF64(): number {
     ensure(8);
     const v = view.getFloat64(offset, false);
@@ -93,23 +179,166 @@ export function decode(buffer: Uint8Array, options: DecodeOptions = {}): KodaVal
     if (buffer[offset + i] !== MAGIC[i]) fail('Invalid magic number');
   }
   offset += 4;
-  const version = readU8();
-  if (version !== VERSION) fail(`Unsupported version: ${version}`);
+  const versionByte = readU8();
+  const flags = versionByte & (FLAG_EXTERNAL_DICT | FLAG_SESSION);
+  version = versionByte & ~flags;
+  if (version !== VERSION && version !== VERSION_VARINT) fail(`Unsupported version: ${version}`);
+  if (flags === (FLAG_EXTERNAL_DICT | FLAG_SESSION)) fail(`Unsupported version: ${versionByte}`);
+  // Keys the document does not repeat: an external dictionary or the session's.
+  let base: readonly string[] | undefined;
+  if (flags & FLAG_EXTERNAL_DICT) {
+    ensure(8);
+    const id = view.getBigUint64(offset, false);
+    if (options.dictionary === undefined || options.dictionary.id !== id) fail('Unknown dictionary');
+    offset += 8;
+    base = options.dictionary.keys;
+  } else if (flags & FLAG_SESSION) {
+    if (session === undefined) fail('Session frame outside a decoder session');
+    if (readLen() !== session.length) fail('Session dictionary out of sync');
+    base = session;
+  }
 
-  const dictLen = readU32();
-  if (dictLen > maxDict) fail('Dictionary too large');
-  const dictionary: string[] = new Array(dictLen);
+  const dictLen = readLen();
+  const baseLen = base?.length ?? 0;
+  if (dictLen + baseLen > maxDict) fail('Dictionary too large');
+  let dictionary: string[] = new Array(dictLen);
   for (let i = 0; i < dictLen; i++) {
-    const keyLen = readU32();
+    const keyLen = readLen();
     if (keyLen > maxStr) fail('Key string too long');
     const keyBytes = readBytes(keyLen);
     dictionary[i] = decodeUtf8(keyBytes);
   }
+  if (base !== undefined && dictLen === 0) {
+    dictionary = base as string[];
+  } else if (base !== undefined) {
+    // Inline keys must be sorted and absent from the base dictionary, so the
+    // merged index space is well defined.
+    const known = new Set(base);
+    for (let i = 0; i < dictLen; i++) {
+      if ((i > 0 && compareKeys(dictionary[i - 1]!, dictionary[i]!) >= 0) || known.has(dictionary[i]!)) {
+        fail('Invalid dictionary');
+      }
+    }
+    dictionary = [...base, ...dictionary].sort(compareKeys);
+  }
+
+  let strings: string[] = [];
+  if (offset < buffer.length && buffer[offset] === Tag.StringTable) {
+    offset++;
+    const count = readLen();
+    if (count > buffer.length - offset) fail('Truncated input');
+    strings = new Array(count);
+    for (let i = 0; i < count; i++) {
+      const len = readLen();
+      if (len > maxStr) fail('String too long');
+      strings[i] = decodeUtf8(readBytes(len));
+    }
+  }
+
+  /** Shared subtrees in definition order; references return the same object. */
+  const shared: KodaValue[] = [];
+
+  function decodePacked(tag: Tag, count: number, typed: boolean): KodaValue {
+    const width = tag === Tag.PackedInt8 ? 1 : tag === Tag.PackedInt16 ? 2 : tag === Tag.PackedInt32 || tag === Tag.PackedFloat32 ? 4 : 8;
+    if (count > (buffer.length - offset) / width) fail('Truncated input');
+    const start = offset;
+    offset += count * width;
+    switch (tag) {
+      case Tag.PackedInt8: {
+        const out = typed ? new Int8Array(count) : new Array<number>(count);
+        for (let i = 0; i < count; i++) out[i] = view.getInt8(start + i);
+        return out;
+      }
+      case Tag.PackedInt16: {
+        const out = typed ? new Int16Array(count) : new Array<number>(count);
+        for (let i = 0; i < count; i++) out[i] = view.getInt16(start + i * 2, false);
+        return out;
+      }
+      case Tag.PackedInt32: {
+        const out = typed ? new Int32Array(count) : new Array<number>(count);
+        for (let i = 0; i < count; i++) out[i] = view.getInt32(start + i * 4, false);
+        return out;
+      }
+      case Tag.PackedInt64: {
+        if (typed) {
+          const out = new BigInt64Array(count);
+          for (let i = 0; i < count; i++) out[i] = view.getBigInt64(start + i * 8, false);
+          return out;
+        }
+        const out = new Array<number>(count);
+        for (let i = 0; i < count; i++) out[i] = Number(view.getBigInt64(start + i * 8, false));
+        return out;
+      }
+      case Tag.PackedFloat32: {
+        const out = typed ? new Float32Array(count) : new Array<number>(count);
+        for (let i = 0; i < count; i++) out[i] = view.getFloat32(start + i * 4, false);
+        return out;
+      }
+      default: {
+        const out = typed ? new Float64Array(count) : new Array<number>(count);
+        for (let i = 0; i < count; i++) out[i] = view.getFloat64(start + i * 8, false);
+        return out;
+      }
+    }
+  }
+
+  /** Array body of `count` elements after its tag (and count, when it has one). */
+  function decodeItems(tag: number, count: number, depth: number, typed: boolean): KodaValue {
+    switch (tag) {
+      case Tag.Array: {
+        if (count > buffer.length - offset) fail('Truncated input');
+        const arr: KodaValue[] = new Array(count);
+        for (let i = 0; i < count; i++) arr[i] = decodeValue(depth + 1);
+        return arr;
+      }
+      // Columnar and packed arrays are version 2 only (SPEC §6.6, §6.8).
+      case Tag.Columns:
+        if (version === VERSION_VARINT) return decodeColumns(count, depth);
+        fail('Invalid column tag');
+      case Tag.PackedInt8:
+      case Tag.PackedInt16:
+      case Tag.PackedInt32:
+      case Tag.PackedInt64:
+      case Tag.PackedFloat32:
+      case Tag.PackedFloat64:
+        if (version === VERSION_VARINT) return decodePacked(tag, count, typed);
+        fail('Invalid column tag');
+      default:
+        fail('Invalid column tag');
+    }
+  }
+
+  /** Columnar array (SPEC §6.8): key indices, then one count-less array per column. */
+  function decodeColumns(rowCount: number, depth: number): KodaValue {
+    if (depth + 1 > maxDepth) fail('Maximum nesting depth exceeded');
+    const keyCount = readLen();
+    if (keyCount === 0) fail('Invalid column keys');
+    if (keyCount > buffer.length - offset || rowCount > buffer.length - offset) fail('Truncated input');
+    const keys: string[] = new Array(keyCount);
+    let prev = -1;
+    for (let c = 0; c < keyCount; c++) {
+      const keyIdx = readLen();
+      if (keyIdx >= dictionary.length) fail('Invalid key index');
+      if (keyIdx <= prev) fail('Invalid column keys');
+      prev = keyIdx;
+      keys[c] = dictionary[keyIdx]!;
+    }
+    const rows: Record<string, KodaValue>[] = new Array(rowCount);
+    for (let r = 0; r < rowCount; r++) rows[r] = {};
+    for (const key of keys) {
+      const column = decodeItems(readU8(), rowCount, depth + 1, false) as KodaValue[];
+      for (let r = 0; r < rowCount; r++) rows[r]![key] = column[r]!;
+    }
+    return rows;
+  }
 
   function decodeValue(depth: number): KodaValue {
     if (depth > maxDepth) fail('Maximum nesting depth exceeded');
     ensure(1);
     const tag = readU8();
+    if (version === VERSION_VARINT && tag >= SMALL_INT_TAG && tag <= SMALL_INT_TAG + SMALL_INT_MAX) {
+      return tag - SMALL_INT_TAG;
+    }
     switch (tag) {
       case Tag.Null:
         return null;
@@ -118,7 +347,7 @@ export function decode(buffer: Uint8Array, options: DecodeOptions = {}): KodaVal
       case Tag.True:
         return true;
       case Tag.Integer: {
-        const big = readI64();
+        const big = readInteger();
         if (big >= Number.MIN_SAFE_INTEGER && big <= Number.MAX_SAFE_INTEGER) {
           return Number(big);
         }
@@ -127,30 +356,57 @@ export function decode(buffer: Uint8Array, options: DecodeOptions = {}): KodaVal
       case Tag.Float:
         return readF64();
       case Tag.String: {
-        const len = readU32();
+        const len = readLen();
         if (len > maxStr) fail('String too long');
         const bytes = readBytes(len);
         return decodeUtf8(bytes);
       }
+      case Tag.StringRef: {
+        const idx = readLen();
+        if (idx >= strings.length) fail('Invalid string reference');
+        return strings[idx]!;
+      }
+      case Tag.SharedDef: {
+        ensure(1);
+        if (buffer[offset] === Tag.SharedDef || buffer[offset] === Tag.SharedRef) fail('Invalid shared subtree');
+        const v = decodeValue(depth);
+        const empty =
+          v === null || typeof v !== 'object' || (Array.isArray(v) || ArrayBuffer.isView(v) ? (v as ArrayLike<unknown>).length === 0 : Object.keys(v).length === 0);
+        if (empty) fail('Invalid shared subtree');
+        shared.push(v);
+        return v;
+      }
+      case Tag.SharedRef: {
+        const idx = readLen();
+        if (idx >= shared.length) fail('Invalid shared reference');
+        return shared[idx]!;
+      }
       case Tag.Binary:
         fail('Binary type not supported in this version');
-      case Tag.Array: {
-        const count = readU32();
-        const arr: KodaValue[] = new Array(count);
-        for (let i = 0; i < count; i++) arr[i] = decodeValue(depth + 1);
-        return arr;
-      }
+      case Tag.Array:
+        return decodeItems(tag, readLen(), depth, typedArrays);
+      case Tag.Columns:
+        if (version === VERSION_VARINT) return decodeItems(tag, readLen(), depth, typedArrays);
+        fail(`Unknown type tag: 0x${tag.toString(16)}`);
       case Tag.Object: {
-        const count = readU32();
+        const count = readLen();
         const obj: Record<string, KodaValue> = {};
         for (let i = 0; i < count; i++) {
-          const keyIdx = readU32();
+          const keyIdx = readLen();
           if (keyIdx >= dictionary.length) fail('Invalid key index');
           const key = dictionary[keyIdx]!;
           obj[key] = decodeValue(depth + 1);
         }
         return obj;
       }
+      case Tag.PackedInt8:
+      case Tag.PackedInt16:
+      case Tag.PackedInt32:
+      case Tag.PackedInt64:
+      case Tag.PackedFloat32:
+      case Tag.PackedFloat64:
+        if (version === VERSION_VARINT) return decodeItems(tag, readLen(), depth, typedArrays);
+        fail(`Unknown type tag: 0x${tag.toString(16)}`);
       default:
         fail(`Unknown type tag: 0x${tag.toString(16)}`);
     }
@@ -158,5 +414,5 @@ export function decode(buffer: Uint8Array, options: DecodeOptions = {}): KodaVal
 
   const value = decodeValue(0);
   if (offset !== buffer.length) fail('Trailing bytes after root value');
-  return value;
+  return (flags & FLAG_SESSION) !== 0 && dictLen > 0 ? { value, keys: dictionary } : { value };
 }
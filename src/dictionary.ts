@@ -0,0 +1,45 @@
+/**
+ * External key dictionaries (SPEC §6.11). A dictionary agreed on by both ends
+ * is referenced from each document by id instead of being written into it.
+ */
+
+import { compareKeys } from './encoder.js';
+
+export interface KodaDictionary {
+  /** Keys in canonical order (UTF-8 bytes), without duplicates. */
+  readonly keys: readonly string[];
+  /** 64-bit content hash of the keys; documents name the dictionary by it. */
+  readonly id: bigint;
+}
+
+const FNV_OFFSET = 0xcbf29ce484222325n;
+const FNV_PRIME = 0x100000001b3n;
+
+/** FNV-1a 64 over each key's 4-byte big-endian length and UTF-8 bytes. */
+function dictionaryId(keys: readonly string[]): bigint {
+  let h = FNV_OFFSET;
+  const encoder = new TextEncoder();
+  const feed = (b: number): void => {
+    h = BigInt.asUintN(64, (h ^ BigInt(b)) * FNV_PRIME);
+  };
+  for (const k of keys) {
+    const bytes = encoder.encode(k);
+    const n = bytes.length;
+    feed((n >>> 24) & 0xff);
+    feed((n >>> 16) & 0xff);
+    feed((n >>> 8) & 0xff);
+    feed(n & 0xff);
+    for (const b of bytes) feed(b);
+  }
+  return h;
+}
+
+/**
+ * Create an external dictionary from keys in any order. Pass it to `encode`
+ * and `decode` as `{ dictionary }`; keys missing from it are written inline.
+ * The result is a plain frozen object, so it can be sent to worker threads.
+ */
+export function createDictionary(keys: Iterable<string>): KodaDictionary {
+  const sorted = [...new Set(keys)].sort(compareKeys);
+  return Object.freeze({ keys: Object.freeze(sorted), id: dictionaryId(sorted) });
+}
@@ -4,10 +4,19 @@
  */
 
 import type { KodaValue } from './ast.js';
+import type { KodaDictionary } from './dictionary.js';
 import { KodaEncodeError } from './errors.js';
 
 const MAGIC = new Uint8Array([0x4b, 0x4f, 0x44, 0x41]); // "KODA"
 const VERSION = 1;
+/** Compact layout (SPEC §6.7): LEB128 lengths and counts, zigzag varint integers. */
+const VERSION_VARINT = 2;
+/** Version byte flag: the header names an external dictionary (SPEC §6.11). */
+const FLAG_EXTERNAL_DICT = 0x80;
+/** Version byte flag: session frame carrying a dictionary delta (SPEC §6.12). */
+const FLAG_SESSION = 0x40;
+const SMALL_INT_TAG = 0x80;
+const SMALL_INT_MAX = 63;
 
 const enum Tag {
   Null = 0x01,
@@ -19,13 +28,24 @@ const enum Tag {
   Binary = 0x07,
   Array = 0x10,
   Object = 0x11,
+  Columns = 0x12,
+  PackedInt8 = 0x20,
+  PackedInt16 = 0x21,
+  PackedInt32 = 0x22,
+  PackedInt64 = 0x23,
+  PackedFloat32 = 0x24,
+  PackedFloat64 = 0x25,
+  StringTable = 0x30,
+  StringRef = 0x31,
+  SharedDef = 0x32,
+  SharedRef = 0x33,
 }
 
 const MIN_SAFE_INT64 = -0x8000_0000_0000_0000n;
 const MAX_SAFE_INT64 = 0x7fff_ffff_ffff_ffffn;
 
 function collectKeys(value: KodaValue, set: Set<string>): void {
-  if (value === null || typeof value !== 'object') return;
+  if (value === null || typeof value !== 'object' || ArrayBuffer.isView(value)) return;
   if (Array.isArray(value)) {
     for (const v of value) collectKeys(v, set);
     return;
@@ -37,13 +57,207 @@ function collectKeys(value: KodaValue, set: Set<string>): void {
   }
 }
 
+type PackedItem = number | bigint;
+
+/** Element width in bytes of an Int packing that holds x. */
+function intWidth(x: PackedItem): number {
+  if (x >= -0x80 && x <= 0x7f) return 1;
+  if (x >= -0x8000 && x <= 0x7fff) return 2;
+  if (x >= -0x8000_0000 && x <= 0x7fff_ffff) return 4;
+  return 8;
+}
+
+function isPackedInt(x: unknown): x is PackedItem {
+  if (typeof x === 'bigint') return x >= MIN_SAFE_INT64 && x <= MAX_SAFE_INT64;
+  return typeof x === 'number' && Number.isInteger(x) && x >= Number.MIN_SAFE_INTEGER && x <= Number.MAX_SAFE_INTEGER;
+}
+
+function isPackedFloat(x: unknown): boolean {
+  return (typeof x === 'number' || typeof x === 'bigint') && !isPackedInt(x);
+}
+
+/**
+ * Canonical packed tag for an array (SPEC §6.6): version 2, non-empty and all
+ * integers, or all floats. Returns undefined when the array must use the
+ * Array tag.
+ */
+function packedTag(items: ArrayLike<unknown>, version: number): Tag | undefined {
+  const n = items.length;
+  if (version !== VERSION_VARINT || n === 0) return undefined;
+  if (isPackedInt(items[0])) {
+    let width = 1;
+    for (let i = 0; i < n; i++) {
+      const x = items[i];
+      if (!isPackedInt(x)) return undefined;
+      if (width < 8) width = Math.max(width, intWidth(x));
+    }
+    return width === 1 ? Tag.PackedInt8 : width === 2 ? Tag.PackedInt16 : width === 4 ? Tag.PackedInt32 : Tag.PackedInt64;
+  }
+  let f32 = true;
+  for (let i = 0; i < n; i++) {
+    const x = items[i];
+    if (!isPackedFloat(x)) return undefined;
+    const d = Number(x);
+    if (f32 && Math.fround(d) !== d) f32 = false;
+  }
+  return f32 ? Tag.PackedFloat32 : Tag.PackedFloat64;
+}
+
 function encodeUtf8(s: string): Uint8Array {
   return new TextEncoder().encode(s);
 }
 
+/** Canonical key order: lexicographic by UTF-8 bytes. */
+export function compareKeys(a: string, b: string): number {
+  const aa = encodeUtf8(a);
+  const bb = encodeUtf8(b);
+  for (let i = 0; i < Math.min(aa.length, bb.length); i++) {
+    if (aa[i]! !== bb[i]!) return aa[i]! - bb[i]!;
+  }
+  return aa.length - bb.length;
+}
+
+function countStrings(value: KodaValue, counts: Map<string, number>): void {
+  if (typeof value === 'string') {
+    counts.set(value, (counts.get(value) ?? 0) + 1);
+    return;
+  }
+  if (value === null || typeof value !== 'object' || ArrayBuffer.isView(value)) return;
+  if (Array.isArray(value)) {
+    for (const v of value) countStrings(v, counts);
+    return;
+  }
+  const obj = value as Record<string, KodaValue>;
+  for (const k of Object.keys(obj)) countStrings(obj[k]!, counts);
+}
+
+function isPlainObject(v: unknown): v is Record<string, KodaValue> {
+  return typeof v === 'object' && v !== null && !Array.isArray(v) && !ArrayBuffer.isView(v);
+}
+
+/**
+ * Shared sorted key set when an array qualifies for the columnar form
+ * (SPEC §6.8): version 2, at least two rows, all objects with the same
+ * non-empty keys.
+ */
+function columnKeys(items: ArrayLike<unknown>, version: number): string[] | undefined {
+  if (version !== VERSION_VARINT || items.length < 2) return undefined;
+  const first = items[0];
+  if (!isPlainObject(first)) return undefined;
+  const keys = Object.keys(first);
+  if (keys.length === 0) return undefined;
+  for (let i = 1; i < items.length; i++) {
+    const row = items[i];
+    if (!isPlainObject(row)) return undefined;
+    const rowKeys = Object.keys(row);
+    if (rowKeys.length !== keys.length) return undefined;
+    for (const k of rowKeys) {
+      if (!Object.prototype.hasOwnProperty.call(first, k)) return undefined;
+    }
+  }
+  return keys.sort(compareKeys);
+}
+
+/** Non-empty array, typed array or object: the values a shared subtree may hold. */
+function isShareable(v: unknown): v is object {
+  if (Array.isArray(v) || ArrayBuffer.isView(v)) return (v as ArrayLike<unknown>).length > 0;
+  return isPlainObject(v) && Object.keys(v).length > 0;
+}
+
+/**
+ * Hash-consing for shared subtrees (SPEC §6.10). Structurally equal values get
+ * the same class id; a typed array equals the plain array of the same numbers.
+ */
+class SubtreeClasses {
+  readonly counts: number[] = [];
+  private readonly ids = new Map<string, number>();
+  private readonly memo = new WeakMap<object, number>();
+
+  classOf(v: object): number {
+    const known = this.memo.get(v);
+    if (known !== undefined) return known;
+    let sig: string;
+    if (Array.isArray(v) || ArrayBuffer.isView(v)) {
+      const items = v as ArrayLike<KodaValue | bigint>;
+      const parts = new Array<string>(items.length);
+      for (let i = 0; i < items.length; i++) parts[i] = this.token(items[i]!);
+      sig = `[${parts.join(',')}]`;
+    } else {
+      const obj = v as Record<string, KodaValue>;
+      sig = `{${Object.keys(obj).sort().map((k) => `${JSON.stringify(k)}:${this.token(obj[k]!)}`).join(',')}}`;
+    }
+    let id = this.ids.get(sig);
+    if (id === undefined) {
+      id = this.counts.length;
+      this.ids.set(sig, id);
+      this.counts.push(0);
+    }
+    this.memo.set(v, id);
+    return id;
+  }
+
+  /** Integers and floats stay distinct, as they encode differently. */
+  private token(v: KodaValue | bigint): string {
+    if (v === null) return 'n';
+    if (typeof v === 'boolean') return v ? 't' : 'f';
+    if (typeof v === 'number' || typeof v === 'bigint') return isPackedInt(v) ? `i${v}` : `d${Number(v)}`;
+    if (typeof v === 'string') return JSON.stringify(v);
+    return `#${this.classOf(v)}`;
+  }
+}
+
+/**
+ * Count how often each subtree is written, following the encoder's layout:
+ * packed arrays have no child values and columnar rows are not values
+ * themselves. Repeats are not descended into, since they become references.
+ */
+function countSubtrees(v: KodaValue, version: number, classes: SubtreeClasses): void {
+  if (!isShareable(v)) return;
+  const id = classes.classOf(v);
+  const seen = classes.counts[id]!;
+  classes.counts[id] = seen + 1;
+  if (seen > 0) return;
+  if (ArrayBuffer.isView(v)) return;
+  if (Array.isArray(v)) {
+    countItems(v, version, classes);
+    return;
+  }
+  const obj = v as Record<string, KodaValue>;
+  for (const k of Object.keys(obj)) countSubtrees(obj[k]!, version, classes);
+}
+
+function countItems(items: ArrayLike<KodaValue>, version: number, classes: SubtreeClasses): void {
+  if (packedTag(items, version) !== undefined) return;
+  const keys = columnKeys(items, version);
+  if (keys !== undefined) {
+    const rows = items as ArrayLike<Record<string, KodaValue>>;
+    for (const key of keys) {
+      const column = new Array<KodaValue>(rows.length);
+      for (let r = 0; r < rows.length; r++) column[r] = rows[r]![key]!;
+      countItems(column, version, classes);
+    }
+    return;
+  }
+  for (let i = 0; i < items.length; i++) countSubtrees(items[i]!, version, classes);
+}
+
 export interface EncodeOptions {
   /** Max nesting depth (default 256) */
   maxDepth?: number;
+  /** Binary format version: 1 (fixed-width, default) or 2 (varint, packed and columnar arrays; SPEC §6.6–6.8) */
+  version?: 1 | 2;
+  /** Store repeated string values once in a string table (SPEC §6.9, default false) */
+  stringTable?: boolean;
+  /** Write repeated subtrees once and refer back to them (SPEC §6.10, default false) */
+  dedupe?: boolean;
+  /** External dictionary from `createDictionary`; only keys it lacks are written inline (SPEC §6.11) */
+  dictionary?: KodaDictionary;
+  /**
+   * Native threads for a large root array (default 1). Output is
+   * byte-identical to a serial encode. Ignored with `dedupe` and without the
+   * addon.
+   */
+  threads?: number;
 }
 
 const DEFAULT_MAX_DEPTH = 256;
@@ -52,17 +266,44 @@ const DEFAULT_MAX_DEPTH = 256;
  * Encode a KODA value to canonical binary form.
  */
 export function encode(value: KodaValue, options: EncodeOptions = {}): Uint8Array {
+  return encodeDocument(value, options, undefined).bytes;
+}
+
+/**
+ * Encode one session frame (SPEC §6.12). `session` is the sorted session
+ * dictionary before this frame; the returned keys are the dictionary after it.
+ */
+export function encodeSessionFrame(
+  value: KodaValue,
+  options: EncodeOptions,
+  session: readonly string[]
+): { bytes: Uint8Array; keys: string[] } {
+  return encodeDocument(value, options, session);
+}
+
+function encodeDocument(
+  value: KodaValue,
+  options: EncodeOptions,
+  session: readonly string[] | undefined
+): { bytes: Uint8Array; keys: string[] } {
   const maxDepth = options.maxDepth ?? DEFAULT_MAX_DEPTH;
+  const version = options.version ?? VERSION;
+  if (version !== VERSION && version !== VERSION_VARINT) {
+    throw new KodaEncodeError(`Unsupported version: ${version}`);
+  }
   const keysSet = new Set<string>();
   collectKeys(value, keysSet);
-  const dictionary = [...keysSet].sort((a, b) => {
-    const aa = encodeUtf8(a);
-    const bb = encodeUtf8(b);
-    for (let i = 0; i < Math.min(aa.length, bb.length); i++) {
-      if (aa[i]! !== bb[i]!) return aa[i]! - bb[i]!;
-    }
-    return aa.length - bb.length;
-  });
+  // Keys already known to the decoder (an external dictionary or the session)
+  // are not written; key indices refer to the sorted union.
+  const external = session === undefined ? options.dictionary : undefined;
+  const base = session ?? external?.keys;
+  let inlineKeys: string[] = [];
+  if (base !== undefined) {
+    const known = new Set(base);
+    inlineKeys = [...keysSet].filter((k) => !known.has(k)).sort(compareKeys);
+    for (const k of base) keysSet.add(k);
+  }
+  const dictionary = [...keysSet].sort(compareKeys);
   const keyToIndex = new Map<string, number>();
   dictionary.forEach((k, i) => keyToIndex.set(k, i));
 
@@ -85,22 +326,91 @@ export function encode(value: KodaValue, options: EncodeOptions = {}): Uint8Arra
     ensure(1);
     buf[off++] = x;
   }
+  function writeUvarint(x: number | bigint): void {
+    if (typeof x === 'bigint') {
+      while (x >= 0x80n) {
+        writeByte(Number(x & 0x7fn) | 0x80);
+        x >>= 7n;
+      }
+      writeByte(Number(x));
+      return;
+    }
+    while (x >= 0x80) {
+      writeByte((x % 0x80) | 0x80);
+      x = Math.floor(x / 0x80);
+    }
+    writeByte(x);
+  }
+  /** Length, count or key index: 4 bytes in v1, LEB128 in v2. */
+  function writeLen(n: number): void {
+    if (version === VERSION_VARINT) {
+      writeUvarint(n);
+      return;
+    }
+    ensure(4);
+    new DataView(buf.buffer, buf.byteOffset + off, 4).setUint32(0, n, false);
+    off += 4;
+  }
+  function writeInteger(big: bigint): void {
+    if (version === VERSION) {
+      writeByte(Tag.Integer);
+      ensure(8);
+      new DataView(buf.buffer, buf.byteOffset + off, 8).setBigInt64(0, big, false);
+      off += 8;
+    } else if (big >= 0n && big <= SMALL_INT_MAX) {
+      writeByte(SMALL_INT_TAG + Number(big));
+    } else {
+      writeByte(Tag.Integer);
+      writeUvarint(BigInt.asUintN(64, (big << 1n) ^ (big >> 63n)));
+    }
+  }
 
   write(MAGIC);
-  writeByte(VERSION);
+  if (external !== undefined) {
+    writeByte(version | FLAG_EXTERNAL_DICT);
+    ensure(8);
+    new DataView(buf.buffer, buf.byteOffset + off, 8).setBigUint64(0, external.id, false);
+    off += 8;
+  } else if (session !== undefined) {
+    writeByte(version | FLAG_SESSION);
+    writeLen(session.length);
+  } else {
+    writeByte(version);
+  }
 
-  const dictCount = dictionary.length;
-  const dictCountBuf = new ArrayBuffer(4);
-  new DataView(dictCountBuf).setUint32(0, dictCount, false);
-  write(new Uint8Array(dictCountBuf));
-  for (const k of dictionary) {
+  const headerKeys = base !== undefined ? inlineKeys : dictionary;
+  writeLen(headerKeys.length);
+  for (const k of headerKeys) {
     const bytes = encodeUtf8(k);
-    const lenBuf = new ArrayBuffer(4);
-    new DataView(lenBuf).setUint32(0, bytes.length, false);
-    write(new Uint8Array(lenBuf));
+    writeLen(bytes.length);
     write(bytes);
   }
 
+  const stringToIndex = new Map<string, number>();
+  if (options.stringTable) {
+    // Canonical table: every string value that occurs more than once, sorted.
+    const counts = new Map<string, number>();
+    countStrings(value, counts);
+    const table = [...counts.keys()].filter((s) => counts.get(s)! > 1).sort(compareKeys);
+    if (table.length > 0) {
+      writeByte(Tag.StringTable);
+      writeLen(table.length);
+      table.forEach((s, i) => {
+        const bytes = encodeUtf8(s);
+        writeLen(bytes.length);
+        write(bytes);
+        stringToIndex.set(s, i);
+      });
+    }
+  }
+
+  let subtrees: SubtreeClasses | undefined;
+  const sharedId = new Map<number, number>();
+  if (options.dedupe) {
+    subtrees = new SubtreeClasses();
+    countSubtrees(value, version, subtrees);
+  }
+
   function encodeValue(v: KodaValue, depth: number): void {
     if (depth > maxDepth) {
       throw new KodaEncodeError('Maximum nesting depth exceeded', { byteOffset: off });
@@ -121,10 +431,7 @@ export function encode(value: KodaValue, options: EncodeOptions = {}): Uint8Arra
       if (Number.isInteger(v) && v >= Number.MIN_SAFE_INTEGER && v <= Number.MAX_SAFE_INTEGER) {
         const big = BigInt(v);
         if (big >= MIN_SAFE_INT64 && big <= MAX_SAFE_INT64) {
-          writeByte(Tag.Integer);
-          ensure(8);
-          new DataView(buf.buffer, buf.byteOffset + off, 8).setBigInt64(0, big, false);
-          off += 8;
+          writeInteger(big);
           return;
         }
       }
@@ -135,46 +442,112 @@ export function encode(value: KodaValue, options: EncodeOptions = {}): Uint8Arra
       return;
     }
     if (typeof v === 'string') {
+      const ref = stringToIndex.get(v);
+      if (ref !== undefined) {
+        writeByte(Tag.StringRef);
+        writeLen(ref);
+        return;
+      }
       const bytes = encodeUtf8(v);
       writeByte(Tag.String);
-      const lenBuf = new ArrayBuffer(4);
-      new DataView(lenBuf).setUint32(0, bytes.length, false);
-      write(new Uint8Array(lenBuf));
+      writeLen(bytes.length);
       write(bytes);
       return;
     }
-    if (Array.isArray(v)) {
-      writeByte(Tag.Array);
-      const lenBuf = new ArrayBuffer(4);
-      new DataView(lenBuf).setUint32(0, v.length, false);
-      write(new Uint8Array(lenBuf));
-      for (const item of v) encodeValue(item, depth + 1);
+    if (subtrees !== undefined && isShareable(v)) {
+      const id = subtrees.classOf(v);
+      if (subtrees.counts[id]! > 1) {
+        const ref = sharedId.get(id);
+        if (ref !== undefined) {
+          writeByte(Tag.SharedRef);
+          writeLen(ref);
+          return;
+        }
+        // Ids are assigned when the definition ends, so a reference can only
+        // point at a completed subtree.
+        writeByte(Tag.SharedDef);
+        encodeContainer(v, depth);
+        sharedId.set(id, sharedId.size);
+        return;
+      }
+    }
+    encodeContainer(v, depth);
+  }
+
+  function encodeContainer(v: KodaValue, depth: number): void {
+    if (Array.isArray(v) || ArrayBuffer.isView(v)) {
+      encodeItems(v as ArrayLike<KodaValue | bigint>, depth, true);
       return;
     }
     const obj = v as Record<string, KodaValue>;
-    const sortedKeys = Object.keys(obj).sort((a, b) => {
-      const aa = encodeUtf8(a);
-      const bb = encodeUtf8(b);
-      for (let i = 0; i < Math.min(aa.length, bb.length); i++) {
-        if (aa[i]! !== bb[i]!) return aa[i]! - bb[i]!;
-      }
-      return aa.length - bb.length;
-    });
+    const sortedKeys = Object.keys(obj).sort(compareKeys);
     writeByte(Tag.Object);
-    const countBuf = new ArrayBuffer(4);
-    new DataView(countBuf).setUint32(0, sortedKeys.length, false);
-    write(new Uint8Array(countBuf));
+    writeLen(sortedKeys.length);
     for (const key of sortedKeys) {
-      const idx = keyToIndex.get(key);
-      if (idx === undefined) throw new KodaEncodeError('Key not in dictionary', { byteOffset: off });
-      const idxBuf = new ArrayBuffer(4);
-      new DataView(idxBuf).setUint32(0, idx, false);
-      write(new Uint8Array(idxBuf));
+      writeLen(keyIndex(key));
       encodeValue(obj[key]!, depth + 1);
     }
   }
 
+  function keyIndex(key: string): number {
+    const idx = keyToIndex.get(key);
+    if (idx === undefined) throw new KodaEncodeError('Key not in dictionary', { byteOffset: off });
+    return idx;
+  }
+
+  /** Array body; the count is omitted for columns, whose length is the row count. */
+  function encodeItems(items: ArrayLike<KodaValue | bigint>, depth: number, withCount: boolean): void {
+    const tag = packedTag(items, version);
+    if (tag !== undefined) {
+      writeByte(tag);
+      if (withCount) writeLen(items.length);
+      writePacked(items as ArrayLike<PackedItem>, tag);
+      return;
+    }
+    const keys = columnKeys(items, version);
+    if (keys !== undefined) {
+      const rows = items as ArrayLike<Record<string, KodaValue>>;
+      writeByte(Tag.Columns);
+      if (withCount) writeLen(rows.length);
+      writeLen(keys.length);
+      for (const key of keys) writeLen(keyIndex(key));
+      for (const key of keys) {
+        const column = new Array<KodaValue>(rows.length);
+        for (let r = 0; r < rows.length; r++) column[r] = rows[r]![key]!;
+        encodeItems(column, depth + 1, false);
+      }
+      return;
+    }
+    writeByte(Tag.Array);
+    if (withCount) writeLen(items.length);
+    for (let i = 0; i < items.length; i++) {
+      const item = items[i]!;
+      // 64-bit typed array elements in range are written exactly, as they are when packed.
+      if (typeof item === 'bigint' && isPackedInt(item) && depth + 1 <= maxDepth) writeInteger(item);
+      else encodeValue(typeof item === 'bigint' ? Number(item) : item, depth + 1);
+    }
+  }
+
+  function writePacked(items: ArrayLike<PackedItem>, tag: Tag): void {
+    const n = items.length;
+    const width = tag === Tag.PackedInt8 ? 1 : tag === Tag.PackedInt16 ? 2 : tag === Tag.PackedInt32 || tag === Tag.PackedFloat32 ? 4 : 8;
+    ensure(n * width);
+    const view = new DataView(buf.buffer, buf.byteOffset + off, n * width);
+    for (let i = 0, p = 0; i < n; i++, p += width) {
+      const x = items[i]!;
+      switch (tag) {
+        case Tag.PackedInt8: view.setInt8(p, Number(x)); break;
+        case Tag.PackedInt16: view.setInt16(p, Number(x), false); break;
+        case Tag.PackedInt32: view.setInt32(p, Number(x), false); break;
+        case Tag.PackedInt64: view.setBigInt64(p, BigInt(x), false); break;
+        case Tag.PackedFloat32: view.setFloat32(p, Number(x), false); break;
+        default: view.setFloat64(p, Number(x), false); break;
+      }
+    }
+    off += n * width;
+  }
+
   encodeValue(value, 0);
 
-  return off === buf.length ? buf : buf.subarray(0, off);
+  return { bytes: off === buf.length ? buf : buf.subarray(0, off), keys: dictionary };
 }
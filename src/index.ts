@@ -5,7 +5,8 @@
  * @module koda-js
  */
 
-import { readFile, writeFile } from 'node:fs/promises';
+import { createHash } from 'node:crypto';
+import { readdir, readFile, writeFile } from 'node:fs/promises';
 import { dirname, join } from 'node:path';
 import { fileURLToPath } from 'node:url';
 import type { KodaValue } from './ast.js';
@@ -13,26 +14,50 @@ import { decode as decodeBinary } from './decoder.js';
 import type { DecodeOptions } from './decoder.js';
 import { encode as encodeBinary } from './encoder.js';
 import type { EncodeOptions } from './encoder.js';
-import { KodaDecodeError, KodaParseError } from './errors.js';
-import { loadNative, type NativeBinding } from './native.js';
+import { KodaDecodeError, KodaEncodeError, KodaParseError } from './errors.js';
+import {
+  loadNative,
+  nativeDictionary,
+  type NativeBinding,
+  type NativeDecodeOptions,
+  type NativeEncodeOptions,
+  type NativeParseOptions,
+} from './native.js';
 import { parseFast } from './parseFast.js';
 import { parse as parseWithLexer } from './parser.js';
 import type { ParseOptions } from './parser.js';
+import type { ParseCache } from './cache.js';
 import { decodeAsync } from './decode-async.js';
+import { lazyValue } from './lazy.js';
+import { withCancel, type AsyncOptions } from './pool.js';
 import { stringify as stringifyText } from './stringify.js';
 import type { StringifyOptions } from './stringify.js';
+import { xxh3 } from './xxh3.js';
 
-export type { KodaValue, KodaObject, KodaArray, SourcePosition } from './ast.js';
-export { isKodaObject, isKodaArray, isKodaString, isKodaNumber, isKodaBoolean, isKodaNull } from './ast.js';
+export type { KodaValue, KodaObject, KodaArray, KodaTypedArray, SourcePosition } from './ast.js';
+export { isKodaObject, isKodaArray, isKodaTypedArray, isKodaString, isKodaNumber, isKodaBoolean, isKodaNull } from './ast.js';
 export { KodaError, KodaParseError, KodaEncodeError, KodaDecodeError } from './errors.js';
 export type { ParseOptions } from './parser.js';
 export type { StringifyOptions } from './stringify.js';
 export type { EncodeOptions } from './encoder.js';
 export type { DecodeOptions } from './decoder.js';
+export { createDictionary } from './dictionary.js';
+export type { KodaDictionary } from './dictionary.js';
+export { createEncoderSession, createDecoderSession } from './session.js';
+export type { EncoderSession, DecoderSession } from './session.js';
+export { createStreamEncoder } from './writer.js';
+export type { StreamEncoder } from './writer.js';
 export { decodeAsync, createDecoderPool } from './decode-async.js';
-export type { DecoderPool, DecoderPoolOptions } from './decode-async.js';
-export { createEncodeStream, createDecodeStream } from './streams.js';
-export type { EncodeStreamOptions, DecodeStreamOptions } from './streams.js';
+export { materialize } from './lazy.js';
+export { decodeIncremental, decodeTimeSliced } from './sliced.js';
+export { createParseCache } from './cache.js';
+export type { ParseCache, ParseCacheOptions, ParseCacheStats } from './cache.js';
+export type { IncrementalDecode, TimeSlicedDecodeOptions } from './sliced.js';
+export type { DecoderPool, DecoderPoolOptions, DecoderPoolStats, DecoderWorkerStats } from './decode-async.js';
+export { configureThreadPool, getThreadPoolStats } from './pool.js';
+export type { AsyncOptions, CancelOptions, TaskPriority, ThreadPoolOptions, ThreadPoolStats } from './pool.js';
+export { createEncodeStream, createDecodeStream, createIncrementalDecodeStream } from './streams.js';
+export type { EncodeStreamOptions, DecodeStreamOptions, IncrementalDecodeStreamOptions } from './streams.js';
 
 const _addonPath = join(dirname(dirname(fileURLToPath(import.meta.url))), 'build', 'Release', 'koda_js.node');
 
@@ -48,12 +73,14 @@ export function isNativeAvailable(): boolean {
 /**
  * Parse KODA text (.koda) into a value.
  * Uses native C++ implementation when addon is built (faster, better for huge files).
+ * With `cache`, text parsed before is returned from the cache, frozen.
  */
-export function parse(text: string, options?: ParseOptions): KodaValue {
+export function parse(text: string, options?: ParseOptions & { cache?: ParseCache }): KodaValue {
+  if (options?.cache) return options.cache.parse(text, options);
   const native = getNative();
   if (native) {
     try {
-      return native.parse(text, { maxDepth: options?.maxDepth }) as KodaValue;
+      return native.parse(text, nativeParseOptions(options)) as KodaValue;
     } catch (e) {
       throw e instanceof KodaParseError ? e : new KodaParseError((e as Error).message);
     }
@@ -61,6 +88,36 @@ export function parse(text: string, options?: ParseOptions): KodaValue {
   return parseFast(text, options);
 }
 
+/**
+ * Parse KODA text on the native thread pool; the main thread only builds the
+ * resulting JS value. `signal` and `deadlineMs` stop the parse where it is.
+ * Without the addon, parses on the main thread.
+ */
+export async function parseAsync(text: string, options?: ParseOptions & AsyncOptions): Promise<KodaValue> {
+  const native = getNative();
+  if (!native) {
+    options?.signal?.throwIfAborted();
+    return parseFast(text, options);
+  }
+  try {
+    return (await withCancel(native, options, (cancel) =>
+      native.parseAsync(text, { ...nativeParseOptions(options), priority: options?.priority, cancel })
+    )) as KodaValue;
+  } catch (e) {
+    if (options?.signal?.aborted && e === options.signal.reason) throw e;
+    throw e instanceof KodaParseError ? e : new KodaParseError((e as Error).message);
+  }
+}
+
+function nativeParseOptions(options: ParseOptions | undefined): NativeParseOptions {
+  return {
+    maxDepth: options?.maxDepth,
+    maxInputLength: options?.maxInputLength,
+    mode: options?.mode,
+    threads: options?.threads,
+  };
+}
+
 /**
  * Serialize a value to KODA text.
  * Uses native C++ when addon is built (unless options like indent are used).
@@ -80,33 +137,130 @@ export function stringify(value: KodaValue, options?: StringifyOptions): string
 export function encode(value: KodaValue, options?: EncodeOptions): Uint8Array {
   const native = getNative();
   if (native) {
-    return native.encode(value, { maxDepth: options?.maxDepth }) as Uint8Array;
+    return native.encode(value, nativeEncodeOptions(native, options)) as Uint8Array;
   }
   return encodeBinary(value, options);
 }
 
 /**
- * Decode binary (.kod) to a value. Non-blocking: runs in a worker thread so the
- * main thread stays responsive. Prefer this over decodeSync for large payloads.
+ * Encode on the native thread pool. The value is read on the main thread;
+ * the encoding itself runs off it. Without the addon, encodes on the main
+ * thread.
  */
-export function decode(buffer: Uint8Array, options?: DecodeOptions): Promise<KodaValue> {
-  return decodeAsync(buffer, options);
+export async function encodeAsync(value: KodaValue, options?: EncodeOptions & AsyncOptions): Promise<Uint8Array> {
+  const native = getNative();
+  if (!native) {
+    options?.signal?.throwIfAborted();
+    return encodeBinary(value, options);
+  }
+  return withCancel(native, options, (cancel) =>
+    native.encodeAsync(value, { ...nativeEncodeOptions(native, options), priority: options?.priority, cancel })
+  );
+}
+
+function nativeEncodeOptions(native: NativeBinding, options: EncodeOptions | undefined): NativeEncodeOptions {
+  return {
+    maxDepth: options?.maxDepth,
+    version: options?.version,
+    stringTable: options?.stringTable,
+    dedupe: options?.dedupe,
+    dictionary: nativeDictionary(native, options?.dictionary),
+    threads: options?.threads,
+  };
+}
+
+/**
+ * Decode binary (.kod) to a value without blocking the main thread. With the
+ * addon, decoding runs on the native thread pool and only the JS value is
+ * built on the main thread; otherwise it runs in a worker thread. Prefer this
+ * over decodeSync for large payloads. With `lazy`, not even the JS value is
+ * built up front: fields are converted as they are read.
+ */
+export async function decode(buffer: Uint8Array, options?: DecodeOptions & AsyncOptions): Promise<KodaValue> {
+  const native = getNative();
+  if (!native) return decodeAsync(buffer, options);
+  try {
+    const buf = Buffer.isBuffer(buffer) ? buffer : Buffer.from(buffer);
+    const value = await withCancel(native, options, (cancel) =>
+      native.decodeAsync(buf, { ...nativeDecodeOptions(native, options), priority: options?.priority, cancel })
+    );
+    return lazyValue(native, value);
+  } catch (e) {
+    if (options?.signal?.aborted && e === options.signal.reason) throw e;
+    throw e instanceof KodaDecodeError ? e : new KodaDecodeError((e as Error).message);
+  }
+}
+
+export type HashAlgorithm = 'xxh3' | 'sha256';
+
+export interface HashOptions extends EncodeOptions {
+  /** `'xxh3'` (default): fast 64-bit, 16 hex digits. `'sha256'`: cryptographic, 64 hex digits. */
+  algorithm?: HashAlgorithm;
+}
+
+/**
+ * Hex digest of the canonical binary encoding of a value. Equal values give
+ * equal digests, whatever their key order. With the addon, the encoder feeds
+ * the hash directly and no encoded buffer is built. Encode options that
+ * change the bytes (`version`, `stringTable`, `dedupe`, `dictionary`) change
+ * the digest.
+ */
+export function hash(value: KodaValue, options?: HashOptions): string {
+  const native = getNative();
+  if (native) {
+    try {
+      return native.hash(value, { ...nativeEncodeOptions(native, options), algorithm: options?.algorithm });
+    } catch (e) {
+      throw e instanceof KodaEncodeError ? e : new KodaEncodeError((e as Error).message);
+    }
+  }
+  return digest(encodeBinary(value, options), options?.algorithm);
+}
+
+/** Hex digest of already encoded bytes: hash() of the value they encode, for canonical input. */
+export function hashBinary(buffer: Uint8Array, options?: { algorithm?: HashAlgorithm }): string {
+  const native = getNative();
+  if (native) {
+    const buf = Buffer.isBuffer(buffer) ? buffer : Buffer.from(buffer.buffer, buffer.byteOffset, buffer.byteLength);
+    try {
+      return native.hashBinary(buf, { algorithm: options?.algorithm });
+    } catch (e) {
+      throw e instanceof KodaEncodeError ? e : new KodaEncodeError((e as Error).message);
+    }
+  }
+  return digest(buffer, options?.algorithm);
+}
+
+function digest(bytes: Uint8Array, algorithm: HashAlgorithm = 'xxh3'): string {
+  if (algorithm === 'sha256') return createHash('sha256').update(bytes).digest('hex');
+  if (algorithm === 'xxh3') return xxh3(bytes).toString(16).padStart(16, '0');
+  throw new KodaEncodeError(`Unknown hash algorithm: ${String(algorithm)}`);
+}
+
+function nativeDecodeOptions(native: NativeBinding, options: DecodeOptions | undefined): NativeDecodeOptions {
+  return {
+    maxDepth: options?.maxDepth,
+    maxDictionarySize: options?.maxDictionarySize,
+    maxStringLength: options?.maxStringLength,
+    typedArrays: options?.typedArrays,
+    lazy: options?.lazy,
+    dictionary: nativeDictionary(native, options?.dictionary),
+    threads: options?.threads,
+  };
 }
 
 /**
  * Synchronous decode. Blocks the event loop; use sparingly or for small payloads.
  * Uses native C++ when addon is built, otherwise JS fallback.
+ * With `cache`, bytes decoded before are returned from the cache, frozen.
  */
-export function decodeSync(buffer: Uint8Array, options?: DecodeOptions): KodaValue {
+export function decodeSync(buffer: Uint8Array, options?: DecodeOptions & { cache?: ParseCache }): KodaValue {
+  if (options?.cache) return options.cache.decode(buffer, options);
   const native = getNative();
   if (native) {
     try {
       const buf = Buffer.isBuffer(buffer) ? buffer : Buffer.from(buffer);
-      return native.decode(buf, {
-        maxDepth: options?.maxDepth,
-        maxDictionarySize: options?.maxDictionarySize,
-        maxStringLength: options?.maxStringLength,
-      }) as KodaValue;
+      return lazyValue(native, native.decode(buf, nativeDecodeOptions(native, options)));
     } catch (e) {
       throw e instanceof KodaDecodeError ? e : new KodaDecodeError((e as Error).message);
     }
@@ -115,11 +269,145 @@ export function decodeSync(buffer: Uint8Array, options?: DecodeOptions): KodaVal
 }
 
 /**
- * Load and parse a .koda text file (UTF-8).
+ * Load and parse a .koda text file (UTF-8). Same as parseFile; with `cache`,
+ * the file is read and an unchanged file is not parsed again.
+ */
+export async function loadFile(path: string, options?: ParseOptions & { cache?: ParseCache }): Promise<KodaValue> {
+  if (options?.cache) return options.cache.parse(await readFile(path), options);
+  return parseFile(path, options);
+}
+
+/**
+ * Parse a .koda text file. With the addon, the file is mapped read-only and
+ * parsed in place on the native thread pool, so the text is never copied
+ * into a JS string or a native buffer. Otherwise it is read and parsed on the
+ * main thread.
+ *
+ * With the addon, the file must not be truncated while it is parsed: on
+ * POSIX systems, reading a mapped page past the new end of the file kills
+ * the process with SIGBUS. Replace such files by renaming a new file over
+ * them rather than rewriting them in place.
+ */
+export async function parseFile(path: string, options?: ParseOptions & AsyncOptions): Promise<KodaValue> {
+  const native = getNative();
+  if (!native) {
+    const content = await readFile(path, 'utf-8');
+    options?.signal?.throwIfAborted();
+    return parseFast(content, options);
+  }
+  try {
+    return (await withCancel(native, options, (cancel) =>
+      native.parseFile(path, { ...nativeParseOptions(options), priority: options?.priority, cancel })
+    )) as KodaValue;
+  } catch (e) {
+    if (options?.signal?.aborted && e === options.signal.reason) throw e;
+    throw e instanceof KodaParseError ? e : new KodaParseError((e as Error).message);
+  }
+}
+
+export interface LoadFilesOptions extends ParseOptions, AsyncOptions {
+  /** Files parsed at once (default: the native pool's thread count, or 8 without the addon). */
+  concurrency?: number;
+}
+
+/** One file of a loadFiles() batch: its value, or the error that file alone raised. */
+export type LoadFilesResult =
+  | { path: string; value: KodaValue; error?: undefined }
+  | { path: string; value?: undefined; error: KodaParseError };
+
+/**
+ * Parse many .koda files at once: an array of paths, or a directory whose
+ * `.koda` files are loaded in name order. With the addon, files are mapped
+ * and parsed on the native thread pool in parallel, and the values are built
+ * on the main thread in one batch. Results follow the order of the paths; a
+ * file that cannot be read or parsed gets an `error` entry rather than
+ * failing the batch. Aborting or passing the deadline rejects the batch.
+ * Files are mapped as by parseFile, so none may be truncated while the batch
+ * runs.
+ */
+export async function loadFiles(
+  paths: readonly string[] | string,
+  options?: LoadFilesOptions
+): Promise<LoadFilesResult[]> {
+  const list =
+    typeof paths === 'string'
+      ? (await readdir(paths)).filter((name) => name.endsWith('.koda')).sort().map((name) => join(paths, name))
+      : [...paths];
+  const native = getNative();
+  if (!native) return loadFilesSerially(list, options);
+  try {
+    const results = await withCancel(native, options, (cancel) =>
+      native.loadFiles(list, {
+        ...nativeParseOptions(options),
+        priority: options?.priority,
+        concurrency: options?.concurrency,
+        cancel,
+      })
+    );
+    return results.map((r) =>
+      r.error !== undefined
+        ? { path: r.path, error: new KodaParseError(r.error) }
+        : { path: r.path, value: r.value as KodaValue }
+    );
+  } catch (e) {
+    if (options?.signal?.aborted && e === options.signal.reason) throw e;
+    throw e instanceof KodaParseError ? e : new KodaParseError((e as Error).message);
+  }
+}
+
+/** loadFiles without the addon: reads overlap, parsing runs on the main thread. */
+async function loadFilesSerially(paths: string[], options?: LoadFilesOptions): Promise<LoadFilesResult[]> {
+  const results: LoadFilesResult[] = new Array(paths.length);
+  let next = 0;
+  const deadline = options?.deadlineMs !== undefined ? Date.now() + options.deadlineMs : undefined;
+  const run = async () => {
+    while (next < paths.length) {
+      const i = next++;
+      const path = paths[i];
+      options?.signal?.throwIfAborted();
+      if (deadline !== undefined && Date.now() >= deadline) throw new KodaParseError('Deadline exceeded');
+      try {
+        results[i] = { path, value: parseFast(await readFile(path, 'utf-8'), options) };
+      } catch (e) {
+        results[i] = { path, error: e instanceof KodaParseError ? e : new KodaParseError((e as Error).message) };
+      }
+    }
+  };
+  const runners = Math.max(1, Math.min(options?.concurrency ?? 8, paths.length));
+  await Promise.all(Array.from({ length: runners }, run));
+  return results;
+}
+
+/**
+ * Decode a .kod binary file. With the addon, the file is mapped read-only
+ * and decoded in place on the native thread pool; no Buffer holds its bytes.
+ * Otherwise it is read, then decoded as by decode().
+ *
+ * As with parseFile, the file must not be truncated while it is decoded, or
+ * reading past its new end kills the process with SIGBUS.
+ */
+export async function decodeFile(path: string, options?: DecodeOptions & AsyncOptions): Promise<KodaValue> {
+  const native = getNative();
+  if (!native) return decodeAsync(await readFile(path), options);
+  try {
+    const value = await withCancel(native, options, (cancel) =>
+      native.decodeFile(path, { ...nativeDecodeOptions(native, options), priority: options?.priority, cancel })
+    );
+    return lazyValue(native, value);
+  } catch (e) {
+    if (options?.signal?.aborted && e === options.signal.reason) throw e;
+    throw e instanceof KodaDecodeError ? e : new KodaDecodeError((e as Error).message);
+  }
+}
+
+/**
+ * Open a .kod binary file as a lazy, read-only view: decodeFile with
+ * `lazy: true`. Fields are converted to JS as they are read. The file must
+ * not be truncated until the promise settles; the view itself no longer
+ * reads it.
  */
-export async function loadFile(path: string, options?: ParseOptions): Promise<KodaValue> {
-  const content = await readFile(path, 'utf-8');
-  return parse(content, options);
+export function openViewFile(path: string, options?: DecodeOptions & AsyncOptions): Promise<KodaValue> {
+  return decodeFile(path, { ...options, lazy: true });
 }
 
 /** Lexer-based parser (better error positions); default parse uses fast path when no native. */
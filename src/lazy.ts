@@ -0,0 +1,86 @@
+/**
+ * Lazy decode results: the decoded document stays in native memory and each
+ * field is converted to JS the first time it is read, so the main thread
+ * pays for the fields it touches rather than for the whole document.
+ */
+
+import type { KodaValue } from './ast.js';
+import type { NativeBinding, NativeLazyNode } from './native.js';
+
+const INDEX = /^(?:0|[1-9]\d*)$/;
+
+/** Native node behind each proxy, for materialize(). */
+const nodes = new WeakMap<object, NativeLazyNode>();
+
+/**
+ * Wrap a native decode result. Arrays and objects become read-only proxies
+ * that load their children on access and keep them; other values are returned
+ * as they are. Spreading, JSON.stringify and iteration work as on plain
+ * values. Two paths to one shared subtree (`dedupe`) give two proxies.
+ */
+export function lazyValue(binding: NativeBinding, value: unknown): KodaValue {
+  return value instanceof binding.LazyNode ? lazyNode(binding, value) : (value as KodaValue);
+}
+
+function lazyNode(binding: NativeBinding, node: NativeLazyNode): KodaValue {
+  const isArray = node.kind() === 'array';
+  const length = node.length();
+  const target: Record<string, KodaValue> | KodaValue[] = isArray ? new Array<KodaValue>(length) : {};
+  let keys: string[] | undefined;
+
+  /** Load `key` into the target; false if the node has no such child. */
+  const load = (key: string): boolean => {
+    if (Object.prototype.hasOwnProperty.call(target, key)) return true;
+    if (isArray && (!INDEX.test(key) || Number(key) >= length)) return false;
+    const child = node.get(isArray ? Number(key) : key);
+    if (child === undefined) return false;
+    Object.defineProperty(target, key, {
+      value: lazyValue(binding, child),
+      writable: true,
+      enumerable: true,
+      configurable: true,
+    });
+    return true;
+  };
+
+  const proxy = new Proxy(target, {
+    get(t, key, receiver) {
+      if (typeof key === 'string' && !(isArray && key === 'length') && load(key)) return (t as Record<string, KodaValue>)[key];
+      return Reflect.get(t, key, receiver);
+    },
+    has(t, key) {
+      return (typeof key === 'string' && load(key)) || Reflect.has(t, key);
+    },
+    ownKeys() {
+      if (!isArray) return (keys ??= node.keys());
+      const out: string[] = [];
+      for (let i = 0; i < length; i++) out.push(String(i));
+      out.push('length');
+      return out;
+    },
+    getOwnPropertyDescriptor(t, key) {
+      if (typeof key === 'string') load(key);
+      return Reflect.getOwnPropertyDescriptor(t, key);
+    },
+    set() {
+      return false;
+    },
+    defineProperty() {
+      return false;
+    },
+    deleteProperty() {
+      return false;
+    },
+  });
+  nodes.set(proxy, node);
+  return proxy as KodaValue;
+}
+
+/**
+ * Plain, mutable copy of a lazy decode result, converted in one native pass.
+ * Any other value is returned unchanged.
+ */
+export function materialize(value: KodaValue): KodaValue {
+  const node = typeof value === 'object' && value !== null ? nodes.get(value) : undefined;
+  return node ? (node.materialize() as KodaValue) : value;
+}
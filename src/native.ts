@@ -4,12 +4,113 @@
  */
 
 import { createRequire } from 'node:module';
+import type { KodaDictionary } from './dictionary.js';
+
+/** Opaque native dictionary handle; holds the keys and their interned JS strings. */
+export type NativeDictionary = object;
+
+export interface NativeEncodeOptions {
+  maxDepth?: number;
+  version?: number;
+  stringTable?: boolean;
+  dedupe?: boolean;
+  dictionary?: NativeDictionary;
+  threads?: number;
+}
+
+export interface NativeDecodeOptions {
+  maxDepth?: number;
+  maxDictionarySize?: number;
+  maxStringLength?: number;
+  typedArrays?: boolean;
+  lazy?: boolean;
+  dictionary?: NativeDictionary;
+  threads?: number;
+}
+
+export interface NativeParseOptions {
+  maxDepth?: number;
+  maxInputLength?: number;
+  mode?: 'lexer' | 'indexed';
+  threads?: number;
+}
+
+/** Stop request polled by native parse/encode/decode loops. */
+export interface NativeCancelToken {
+  cancel(): void;
+}
+
+/** Scheduling class of a call queued on the native thread pool, and its cancel token. */
+export interface NativeAsyncOptions {
+  priority?: 'high' | 'normal' | 'low';
+  cancel?: NativeCancelToken;
+}
+
+export interface NativePoolStats {
+  threads: number;
+  active: number;
+  queued: { high: number; normal: number; low: number };
+  executed: number;
+  stolen: number;
+}
+
+/** One array or object of a lazily decoded document; children are converted by get(). */
+export interface NativeLazyNode {
+  kind(): 'array' | 'object';
+  length(): number;
+  keys(): string[];
+  get(key: string | number): unknown;
+  materialize(): unknown;
+}
+
+/** Content-addressed cache of frozen parse and decode results. */
+export interface NativeParseCache {
+  parse(text: string | Buffer, options?: NativeParseOptions): unknown;
+  decode(buffer: Buffer, options?: NativeDecodeOptions): unknown;
+  stats(): { entries: number; bytes: number; maxBytes: number; hits: number; misses: number; evictions: number };
+  clear(): void;
+}
 
 export interface NativeBinding {
-  parse(text: string, options?: { maxDepth?: number }): unknown;
+  parse(text: string, options?: NativeParseOptions): unknown;
   stringify(value: unknown): string;
-  encode(value: unknown, options?: { maxDepth?: number }): Buffer;
-  decode(buffer: Buffer, options?: { maxDepth?: number; maxDictionarySize?: number; maxStringLength?: number }): unknown;
+  encode(value: unknown, options?: NativeEncodeOptions): Buffer;
+  decode(buffer: Buffer, options?: NativeDecodeOptions & NativeAsyncOptions): unknown;
+  decodeDetached(buffer: Buffer, options?: NativeDecodeOptions & NativeAsyncOptions): number;
+  adoptDocument(id: number): unknown;
+  /** Free a decodeDetached() document that will not be adopted; unknown ids are ignored. */
+  releaseDocument(id: number): void;
+  parseAsync(text: string, options?: NativeParseOptions & NativeAsyncOptions): Promise<unknown>;
+  encodeAsync(value: unknown, options?: NativeEncodeOptions & NativeAsyncOptions): Promise<Buffer>;
+  decodeAsync(buffer: Buffer, options?: NativeDecodeOptions & NativeAsyncOptions): Promise<unknown>;
+  parseFile(path: string, options?: NativeParseOptions & NativeAsyncOptions): Promise<unknown>;
+  decodeFile(path: string, options?: NativeDecodeOptions & NativeAsyncOptions): Promise<unknown>;
+  hash(value: unknown, options?: NativeEncodeOptions & { algorithm?: string }): string;
+  hashBinary(buffer: Buffer, options?: { algorithm?: string }): string;
+  loadFiles(
+    paths: string[],
+    options?: NativeParseOptions & NativeAsyncOptions & { concurrency?: number }
+  ): Promise<Array<{ path: string; value?: unknown; error?: string }>>;
+  configurePool(options: { threads?: number }): void;
+  poolStats(): NativePoolStats;
+  Dictionary: new (keys: readonly string[]) => NativeDictionary;
+  LazyNode: new () => NativeLazyNode;
+  /** `flag`: cancel when its first word is nonzero (an Int32Array over a SharedArrayBuffer). */
+  CancelToken: new (options?: { deadlineMs?: number; flag?: Int32Array }) => NativeCancelToken;
+  EncoderSession: new (options?: NativeEncodeOptions) => { encode(value: unknown): Buffer };
+  DecoderSession: new (options?: NativeDecodeOptions) => { decode(buffer: Buffer): unknown };
+  FrameEncoder: new (options?: NativeEncodeOptions & { session?: boolean }) => { encode(value: unknown): Buffer };
+  FrameDecoder: new (
+    options?: NativeDecodeOptions & { maxFrameSize?: number; session?: boolean }
+  ) => { push(chunk: Buffer): unknown[]; end(): void };
+  StreamEncoder: new (options?: NativeEncodeOptions) => {
+    beginArray(): void;
+    writeValue(value: unknown): void;
+    finish(path?: string): Buffer | undefined;
+  };
+  IncrementalDecoder: new (options?: NativeDecodeOptions) => { push(chunk: Buffer): unknown[]; end(): void };
+  ParseCache: new (options?: { maxBytes?: number }) => NativeParseCache;
+  SlicedDecoder: new (buffer: Buffer, options?: NativeDecodeOptions) => { step(budgetMs: number): boolean; result(): unknown };
 }
 
 let cached: NativeBinding | null | undefined = undefined;
@@ -39,3 +140,20 @@ export function loadNative(callerUrl: string, addonPath: string): NativeBinding
   cached = null;
   return null;
 }
+
+const dictionaries = new Map<bigint, NativeDictionary>();
+
+/**
+ * Native handle for an external dictionary, created once per dictionary id so
+ * its interned key strings are reused across calls (and across structured
+ * clones of the same dictionary in workers).
+ */
+export function nativeDictionary(binding: NativeBinding, dict: KodaDictionary | undefined): NativeDictionary | undefined {
+  if (dict === undefined) return undefined;
+  let handle = dictionaries.get(dict.id);
+  if (handle === undefined) {
+    handle = new binding.Dictionary(dict.keys);
+    dictionaries.set(dict.id, handle);
+  }
+  return handle;
+}
@@ -13,6 +13,19 @@ export interface ParseOptions {
   maxDepth?: number;
   /** Max input length in characters. Passed to lexer. */
   maxInputLength?: number;
+  /**
+   * Tokenizer used by the native parser: 'lexer' (default) scans byte by byte;
+   * 'indexed' first finds all token starts with SIMD, which is faster on large
+   * inputs. Same values and errors either way. Ignored without the addon.
+   */
+  mode?: 'lexer' | 'indexed';
+  /**
+   * Native threads for a large root array or root object (default 1). The
+   * root is split between top-level elements or pairs and the pieces are
+   * parsed in parallel; errors and duplicate keys are reported as in a
+   * serial parse. Ignored without the addon.
+   */
+  threads?: number;
 }
 
 const DEFAULT_MAX_DEPTH = 256;
@@ -0,0 +1,91 @@
+/**
+ * The native thread pool behind parseAsync, encodeAsync and decode, and the
+ * `threads` option of parse/encode/decodeSync. Workers steal queued work from
+ * each other, so one large job does not hold up the ones behind it while
+ * other threads are idle, and a large root array is split into subtasks that
+ * any free worker can pick up.
+ */
+
+import { dirname, join } from 'node:path';
+import { fileURLToPath } from 'node:url';
+import { loadNative, type NativeBinding, type NativeCancelToken } from './native.js';
+
+const addonPath = join(dirname(dirname(fileURLToPath(import.meta.url))), 'build', 'Release', 'koda_js.node');
+
+function getNative(): NativeBinding | null {
+  return loadNative(import.meta.url, addonPath);
+}
+
+/** Scheduling class of an async call: queued high-priority work always starts first. */
+export type TaskPriority = 'high' | 'normal' | 'low';
+
+/** Stopping an async call early. A stopped call releases its thread and memory within a few KB of work. */
+export interface CancelOptions {
+  /** Abort the call; it then rejects with `signal.reason`. */
+  signal?: AbortSignal;
+  /** Reject with a "Deadline exceeded" error once this many ms have passed since the call, queue time included. */
+  deadlineMs?: number;
+}
+
+export interface AsyncOptions extends CancelOptions {
+  /** Scheduling class on the native thread pool (default 'normal'). */
+  priority?: TaskPriority;
+}
+
+/**
+ * Run a native call with a cancel token tied to `options.signal` and
+ * `options.deadlineMs` (none when neither is set). An aborted call rejects
+ * with the signal's reason.
+ */
+export async function withCancel<T>(
+  native: NativeBinding,
+  options: CancelOptions | undefined,
+  run: (cancel: NativeCancelToken | undefined) => Promise<T>
+): Promise<T> {
+  const signal = options?.signal;
+  signal?.throwIfAborted();
+  if (!signal && options?.deadlineMs === undefined) return run(undefined);
+  const token = new native.CancelToken({ deadlineMs: options?.deadlineMs });
+  const onAbort = () => token.cancel();
+  signal?.addEventListener('abort', onAbort, { once: true });
+  try {
+    return await run(token);
+  } catch (e) {
+    if (signal?.aborted) throw signal.reason;
+    throw e;
+  } finally {
+    signal?.removeEventListener('abort', onAbort);
+  }
+}
+
+export interface ThreadPoolOptions {
+  /** Worker threads (default: one per hardware thread). */
+  threads?: number;
+}
+
+export interface ThreadPoolStats {
+  threads: number;
+  /** Tasks running now. */
+  active: number;
+  /** Tasks waiting, by priority. */
+  queued: Record<TaskPriority, number>;
+  /** Tasks finished so far. */
+  executed: number;
+  /** Of those, tasks taken from another worker's queue. */
+  stolen: number;
+}
+
+/**
+ * Resize the native thread pool. Running tasks finish first and queued ones
+ * are kept. No-op without the addon.
+ */
+export function configureThreadPool(options: ThreadPoolOptions): void {
+  const native = getNative();
+  if (native && options.threads !== undefined) native.configurePool({ threads: Math.max(1, options.threads) });
+}
+
+/** Native thread pool counters, or null without the addon. */
+export function getThreadPoolStats(): ThreadPoolStats | null {
+  const native = getNative();
+  return native ? native.poolStats() : null;
+}
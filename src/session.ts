@@ -0,0 +1,89 @@
+/**
+ * Session codecs (SPEC §6.12): a dictionary that grows across a stream of
+ * frames, so each frame carries only the keys that are new to the session.
+ * Uses the native session state when the addon is built; falls back to JS.
+ */
+
+import { dirname, join } from 'node:path';
+import { fileURLToPath } from 'node:url';
+import type { KodaValue } from './ast.js';
+import { decodeSessionFrame } from './decoder.js';
+import type { DecodeOptions } from './decoder.js';
+import { encodeSessionFrame } from './encoder.js';
+import type { EncodeOptions } from './encoder.js';
+import { KodaDecodeError } from './errors.js';
+import { loadNative, nativeDictionary, type NativeBinding } from './native.js';
+
+const addonPath = join(dirname(dirname(fileURLToPath(import.meta.url))), 'build', 'Release', 'koda_js.node');
+
+function getNative(): NativeBinding | null {
+  return loadNative(import.meta.url, addonPath);
+}
+
+export interface EncoderSession {
+  /** Encode one frame; the first frame carries every key, later ones only new keys. */
+  encode(value: KodaValue): Uint8Array;
+}
+
+export interface DecoderSession {
+  /** Decode the next frame. Frames must arrive in the order they were encoded. */
+  decode(buffer: Uint8Array): KodaValue;
+}
+
+/**
+ * Create a session encoder. With `dictionary`, the session starts from its
+ * keys; the decoder session must then be created with the same dictionary.
+ */
+export function createEncoderSession(options: EncodeOptions = {}): EncoderSession {
+  const native = getNative();
+  if (native) {
+    const session = new native.EncoderSession({
+      maxDepth: options.maxDepth,
+      version: options.version,
+      stringTable: options.stringTable,
+      dedupe: options.dedupe,
+      dictionary: nativeDictionary(native, options.dictionary),
+    });
+    return { encode: (value) => session.encode(value) as Uint8Array };
+  }
+  let keys: readonly string[] = options.dictionary?.keys ?? [];
+  const frameOptions: EncodeOptions = { ...options, dictionary: undefined };
+  return {
+    encode(value) {
+      const frame = encodeSessionFrame(value, frameOptions, keys);
+      keys = frame.keys;
+      return frame.bytes;
+    },
+  };
+}
+
+/** Create a session decoder; standalone documents are accepted too. */
+export function createDecoderSession(options: DecodeOptions = {}): DecoderSession {
+  const native = getNative();
+  if (native) {
+    const session = new native.DecoderSession({
+      maxDepth: options.maxDepth,
+      maxDictionarySize: options.maxDictionarySize,
+      maxStringLength: options.maxStringLength,
+      typedArrays: options.typedArrays,
+      dictionary: nativeDictionary(native, options.dictionary),
+    });
+    return {
+      decode(buffer) {
+        try {
+          return session.decode(Buffer.isBuffer(buffer) ? buffer : Buffer.from(buffer)) as KodaValue;
+        } catch (e) {
+          throw e instanceof KodaDecodeError ? e : new KodaDecodeError((e as Error).message);
+        }
+      },
+    };
+  }
+  let keys: readonly string[] = options.dictionary?.keys ?? [];
+  return {
+    decode(buffer) {
+      const frame = decodeSessionFrame(buffer, options, keys);
+      if (frame.keys !== undefined) keys = frame.keys;
+      return frame.value;
+    },
+  };
+}
@@ -0,0 +1,138 @@
+/**
+ * Time-sliced decode on the main thread: the work is split into steps of a
+ * bounded duration, run one per event-loop turn, so a mid-sized document
+ * decodes without a thread handoff and without one long blocking tick.
+ */
+
+import { dirname, join } from 'node:path';
+import { fileURLToPath } from 'node:url';
+import type { KodaValue } from './ast.js';
+import { decode as decodeBinary } from './decoder.js';
+import type { DecodeOptions } from './decoder.js';
+import { KodaDecodeError } from './errors.js';
+import { loadNative, nativeDictionary, type NativeBinding } from './native.js';
+import type { CancelOptions } from './pool.js';
+
+const addonPath = join(dirname(dirname(fileURLToPath(import.meta.url))), 'build', 'Release', 'koda_js.node');
+
+function getNative(): NativeBinding | null {
+  return loadNative(import.meta.url, addonPath);
+}
+
+const DEFAULT_SLICE_MS = 4;
+
+/** A decode that advances a bounded amount of work per step(). */
+export interface IncrementalDecode {
+  /**
+   * Work for about `budgetMs` milliseconds (default 4); true once the value
+   * is complete. Overshoot is bounded by the native decode of one root
+   * array element, or of the whole root when it is not a plain array. A
+   * columnar root (an array of records) is decoded natively in one step;
+   * only its conversion to JS is spread over the following steps. Once a
+   * step has thrown, every later step throws the same error.
+   */
+  step(budgetMs?: number): boolean;
+  /** True once step() has returned true. */
+  readonly done: boolean;
+  /** The decoded value; throws until done, or the error a step threw. */
+  readonly value: KodaValue;
+}
+
+export interface TimeSlicedDecodeOptions extends DecodeOptions, CancelOptions {
+  /** Budget of each step in milliseconds (default 4). */
+  sliceMs?: number;
+}
+
+/**
+ * Start a resumable decode of `buffer`. Nothing is decoded until step() is
+ * called. Without the addon, the first step decodes the whole buffer.
+ * `lazy` is not supported here; every field is converted.
+ */
+export function decodeIncremental(buffer: Uint8Array, options?: DecodeOptions): IncrementalDecode {
+  const native = getNative();
+  if (!native) {
+    let done = false;
+    let value: KodaValue = null;
+    let error: unknown;
+    return {
+      step() {
+        if (error !== undefined) throw error;
+        if (!done) {
+          try {
+            value = decodeBinary(buffer, options);
+          } catch (e) {
+            error = e;
+            throw e;
+          }
+          done = true;
+        }
+        return true;
+      },
+      get done() {
+        return done;
+      },
+      get value() {
+        if (error !== undefined) throw error;
+        if (!done) throw new KodaDecodeError('Decode is not complete');
+        return value;
+      },
+    };
+  }
+  const buf = Buffer.isBuffer(buffer) ? buffer : Buffer.from(buffer);
+  const decoder = new native.SlicedDecoder(buf, {
+    maxDepth: options?.maxDepth,
+    maxDictionarySize: options?.maxDictionarySize,
+    maxStringLength: options?.maxStringLength,
+    typedArrays: options?.typedArrays,
+    dictionary: nativeDictionary(native, options?.dictionary),
+  });
+  let done = false;
+  return {
+    step(budgetMs = DEFAULT_SLICE_MS) {
+      if (done) return true;
+      try {
+        done = decoder.step(budgetMs);
+      } catch (e) {
+        throw e instanceof KodaDecodeError ? e : new KodaDecodeError((e as Error).message);
+      }
+      return done;
+    },
+    get done() {
+      return done;
+    },
+    get value() {
+      try {
+        return decoder.result() as KodaValue;
+      } catch (e) {
+        throw e instanceof KodaDecodeError ? e : new KodaDecodeError((e as Error).message);
+      }
+    },
+  };
+}
+
+/**
+ * Decode on the main thread one step per event-loop turn (via setImmediate),
+ * so no turn spends much more than `sliceMs` on it. Suited to payloads too
+ * small to be worth a thread handoff but large enough that decodeSync would
+ * stall the loop. `signal` and `deadlineMs` are checked between steps.
+ */
+export function decodeTimeSliced(buffer: Uint8Array, options?: TimeSlicedDecodeOptions): Promise<KodaValue> {
+  const signal = options?.signal;
+  const deadline = options?.deadlineMs !== undefined ? Date.now() + options.deadlineMs : undefined;
+  const sliceMs = options?.sliceMs ?? DEFAULT_SLICE_MS;
+  return new Promise((resolve, reject) => {
+    let decode: IncrementalDecode;
+    const tick = () => {
+      try {
+        signal?.throwIfAborted();
+        if (deadline !== undefined && Date.now() >= deadline) throw new KodaDecodeError('Deadline exceeded');
+        decode ??= decodeIncremental(buffer, options);
+        if (decode.step(sliceMs)) resolve(decode.value);
+        else setImmediate(tick);
+      } catch (e) {
+        reject(e);
+      }
+    };
+    tick();
+  });
+}
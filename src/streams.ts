@@ -0,0 +1,294 @@
+/**
+ * Record-based streaming: each value is one `[varint length][payload]` frame.
+ * Also incremental decoding of one large document's root array.
+ * Uses the native codecs when the addon is built; falls back to JS.
+ */
+
+import { dirname, join } from 'node:path';
+import { Transform } from 'node:stream';
+import type { TransformCallback } from 'node:stream';
+import { fileURLToPath } from 'node:url';
+import type { KodaValue } from './ast.js';
+import type { DecodeOptions } from './decoder.js';
+import { decode as decodeBinary } from './decoder.js';
+import type { EncodeOptions } from './encoder.js';
+import { encode as encodeBinary } from './encoder.js';
+import { KodaDecodeError, KodaEncodeError } from './errors.js';
+import { loadNative, nativeDictionary, type NativeBinding } from './native.js';
+import { createDecoderSession, createEncoderSession } from './session.js';
+
+const addonPath = join(dirname(dirname(fileURLToPath(import.meta.url))), 'build', 'Release', 'koda_js.node');
+
+function getNative(): NativeBinding | null {
+  return loadNative(import.meta.url, addonPath);
+}
+
+const DEFAULT_MAX_FRAME_SIZE = 64 * 1024 * 1024;
+/** A 32-bit length needs at most 5 LEB128 bytes. */
+const MAX_HEADER_BYTES = 5;
+
+export interface EncodeStreamOptions extends EncodeOptions {
+  /** Stream buffer size (objects on the writable side, bytes on the readable side) */
+  highWaterMark?: number;
+  /** Share one growing dictionary across frames (SPEC §6.12); the decoder must also use `session` */
+  session?: boolean;
+}
+
+export interface DecodeStreamOptions extends DecodeOptions {
+  /** Largest accepted payload in bytes (default 64 MiB) */
+  maxFrameSize?: number;
+  /** Stream buffer size (bytes on the writable side, objects on the readable side) */
+  highWaterMark?: number;
+  /** Decode session frames (SPEC §6.12) written by an encode stream with `session` */
+  session?: boolean;
+}
+
+export interface IncrementalDecodeStreamOptions extends DecodeOptions {
+  /** Stream buffer size (bytes on the writable side, objects on the readable side) */
+  highWaterMark?: number;
+}
+
+function frameHeader(n: number): Uint8Array {
+  const out: number[] = [];
+  while (n >= 0x80) {
+    out.push((n % 0x80) | 0x80);
+    n = Math.floor(n / 0x80);
+  }
+  out.push(n);
+  return Uint8Array.from(out);
+}
+
+/**
+ * JS counterpart of the native FrameReader: scans a list of chunks in place,
+ * copying only frames that straddle chunk boundaries.
+ */
+class FrameReader {
+  private readonly chunks: Uint8Array[] = [];
+  private offset = 0;
+  private buffered = 0;
+
+  constructor(private readonly maxFrameSize: number) {}
+
+  push(chunk: Uint8Array): void {
+    if (chunk.length === 0) return;
+    this.chunks.push(chunk);
+    this.buffered += chunk.length;
+  }
+
+  get pending(): number {
+    return this.buffered;
+  }
+
+  /** Next complete payload, or undefined if more input is needed. */
+  next(): Uint8Array | undefined {
+    let len = 0;
+    let header = 0;
+    for (;; header++) {
+      if (header >= this.buffered) return undefined;
+      const b = this.at(header);
+      if ((header === MAX_HEADER_BYTES - 1 && b > 0x0f) || (header > 0 && b === 0)) {
+        throw new KodaDecodeError('Malformed frame length');
+      }
+      len += (b & 0x7f) * 2 ** (7 * header);
+      if ((b & 0x80) === 0) break;
+    }
+    header++;
+    if (len > this.maxFrameSize) throw new KodaDecodeError('Frame too large');
+    if (this.buffered - header < len) return undefined;
+    this.consume(header);
+    const first = this.chunks[0];
+    let payload: Uint8Array;
+    if (len === 0 || first === undefined) {
+      payload = new Uint8Array(0);
+    } else if (first.length - this.offset >= len) {
+      payload = first.subarray(this.offset, this.offset + len);
+    } else {
+      payload = new Uint8Array(len);
+      let copied = 0;
+      for (const c of this.chunks) {
+        const from = copied === 0 ? this.offset : 0;
+        const n = Math.min(c.length - from, len - copied);
+        payload.set(c.subarray(from, from + n), copied);
+        copied += n;
+        if (copied === len) break;
+      }
+    }
+    this.consume(len);
+    return payload;
+  }
+
+  private at(i: number): number {
+    i += this.offset;
+    for (const c of this.chunks) {
+      if (i < c.length) return c[i]!;
+      i -= c.length;
+    }
+    return 0;
+  }
+
+  private consume(n: number): void {
+    this.buffered -= n;
+    while (n > 0) {
+      const avail = this.chunks[0]!.length - this.offset;
+      if (n < avail) {
+        this.offset += n;
+        return;
+      }
+      n -= avail;
+      this.chunks.shift();
+      this.offset = 0;
+    }
+  }
+}
+
+/**
+ * Transform stream: accepts KODA values and outputs framed binary, one
+ * `[varint length][payload]` record per value.
+ */
+export function createEncodeStream(options: EncodeStreamOptions = {}): Transform {
+  const { highWaterMark, session, ...encodeOptions } = options;
+  let encodeFrame: (value: KodaValue) => Uint8Array;
+  const native = getNative();
+  if (native) {
+    const encoder = new native.FrameEncoder({
+      ...encodeOptions,
+      dictionary: nativeDictionary(native, encodeOptions.dictionary),
+      session,
+    });
+    encodeFrame = (value) => encoder.encode(value);
+  } else {
+    const sessionEncoder = session ? createEncoderSession(encodeOptions) : undefined;
+    encodeFrame = (value) => {
+      const payload = sessionEncoder ? sessionEncoder.encode(value) : encodeBinary(value, encodeOptions);
+      const header = frameHeader(payload.length);
+      const frame = new Uint8Array(header.length + payload.length);
+      frame.set(header, 0);
+      frame.set(payload, header.length);
+      return frame;
+    };
+  }
+  return new Transform({
+    writableObjectMode: true,
+    highWaterMark,
+    transform(value: KodaValue, _encoding: BufferEncoding, callback: TransformCallback) {
+      try {
+        callback(null, encodeFrame(value));
+      } catch (e) {
+        callback(e instanceof KodaEncodeError ? e : new KodaEncodeError((e as Error).message));
+      }
+    },
+  });
+}
+
+/**
+ * Transform stream: accepts binary chunks and emits one value per frame.
+ * All frames completed by a chunk are decoded in one batch.
+ */
+export function createDecodeStream(options: DecodeStreamOptions = {}): Transform {
+  const { highWaterMark, session, maxFrameSize = DEFAULT_MAX_FRAME_SIZE, ...decodeOptions } = options;
+  let pushChunk: (chunk: Buffer) => KodaValue[];
+  let end: () => void;
+  const native = getNative();
+  if (native) {
+    const decoder = new native.FrameDecoder({
+      ...decodeOptions,
+      dictionary: nativeDictionary(native, decodeOptions.dictionary),
+      maxFrameSize,
+      session,
+    });
+    pushChunk = (chunk) => decoder.push(chunk) as KodaValue[];
+    end = () => decoder.end();
+  } else {
+    const reader = new FrameReader(maxFrameSize);
+    const sessionDecoder = session ? createDecoderSession(decodeOptions) : undefined;
+    pushChunk = (chunk) => {
+      reader.push(chunk);
+      const values: KodaValue[] = [];
+      for (let payload = reader.next(); payload !== undefined; payload = reader.next()) {
+        values.push(sessionDecoder ? sessionDecoder.decode(payload) : decodeBinary(payload, decodeOptions));
+      }
+      return values;
+    };
+    end = () => {
+      if (reader.pending > 0) throw new KodaDecodeError('Truncated frame');
+    };
+  }
+  return new Transform({
+    readableObjectMode: true,
+    highWaterMark,
+    transform(chunk: Buffer, _encoding: BufferEncoding, callback: TransformCallback) {
+      try {
+        for (const value of pushChunk(chunk)) this.push(value);
+        callback();
+      } catch (e) {
+        callback(e instanceof KodaDecodeError ? e : new KodaDecodeError((e as Error).message));
+      }
+    },
+    flush(callback: TransformCallback) {
+      try {
+        end();
+        callback();
+      } catch (e) {
+        callback(e instanceof KodaDecodeError ? e : new KodaDecodeError((e as Error).message));
+      }
+    },
+  });
+}
+
+/**
+ * Transform stream over the chunks of one (unframed) KODA document: emits
+ * the elements of a root array as each one completes, so a large archive of
+ * records is processed without buffering it. A root that is not an array is
+ * emitted as a single value at the end.
+ * With the C++ addon the document is scanned incrementally; the JS fallback
+ * buffers it and decodes when the input ends.
+ */
+export function createIncrementalDecodeStream(options: IncrementalDecodeStreamOptions = {}): Transform {
+  const { highWaterMark, ...decodeOptions } = options;
+  let pushChunk: (chunk: Buffer) => KodaValue[];
+  let end: () => KodaValue[];
+  const native = getNative();
+  if (native) {
+    const decoder = new native.IncrementalDecoder({
+      ...decodeOptions,
+      dictionary: nativeDictionary(native, decodeOptions.dictionary),
+    });
+    pushChunk = (chunk) => decoder.push(chunk) as KodaValue[];
+    end = () => {
+      decoder.end();
+      return [];
+    };
+  } else {
+    const chunks: Buffer[] = [];
+    pushChunk = (chunk) => {
+      chunks.push(chunk);
+      return [];
+    };
+    end = () => {
+      const value = decodeBinary(Buffer.concat(chunks), decodeOptions);
+      if (Array.isArray(value)) return value;
+      if (ArrayBuffer.isView(value)) return Array.from(value as ArrayLike<number>);
+      return [value];
+    };
+  }
+  return new Transform({
+    readableObjectMode: true,
+    highWaterMark,
+    transform(chunk: Buffer, _encoding: BufferEncoding, callback: TransformCallback) {
+      try {
+        for (const value of pushChunk(chunk)) this.push(value);
+        callback();
+      } catch (e) {
+        callback(e instanceof KodaDecodeError ? e : new KodaDecodeError((e as Error).message));
+      }
+    },
+    flush(callback: TransformCallback) {
+      try {
+        for (const value of end()) this.push(value);
+        callback();
+      } catch (e) {
+        callback(e instanceof KodaDecodeError ? e : new KodaDecodeError((e as Error).message));
+      }
+    },
+  });
+}
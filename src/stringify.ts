@@ -63,6 +63,9 @@ function stringifyValue(
   if (value === false) return 'false';
   if (typeof value === 'number') return writeNumber(value);
   if (typeof value === 'string') return quoteValueString(value);
+  if (ArrayBuffer.isView(value)) {
+    return stringifyValue(Array.from(value as ArrayLike<number | bigint>, Number), indent, newline, level);
+  }
   if (Array.isArray(value)) {
     if (value.length === 0) return '[]';
     const nextPrefix = indent.repeat(level + 1);
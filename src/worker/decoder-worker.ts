@@ -9,7 +9,7 @@ import { parentPort } from 'node:worker_threads';
 import type { KodaValue } from '../ast.js';
 import { decode as decodeJS } from '../decoder.js';
 import type { DecodeOptions } from '../decoder.js';
-import { loadNative, type NativeBinding } from '../native.js';
+import { loadNative, nativeDictionary, type NativeAsyncOptions, type NativeBinding, type NativeDecodeOptions } from '../native.js';
 
 const __dirname = dirname(fileURLToPath(import.meta.url));
 const addonPath = join(__dirname, '..', '..', 'build', 'Release', 'koda_js.node');
@@ -26,6 +26,13 @@ export interface DecoderWorkerMessageIn {
   id: number;
   buffer: ArrayBuffer;
   options?: DecodeOptions;
+  /** Over a SharedArrayBuffer; the sender stores 1 to stop the decode. */
+  flag?: Int32Array;
+}
+
+/** Several small decodes sent together by a decoder pool; answered with one `results` message. */
+export interface DecoderWorkerBatchIn {
+  jobs: DecoderWorkerMessageIn[];
 }
 
 export interface DecoderWorkerMessageOutSuccess {
@@ -33,31 +40,63 @@ export interface DecoderWorkerMessageOutSuccess {
   value: KodaValue;
 }
 
+/** Lazy result: a native document id for adoptDocument() on the receiving thread. */
+export interface DecoderWorkerMessageOutDocument {
+  id: number;
+  document: number;
+}
+
 export interface DecoderWorkerMessageOutError {
   id: number;
   error: string;
 }
 
-function doDecode(buffer: ArrayBuffer, options?: DecodeOptions): KodaValue {
+function doDecode(buffer: ArrayBuffer, options?: DecodeOptions, flag?: Int32Array): KodaValue {
   const buf = Buffer.from(buffer);
   const binding = getNative();
   if (binding) {
-    return binding.decode(buf, {
-      maxDepth: options?.maxDepth,
-      maxDictionarySize: options?.maxDictionarySize,
-      maxStringLength: options?.maxStringLength,
-    }) as KodaValue;
+    return binding.decode(buf, nativeOptions(binding, options, flag)) as KodaValue;
   }
+  if (flag && Atomics.load(flag, 0) !== 0) throw new Error('Operation aborted');
   return decodeJS(new Uint8Array(buffer), options);
 }
 
-parentPort!.on('message', (msg: DecoderWorkerMessageIn) => {
-  const { id, buffer, options } = msg;
+function nativeOptions(
+  binding: NativeBinding,
+  options: DecodeOptions | undefined,
+  flag: Int32Array | undefined
+): NativeDecodeOptions & NativeAsyncOptions {
+  return {
+    cancel: flag ? new binding.CancelToken({ flag }) : undefined,
+    maxDepth: options?.maxDepth,
+    maxDictionarySize: options?.maxDictionarySize,
+    maxStringLength: options?.maxStringLength,
+    typedArrays: options?.typedArrays,
+    dictionary: nativeDictionary(binding, options?.dictionary),
+  };
+}
+
+function run(
+  msg: DecoderWorkerMessageIn
+): DecoderWorkerMessageOutSuccess | DecoderWorkerMessageOutDocument | DecoderWorkerMessageOutError {
+  const { id, buffer, options, flag } = msg;
   try {
-    const value = doDecode(buffer, options);
-parentPort!.postMessage({ id, value } as DecoderWorkerMessageOutSuccess);
+    const binding = getNative();
+    if (options?.lazy && binding) {
+      // The document stays in native memory and only its id is cloned back.
+      return { id, document: binding.decodeDetached(Buffer.from(buffer), nativeOptions(binding, options, flag)) };
+    }
+    return { id, value: doDecode(buffer, options, flag) };
   } catch (err) {
     const message = err instanceof Error ? err.message : String(err);
-    parentPort!.postMessage({ id, error: message } as DecoderWorkerMessageOutError);
+    return { id, error: message };
+  }
+}
+
+parentPort!.on('message', (msg: DecoderWorkerMessageIn | DecoderWorkerBatchIn) => {
+  if ('jobs' in msg) {
+    parentPort!.postMessage({ results: msg.jobs.map(run) });
+  } else {
+    parentPort!.postMessage(run(msg));
   }
 });
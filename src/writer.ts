@@ -0,0 +1,90 @@
+/**
+ * Streaming writer for one root array too large to hold in memory. The output
+ * is byte-identical to `encode` of the whole array.
+ * Uses the native spill-file encoder when the addon is built; falls back to JS.
+ */
+
+import { writeFileSync } from 'node:fs';
+import { dirname, join } from 'node:path';
+import { fileURLToPath } from 'node:url';
+import type { KodaValue } from './ast.js';
+import { encode } from './encoder.js';
+import type { EncodeOptions } from './encoder.js';
+import { KodaEncodeError } from './errors.js';
+import { loadNative, nativeDictionary, type NativeBinding } from './native.js';
+
+const addonPath = join(dirname(dirname(fileURLToPath(import.meta.url))), 'build', 'Release', 'koda_js.node');
+
+function getNative(): NativeBinding | null {
+  return loadNative(import.meta.url, addonPath);
+}
+
+export interface StreamEncoder {
+  /** Start the root array; call once, before the first `writeValue`. */
+  beginArray(): void;
+  /** Append one element of the root array. */
+  writeValue(value: KodaValue): void;
+  /** Return the encoded document. */
+  finish(): Uint8Array;
+  /** Write the encoded document to a file. */
+  finish(path: string): void;
+}
+
+function wrap<T>(fn: () => T): T {
+  try {
+    return fn();
+  } catch (e) {
+    throw e instanceof KodaEncodeError ? e : new KodaEncodeError((e as Error).message);
+  }
+}
+
+/**
+ * Create a streaming array writer. With the C++ addon, rows are spilled to a
+ * temporary file with provisional key ids and re-encoded once the dictionary
+ * is complete, so memory depends on the key set rather than the row count.
+ * `stringTable` and `dedupe` need the whole document and are not supported.
+ * The JS fallback keeps the rows in memory and encodes them in `finish`.
+ */
+export function createStreamEncoder(options: EncodeOptions = {}): StreamEncoder {
+  if (options.stringTable || options.dedupe) {
+    throw new KodaEncodeError('Streaming encode does not support stringTable or dedupe');
+  }
+  const native = getNative();
+  if (native) {
+    const encoder = wrap(
+      () =>
+        new native.StreamEncoder({
+          maxDepth: options.maxDepth,
+          version: options.version,
+          dictionary: nativeDictionary(native, options.dictionary),
+        })
+    );
+    return {
+      beginArray: () => wrap(() => encoder.beginArray()),
+      writeValue: (value) => wrap(() => encoder.writeValue(value)),
+      finish: ((path?: string) => wrap(() => encoder.finish(path))) as StreamEncoder['finish'],
+    };
+  }
+  let rows: KodaValue[] | undefined;
+  let finished = false;
+  const inProgress = (): KodaValue[] => {
+    if (rows === undefined || finished) throw new KodaEncodeError('No array in progress');
+    return rows;
+  };
+  return {
+    beginArray() {
+      if (rows !== undefined) throw new KodaEncodeError('Array already begun');
+      rows = [];
+    },
+    writeValue(value) {
+      inProgress().push(value);
+    },
+    finish: ((path?: string) => {
+      const bytes = encode(inProgress(), options);
+      finished = true;
+      if (path === undefined) return bytes;
+      writeFileSync(path, bytes);
+      return undefined;
+    }) as StreamEncoder['finish'],
+  };
+}
@@ -0,0 +1,145 @@
+/**
+ * XXH3 (64-bit, default secret, seed 0) in plain JS, for hash() without the
+ * native addon. Uses BigInt arithmetic, so it is far slower than the native
+ * version; the output is the same.
+ */
+
+const M = (1n << 64n) - 1n;
+const M32 = 0xffffffffn;
+
+const P32_1 = 0x9e3779b1n;
+const P32_2 = 0x85ebca77n;
+const P32_3 = 0xc2b2ae3dn;
+const P1 = 0x9e3779b185ebca87n;
+const P2 = 0xc2b2ae3d27d4eb4fn;
+const P3 = 0x165667b19e3779f9n;
+const P4 = 0x85ebca77c2b2ae63n;
+const P5 = 0x27d4eb2f165667c5n;
+const MX1 = 0x165667919e3779f9n;
+const MX2 = 0x9fb21c651e98df25n;
+
+const SECRET = new Uint8Array([
+  0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+  0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+  0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+  0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+  0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+  0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+  0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+  0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+  0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+  0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+  0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+  0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+]);
+const SECRET_VIEW = new DataView(SECRET.buffer);
+
+const rotl = (x: bigint, r: bigint): bigint => ((x << r) | (x >> (64n - r))) & M;
+const mul = (a: bigint, b: bigint): bigint => (a * b) & M;
+const fold64 = (a: bigint, b: bigint): bigint => {
+  const p = a * b;
+  return (p & M) ^ (p >> 64n);
+};
+
+function xxh64Avalanche(h: bigint): bigint {
+  h ^= h >> 33n;
+  h = mul(h, P2);
+  h ^= h >> 29n;
+  h = mul(h, P3);
+  return h ^ (h >> 32n);
+}
+
+function avalanche(h: bigint): bigint {
+  h ^= h >> 37n;
+  h = mul(h, MX1);
+  return h ^ (h >> 32n);
+}
+
+function rrmxmx(h: bigint, len: bigint): bigint {
+  h ^= rotl(h, 49n) ^ rotl(h, 24n);
+  h = mul(h, MX2);
+  h ^= ((h >> 35n) + len) & M;
+  h = mul(h, MX2);
+  return h ^ (h >> 28n);
+}
+
+/** XXH3_64bits of `bytes`. */
+export function xxh3(bytes: Uint8Array): bigint {
+  const view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+  const r64 = (i: number): bigint => view.getBigUint64(i, true);
+  const r32 = (i: number): bigint => BigInt(view.getUint32(i, true));
+  const s64 = (i: number): bigint => SECRET_VIEW.getBigUint64(i, true);
+  const s32 = (i: number): bigint => BigInt(SECRET_VIEW.getUint32(i, true));
+  const mix16 = (i: number, s: number): bigint => fold64(r64(i) ^ s64(s), r64(i + 8) ^ s64(s + 8));
+  const n = bytes.length;
+  const len = BigInt(n);
+
+  if (n === 0) return xxh64Avalanche(s64(56) ^ s64(64));
+  if (n <= 3) {
+    const combined = (BigInt(bytes[0]) << 16n) | (BigInt(bytes[n >> 1]) << 24n) | BigInt(bytes[n - 1]) | (len << 8n);
+    return xxh64Avalanche(combined ^ (s32(0) ^ s32(4)));
+  }
+  if (n <= 8) {
+    const input = (r32(n - 4) + (r32(0) << 32n)) & M;
+    return rrmxmx(input ^ (s64(8) ^ s64(16)), len);
+  }
+  if (n <= 16) {
+    const lo = r64(0) ^ (s64(24) ^ s64(32));
+    const hi = r64(n - 8) ^ (s64(40) ^ s64(48));
+    return avalanche((len + swap64(lo) + hi + fold64(lo, hi)) & M);
+  }
+  let acc = mul(len, P1);
+  if (n <= 128) {
+    if (n > 32) {
+      if (n > 64) {
+        if (n > 96) acc += mix16(48, 96) + mix16(n - 64, 112);
+        acc += mix16(32, 64) + mix16(n - 48, 80);
+      }
+      acc += mix16(16, 32) + mix16(n - 32, 48);
+    }
+    acc += mix16(0, 0) + mix16(n - 16, 16);
+    return avalanche(acc & M);
+  }
+  if (n <= 240) {
+    for (let i = 0; i < 8; i++) acc += mix16(16 * i, 16 * i);
+    acc = avalanche(acc & M);
+    const rounds = Math.floor(n / 16);
+    for (let i = 8; i < rounds; i++) acc += mix16(16 * i, 16 * (i - 8) + 3);
+    acc += mix16(n - 16, 136 - 17);
+    return avalanche(acc & M);
+  }
+
+  const accs = [P32_3, P1, P2, P3, P4, P32_2, P5, P32_1];
+  const accumulate = (at: number, s: number): void => {
+    for (let i = 0; i < 8; i++) {
+      const data = r64(at + 8 * i);
+      const key = data ^ s64(s + 8 * i);
+      accs[i ^ 1] = (accs[i ^ 1] + data) & M;
+      accs[i] = (accs[i] + (key & M32) * (key >> 32n)) & M;
+    }
+  };
+  const stripesPerBlock = (SECRET.length - 64) / 8;
+  const blockLen = 64 * stripesPerBlock;
+  const blocks = Math.floor((n - 1) / blockLen);
+  for (let b = 0; b < blocks; b++) {
+    for (let s = 0; s < stripesPerBlock; s++) accumulate(b * blockLen + s * 64, s * 8);
+    for (let i = 0; i < 8; i++) {
+      let a = accs[i];
+      a ^= a >> 47n;
+      a ^= s64(SECRET.length - 64 + 8 * i);
+      accs[i] = mul(a, P32_1);
+    }
+  }
+  const stripes = Math.floor((n - 1 - blockLen * blocks) / 64);
+  for (let s = 0; s < stripes; s++) accumulate(blocks * blockLen + s * 64, s * 8);
+  accumulate(n - 64, SECRET.length - 64 - 7);
+  let h = mul(len, P1);
+  for (let i = 0; i < 4; i++) h += fold64(accs[2 * i] ^ s64(11 + 16 * i), accs[2 * i + 1] ^ s64(19 + 16 * i));
+  return avalanche(h & M);
+}
+
+function swap64(x: bigint): bigint {
+  let r = 0n;
+  for (let i = 0n; i < 8n; i++) r = (r << 8n) | ((x >> (8n * i)) & 0xffn);
+  return r;
+}
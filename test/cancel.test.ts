@@ -0,0 +1,92 @@
+import { createDecoderPool, decode, decodeAsync, encode, encodeAsync, isNativeAvailable, parseAsync } from '../src/index.js';
+import type { CancelOptions } from '../src/index.js';
+
+const value = { list: Array.from({ length: 1000 }, (_, i) => ({ i, s: `s${i}` })) };
+const bytes = encode(value);
+
+describe('cancellation', () => {
+  it('rejects with the reason of an already aborted signal', async () => {
+    const reason = new Error('stop');
+    const signal = AbortSignal.abort(reason);
+    await expect(parseAsync('a: 1', { signal })).rejects.toBe(reason);
+    await expect(encodeAsync(value, { signal })).rejects.toBe(reason);
+    await expect(decode(bytes, { signal })).rejects.toBe(reason);
+    await expect(decodeAsync(bytes, { signal })).rejects.toBe(reason);
+  });
+
+  describe('native calls on multi-megabyte input', () => {
+    const rows = Array.from({ length: 500000 }, (_, i) => ({ id: i, name: `row-${i}` }));
+    const text = `[${rows.map((row) => `{id: ${row.id}, name: "${row.name}"}`).join(', ')}]`;
+    const binary = encode(rows);
+    const calls: Record<string, (options: CancelOptions) => Promise<unknown>> = {
+      parseAsync: (options) => parseAsync(text, { ...options, maxInputLength: text.length }),
+      encodeAsync: (options) => encodeAsync(rows, options),
+      decode: (options) => decode(binary, options),
+    };
+
+    /**
+     * Milliseconds from the call's return to its promise settling, so the
+     * copy of the input on the JS thread is left out.
+     */
+    async function settle(call: () => Promise<unknown>): Promise<number> {
+      const pending = call();
+      const start = performance.now();
+      await pending.catch(() => undefined);
+      return performance.now() - start;
+    }
+
+    for (const [name, call] of Object.entries(calls)) {
+      it(`stops ${name} when aborted mid-run`, async () => {
+        if (!isNativeAvailable()) return;
+        const full = await settle(() => call({}));
+        const reason = new Error('stop');
+        const controller = new AbortController();
+        let pending: Promise<unknown> | undefined;
+        const elapsed = await settle(() => {
+          pending = call({ signal: controller.signal });
+          setTimeout(() => controller.abort(reason), 1);
+          return pending;
+        });
+        await expect(pending).rejects.toBe(reason);
+        expect(elapsed).toBeLessThan(full / 2);
+      });
+    }
+
+    it('stops a parse at a deadline it reaches mid-run', async () => {
+      if (!isNativeAvailable()) return;
+      const full = await settle(() => calls.parseAsync({}));
+      let pending: Promise<unknown> | undefined;
+      const elapsed = await settle(() => (pending = calls.parseAsync({ deadlineMs: 2 })));
+      await expect(pending).rejects.toThrow('Deadline exceeded');
+      expect(elapsed).toBeLessThan(full / 2);
+    });
+  });
+
+  it('stops decodeAsync when aborted or past its deadline', async () => {
+    const controller = new AbortController();
+    const pending = decodeAsync(bytes, { signal: controller.signal });
+    controller.abort(new Error('user abort'));
+    await expect(pending).rejects.toThrow('user abort');
+    await expect(decodeAsync(bytes, { deadlineMs: 0 })).rejects.toThrow('Deadline exceeded');
+    expect(await decodeAsync(bytes, { deadlineMs: 60_000 })).toEqual(value);
+  });
+
+  it('drops cancelled pool calls from the queue and keeps serving', async () => {
+    const pool = createDecoderPool({ maxQueue: 1 });
+    try {
+      const running = pool.decode(bytes);
+      const controller = new AbortController();
+      const waiting = pool.decode(bytes, { signal: controller.signal });
+      const late = pool.decode(bytes, { deadlineMs: 0 });
+      expect(pool.stats().waiting).toBe(2);
+      controller.abort(new Error('user abort'));
+      await expect(waiting).rejects.toThrow('user abort');
+      await expect(late).rejects.toThrow('Deadline exceeded');
+      expect(pool.stats().waiting).toBe(0);
+      expect(await running).toEqual(value);
+      expect(await pool.decode(bytes, { deadlineMs: 60_000 })).toEqual(value);
+    } finally {
+      pool.destroy();
+    }
+  });
+});
@@ -0,0 +1,72 @@
+import { decodeSync, encode, type KodaValue } from '../src/index.js';
+import { decode as decodeJs } from '../src/decoder.js';
+import { encode as encodeJs } from '../src/encoder.js';
+
+const hex = (bytes: Uint8Array): string => Buffer.from(bytes).toString('hex');
+
+describe('columnar arrays', () => {
+  const cases: Array<[string, KodaValue, string]> = [
+    [
+      'stores same-shaped rows column-major, packing numeric columns',
+      [{ a: 1, b: 'x' }, { a: 2, b: 'y' }],
+      '4b4f4441020201610162' + '120202000120010210060178060179',
+    ],
+    ['stores a column of same-shaped objects as nested columns', [{ p: { x: 1 } }, { p: { x: 2 } }], '4b4f444102020170017812020100120101200102'],
+    ['keeps a single row tagged', [{ a: 1 }], '4b4f444102010161100111010081'],
+    ['keeps rows with different key sets tagged', [{ a: 1 }, { b: 1 }], '4b4f444102020161016210021101008111010181'],
+    ['keeps empty objects tagged', [{}, {}], '4b4f44410200100211001100'],
+  ];
+
+  for (const [name, value, expected] of cases) {
+    it(name, () => {
+      expect(hex(encodeJs(value, { version: 2 }))).toBe(expected);
+      expect(hex(encode(value, { version: 2 }))).toBe(expected);
+      expect(decodeSync(encode(value, { version: 2 }))).toEqual(value);
+    });
+  }
+
+  it('round-trips records in both versions', () => {
+    const rows = Array.from({ length: 100 }, (_, i) => ({
+      id: i,
+      label: `row ${i}`,
+      score: i / 3,
+      flags: [i % 2 === 0, null],
+      meta: { kind: i % 3, tags: ['a'] },
+    }));
+    for (const version of [1, 2] as const) {
+      const bytes = encode(rows, { version });
+      expect(hex(bytes)).toBe(hex(encodeJs(rows, { version })));
+      expect(decodeSync(bytes)).toEqual(rows);
+      expect(decodeJs(bytes)).toEqual(rows);
+    }
+  });
+
+  it('is smaller than the row-major layout', () => {
+    const rows = Array.from({ length: 50 }, (_, i) => ({ x: i, y: i * 2 }));
+    const rowMajor = encode(rows.map((r) => [r.x, r.y, 'pad']), { version: 2 });
+    expect(encode(rows, { version: 2 }).byteLength).toBeLessThan(rowMajor.byteLength);
+  });
+
+  it('keeps rows tagged in version 1', () => {
+    const rows = [{ a: 1 }, { a: 2 }];
+    const expected =
+      '4b4f444101000000010000000161' +
+      '1000000002' +
+      '110000000100000000040000000000000001' +
+      '110000000100000000040000000000000002';
+    expect(hex(encodeJs(rows))).toBe(expected);
+    expect(hex(encode(rows))).toBe(expected);
+  });
+
+  it('rejects the columns tag in a version 1 document', () => {
+    const bad = Buffer.from('4b4f44410100000000' + '120000000200000001', 'hex');
+    expect(() => decodeSync(bad)).toThrow('Unknown type tag');
+    expect(() => decodeJs(bad)).toThrow('Unknown type tag');
+  });
+
+  it('rejects column keys that do not ascend', () => {
+    const bad = Buffer.from('4b4f4441020201610162' + '120202010020010210060178060179', 'hex');
+    expect(() => decodeSync(bad)).toThrow('Invalid column keys');
+    expect(() => decodeJs(bad)).toThrow('Invalid column keys');
+  });
+});
@@ -0,0 +1,64 @@
+import { setTimeout as sleep } from 'node:timers/promises';
+import { decodeSync, encode, getThreadPoolStats, isNativeAvailable, type KodaValue } from '../src/index.js';
+import { decode as decodeJs } from '../src/decoder.js';
+
+// Large enough (> 512 KB) for the native split decode to engage.
+function records(n: number): KodaValue {
+  return Array.from({ length: n }, (_, i) => ({
+    id: i,
+    name: `name-${i}`,
+    ratio: i / 8,
+    tags: i % 3 === 0 ? null : ['a', 'b'],
+    nested: { p: i % 7, q: 'q' },
+  }));
+}
+
+/**
+ * Whether the native pool finishes a task after `before` tasks. A serial
+ * decodeSync runs entirely on the calling thread, so only the split decode
+ * queues pool tasks; they may finish just after the call returns.
+ */
+async function poolRanSince(before: number): Promise<boolean> {
+  for (let i = 0; i < 100; i++) {
+    if (getThreadPoolStats()!.executed > before) return true;
+    await sleep(10);
+  }
+  return false;
+}
+
+describe('decodeSync threads', () => {
+  it('decodes a columnar root the same as a serial decode', () => {
+    const bytes = encode(records(40000), { version: 2 });
+    expect(bytes.byteLength).toBeGreaterThan(512 * 1024);
+    const serial = decodeSync(bytes);
+    expect(decodeSync(bytes, { threads: 4 })).toEqual(serial);
+    expect(decodeJs(bytes)).toEqual(serial);
+  });
+
+  for (const version of [1, 2] as const) {
+    it(`decodes a plain root array the same as a serial decode (v${version})`, () => {
+      const value = Array.from({ length: 40000 }, (_, i) => (i % 2 ? `s${i}` : { i, s: 'x'.repeat(i % 20) }));
+      const bytes = encode(value, { version });
+      expect(decodeSync(bytes, { threads: 4 })).toEqual(decodeSync(bytes));
+    });
+  }
+
+  for (const [name, value] of [
+    ['columnar root', records(40000)],
+    ['plain root array', Array.from({ length: 40000 }, (_, i) => `s${i}-${'x'.repeat(i % 20)}`)],
+  ] as const) {
+    it(`splits a ${name} over the thread pool`, async () => {
+      if (!isNativeAvailable()) return;
+      const bytes = encode(value as KodaValue, { version: 2 });
+      const before = getThreadPoolStats()!.executed;
+      decodeSync(bytes, { threads: 4 });
+      expect(await poolRanSince(before)).toBe(true);
+    });
+  }
+
+  it('reports the serial error for truncated input', () => {
+    const bytes = encode(records(40000), { version: 2 });
+    const truncated = bytes.subarray(0, bytes.byteLength - 3);
+    expect(() => decodeSync(truncated, { threads: 4 })).toThrow('Truncated input');
+  });
+});
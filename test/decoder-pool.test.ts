@@ -0,0 +1,77 @@
+import { createDecoderPool, encode } from '../src/index.js';
+
+const small = (i: number) => encode({ i, tags: ['a', 'b'] });
+
+describe('createDecoderPool', () => {
+  it('decodes many buffers, each to its own result', async () => {
+    const pool = createDecoderPool({ poolSize: 3 });
+    try {
+      const results = await Promise.all(Array.from({ length: 200 }, (_, i) => pool.decode(small(i))));
+      results.forEach((r, i) => expect(r).toEqual({ i, tags: ['a', 'b'] }));
+      const stats = pool.stats();
+      expect(stats.queued).toBe(0);
+      expect(stats.workers.reduce((n, w) => n + w.completed, 0)).toBe(200);
+      for (const w of stats.workers) {
+        expect(w.inFlight).toBe(0);
+        expect(w.utilization).toBeGreaterThanOrEqual(0);
+        expect(w.utilization).toBeLessThanOrEqual(1);
+      }
+    } finally {
+      pool.destroy();
+    }
+  });
+
+  it('sends the jobs behind a large buffer to the least loaded worker', async () => {
+    const pool = createDecoderPool({ poolSize: 2 });
+    try {
+      const large = encode({ blob: 'x'.repeat(200 * 1024) });
+      await Promise.all([pool.decode(large), ...Array.from({ length: 10 }, (_, i) => pool.decode(small(i)))]);
+      expect(pool.stats().workers.map((w) => w.completed)).toEqual([1, 10]);
+    } finally {
+      pool.destroy();
+    }
+  });
+
+  it("rejects calls past maxQueue with onFull 'reject'", async () => {
+    const pool = createDecoderPool({ maxQueue: 2, onFull: 'reject' });
+    try {
+      const calls = Array.from({ length: 5 }, (_, i) => pool.decode(small(i)));
+      const settled = await Promise.allSettled(calls);
+      expect(settled.map((s) => s.status)).toEqual(['fulfilled', 'fulfilled', 'rejected', 'rejected', 'rejected']);
+      expect((settled[2] as PromiseRejectedResult).reason.message).toBe('Decoder pool queue is full');
+      expect(pool.stats().rejected).toBe(3);
+    } finally {
+      pool.destroy();
+    }
+  });
+
+  it("holds calls past maxQueue until there is room with onFull 'wait'", async () => {
+    const pool = createDecoderPool({ maxQueue: 1 });
+    try {
+      const calls = Array.from({ length: 5 }, (_, i) => pool.decode(small(i)));
+      expect(pool.stats().waiting).toBe(4);
+      const results = await Promise.all(calls);
+      results.forEach((r, i) => expect(r).toEqual({ i, tags: ['a', 'b'] }));
+      expect(pool.stats().waiting).toBe(0);
+    } finally {
+      pool.destroy();
+    }
+  });
+
+  it('admits a buffer over maxQueueBytes when the pool is idle', async () => {
+    const pool = createDecoderPool({ maxQueueBytes: 16, onFull: 'reject' });
+    try {
+      const first = pool.decode(small(1));
+      await expect(pool.decode(small(2))).rejects.toThrow('Decoder pool queue is full');
+      expect(await first).toEqual({ i: 1, tags: ['a', 'b'] });
+    } finally {
+      pool.destroy();
+    }
+  });
+
+  it('rejects calls after destroy()', async () => {
+    const pool = createDecoderPool();
+    pool.destroy();
+    await expect(pool.decode(small(0))).rejects.toThrow('Decoder pool has been destroyed');
+  });
+});
@@ -0,0 +1,51 @@
+import { decodeSync, encode, type KodaValue } from '../src/index.js';
+import { decode as decodeJs } from '../src/decoder.js';
+import { encode as encodeJs } from '../src/encoder.js';
+
+const hex = (bytes: Uint8Array): string => Buffer.from(bytes).toString('hex');
+
+describe('shared subtrees (dedupe)', () => {
+  const cases: Array<[string, KodaValue, string]> = [
+    ['defines a repeat at its first occurrence', { a: [1, 2], b: [1, 2] }, '4b4f4441020201610162' + '1102' + '00322002010201' + '3300'],
+    [
+      'numbers nested definitions in the order they end',
+      { a: { p: [5, 6] }, b: { p: [5, 6] }, c: [5, 6] },
+      '4b4f444102040161016201630170' + '1103' + '00321101033220020506' + '013301' + '023300',
+    ],
+    ['never shares empty containers', [[], []], '4b4f44410200100210001000'],
+    ['never shares the rows of a columnar array as columns', [{ x: 1 }, { x: 1 }, { x: 2 }], '4b4f4441020101781203010020010102'],
+  ];
+
+  for (const [name, value, expected] of cases) {
+    it(name, () => {
+      expect(hex(encodeJs(value, { version: 2, dedupe: true }))).toBe(expected);
+      expect(hex(encode(value, { version: 2, dedupe: true }))).toBe(expected);
+      expect(decodeSync(Buffer.from(expected, 'hex'))).toEqual(value);
+      expect(decodeJs(Buffer.from(expected, 'hex'))).toEqual(value);
+    });
+  }
+
+  it('round-trips and shrinks documents with repeated subtrees', () => {
+    const address = { street: 'Main St', city: 'Springfield', zip: [1, 2, 3, 4, 5] };
+    const value = Array.from({ length: 50 }, (_, i) => ({ id: i, home: address, work: i % 2 ? address : { street: 'Elm', city: 'X', zip: [9] } }));
+    for (const version of [1, 2] as const) {
+      const bytes = encode(value, { version, dedupe: true });
+      expect(hex(bytes)).toBe(hex(encodeJs(value, { version, dedupe: true })));
+      expect(bytes.byteLength).toBeLessThan(encode(value, { version }).byteLength);
+      expect(decodeSync(bytes)).toEqual(value);
+    }
+  });
+
+  it('combines with the string table', () => {
+    const value = { a: { s: 'repeat', t: 'repeat' }, b: { s: 'repeat', t: 'repeat' } };
+    const bytes = encode(value, { dedupe: true, stringTable: true });
+    expect(hex(bytes)).toBe(hex(encodeJs(value, { dedupe: true, stringTable: true })));
+    expect(decodeSync(bytes)).toEqual(value);
+  });
+
+  it('rejects a reference to an undefined subtree', () => {
+    const bad = Buffer.from('4b4f44410200' + '3300', 'hex');
+    expect(() => decodeSync(bad)).toThrow('Invalid shared reference');
+    expect(() => decodeJs(bad)).toThrow('Invalid shared reference');
+  });
+});
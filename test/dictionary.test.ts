@@ -0,0 +1,57 @@
+import { createDictionary, decodeSync, encode, type KodaValue } from '../src/index.js';
+import { decode as decodeJs } from '../src/decoder.js';
+import { encode as encodeJs } from '../src/encoder.js';
+
+const hex = (bytes: Uint8Array): string => Buffer.from(bytes).toString('hex');
+
+describe('external dictionaries', () => {
+  const dictionary = createDictionary(['b', 'a', 'b']);
+
+  it('sorts and dedupes the keys, and names them by FNV-1a 64', () => {
+    expect(dictionary.keys).toEqual(['a', 'b']);
+    expect(dictionary.id).toBe(0xee46e216fed8fedcn);
+    expect(Object.isFrozen(dictionary)).toBe(true);
+    expect(createDictionary(['a', 'b']).id).toBe(dictionary.id);
+  });
+
+  const cases: Array<[string, KodaValue, 1 | 2, string]> = [
+    ['leaves the key list empty when every key is known (v1)', { a: 1, b: 2 }, 1,
+      '4b4f444181ee46e216fed8fedc00000000' + '11000000020000000004000000000000000100000001040000000000000002'],
+    ['leaves the key list empty when every key is known (v2)', { a: 1, b: 2 }, 2, '4b4f444182ee46e216fed8fedc00' + '110200810182'],
+    ['writes the missing keys inline (v1)', { a: 1, c: 2 }, 1,
+      '4b4f444181ee46e216fed8fedc000000010000000163' + '11000000020000000004000000000000000100000002040000000000000002'],
+    ['writes the missing keys inline (v2)', { a: 1, c: 2 }, 2, '4b4f444182ee46e216fed8fedc010163' + '110200810282'],
+  ];
+
+  for (const [name, value, version, expected] of cases) {
+    it(name, () => {
+      expect(hex(encodeJs(value, { dictionary, version }))).toBe(expected);
+      expect(hex(encode(value, { dictionary, version }))).toBe(expected);
+      expect(decodeSync(Buffer.from(expected, 'hex'), { dictionary })).toEqual(value);
+      expect(decodeJs(Buffer.from(expected, 'hex'), { dictionary })).toEqual(value);
+    });
+  }
+
+  it('round-trips columnar rows with a dictionary', () => {
+    const value = Array.from({ length: 10 }, (_, i) => ({ a: i, b: `s${i}`, extra: i % 2 === 0 }));
+    const bytes = encode(value, { dictionary, version: 2 });
+    expect(hex(bytes)).toBe(hex(encodeJs(value, { dictionary, version: 2 })));
+    expect(encode(value, { dictionary }).byteLength).toBeLessThan(encode(value).byteLength);
+    expect(decodeSync(bytes, { dictionary })).toEqual(value);
+  });
+
+  it('refuses a document whose dictionary is missing or different', () => {
+    const bytes = encode({ a: 1 }, { dictionary });
+    const other = createDictionary(['a']);
+    for (const decode of [decodeSync, decodeJs]) {
+      expect(() => decode(bytes)).toThrow('Unknown dictionary');
+      expect(() => decode(bytes, { dictionary: other })).toThrow('Unknown dictionary');
+    }
+  });
+
+  it('rejects inline keys the dictionary already has', () => {
+    const bad = Buffer.from('4b4f444182ee46e216fed8fedc010161' + '1101008101', 'hex');
+    expect(() => decodeSync(bad, { dictionary })).toThrow('Invalid dictionary');
+    expect(() => decodeJs(bad, { dictionary })).toThrow('Invalid dictionary');
+  });
+});
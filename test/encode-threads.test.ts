@@ -0,0 +1,37 @@
+import { createDictionary, encode, encodeAsync, type EncodeOptions, type KodaValue } from '../src/index.js';
+import { encode as encodeJs } from '../src/encoder.js';
+
+const hex = (bytes: Uint8Array): string => Buffer.from(bytes).toString('hex');
+
+// Root arrays long enough (> 8192 elements) for the native split encode to engage.
+const values: Record<string, KodaValue> = {
+  'uniform records': Array.from({ length: 20000 }, (_, i) => ({ id: i, name: `n${i % 500}`, ok: i % 2 === 0 })),
+  'mixed elements': Array.from({ length: 20000 }, (_, i) =>
+    i % 3 === 0 ? { [`k${i % 37}`]: [i, `s${i % 11}`], shared: 'x' } : i % 3 === 1 ? `s${i % 11}` : i * 1.5
+  ),
+  'packed numbers': Array.from({ length: 20000 }, (_, i) => i * 3),
+};
+
+const variants: Record<string, EncodeOptions> = {
+  v1: {},
+  v2: { version: 2 },
+  'string table': { version: 2, stringTable: true },
+  dictionary: { dictionary: createDictionary(['id', 'shared', 'k1']) },
+};
+
+describe('encode threads', () => {
+  for (const [name, value] of Object.entries(values)) {
+    for (const [variant, options] of Object.entries(variants)) {
+      it(`writes the same bytes as a serial encode for ${name} (${variant})`, () => {
+        const serial = hex(encodeJs(value, options));
+        expect(hex(encode(value, options))).toBe(serial);
+        expect(hex(encode(value, { ...options, threads: 4 }))).toBe(serial);
+      });
+    }
+  }
+
+  it('writes the same bytes from encodeAsync', async () => {
+    const value = values['mixed elements']!;
+    expect(hex(await encodeAsync(value, { threads: 4, stringTable: true }))).toBe(hex(encode(value, { stringTable: true })));
+  });
+});
@@ -0,0 +1,57 @@
+import { mkdtempSync, rmSync, writeFileSync } from 'node:fs';
+import { tmpdir } from 'node:os';
+import { join } from 'node:path';
+import { decodeFile, encode, KodaParseError, materialize, openViewFile, parse, parseFile, saveFile } from '../src/index.js';
+
+const dir = mkdtempSync(join(tmpdir(), 'koda-files-'));
+afterAll(() => rmSync(dir, { recursive: true, force: true }));
+
+const text = 'name: "app"\nservers: [{host: "a", port: 1}, {host: "b", port: 2}]\nratio: 0.5\n';
+const value = { name: 'app', servers: [{ host: 'a', port: 1 }, { host: 'b', port: 2 }], ratio: 0.5 };
+
+describe('file entry points', () => {
+  it('parseFile gives the same value as parse', async () => {
+    const path = join(dir, 'config.koda');
+    writeFileSync(path, text);
+    expect(await parseFile(path)).toEqual(parse(text));
+    expect(await parseFile(path, { mode: 'indexed' })).toEqual(value);
+  });
+
+  it('round-trips through saveFile', async () => {
+    const path = join(dir, 'saved.koda');
+    await saveFile(path, value);
+    expect(await parseFile(path)).toEqual(value);
+  });
+
+  it('decodeFile and openViewFile read a binary file', async () => {
+    const path = join(dir, 'data.kod');
+    writeFileSync(path, encode(value, { version: 2, stringTable: true }));
+    expect(await decodeFile(path)).toEqual(value);
+    expect(materialize(await openViewFile(path))).toEqual(value);
+  });
+
+  it('rejects an empty or invalid file as parse would', async () => {
+    const empty = join(dir, 'empty.koda');
+    writeFileSync(empty, '');
+    await expect(parseFile(empty)).rejects.toThrow(KodaParseError);
+    const bad = join(dir, 'bad.koda');
+    writeFileSync(bad, 'a: [1,');
+    await expect(parseFile(bad)).rejects.toThrow(KodaParseError);
+    const truncated = join(dir, 'truncated.kod');
+    writeFileSync(truncated, encode(value).subarray(0, 12));
+    await expect(decodeFile(truncated)).rejects.toThrow('Truncated input');
+  });
+
+  it('rejects a missing file', async () => {
+    await expect(parseFile(join(dir, 'missing.koda'))).rejects.toThrow();
+    await expect(decodeFile(join(dir, 'missing.kod'))).rejects.toThrow();
+  });
+
+  it('honours an aborted signal', async () => {
+    const path = join(dir, 'config.koda');
+    writeFileSync(path, text);
+    const reason = new Error('stop');
+    await expect(parseFile(path, { signal: AbortSignal.abort(reason) })).rejects.toBe(reason);
+    await expect(decodeFile(path, { signal: AbortSignal.abort(reason) })).rejects.toBe(reason);
+  });
+});
@@ -0,0 +1,77 @@
+import { createHash } from 'node:crypto';
+import { createDictionary, encode, hash, hashBinary, KodaEncodeError, type KodaValue } from '../src/index.js';
+import { xxh3 } from '../src/xxh3.js';
+
+/** `n` bytes of a fixed pattern. */
+const pattern = (n: number): Uint8Array => Uint8Array.from({ length: n }, (_, i) => (i * 31 + 7) & 0xff);
+
+// XXH3_64bits of pattern(n), from the reference implementation. The lengths
+// cover each size class of the algorithm.
+const vectors: Array<[number, string]> = [
+  [0, '2d06800538d394c2'],
+  [1, '4c5cca45d0f4811f'],
+  [3, '15f7093b173d005c'],
+  [4, 'dca012f95811b6b9'],
+  [8, 'dec6a9a43575982e'],
+  [9, 'cbe393399f17ffbd'],
+  [16, '7e484c18d74895d0'],
+  [17, '208bde5ee2bed407'],
+  [33, '199a362122d71f46'],
+  [65, 'fab36b851b94ce20'],
+  [97, '60e3e1d0d43785b3'],
+  [128, 'f92b70eaa21a6288'],
+  [129, 'f8f76713f2bb60fa'],
+  [240, 'ccc7375172c41f03'],
+  [241, '0b3b630948ce4a00'],
+  [1024, '23bc880ebf0d29c6'],
+  [1025, 'c09fdfbc398c7d82'],
+  [3000, '6eb4b5bfe14d9786'],
+];
+
+describe('hashing', () => {
+  it('matches the reference XXH3', () => {
+    for (const [n, expected] of vectors) {
+      expect(xxh3(pattern(n)).toString(16).padStart(16, '0')).toBe(expected);
+      expect(hashBinary(pattern(n))).toBe(expected);
+    }
+  });
+
+  it('gives SHA-256 of the bytes with algorithm sha256', () => {
+    for (const n of [0, 55, 56, 64, 1000]) {
+      const bytes = pattern(n);
+      expect(hashBinary(bytes, { algorithm: 'sha256' })).toBe(createHash('sha256').update(bytes).digest('hex'));
+    }
+  });
+
+  it('hashes the canonical encoding of a value, whatever its key order', () => {
+    const a = { b: [1, 2.5, 'x'], a: { y: null, x: true } };
+    const b = { a: { x: true, y: null }, b: [1, 2.5, 'x'] };
+    expect(hash(a)).toBe(hash(b));
+    expect(hash(a)).toMatch(/^[0-9a-f]{16}$/);
+    expect(hash(a, { algorithm: 'sha256' })).toMatch(/^[0-9a-f]{64}$/);
+    expect(hash(a)).not.toBe(hash({ ...a, c: 1 }));
+  });
+
+  it('equals hashBinary of the encoded bytes under every encode option', () => {
+    const value: KodaValue = {
+      rows: Array.from({ length: 50 }, (_, i) => ({ id: i, name: `n${i % 5}`, sub: { p: [1, 2] } })),
+      packed: [1, 2, 3],
+    };
+    const variants = [
+      {},
+      { version: 2 as const },
+      { version: 2 as const, stringTable: true, dedupe: true },
+      { dictionary: createDictionary(['id', 'name']) },
+    ];
+    for (const options of variants) {
+      for (const algorithm of ['xxh3', 'sha256'] as const) {
+        expect(hash(value, { ...options, algorithm })).toBe(hashBinary(encode(value, options), { algorithm }));
+      }
+    }
+    expect(hash(value)).not.toBe(hash(value, { version: 2 }));
+  });
+
+  it('rejects an unknown algorithm', () => {
+    expect(() => hash(1, { algorithm: 'md5' as never })).toThrow(KodaEncodeError);
+  });
+});
@@ -0,0 +1,51 @@
+import { createIncrementalDecodeStream, createDictionary, encode, type KodaValue } from '../src/index.js';
+import type { EncodeOptions, IncrementalDecodeStreamOptions } from '../src/index.js';
+
+/** Feed `chunks` through an incremental decode stream and collect what it emits. */
+function decodeChunks(chunks: Uint8Array[], options?: IncrementalDecodeStreamOptions): Promise<KodaValue[]> {
+  return new Promise((resolve, reject) => {
+    const values: KodaValue[] = [];
+    const stream = createIncrementalDecodeStream(options);
+    stream.on('data', (value: KodaValue) => values.push(value));
+    stream.on('error', reject);
+    stream.on('end', () => resolve(values));
+    for (const chunk of chunks) stream.write(Buffer.from(chunk));
+    stream.end();
+  });
+}
+
+describe('createIncrementalDecodeStream', () => {
+  const dictionary = createDictionary(['id']);
+  const cases: Array<[string, KodaValue, EncodeOptions & IncrementalDecodeStreamOptions]> = [
+    ['mixed elements', [{ a: 1, b: 'xy' }, [1, 2], 'long string '.repeat(20), 2.5, { n: { m: [true] } }], {}],
+    ['columnar rows', Array.from({ length: 6 }, (_, i) => ({ id: i, name: `n${i}` })), { version: 2 }],
+    ['a packed root', [1, 2, 300, -4], { version: 2 }],
+    ['version 2 with shared strings and subtrees', [{ s: 'rep', t: [1, 'rep'] }, { s: 'rep', t: [1, 'rep'] }, 'rep'], { version: 2, stringTable: true, dedupe: true }],
+    ['a dictionary', [{ id: 1, x: 2 }, { id: 3 }], { dictionary }],
+  ];
+
+  for (const [name, value, options] of cases) {
+    it(`emits the elements of a root array with ${name}, whatever the chunking`, async () => {
+      const bytes = encode(value, options);
+      const expected = value as KodaValue[];
+      expect(await decodeChunks([bytes], options)).toEqual(expected);
+      expect(await decodeChunks(Array.from(bytes, (b) => Uint8Array.of(b)), options)).toEqual(expected);
+      for (let cut = 1; cut < bytes.length; cut++) {
+        expect(await decodeChunks([bytes.subarray(0, cut), bytes.subarray(cut)], options)).toEqual(expected);
+      }
+    });
+  }
+
+  it('emits a root that is not an array as one value', async () => {
+    const value = { a: [1, 2], b: 'c' };
+    const bytes = encode(value);
+    expect(await decodeChunks([bytes.subarray(0, 5), bytes.subarray(5)])).toEqual([value]);
+  });
+
+  it('rejects a document that ends early', async () => {
+    const bytes = encode([{ a: 1 }, { b: 2 }]);
+    for (const cut of [3, 10, bytes.length - 1]) {
+      await expect(decodeChunks([bytes.subarray(0, cut)])).rejects.toThrow('Truncated input');
+    }
+  });
+});
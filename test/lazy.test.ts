@@ -0,0 +1,63 @@
+import { createDecoderPool, decodeAsync, decodeSync, encode, isNativeAvailable, materialize } from '../src/index.js';
+
+const value = {
+  name: 'doc',
+  items: Array.from({ length: 50 }, (_, i) => ({ id: i, tags: ['a', `t${i}`] })),
+  packed: [1, 2, 3],
+  nested: { deep: { list: [null, true, 1.5] } },
+};
+const bytes = encode(value);
+
+describe('lazy decode', () => {
+  it('reads the same fields as an eager decode', () => {
+    const lazy = decodeSync(bytes, { lazy: true }) as typeof value;
+    expect(lazy.name).toBe('doc');
+    expect(lazy.items[7]!.tags[1]).toBe('t7');
+    expect(lazy.items).toHaveLength(50);
+    expect(Object.keys(lazy).sort()).toEqual(Object.keys(value).sort());
+    expect(JSON.parse(JSON.stringify(lazy))).toEqual(value);
+  });
+
+  it('materializes a plain, mutable copy', () => {
+    const plain = materialize(decodeSync(bytes, { lazy: true })) as typeof value;
+    expect(plain).toEqual(value);
+    plain.name = 'changed';
+    expect(plain.name).toBe('changed');
+  });
+
+  it('is read-only with the addon', () => {
+    if (!isNativeAvailable()) return;
+    const lazy = decodeSync(bytes, { lazy: true }) as { name: string };
+    expect(() => {
+      lazy.name = 'x';
+    }).toThrow();
+  });
+
+  it('adopts documents decoded in a worker', async () => {
+    const lazy = await decodeAsync(bytes, { lazy: true });
+    expect(materialize(lazy)).toEqual(value);
+  });
+
+  it('adopts documents decoded by a pool, and drops the ones nobody takes', async () => {
+    const pool = createDecoderPool({ poolSize: 2 });
+    try {
+      const results = await Promise.all(Array.from({ length: 8 }, () => pool.decode(bytes, { lazy: true })));
+      for (const r of results) expect(materialize(r)).toEqual(value);
+      // Replies to cancelled calls are released rather than adopted.
+      const controller = new AbortController();
+      const cancelled = pool.decode(bytes, { lazy: true, signal: controller.signal });
+      controller.abort();
+      await expect(cancelled).rejects.toThrow();
+      expect(materialize(await pool.decode(bytes, { lazy: true }))).toEqual(value);
+    } finally {
+      pool.destroy();
+    }
+  });
+
+  it('rejects pending lazy decodes when the pool is destroyed', async () => {
+    const pool = createDecoderPool();
+    const pending = pool.decode(bytes, { lazy: true });
+    pool.destroy();
+    await expect(pending).rejects.toThrow('destroyed');
+  });
+});
@@ -0,0 +1,61 @@
+import { mkdirSync, mkdtempSync, rmSync, writeFileSync } from 'node:fs';
+import { tmpdir } from 'node:os';
+import { join } from 'node:path';
+import { KodaParseError, loadFiles, parse } from '../src/index.js';
+
+const dir = mkdtempSync(join(tmpdir(), 'koda-load-'));
+afterAll(() => rmSync(dir, { recursive: true, force: true }));
+
+const texts: Record<string, string> = {
+  'b.koda': 'name: "b"\nport: 2',
+  'a.koda': 'name: "a"\nlist: [1, 2, 3]',
+  'c.koda': 'name: "c"\nnested: {deep: {x: true}}',
+  'broken.koda': 'name: [1,',
+  'notes.txt': 'not a config',
+};
+for (const [name, text] of Object.entries(texts)) writeFileSync(join(dir, name), text);
+
+describe('loadFiles', () => {
+  it('loads the .koda files of a directory in name order', async () => {
+    const results = await loadFiles(dir);
+    expect(results.map((r) => r.path)).toEqual(['a.koda', 'b.koda', 'broken.koda', 'c.koda'].map((n) => join(dir, n)));
+    for (const r of results) {
+      const name = r.path.slice(dir.length + 1);
+      if (name === 'broken.koda') {
+        expect(r.error).toBeInstanceOf(KodaParseError);
+        expect(r.value).toBeUndefined();
+      } else {
+        expect(r.error).toBeUndefined();
+        expect(r.value).toEqual(parse(texts[name]!));
+      }
+    }
+  });
+
+  it('keeps the order of an explicit list and reports a missing file on its own', async () => {
+    const paths = [join(dir, 'c.koda'), join(dir, 'missing.koda'), join(dir, 'a.koda')];
+    for (const concurrency of [1, 2, 8]) {
+      const results = await loadFiles(paths, { concurrency });
+      expect(results.map((r) => r.path)).toEqual(paths);
+      expect(results[0]!.value).toEqual(parse(texts['c.koda']!));
+      expect(results[1]!.error).toBeInstanceOf(KodaParseError);
+      expect(results[2]!.value).toEqual(parse(texts['a.koda']!));
+    }
+  });
+
+  it('loads many files', async () => {
+    const many = join(dir, 'many');
+    mkdirSync(many);
+    for (let i = 0; i < 50; i++) writeFileSync(join(many, `f${String(i).padStart(2, '0')}.koda`), `id: ${i}\nmode: 'x'`);
+    const results = await loadFiles(many, { mode: 'indexed' });
+    expect(results.map((r) => r.value)).toEqual(Array.from({ length: 50 }, (_, i) => ({ id: i, mode: 'x' })));
+  });
+
+  it('returns nothing for an empty list', async () => {
+    expect(await loadFiles([])).toEqual([]);
+  });
+
+  it('rejects the batch when aborted', async () => {
+    const reason = new Error('stop');
+    await expect(loadFiles(dir, { signal: AbortSignal.abort(reason) })).rejects.toBe(reason);
+  });
+});
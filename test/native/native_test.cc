@@ -0,0 +1,548 @@
+// Tests of the C++ API that has no JS binding or that the JS tests cannot
+// reach without the addon (SAX parser, indexed and threaded parse, Cursor,
+// thread pool, cancellation, mapped files, streaming hashes). Build and run
+// from the package root with `npm run test:native`; exits nonzero if a check
+// fails.
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "koda_binary.h"
+#include "koda_cancel.h"
+#include "koda_hash.h"
+#include "koda_mmap.h"
+#include "koda_parse.h"
+#include "koda_pool.h"
+#include "koda_sax.h"
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond)                                                          \
+  do {                                                                       \
+    if (!(cond)) {                                                           \
+      std::fprintf(stderr, "%s:%d: CHECK(%s)\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                            \
+    }                                                                        \
+  } while (0)
+
+// Message of the std::runtime_error that `fn` throws, or "" if none.
+template <typename Fn>
+std::string error_of(Fn fn) {
+  try {
+    fn();
+  } catch (const std::runtime_error& e) {
+    return e.what();
+  }
+  return "";
+}
+
+// Records SAX events as text; rejects a key seen twice in a row.
+struct Recorder {
+  std::string out;
+  std::string last_key;
+
+  void on_object_start() { out += "{"; last_key.clear(); }
+  void on_object_end() { out += "}"; }
+  bool on_key(std::string_view key) {
+    if (key == last_key) return false;
+    last_key = std::string(key);
+    out += std::string(key) + "=";
+    return true;
+  }
+  void on_array_start() { out += "["; }
+  void on_array_end() { out += "]"; }
+  void on_string(std::string_view s) { out += "'" + std::string(s) + "' "; }
+  void on_int(int64_t x) { out += std::to_string(x) + " "; }
+  void on_float(double x) { out += std::to_string(x) + " "; }
+  void on_bool(bool b) { out += b ? "true " : "false "; }
+  void on_null() { out += "null "; }
+};
+
+std::string sax(std::string_view text, koda::ParseMode mode = koda::ParseMode::Lexer) {
+  Recorder r;
+  koda::parse_sax(text, r, 256, 1000000, mode);
+  return r.out;
+}
+
+void test_sax_events() {
+  const std::string expected = "{name='app' port=8080 list=[1 2.500000 'x' true null ]deep={a={}}}";
+  CHECK(sax("name: \"app\"\nport: 8080\nlist: [1, 2.5, 'x', true, null]\ndeep: {a: {}}") == expected);
+  CHECK(sax("{name: app, port: 8080, list: [1 2.5 \"x\" true null], deep: {a: {}}}") == expected);
+  CHECK(sax("// comment\n[1, [\"a\\nb\"], {k: -3}]") == "[1 ['a\nb' ]{k=-3 }]");
+  CHECK(sax("42") == "42 ");
+}
+
+void test_sax_modes_agree() {
+  const std::string text = "items: [" + std::string(2000, ' ') + "{id: 1, tags: [a, \"b c\"]}, {id: 2, v: 1e3}]\nok: true";
+  CHECK(sax(text, koda::ParseMode::Indexed) == sax(text));
+}
+
+void test_sax_errors() {
+  CHECK(error_of([] { sax("a: 1\na: 2"); }).find("Duplicate key") != std::string::npos);
+  CHECK(error_of([] { sax("[1, 2"); }) != "");
+  CHECK(error_of([] { sax("{a: 1} extra"); }).find("Expected end of input") != std::string::npos);
+  CHECK(error_of([] {
+          Recorder r;
+          koda::parse_sax("[[[1]]]", r, 2);
+        }) == "Maximum nesting depth exceeded");
+  // The handler-driven parse reports the same errors as parse().
+  for (const char* bad : {"a: [1, }", "{a: 1", "[1, 2] 3"}) {
+    CHECK(error_of([&] { sax(bad); }) == error_of([&] { koda::parse(bad); }));
+  }
+}
+
+std::string parse_result(const std::string& text, koda::ParseMode mode) {
+  std::string error = error_of([&] { koda::parse(text, 256, 1000000, mode); });
+  return error.empty() ? koda::stringify(koda::parse(text, 256, 1000000, mode)) : "error: " + error;
+}
+
+void test_indexed_parse_matches_lexer() {
+  // Escapes, comments and quotes placed across the 64-byte blocks the index
+  // is built from.
+  std::vector<std::string> texts;
+  for (size_t pad = 0; pad < 70; pad++) {
+    const std::string p(pad, ' ');
+    texts.push_back(p + "a: \"x\\\"y\\\\\" b: [1,2.5e3,-7]");
+    texts.push_back(p + "s: 'it\\'s // not a comment' // comment \"\n t: {u: [true false null]}");
+    texts.push_back(p + "/* block ] } */ k: \"tab\\there\\n\" m: ident_1");
+    texts.push_back(p + "a: \"unclosed");
+    texts.push_back(p + "a: [1, }");
+    texts.push_back(p + "a: 1 /");
+    texts.push_back(p + "a: \"ctl\x01\"");
+  }
+  for (const std::string& text : texts) {
+    CHECK(parse_result(text, koda::ParseMode::Indexed) == parse_result(text, koda::ParseMode::Lexer));
+  }
+}
+
+std::string parse_with_threads(const std::string& text, unsigned threads, koda::ParseMode mode) {
+  koda::ParseOptions options;
+  options.max_input_len = text.size();
+  options.threads = threads;
+  options.mode = mode;
+  std::string error = error_of([&] { koda::parse(text, options); });
+  return error.empty() ? koda::stringify(koda::parse(text, options)) : "error: " + error;
+}
+
+void test_threaded_parse_matches_serial() {
+  // Both well over the size at which the parse is split.
+  std::string array = "[";
+  std::string object;
+  for (int i = 0; i < 40000; i++) {
+    const std::string item = "{id: " + std::to_string(i) + ", name: \"n,]" + std::to_string(i) + "\", v: [1.5, true]}";
+    array += item + (i % 3 ? ", " : "\n");
+    if (i < 6000) object += "k" + std::to_string(i) + ": " + item + " // " + std::string(100, '-') + "\n";
+  }
+  const std::vector<std::string> texts = {
+      array + "]",
+      object,
+      array + "]]",                             // error after the last element
+      array.substr(0, array.size() / 2) + "}",  // error mid-way
+      object + "k7: 1\n",                       // duplicate key far from the first
+  };
+  for (const std::string& text : texts) {
+    for (koda::ParseMode mode : {koda::ParseMode::Lexer, koda::ParseMode::Indexed}) {
+      CHECK(parse_with_threads(text, 4, mode) == parse_with_threads(text, 1, koda::ParseMode::Lexer));
+    }
+  }
+  CHECK(parse_with_threads(texts[4], 4, koda::ParseMode::Lexer).find("Duplicate key") != std::string::npos);
+}
+
+// Rebuild the value at the cursor's current event from the events after it.
+koda::Value rebuild(koda::Cursor& cursor) {
+  using Type = koda::Cursor::Event::Type;
+  const koda::Cursor::Event& e = cursor.event();
+  switch (e.type) {
+    case Type::ObjectStart: {
+      koda::Value obj;
+      obj.type = koda::Value::Type::Object;
+      while (cursor.next() && cursor.event().type == Type::Key) {
+        std::string key = cursor.keys()[cursor.event().key];
+        cursor.next();
+        obj.obj.emplace_back(std::move(key), rebuild(cursor));
+      }
+      return obj;
+    }
+    case Type::ArrayStart: {
+      koda::Value arr;
+      arr.type = koda::Value::Type::Array;
+      while (cursor.next() && cursor.event().type != Type::End) arr.arr.push_back(rebuild(cursor));
+      return arr;
+    }
+    case Type::Bool: return koda::Value::bool_val(e.b);
+    case Type::Int: return koda::Value::int_val(e.i);
+    case Type::Float: return koda::Value::float_val(e.d);
+    case Type::String: return koda::Value::string_val(std::string(e.s));
+    default: return koda::Value::null_val();
+  }
+}
+
+koda::Value walk(const std::vector<uint8_t>& bytes, const koda::DecodeOptions& options = koda::DecodeOptions()) {
+  koda::Cursor cursor(bytes.data(), bytes.size(), options);
+  CHECK(cursor.next());
+  koda::Value v = rebuild(cursor);
+  CHECK(!cursor.next());
+  return v;
+}
+
+const char* const kDocument =
+    "name: \"doc\"\n"
+    "rows: [{id: 1, tag: \"x\", score: 0.5}, {id: 2, tag: \"x\", score: 1.5}, {id: 3, tag: \"y\", score: 2}]\n"
+    "packed: [1, 2, 300, -4]\n"
+    "floats: [0.5, 1.25]\n"
+    "shared: {a: [\"s\", [7, 8]], b: [\"s\", [7, 8]]}\n"
+    "mixed: [null, true, \"x\", {}, []]";
+
+void test_cursor_replays_document() {
+  const koda::Value value = koda::parse(kDocument);
+  const koda::Dictionary dictionary = koda::make_dictionary({"id", "name"});
+  std::vector<koda::EncodeOptions> variants(6);
+  variants[1].version = koda::VERSION_VARINT;
+  variants[2].string_table = true;
+  variants[3].dedupe = true;
+  variants[4].version = koda::VERSION_VARINT;
+  variants[4].string_table = true;
+  variants[4].dedupe = true;
+  variants[5].dictionary = &dictionary;
+  for (const koda::EncodeOptions& options : variants) {
+    const std::vector<uint8_t> bytes = koda::encode(value, options);
+    koda::DecodeOptions decode_options;
+    decode_options.dictionary = options.dictionary;
+    // Re-encoding what the cursor reports gives back the same bytes.
+    CHECK(koda::encode(walk(bytes, decode_options), options) == bytes);
+  }
+}
+
+void test_cursor_skip() {
+  const std::vector<uint8_t> bytes = koda::encode(koda::parse("a: [1, {b: 2}]\nc: {d: [3]}\ne: \"end\""));
+  koda::Cursor cursor(bytes.data(), bytes.size());
+  std::vector<std::string> keys;
+  CHECK(cursor.next() && cursor.event().type == koda::Cursor::Event::Type::ObjectStart);
+  CHECK(cursor.event().count == 3);
+  while (cursor.next() && cursor.event().type == koda::Cursor::Event::Type::Key) {
+    keys.push_back(cursor.keys()[cursor.event().key]);
+    if (keys.back() != "e") {
+      cursor.skip();
+    } else {
+      CHECK(cursor.next() && cursor.event().s == "end");
+    }
+  }
+  CHECK((keys == std::vector<std::string>{"a", "c", "e"}));
+  CHECK(cursor.event().type == koda::Cursor::Event::Type::End);
+  CHECK(!cursor.next());
+}
+
+// Skips each row of "rows" (columnar in version 2) and every other member,
+// in each layout; the cursor must land on the root's End.
+void test_cursor_skip_layouts() {
+  using Type = koda::Cursor::Event::Type;
+  const koda::Value value = koda::parse(kDocument);
+  std::vector<koda::EncodeOptions> variants(3);
+  variants[1].version = koda::VERSION_VARINT;
+  variants[2].version = koda::VERSION_VARINT;
+  variants[2].dedupe = true;
+  for (const koda::EncodeOptions& options : variants) {
+    const std::vector<uint8_t> bytes = koda::encode(value, options);
+    koda::Cursor cursor(bytes.data(), bytes.size());
+    CHECK(cursor.next() && cursor.event().type == Type::ObjectStart);
+    size_t members = 0;
+    size_t rows = 0;
+    while (cursor.next() && cursor.event().type == Type::Key) {
+      ++members;
+      if (cursor.keys()[cursor.event().key] != "rows") {
+        cursor.skip();
+        continue;
+      }
+      CHECK(cursor.next() && cursor.event().type == Type::ArrayStart);
+      while (cursor.next() && cursor.event().type == Type::ObjectStart) {
+        ++rows;
+        cursor.skip();
+      }
+    }
+    CHECK(members == 6);
+    CHECK(rows == 3);
+    CHECK(cursor.event().type == Type::End);
+    CHECK(!cursor.next());
+  }
+}
+
+// Skipping a shared subtree does not replay it: this one would expand to
+// 2^40 events, far past the cursor's expansion limit.
+void test_cursor_skip_shared() {
+  const size_t depth = 40;
+  std::vector<uint8_t> bytes = {'K', 'O', 'D', 'A', koda::VERSION_VARINT, 3, 1, 'a', 1, 'b', 1, 'c',
+                                koda::TAG_OBJECT, 3, 0};
+  // Shared subtree i is [subtree i - 1, reference to it]; subtree 0 is [1, 2].
+  for (size_t i = 0; i < depth; ++i) bytes.insert(bytes.end(), {koda::TAG_SHARED_DEF, koda::TAG_ARRAY, 2});
+  bytes.insert(bytes.end(), {koda::TAG_SHARED_DEF, koda::TAG_PACKED_INT8, 2, 1, 2});
+  for (size_t i = 0; i < depth; ++i) bytes.insert(bytes.end(), {koda::TAG_SHARED_REF, static_cast<uint8_t>(i)});
+  bytes.insert(bytes.end(), {1, koda::TAG_SHARED_REF, static_cast<uint8_t>(depth)});
+  bytes.insert(bytes.end(), {2, koda::TAG_STRING, 3, 'e', 'n', 'd'});
+  koda::Cursor cursor(bytes.data(), bytes.size());
+  CHECK(cursor.next() && cursor.next() && cursor.keys()[cursor.event().key] == "a");
+  cursor.skip();
+  CHECK(cursor.next() && cursor.keys()[cursor.event().key] == "b");
+  cursor.skip();
+  CHECK(cursor.next() && cursor.keys()[cursor.event().key] == "c");
+  CHECK(cursor.next() && cursor.event().s == "end");
+  CHECK(cursor.next() && cursor.event().type == koda::Cursor::Event::Type::End);
+  CHECK(!cursor.next());
+}
+
+void test_cursor_errors() {
+  std::vector<uint8_t> bytes = koda::encode(koda::parse("[1, \"two\", {three: 3}]"));
+  bytes.pop_back();
+  CHECK(error_of([&] {
+          koda::Cursor cursor(bytes.data(), bytes.size());
+          while (cursor.next()) {
+          }
+        }) == "Truncated input");
+  koda::EncoderSession session;
+  const std::vector<uint8_t> frame = session.encode(koda::parse("a: 1"));
+  CHECK(error_of([&] { koda::Cursor cursor(frame.data(), frame.size()); }) == "Session frame outside a decoder session");
+  // Packed and columnar arrays are version 2 only.
+  for (uint8_t tag : {koda::TAG_PACKED_INT8, koda::TAG_COLUMNS}) {
+    const std::vector<uint8_t> v1 = {'K', 'O', 'D', 'A', koda::VERSION, 0, 0, 0, 0, tag, 0, 0, 0, 1, 5};
+    CHECK(error_of([&] {
+            koda::Cursor cursor(v1.data(), v1.size());
+            while (cursor.next()) {
+            }
+          }) == "Unknown type tag");
+  }
+}
+
+void test_pool_priorities() {
+  koda::ThreadPool pool(1);
+  std::mutex m;
+  std::condition_variable cv;
+  bool release = false;
+  std::string order;
+  std::atomic<int> done{0};
+  // Hold the only worker while the other tasks queue up behind it.
+  pool.submit([&] {
+    std::unique_lock<std::mutex> lock(m);
+    cv.wait(lock, [&] { return release; });
+  });
+  auto task = [&](char c) {
+    return [&, c] {
+      {
+        std::lock_guard<std::mutex> lock(m);
+        order += c;
+      }
+      done++;
+    };
+  };
+  pool.submit(task('l'), koda::Priority::Low);
+  pool.submit(task('n'), koda::Priority::Normal);
+  pool.submit(task('h'), koda::Priority::High);
+  pool.submit(task('m'), koda::Priority::Normal);
+  while (pool.stats().queued[static_cast<size_t>(koda::Priority::Low)] != 1) std::this_thread::yield();
+  {
+    std::lock_guard<std::mutex> lock(m);
+    release = true;
+  }
+  cv.notify_all();
+  while (done < 4) std::this_thread::yield();
+  CHECK(order == "hnml");
+}
+
+void test_pool_parallel_for() {
+  koda::ThreadPool pool(4);
+  std::vector<std::atomic<int>> hits(1000);
+  pool.parallel_for(hits.size(), [&](size_t i) { hits[i]++; });
+  bool once = true;
+  for (auto& h : hits) once = once && h == 1;
+  CHECK(once);
+
+  // Nested inside a pool task, with every worker busy in the outer loop.
+  std::atomic<int> inner{0};
+  pool.parallel_for(8, [&](size_t) { pool.parallel_for(50, [&](size_t) { inner++; }); });
+  CHECK(inner == 400);
+
+  CHECK(error_of([&] {
+          pool.parallel_for(100, [](size_t i) {
+            if (i == 30 || i == 70) throw std::runtime_error("fail " + std::to_string(i));
+          });
+        }) == "fail 30");
+}
+
+void test_pool_resize() {
+  koda::ThreadPool pool(2);
+  CHECK(pool.threads() == 2);
+  std::atomic<int> done{0};
+  for (int i = 0; i < 100; i++) pool.submit([&] { done++; });
+  pool.set_threads(3);
+  CHECK(pool.threads() == 3);
+  pool.set_threads(0);
+  CHECK(pool.threads() == 1);
+  while (done < 100) std::this_thread::yield();
+  koda::PoolStats stats = pool.stats();
+  CHECK(stats.executed >= 100);
+  CHECK(stats.active == 0);
+}
+
+void test_cancel_tokens() {
+  std::string text = "[";
+  for (int i = 0; i < 100000; i++) text += "{id: " + std::to_string(i) + ", s: \"x\"}, ";
+  text += "]";
+  const koda::Value value = koda::parse(text, 256, text.size());
+  const std::vector<uint8_t> bytes = koda::encode(value);
+
+  koda::CancelToken cancelled;
+  cancelled.cancel();
+  koda::CancelToken expired;
+  expired.set_deadline(koda::CancelToken::Clock::now());
+  int32_t word = 1;
+  koda::CancelToken flagged;
+  flagged.set_flag(&word);
+
+  for (unsigned threads : {1u, 4u}) {
+    for (const koda::CancelToken* token : {&cancelled, &flagged}) {
+      koda::ParseOptions parse_options;
+      parse_options.max_input_len = text.size();
+      parse_options.threads = threads;
+      parse_options.cancel = token;
+      CHECK(error_of([&] { koda::parse(text, parse_options); }) == "Operation aborted");
+      koda::EncodeOptions encode_options;
+      encode_options.threads = threads;
+      encode_options.cancel = token;
+      CHECK(error_of([&] { koda::encode(value, encode_options); }) == "Operation aborted");
+      koda::DecodeOptions decode_options;
+      decode_options.threads = threads;
+      decode_options.cancel = token;
+      CHECK(error_of([&] { koda::decode(bytes.data(), bytes.size(), decode_options, nullptr); }) == "Operation aborted");
+    }
+    koda::DecodeOptions decode_options;
+    decode_options.threads = threads;
+    decode_options.cancel = &expired;
+    CHECK(error_of([&] { koda::decode(bytes.data(), bytes.size(), decode_options, nullptr); }) == "Deadline exceeded");
+  }
+  // Stage 1 of an indexed or threaded parse stops on its own.
+  CHECK(error_of([&] { koda::build_structural_index(text, &cancelled); }) == "Operation aborted");
+  CHECK(error_of([&] { koda::build_structural_index(text, &expired); }) == "Deadline exceeded");
+
+  // A token that never fires changes nothing.
+  koda::CancelToken idle;
+  koda::DecodeOptions decode_options;
+  decode_options.cancel = &idle;
+  CHECK(koda::encode(koda::decode(bytes.data(), bytes.size(), decode_options, nullptr)) == bytes);
+  bool typed = false;
+  try {
+    cancelled.check();
+  } catch (const koda::Cancelled&) {
+    typed = true;
+  }
+  CHECK(typed);
+}
+
+void test_mapped_file() {
+  const std::string path = "build/native_test_mapped.koda";
+  const std::string text = "a: [1, 2]\nb: \"text\"\n";
+  std::ofstream(path, std::ios::binary) << text;
+  {
+    koda::MappedFile file(path);
+    CHECK(file.size() == text.size());
+    CHECK(file.text() == text);
+    CHECK(koda::stringify(koda::parse(file.text(), koda::ParseOptions())) == koda::stringify(koda::parse(text)));
+  }
+  std::ofstream(path, std::ios::binary | std::ios::trunc).close();
+  {
+    koda::MappedFile file(path);
+    CHECK(file.size() == 0);
+    CHECK(file.text().empty());
+  }
+  std::remove(path.c_str());
+  CHECK(error_of([&] { koda::MappedFile file(path); }) == "Cannot open file: " + path);
+}
+
+std::vector<uint8_t> pattern(size_t n) {
+  std::vector<uint8_t> out(n);
+  for (size_t i = 0; i < n; i++) out[i] = static_cast<uint8_t>(i * 31 + 7);
+  return out;
+}
+
+// Digest of `bytes` fed to a fresh H in two pieces split at `cut`.
+template <typename H>
+uint64_t split_digest(const std::vector<uint8_t>& bytes, size_t cut) {
+  H h;
+  h.update(bytes.data(), cut);
+  h.update(bytes.data() + cut, bytes.size() - cut);
+  return h.digest();
+}
+
+void test_streaming_hashes() {
+  // XXH3_64bits and XXH64 of pattern(n), from the reference implementation.
+  struct Vector {
+    size_t n;
+    uint64_t xxh3;
+    uint64_t xxh64;
+  };
+  const Vector vectors[] = {
+      {0, 0x2d06800538d394c2, 0xef46db3751d8e999},   {3, 0x15f7093b173d005c, 0x56e6957632a487f9},
+      {17, 0x208bde5ee2bed407, 0xfe9f0feb7eeedc09},  {129, 0xf8f76713f2bb60fa, 0x28fc8362643627d7},
+      {241, 0x0b3b630948ce4a00, 0xd3f50496d5bf27e0}, {1025, 0xc09fdfbc398c7d82, 0x2c9d0b038b4a4b35},
+      {3000, 0x6eb4b5bfe14d9786, 0xb29c7cb9c2fc750c},
+  };
+  for (const Vector& v : vectors) {
+    const std::vector<uint8_t> bytes = pattern(v.n);
+    bool xxh3_ok = true;
+    bool xxh64_ok = true;
+    for (size_t cut = 0; cut <= v.n; cut += v.n > 300 ? 7 : 1) {
+      xxh3_ok = xxh3_ok && split_digest<koda::Xxh3>(bytes, cut) == v.xxh3;
+      xxh64_ok = xxh64_ok && split_digest<koda::Xxh64>(bytes, cut) == v.xxh64;
+    }
+    CHECK(xxh3_ok);
+    CHECK(xxh64_ok);
+    CHECK(koda::xxh64(bytes.data(), bytes.size()) == v.xxh64);
+  }
+
+  // SHA-256 of "abc" (FIPS 180-2), fed a byte at a time.
+  koda::Sha256 sha;
+  for (char c : std::string("abc")) sha.update(reinterpret_cast<const uint8_t*>(&c), 1);
+  uint8_t out[32];
+  sha.digest(out);
+  std::string hex;
+  for (uint8_t b : out) {
+    char buf[3];
+    std::snprintf(buf, sizeof buf, "%02x", b);
+    hex += buf;
+  }
+  CHECK(hex == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+}
+
+}  // namespace
+
+int main() {
+  test_sax_events();
+  test_sax_modes_agree();
+  test_sax_errors();
+  test_indexed_parse_matches_lexer();
+  test_threaded_parse_matches_serial();
+  test_cursor_replays_document();
+  test_cursor_skip();
+  test_cursor_skip_layouts();
+  test_cursor_skip_shared();
+  test_cursor_errors();
+  test_pool_priorities();
+  test_pool_parallel_for();
+  test_pool_resize();
+  test_cancel_tokens();
+  test_mapped_file();
+  test_streaming_hashes();
+  if (failures) {
+    std::fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+  std::printf("native tests passed\n");
+  return 0;
+}
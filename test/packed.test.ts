@@ -0,0 +1,74 @@
+import { decodeSync, encode, type KodaValue } from '../src/index.js';
+import { decode as decodeJs } from '../src/decoder.js';
+import { encode as encodeJs } from '../src/encoder.js';
+
+const hex = (bytes: Uint8Array): string => Buffer.from(bytes).toString('hex');
+
+describe('packed numeric arrays', () => {
+  const v2 = { version: 2 } as const;
+  // Magic, version 2, empty dictionary, then the root array.
+  const header = '4b4f44410200';
+  const cases: Array<[string, KodaValue, string]> = [
+    ['int8', [1, 2, 3], '2003010203'],
+    ['int8 bounds', [127, -128], '20027f80'],
+    ['int16', [128], '21010080'],
+    ['int32', [40000], '220100009c40'],
+    ['int64', [2 ** 40], '23010000010000000000'],
+    ['float32', [1.5, 0.25], '24023fc000003e800000'],
+    ['float64', [0.1], '25013fb999999999999a'],
+    ['empty', [], '1000'],
+    ['mixed', [1, 1.5], '100281053ff8000000000000'],
+  ];
+
+  for (const [name, value, body] of cases) {
+    it(`encodes ${name} canonically`, () => {
+      expect(hex(encodeJs(value, v2))).toBe(header + body);
+      expect(hex(encode(value, v2))).toBe(header + body);
+      expect(decodeSync(encode(value, v2))).toEqual(value);
+      expect(decodeJs(encodeJs(value, v2))).toEqual(value);
+    });
+  }
+
+  it('writes plain arrays in version 1', () => {
+    const plain = '4b4f444101000000001000000003040000000000000001040000000000000002040000000000000003';
+    expect(hex(encodeJs([1, 2, 3]))).toBe(plain);
+    expect(hex(encode([1, 2, 3]))).toBe(plain);
+    expect(hex(encode(new Int8Array([1, 2, 3])))).toBe(plain);
+    expect(hex(encodeJs(new BigInt64Array([2n ** 62n])))).toBe('4b4f444101000000001000000001044000000000000000');
+  });
+
+  it('rejects packed tags in a version 1 document', () => {
+    const bytes = Buffer.from('4b4f44410100000000200000000105', 'hex');
+    expect(() => decodeJs(bytes)).toThrow('Unknown type tag');
+    expect(() => decodeSync(bytes)).toThrow('Unknown type tag');
+  });
+
+  it('encodes a typed array like the plain array of the same numbers', () => {
+    for (const options of [{}, v2]) {
+      expect(hex(encode(new Int32Array([1, 2, 3]), options))).toBe(hex(encode([1, 2, 3], options)));
+      expect(hex(encode(new Float64Array([1.5]), options))).toBe(hex(encode([1.5], options)));
+    }
+  });
+
+  it('decodes to the narrowest typed array with typedArrays', () => {
+    const typed = (value: KodaValue) => decodeSync(encode(value, v2), { typedArrays: true });
+    expect(typed([1, 2, 3])).toEqual(new Int8Array([1, 2, 3]));
+    expect(typed([128])).toEqual(new Int16Array([128]));
+    expect(typed([40000])).toEqual(new Int32Array([40000]));
+    expect(typed([2 ** 40])).toEqual(new BigInt64Array([2n ** 40n]));
+    expect(typed([1.5])).toEqual(new Float32Array([1.5]));
+    expect(typed([0.1])).toEqual(new Float64Array([0.1]));
+    expect(decodeJs(encode([0.1], v2), { typedArrays: true })).toEqual(new Float64Array([0.1]));
+  });
+
+  it('packs numeric columns nested in objects', () => {
+    const value = { xs: [1, 2, 3], ys: [0.5, -0.5], names: ['a', 'b'] };
+    expect(hex(encode(value, v2))).toBe(hex(encodeJs(value, v2)));
+    expect(decodeSync(encode(value, v2))).toEqual(value);
+  });
+
+  it('rejects a truncated packed body', () => {
+    const bytes = encode([1, 2, 3], v2);
+    expect(() => decodeSync(bytes.subarray(0, bytes.length - 1))).toThrow();
+  });
+});
@@ -0,0 +1,79 @@
+import { createParseCache, decodeSync, encode, KodaDecodeError, parse } from '../src/index.js';
+
+describe('createParseCache', () => {
+  const text = 'name: "app"\nport: 8080\nhosts: ["a", "b"]\n';
+
+  it('returns the same frozen value on a hit', () => {
+    const cache = createParseCache();
+    const first = parse(text, { cache });
+    const second = parse(text, { cache });
+    expect(second).toBe(first);
+    expect(first).toEqual(parse(text));
+    expect(Object.isFrozen(first)).toBe(true);
+    expect(Object.isFrozen((first as { hosts: string[] }).hosts)).toBe(true);
+    expect(cache.stats()).toEqual({
+      entries: 1,
+      bytes: Buffer.byteLength(text),
+      maxBytes: 64 * 1024 * 1024,
+      hits: 1,
+      misses: 1,
+      evictions: 0,
+    });
+  });
+
+  it('takes a Buffer as UTF-8 text', () => {
+    const cache = createParseCache();
+    const value = cache.parse(Buffer.from(text));
+    expect(cache.parse(text)).toBe(value);
+  });
+
+  it('keys by the options that shape the result', () => {
+    const cache = createParseCache();
+    const bytes = encode({ a: [1, 2, 3] });
+    const value = decodeSync(bytes, { cache });
+    expect(decodeSync(bytes, { cache, maxDepth: 10 })).not.toBe(value);
+    expect(decodeSync(bytes, { cache })).toBe(value);
+    expect(cache.stats().entries).toBe(2);
+  });
+
+  it('refuses typedArrays, which cannot be frozen', () => {
+    const cache = createParseCache();
+    const bytes = encode([1, 2, 3]);
+    expect(() => cache.decode(bytes, { typedArrays: true })).toThrow(KodaDecodeError);
+    expect(() => cache.decode(bytes, { typedArrays: true })).toThrow('typedArrays');
+  });
+
+  it('evicts the least recently used entries past maxBytes', () => {
+    const cache = createParseCache({ maxBytes: 40 });
+    const a = cache.parse('a: "0123456789"');
+    cache.parse('b: "0123456789"');
+    cache.parse('a: "0123456789"');
+    cache.parse('c: "0123456789"');
+    expect(cache.stats().evictions).toBe(1);
+    expect(cache.parse('a: "0123456789"')).toBe(a);
+    expect(cache.stats().entries).toBe(2);
+  });
+
+  it('does not cache an input larger than maxBytes', () => {
+    const cache = createParseCache({ maxBytes: 4 });
+    const first = cache.parse(text);
+    expect(cache.parse(text)).not.toBe(first);
+    expect(cache.stats().entries).toBe(0);
+  });
+
+  it('resets the counters on clear()', () => {
+    const cache = createParseCache();
+    parse(text, { cache });
+    parse(text, { cache });
+    cache.clear();
+    expect(cache.stats()).toEqual({ entries: 0, bytes: 0, maxBytes: 64 * 1024 * 1024, hits: 0, misses: 0, evictions: 0 });
+    parse(text, { cache });
+    expect(cache.stats().misses).toBe(1);
+  });
+
+  it('surfaces parse errors without caching them', () => {
+    const cache = createParseCache();
+    expect(() => cache.parse('a: [')).toThrow();
+    expect(cache.stats().entries).toBe(0);
+  });
+});
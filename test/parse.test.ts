@@ -0,0 +1,54 @@
+import { KodaParseError, parse, parseAsync, parseWithLexer } from '../src/index.js';
+
+const documents: Record<string, string> = {
+  'root object without braces': 'name: "app"\nport: 8080\nratio: 0.75\nenabled: true\nnothing: null',
+  'root object with braces and commas': '{name: app, list: [1, 2, 3], nested: {a: {b: []}}}',
+  'comments and quoted keys': '// header\n"quoted key": 1\n\'single\': [true false null]\n',
+  'escapes': 'text: "line\\nnext \\"quoted\\" tab\\t unicode \\u00e9"',
+  'numbers': 'values: [0, -1, 9007199254740991, 1.5e10, -2.25, 1e-7]',
+  'root array': '[{id: 1, tags: [a, b]}, {id: 2, tags: []}, "tail"]',
+  'root scalar': '"just a string"',
+};
+
+describe('parse', () => {
+  for (const [name, text] of Object.entries(documents)) {
+    it(`matches the lexer parser for ${name}`, () => {
+      expect(parse(text)).toEqual(parseWithLexer(text));
+    });
+  }
+
+  it("gives the same values in 'indexed' mode", () => {
+    for (const text of Object.values(documents)) expect(parse(text, { mode: 'indexed' })).toEqual(parseWithLexer(text));
+    const large = `items: [${Array.from({ length: 5000 }, (_, i) => `{id: ${i}, s: "q\\"${'x'.repeat(i % 70)}", n: [${i}, -${i}.5]}`).join(', ')}]`;
+    expect(parse(large, { mode: 'indexed', maxInputLength: 10_000_000 })).toEqual(parseWithLexer(large, { maxInputLength: 10_000_000 }));
+    for (const bad of ['a: "unclosed', 'a: [1, }', 'a: 1 /']) expect(() => parse(bad, { mode: 'indexed' })).toThrow(KodaParseError);
+  });
+
+  it('gives the same values and errors with threads', async () => {
+    const rows = Array.from({ length: 30000 }, (_, i) => `{id: ${i}, name: "n,]${i}", v: [1.5, true]}`);
+    const options = { maxInputLength: 10_000_000 };
+    // Both well over the size at which the native parse is split.
+    const array = `[${rows.join(', ')}]`;
+    const object = rows.slice(0, 8000).map((row, i) => `k${i}: ${row} // ${'-'.repeat(80)}\n`).join('');
+    for (const text of [array, object]) {
+      const serial = parseWithLexer(text, options);
+      expect(parse(text, { ...options, threads: 4 })).toEqual(serial);
+      expect(parse(text, { ...options, threads: 4, mode: 'indexed' })).toEqual(serial);
+      expect(await parseAsync(text, { ...options, threads: 4 })).toEqual(serial);
+    }
+    expect(() => parse(`${object}k7: 1\n`, { ...options, threads: 4 })).toThrow('Duplicate key');
+    expect(() => parse(`${array}]`, { ...options, threads: 4 })).toThrow(KodaParseError);
+  });
+
+  it('throws KodaParseError for invalid text', () => {
+    for (const bad of ['a: [1, }', '{a: 1', '[1, 2] 3', 'a: 1\na: 2', 'a: "x']) {
+      expect(() => parse(bad)).toThrow(KodaParseError);
+      expect(() => parseWithLexer(bad)).toThrow(KodaParseError);
+    }
+  });
+
+  it('enforces maxDepth', () => {
+    expect(() => parse('[[[1]]]', { maxDepth: 2 })).toThrow(KodaParseError);
+    expect(parse('[[[1]]]', { maxDepth: 3 })).toEqual([[[1]]]);
+  });
+});
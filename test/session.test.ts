@@ -0,0 +1,63 @@
+import { createDecoderSession, createDictionary, createEncoderSession, decodeSync, type KodaValue } from '../src/index.js';
+import { decodeSessionFrame } from '../src/decoder.js';
+import { encodeSessionFrame } from '../src/encoder.js';
+
+const hex = (bytes: Uint8Array): string => Buffer.from(bytes).toString('hex');
+
+describe('session frames', () => {
+  const values: KodaValue[] = [{ b: 1 }, { a: 2, b: 3 }, { a: 4 }];
+  // Each frame: session size so far, then only the keys new to the session.
+  const frames = [
+    '4b4f44414200' + '010162' + '11010081',
+    '4b4f44414201' + '010161' + '110200820183',
+    '4b4f44414202' + '00' + '11010084',
+  ];
+
+  it('writes only the keys each frame adds', () => {
+    const session = createEncoderSession({ version: 2 });
+    let keys: readonly string[] = [];
+    values.forEach((value, i) => {
+      const frame = encodeSessionFrame(value, { version: 2 }, keys);
+      keys = frame.keys;
+      expect(hex(frame.bytes)).toBe(frames[i]);
+      expect(hex(session.encode(value))).toBe(frames[i]);
+    });
+    expect(keys).toEqual(['a', 'b']);
+  });
+
+  it('decodes frames in order', () => {
+    const session = createDecoderSession();
+    let keys: readonly string[] = [];
+    frames.forEach((frame, i) => {
+      const bytes = Buffer.from(frame, 'hex');
+      expect(session.decode(bytes)).toEqual(values[i]);
+      const js = decodeSessionFrame(bytes, {}, keys);
+      if (js.keys !== undefined) keys = js.keys;
+      expect(js.value).toEqual(values[i]);
+    });
+  });
+
+  it('round-trips many frames with options, starting from a dictionary', () => {
+    const dictionary = createDictionary(['id', 'name']);
+    for (const options of [{ version: 1 as const }, { version: 2 as const, stringTable: true, dedupe: true }]) {
+      const encoder = createEncoderSession({ ...options, dictionary });
+      const decoder = createDecoderSession({ dictionary });
+      for (let i = 0; i < 20; i++) {
+        const value = { id: i, name: `n${i}`, [`k${i % 5}`]: [i, i, { deep: 'x' }], tags: ['x', 'x'] };
+        expect(decoder.decode(encoder.encode(value))).toEqual(value);
+      }
+    }
+  });
+
+  it('accepts standalone documents in a session', () => {
+    const session = createDecoderSession();
+    expect(session.decode(Buffer.from('4b4f44410201016211010081', 'hex'))).toEqual({ b: 1 });
+  });
+
+  it('rejects frames that arrive out of order or outside a session', () => {
+    const skipped = Buffer.from(frames[1]!, 'hex');
+    expect(() => createDecoderSession().decode(skipped)).toThrow('Session dictionary out of sync');
+    expect(() => decodeSessionFrame(skipped, {}, [])).toThrow('Session dictionary out of sync');
+    expect(() => decodeSync(Buffer.from(frames[0]!, 'hex'))).toThrow('Session frame outside a decoder session');
+  });
+});
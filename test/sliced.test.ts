@@ -0,0 +1,84 @@
+import { decodeIncremental, decodeSync, decodeTimeSliced, encode, isNativeAvailable, KodaDecodeError } from '../src/index.js';
+
+const records = Array.from({ length: 20000 }, (_, i) => ({ id: i, name: `n${i}`, tags: ['a', `t${i % 9}`] }));
+const mixed = Array.from({ length: 20000 }, (_, i) => (i % 2 ? { i, nested: { list: [i, `s${i}`] } } : `s${i}`));
+
+describe('decodeIncremental', () => {
+  for (const [name, value] of [
+    ['a columnar root', records],
+    ['a plain root array', mixed],
+    ['a root object', { a: mixed.slice(0, 100), b: 'x' }],
+  ] as const) {
+    it(`decodes ${name} to the same value as decodeSync, step by step`, () => {
+      for (const version of [1, 2] as const) {
+        const bytes = encode(value, { version, stringTable: version === 2 });
+        const decode = decodeIncremental(bytes);
+        expect(decode.done).toBe(false);
+        let steps = 0;
+        while (!decode.step(0.05)) steps++;
+        expect(decode.done).toBe(true);
+        expect(decode.step()).toBe(true);
+        expect(decode.value).toEqual(decodeSync(bytes));
+        if (isNativeAvailable() && name === 'a plain root array') expect(steps).toBeGreaterThan(1);
+      }
+    });
+  }
+
+  it('throws from value until the decode is complete', () => {
+    const decode = decodeIncremental(encode(mixed));
+    expect(() => decode.value).toThrow(KodaDecodeError);
+  });
+
+  it('reports invalid input from step()', () => {
+    const bytes = encode(mixed);
+    const decode = decodeIncremental(bytes.subarray(0, bytes.length - 5));
+    expect(() => {
+      while (!decode.step()) {
+        // keep stepping
+      }
+    }).toThrow('Truncated input');
+  });
+
+  it('keeps throwing the first error after a failed step', () => {
+    const bytes = encode(mixed);
+    const decode = decodeIncremental(bytes.subarray(0, bytes.length - 5));
+    let first: unknown;
+    try {
+      while (!decode.step()) {
+        // keep stepping
+      }
+    } catch (e) {
+      first = e;
+    }
+    expect(first).toBeInstanceOf(KodaDecodeError);
+    expect(() => decode.step()).toThrow((first as Error).message);
+    expect(decode.done).toBe(false);
+    expect(() => decode.value).toThrow((first as Error).message);
+  });
+});
+
+describe('decodeTimeSliced', () => {
+  it('resolves to the same value as decodeSync', async () => {
+    const bytes = encode(mixed);
+    expect(await decodeTimeSliced(bytes, { sliceMs: 1 })).toEqual(decodeSync(bytes));
+  });
+
+  it('lets other callbacks run between steps', async () => {
+    if (!isNativeAvailable()) return;
+    let ticks = 0;
+    const timer = setInterval(() => ticks++, 0);
+    try {
+      await decodeTimeSliced(encode(Array.from({ length: 200000 }, (_, i) => ({ i, s: `s${i}` }))), { sliceMs: 1 });
+    } finally {
+      clearInterval(timer);
+    }
+    expect(ticks).toBeGreaterThan(0);
+  });
+
+  it('stops when aborted or past its deadline', async () => {
+    const bytes = encode(mixed);
+    const reason = new Error('stop');
+    await expect(decodeTimeSliced(bytes, { signal: AbortSignal.abort(reason) })).rejects.toBe(reason);
+    await expect(decodeTimeSliced(bytes, { deadlineMs: 0 })).rejects.toThrow('Deadline exceeded');
+  });
+});
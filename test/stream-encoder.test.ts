@@ -0,0 +1,52 @@
+import { createStreamEncoder, encode, type KodaValue } from '../src/index.js';
+import { encode as encodeJs } from '../src/encoder.js';
+
+function streamed(rows: KodaValue[], options?: Parameters<typeof createStreamEncoder>[0]): Uint8Array {
+  const encoder = createStreamEncoder(options);
+  encoder.beginArray();
+  for (const row of rows) encoder.writeValue(row);
+  return encoder.finish();
+}
+
+describe('createStreamEncoder', () => {
+  const cases: Record<string, KodaValue[]> = {
+    empty: [],
+    scalars: [1, -2, 3.5, 'x', null, true],
+    'packed ints': [1, 200, -3, 70000],
+    'uniform rows': Array.from({ length: 20 }, (_, i) => ({ id: i, name: `n${i}`, score: i / 4 })),
+    'keys introduced late in nested columns': [
+      { b: 1 },
+      { c: [{ a: 1, b: 2 }, { a: 3, b: 4 }] },
+    ],
+    'nested columns with late keys in every row': Array.from({ length: 5 }, (_, i) => ({
+      k: i,
+      n: [{ q: i, b: 1, a: `s${i}` }, { b: i, q: 1, a: 'x' }],
+    })),
+    // Each column staged past the flush size.
+    'large nested columns': Array.from({ length: 3000 }, (_, i) => ({
+      id: i,
+      name: `${'x'.repeat(40)}${i}`,
+      pos: { x: i % 7, y: i / 2 },
+    })),
+    'mixed rows': [{ z: [{ y: 's', a: 2 }, { a: 3, y: null }] }, [1, 2], 'tail'],
+  };
+
+  for (const [name, rows] of Object.entries(cases)) {
+    for (const version of [1, 2] as const) {
+      it(`matches encode() for ${name} (v${version})`, () => {
+        const bytes = streamed(rows, { version });
+        expect(Buffer.from(bytes).equals(Buffer.from(encode(rows, { version })))).toBe(true);
+        expect(Buffer.from(bytes).equals(Buffer.from(encodeJs(rows, { version })))).toBe(true);
+      });
+    }
+  }
+
+  it('rejects stringTable and dedupe', () => {
+    expect(() => createStreamEncoder({ stringTable: true })).toThrow('does not support');
+    expect(() => createStreamEncoder({ dedupe: true })).toThrow('does not support');
+  });
+
+  it('requires beginArray before writeValue', () => {
+    expect(() => createStreamEncoder().writeValue(1)).toThrow('No array in progress');
+  });
+});
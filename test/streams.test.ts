@@ -0,0 +1,97 @@
+import { Readable } from 'node:stream';
+import { pipeline } from 'node:stream/promises';
+import { setFlagsFromString } from 'node:v8';
+import { runInNewContext } from 'node:vm';
+import { createDecodeStream, createDictionary, createEncodeStream, encode, type KodaValue } from '../src/index.js';
+import type { DecodeStreamOptions, EncodeStreamOptions } from '../src/index.js';
+
+const hex = (bytes: Uint8Array): string => Buffer.from(bytes).toString('hex');
+
+async function encodeAll(values: KodaValue[], options?: EncodeStreamOptions): Promise<Buffer> {
+  const chunks: Buffer[] = [];
+  const stream = createEncodeStream(options);
+  stream.on('data', (chunk: Uint8Array) => chunks.push(Buffer.from(chunk)));
+  await pipeline(Readable.from(values, { objectMode: true }), stream);
+  return Buffer.concat(chunks);
+}
+
+async function decodeAll(chunks: Uint8Array[], options?: DecodeStreamOptions): Promise<KodaValue[]> {
+  const values: KodaValue[] = [];
+  const stream = createDecodeStream(options);
+  stream.on('data', (value: KodaValue) => values.push(value));
+  await pipeline(Readable.from(chunks.map((c) => Buffer.from(c)), { objectMode: false }), stream);
+  return values;
+}
+
+/** `bytes` cut into chunks of `size`. */
+function split(bytes: Uint8Array, size: number): Uint8Array[] {
+  const out: Uint8Array[] = [];
+  for (let i = 0; i < bytes.length; i += size) out.push(bytes.subarray(i, i + size));
+  return out;
+}
+
+describe('framed streams', () => {
+  const values: KodaValue[] = [
+    { id: 1, name: 'a' },
+    [1, 2, 3],
+    'x'.repeat(200),
+    false,
+    { id: 2, nested: { list: [true, 1.5] } },
+  ];
+
+  it('writes one length-prefixed frame per value', async () => {
+    const framed = await encodeAll([{ a: 1 }, 'x'.repeat(200)]);
+    const first = encode({ a: 1 });
+    const second = encode('x'.repeat(200));
+    // Lengths are LEB128: 200 + header bytes needs two.
+    expect(hex(framed)).toBe(
+      hex(Uint8Array.of(first.length)) + hex(first) + hex(Uint8Array.of(0x80 | (second.length & 0x7f), second.length >> 7)) + hex(second)
+    );
+  });
+
+  for (const size of [1, 3, 7, 64, 4096]) {
+    it(`decodes frames split into ${size}-byte chunks`, async () => {
+      const framed = await encodeAll(values);
+      expect(await decodeAll(split(framed, size))).toEqual(values);
+    });
+  }
+
+  it('round-trips with a dictionary, and with session frames', async () => {
+    const dictionary = createDictionary(['id', 'name']);
+    expect(await decodeAll([await encodeAll(values, { dictionary })], { dictionary })).toEqual(values);
+    const records = Array.from({ length: 20 }, (_, i) => ({ id: i, name: `n${i}`, active: i % 2 === 0 }));
+    const framed = await encodeAll(records, { session: true, version: 2 });
+    expect(framed.length).toBeLessThan((await encodeAll(records, { version: 2 })).length);
+    expect(await decodeAll(split(framed, 5), { session: true })).toEqual(records);
+  });
+
+  it('keeps a partial frame across an empty chunk and a collection', async () => {
+    setFlagsFromString('--expose-gc');
+    const gc = runInNewContext('gc') as () => void;
+    const value = { text: 'x'.repeat(100_000) };
+    const framed = await encodeAll([value]);
+    const half = framed.length >> 1;
+    const values: KodaValue[] = [];
+    const stream = createDecodeStream();
+    stream.on('data', (v: KodaValue) => values.push(v));
+    // Copies too large for the Buffer pool, so only the decoder keeps the first half alive.
+    stream.write(Buffer.from(framed.subarray(0, half)));
+    stream.write(Buffer.alloc(0));
+    gc();
+    for (let i = 0; i < 8; i++) Buffer.alloc(half, 0xff);
+    stream.end(Buffer.from(framed.subarray(half)));
+    await new Promise((resolve) => stream.on('end', resolve));
+    expect(values).toEqual([value]);
+  });
+
+  it('rejects a truncated last frame', async () => {
+    const framed = await encodeAll(values);
+    await expect(decodeAll([framed.subarray(0, framed.length - 1)])).rejects.toThrow('Truncated frame');
+  });
+
+  it('rejects frames over maxFrameSize and malformed lengths', async () => {
+    const framed = await encodeAll(['x'.repeat(200)]);
+    await expect(decodeAll([framed], { maxFrameSize: 100 })).rejects.toThrow('Frame too large');
+    await expect(decodeAll([Uint8Array.of(0x80, 0x00)])).rejects.toThrow('Malformed frame length');
+  });
+});
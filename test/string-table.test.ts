@@ -0,0 +1,43 @@
+import { decodeSync, encode, type KodaValue } from '../src/index.js';
+import { decode as decodeJs } from '../src/decoder.js';
+import { encode as encodeJs } from '../src/encoder.js';
+
+const hex = (bytes: Uint8Array): string => Buffer.from(bytes).toString('hex');
+
+describe('string table', () => {
+  const cases: Array<[string, KodaValue, string]> = [
+    [
+      'stores repeated strings once, sorted, and refers to them',
+      ['b', 'a', 'b', 'a', 'c'],
+      '4b4f44410200' + '300201610162' + '10053101310031013100060163',
+    ],
+    ['writes no table when nothing repeats', ['x', 'y'], '4b4f444102001002060178060179'],
+    ['leaves keys in the dictionary', { k: 'k', j: 'k' }, '4b4f44410202016a016b' + '3001016b' + '1102003100013100'],
+  ];
+
+  for (const [name, value, expected] of cases) {
+    it(name, () => {
+      expect(hex(encodeJs(value, { version: 2, stringTable: true }))).toBe(expected);
+      expect(hex(encode(value, { version: 2, stringTable: true }))).toBe(expected);
+      expect(decodeSync(Buffer.from(expected, 'hex'))).toEqual(value);
+    });
+  }
+
+  it('round-trips and shrinks documents with repeated values', () => {
+    const rows = Array.from({ length: 200 }, (_, i) => ({ status: i % 2 ? 'active' : 'suspended', region: 'eu-west-1', n: i }));
+    for (const version of [1, 2] as const) {
+      const plain = encode(rows, { version });
+      const tabled = encode(rows, { version, stringTable: true });
+      expect(hex(tabled)).toBe(hex(encodeJs(rows, { version, stringTable: true })));
+      expect(tabled.byteLength).toBeLessThan(plain.byteLength);
+      expect(decodeSync(tabled)).toEqual(rows);
+      expect(decodeJs(tabled)).toEqual(rows);
+    }
+  });
+
+  it('rejects a reference past the end of the table', () => {
+    const bad = Buffer.from('4b4f44410200' + '30010161' + '3101', 'hex');
+    expect(() => decodeSync(bad)).toThrow('Invalid string reference');
+    expect(() => decodeJs(bad)).toThrow('Invalid string reference');
+  });
+});
@@ -0,0 +1,45 @@
+import { configureThreadPool, decode, encode, encodeAsync, getThreadPoolStats, isNativeAvailable, parseAsync } from '../src/index.js';
+
+describe('thread pool', () => {
+  it('reports stats only with the addon', () => {
+    const stats = getThreadPoolStats();
+    if (!isNativeAvailable()) {
+      expect(stats).toBeNull();
+      return;
+    }
+    expect(stats!.threads).toBeGreaterThanOrEqual(1);
+    expect(Object.keys(stats!.queued).sort()).toEqual(['high', 'low', 'normal']);
+  });
+
+  it('resizes, keeping at least one thread', async () => {
+    const before = getThreadPoolStats()?.threads;
+    try {
+      configureThreadPool({ threads: 3 });
+      if (isNativeAvailable()) expect(getThreadPoolStats()!.threads).toBe(3);
+      configureThreadPool({ threads: 0 });
+      if (isNativeAvailable()) expect(getThreadPoolStats()!.threads).toBe(1);
+      expect(await parseAsync('a: 1')).toEqual({ a: 1 });
+    } finally {
+      if (before !== undefined) configureThreadPool({ threads: before });
+    }
+  });
+
+  it('runs calls of every priority to completion', async () => {
+    const executed = getThreadPoolStats()?.executed ?? 0;
+    const value = { list: Array.from({ length: 100 }, (_, i) => ({ i })) };
+    const bytes = encode(value);
+    const results = await Promise.all(
+      (['high', 'normal', 'low'] as const).flatMap((priority) => [
+        parseAsync('a: [1, 2]', { priority }),
+        encodeAsync(value, { priority }).then((b) => Buffer.from(b).toString('hex')),
+        decode(bytes, { priority }),
+      ])
+    );
+    for (let i = 0; i < results.length; i += 3) {
+      expect(results[i]).toEqual({ a: [1, 2] });
+      expect(results[i + 1]).toBe(Buffer.from(bytes).toString('hex'));
+      expect(results[i + 2]).toEqual(value);
+    }
+    if (isNativeAvailable()) expect(getThreadPoolStats()!.executed).toBeGreaterThanOrEqual(executed + 9);
+  });
+});
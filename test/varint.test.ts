@@ -0,0 +1,58 @@
+import { decodeSync, encode, type KodaValue } from '../src/index.js';
+import { decode as decodeJs } from '../src/decoder.js';
+import { encode as encodeJs } from '../src/encoder.js';
+
+const hex = (bytes: Uint8Array): string => Buffer.from(bytes).toString('hex');
+const bytes = (h: string): Buffer => Buffer.from(h, 'hex');
+
+describe('binary version 2', () => {
+  // Magic, version 2, empty dictionary.
+  const header = '4b4f44410200';
+  const cases: Array<[string, KodaValue, string]> = [
+    ['small int 0', 0, '80'],
+    ['small int 63', 63, 'bf'],
+    ['64', 64, '048001'],
+    ['-1', -1, '0401'],
+    ['-64', -64, '047f'],
+    ['300', 300, '04d804'],
+    ['max safe integer', Number.MAX_SAFE_INTEGER, '04feffffffffffff1f'],
+    ['float', 1.5, '053ff8000000000000'],
+    ['string with a 2-byte length', 'x'.repeat(130), '068201' + '78'.repeat(130)],
+  ];
+
+  for (const [name, value, body] of cases) {
+    it(`encodes ${name}`, () => {
+      expect(hex(encodeJs(value, { version: 2 }))).toBe(header + body);
+      expect(hex(encode(value, { version: 2 }))).toBe(header + body);
+      expect(decodeSync(encode(value, { version: 2 }))).toEqual(value);
+    });
+  }
+
+  it('uses 1-byte key indices and counts', () => {
+    expect(hex(encode({ a: 1, b: [true, null] }, { version: 2 }))).toBe('4b4f4441020201610162110200810110020301');
+  });
+
+  it('decodes to the same value as version 1', () => {
+    const value = { id: 12345, neg: -7, list: [1, 'two', 3.25, null], nested: { deep: [{ k: 1 }, { k: 2 }] } };
+    const v1 = encode(value);
+    const v2 = encode(value, { version: 2 });
+    expect(v2.byteLength).toBeLessThan(v1.byteLength);
+    expect(decodeSync(v2)).toEqual(decodeSync(v1));
+    expect(decodeJs(v2)).toEqual(value);
+  });
+
+  it('rejects overlong varints', () => {
+    // Integer 0 written as 0x80 0x00 instead of a small int.
+    expect(() => decodeSync(bytes(header + '048000'))).toThrow('Malformed varint');
+    expect(() => decodeJs(bytes(header + '048000'))).toThrow('Malformed varint');
+  });
+
+  it('rejects a varint cut short', () => {
+    expect(() => decodeSync(bytes(header + '0480'))).toThrow('Truncated input');
+  });
+
+  it('rejects an unknown version', () => {
+    expect(() => decodeSync(bytes('4b4f4441030080'))).toThrow('Unsupported version');
+    expect(() => encodeJs(1, { version: 3 as 2 })).toThrow('Unsupported version');
+  });
+});